@@ -0,0 +1,766 @@
+/* Copyright (c) 2023, ellie/@ell1e & Spew3D Web Team (see AUTHORS.md).
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+Alternatively, at your option, this file is offered under the Apache 2
+license, see accompanied LICENSE.md.
+*/
+
+/// A small tool to time the markdown functions on generated input.
+/// For meaningful numbers, build it with optimizations on.
+
+#define SPEW3D_IMPLEMENTATION  // Only if not already in another file!
+#define SPEW3D_OPTION_DISABLE_SDL  // Optional, drops graphical stuff.
+#include <spew3d.h>
+#define SPEW3DWEB_IMPLEMENTATION  // Only if not already in another file!
+#include <spew3dweb.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static char *repeat_unit(const char *unit, size_t times, size_t *out_len) {
+    size_t unitlen = strlen(unit);
+    char *result = malloc(unitlen * times + 1);
+    if (!result)
+        return NULL;
+    size_t i = 0;
+    while (i < times) {
+        memcpy(result + i * unitlen, unit, unitlen);
+        i += 1;
+    }
+    result[unitlen * times] = '\0';
+    *out_len = unitlen * times;
+    return result;
+}
+
+static double time_tohtml_ms(const char *input, size_t inputlen) {
+    s3dw_markdown_tohtmloptions options = {0};
+    clock_t start = clock();
+    size_t resultlen = 0;
+    char *result = spew3dweb_markdown_ByteBufToHTML(
+        input, inputlen, &options, &resultlen
+    );
+    clock_t end = clock();
+    if (!result) {
+        fprintf(stderr, "error: conversion failed\n");
+        exit(1);
+    }
+    free(result);
+    return ((double)(end - start) * 1000.0) / (double)CLOCKS_PER_SEC;
+}
+
+static double time_clean_ms(const char *input, size_t inputlen) {
+    clock_t start = clock();
+    size_t resultlen = 0;
+    char *result = spew3dweb_markdown_CleanByteBuf(
+        input, inputlen, 1, 0, NULL, NULL, &resultlen, NULL
+    );
+    clock_t end = clock();
+    if (!result) {
+        fprintf(stderr, "error: cleaning failed\n");
+        exit(1);
+    }
+    free(result);
+    return ((double)(end - start) * 1000.0) / (double)CLOCKS_PER_SEC;
+}
+
+static int bench_emphasis(void) {
+    // Paragraphs full of formatting that is never closed, which
+    // a naive end search handles in quadratic time:
+    const char *units[] = {
+        "*a ", "**a ", "**a *", "~~a __b *c **", "*a `b ", NULL
+    };
+    int k = 0;
+    while (units[k] != NULL) {
+        printf("emphasis \"%s\":\n", units[k]);
+        double lastms = -1;
+        size_t times = 4000;
+        while (times <= 64000) {
+            size_t inputlen = 0;
+            char *input = repeat_unit(units[k], times, &inputlen);
+            if (!input) {
+                fprintf(stderr, "error: out of memory\n");
+                return 0;
+            }
+            double ms = time_tohtml_ms(input, inputlen);
+            free(input);
+            if (lastms > 0 && ms > 0) {
+                printf("  %8d bytes: %9.2f ms (x%.2f)\n",
+                    (int)inputlen, ms, ms / lastms);
+            } else {
+                printf("  %8d bytes: %9.2f ms\n", (int)inputlen, ms);
+            }
+            lastms = ms;
+            times *= 2;
+        }
+        k += 1;
+    }
+    return 1;
+}
+
+static int bench_lines(void) {
+    // Markdown-like text with lines of varying length, some indented:
+    size_t inputlen = 64 * 1024 * 1024;
+    char *input = malloc(inputlen);
+    if (!input) {
+        fprintf(stderr, "error: out of memory\n");
+        return 0;
+    }
+    unsigned int seed = 1;
+    size_t i = 0;
+    while (i < inputlen) {
+        seed = seed * 1103515245u + 12345u;
+        size_t linelen = (seed >> 16) % 120;
+        size_t k = 0;
+        while (k < linelen && i < inputlen) {
+            input[i] = (k < (linelen % 5) ? ' ' : 'a' + (k % 26));
+            i += 1;
+            k += 1;
+        }
+        if (i < inputlen) {
+            input[i] = '\n';
+            i += 1;
+        }
+    }
+
+    const char *implnames[] = {"auto", "scalar", "sse2", "avx2"};
+    size_t scalarbreaks = 0;
+    int impl = _S3D_MD_LINESCAN_AUTO;
+    while (impl <= _S3D_MD_LINESCAN_AVX2) {
+        if (impl != _S3D_MD_LINESCAN_AUTO &&
+                !_internal_s3dw_markdown_LineScanImplSupported(impl)) {
+            printf("lines %-6s: not supported by this CPU/build\n",
+                implnames[impl]);
+            impl += 1;
+            continue;
+        }
+        const int repeats = 8;
+        size_t breaks = 0;
+        clock_t start = clock();
+        int r = 0;
+        while (r < repeats) {
+            size_t positions[64];
+            size_t found = 64;
+            size_t pos = 0;
+            breaks = 0;
+            while (found == 64) {
+                found = _internal_s3dw_markdown_FindLineBreaksWith(
+                    impl, input, inputlen, pos, positions, 64
+                );
+                breaks += found;
+                if (found > 0)
+                    pos = positions[found - 1] + 1;
+            }
+            r += 1;
+        }
+        clock_t end = clock();
+        double secs = (double)(end - start) / (double)CLOCKS_PER_SEC;
+        if (impl == _S3D_MD_LINESCAN_SCALAR)
+            scalarbreaks = breaks;
+        if (scalarbreaks != 0 && breaks != scalarbreaks) {
+            fprintf(stderr, "error: %s found %d line breaks, "
+                "expected %d\n", implnames[impl], (int)breaks,
+                (int)scalarbreaks);
+            free(input);
+            return 0;
+        }
+        printf("lines %-6s: %7.2f GB/s (%d lines)\n",
+            implnames[impl],
+            (secs > 0 ? ((double)inputlen * repeats) /
+                (secs * 1000.0 * 1000.0 * 1000.0) : 0.0),
+            (int)breaks);
+        impl += 1;
+    }
+    free(input);
+    return 1;
+}
+
+static int bench_edit(void) {
+    // A long document like an editor would have open, with a single
+    // character typed and removed again in its middle:
+    const char *unit = "## Section\n\nSome *text* with a [link](x.html)"
+        " and `code`,\nover two lines.\n\n- a list\n- of things\n\n"
+        "    indented code\n\n";
+    s3dw_markdown_tohtmloptions options = {0};
+    size_t times = 1000;
+    while (times <= 16000) {
+        size_t inputlen = 0;
+        char *input = repeat_unit(unit, times, &inputlen);
+        if (!input) {
+            fprintf(stderr, "error: out of memory\n");
+            return 0;
+        }
+        double fullms = time_tohtml_ms(input, inputlen);
+        s3dw_markdown_document *doc = spew3dweb_markdown_NewDocument(
+            input, inputlen, &options
+        );
+        if (!doc) {
+            fprintf(stderr, "error: conversion failed\n");
+            free(input);
+            return 0;
+        }
+        const char *middle = strstr(input + inputlen / 2, "Some");
+        size_t offset = (middle ? (size_t)(middle - input) : 0);
+        const int edits = 1000;
+        clock_t start = clock();
+        int k = 0;
+        while (k < edits) {
+            int result = (k % 2 == 0 ?
+                spew3dweb_markdown_DocumentEdit(
+                    doc, offset, 0, "x", 1, NULL, NULL, NULL) :
+                spew3dweb_markdown_DocumentEdit(
+                    doc, offset, 1, NULL, 0, NULL, NULL, NULL));
+            if (!result) {
+                fprintf(stderr, "error: edit failed\n");
+                spew3dweb_markdown_FreeDocument(doc);
+                free(input);
+                return 0;
+            }
+            k += 1;
+        }
+        clock_t end = clock();
+        double editms = ((double)(end - start) * 1000.0) /
+            ((double)CLOCKS_PER_SEC * edits);
+        start = clock();
+        size_t htmllen = 0;
+        if (!spew3dweb_markdown_DocumentGetHTML(doc, &htmllen)) {
+            fprintf(stderr, "error: out of memory\n");
+            spew3dweb_markdown_FreeDocument(doc);
+            free(input);
+            return 0;
+        }
+        end = clock();
+        double splicems = ((double)(end - start) * 1000.0) /
+            (double)CLOCKS_PER_SEC;
+        printf("edit %8d bytes: full %8.2f ms, edit %6.3f ms, "
+            "joined HTML %6.3f ms\n", (int)inputlen, fullms,
+            editms, splicems);
+        spew3dweb_markdown_FreeDocument(doc);
+        free(input);
+        times *= 4;
+    }
+    return 1;
+}
+
+static double wall_ms(void) {
+    // (clock() would add up the time of all threads.)
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * 1000.0 + (double)now.tv_nsec / 1.0e6;
+}
+
+static int bench_threads(void) {
+    // A big document of mixed blocks, rendered serially and then
+    // split up over more and more threads:
+    const char *unit = "## Section\n\nSome *text* with a [link](x.html)"
+        " and `code`,\nover two lines.\n\n- a list\n- of things\n\n"
+        "    indented code\n\n```\nfenced\n\ncode\n```\n\n"
+        "|a|b|\n|-|-|\n|1|2|\n\n";
+    s3dw_markdown_tohtmloptions options = {0};
+    size_t inputlen = 0;
+    char *input = repeat_unit(unit, 100000, &inputlen);
+    if (!input) {
+        fprintf(stderr, "error: out of memory\n");
+        return 0;
+    }
+    double start = wall_ms();
+    size_t seriallen = 0;
+    char *serial = spew3dweb_markdown_ByteBufToHTML(
+        input, inputlen, &options, &seriallen
+    );
+    double serialms = wall_ms() - start;
+    if (!serial) {
+        fprintf(stderr, "error: conversion failed\n");
+        free(input);
+        return 0;
+    }
+    printf("threads %8d bytes: serial %9.2f ms\n",
+        (int)inputlen, serialms);
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int maxthreads = (cpus > 1 ? (int)cpus : 1);
+    int threads = 1;
+    while (1) {
+        start = wall_ms();
+        size_t resultlen = 0;
+        char *result = spew3dweb_markdown_ByteBufToHTMLParallel(
+            input, inputlen, &options, threads, &resultlen
+        );
+        double ms = wall_ms() - start;
+        if (!result) {
+            fprintf(stderr, "error: conversion failed\n");
+            free(serial);
+            free(input);
+            return 0;
+        }
+        int same = (resultlen == seriallen &&
+            memcmp(result, serial, seriallen) == 0);
+        free(result);
+        printf("threads %8d bytes: %3d threads %9.2f ms (x%.2f)%s\n",
+            (int)inputlen, threads, ms, serialms / ms,
+            (same ? "" : " OUTPUT DIFFERS"));
+        if (!same) {
+            free(serial);
+            free(input);
+            return 0;
+        }
+        if (threads >= maxthreads)
+            break;
+        threads *= 2;
+        if (threads > maxthreads)
+            threads = maxthreads;
+    }
+    free(serial);
+    free(input);
+    return 1;
+}
+
+static int bench_batch(void) {
+    // Many small files like a static site build would convert,
+    // one by one and then in batches over more and more threads:
+    const char *unit = "# Page\n\nSome *text* with a [link](x.html).\n\n"
+        "- a list\n- of things\n\n    code\n\n";
+    s3dw_markdown_tohtmloptions options = {0};
+    const size_t count = 20000;
+    const char **inputs = malloc(sizeof(*inputs) * count);
+    char **results = malloc(sizeof(*results) * count);
+    if (!inputs || !results) {
+        fprintf(stderr, "error: out of memory\n");
+        free(inputs);
+        free(results);
+        return 0;
+    }
+    size_t i = 0;
+    while (i < count) {
+        inputs[i] = unit;
+        i += 1;
+    }
+    double start = wall_ms();
+    i = 0;
+    while (i < count) {
+        char *result = spew3dweb_markdown_ToHTMLEx(
+            inputs[i], &options, NULL
+        );
+        if (!result) {
+            fprintf(stderr, "error: conversion failed\n");
+            free(inputs);
+            free(results);
+            return 0;
+        }
+        free(result);
+        i += 1;
+    }
+    double loopms = wall_ms() - start;
+    printf("batch %6d files: one by one %9.2f ms\n", (int)count, loopms);
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int maxthreads = (cpus > 1 ? (int)cpus : 1);
+    int threads = 1;
+    while (1) {
+        start = wall_ms();
+        if (!spew3dweb_markdown_ByteBufsToHTML(
+                inputs, NULL, count, &options, threads, results, NULL
+                )) {
+            fprintf(stderr, "error: conversion failed\n");
+            free(inputs);
+            free(results);
+            return 0;
+        }
+        double ms = wall_ms() - start;
+        i = 0;
+        while (i < count) {
+            free(results[i]);
+            i += 1;
+        }
+        printf("batch %6d files: %3d threads %9.2f ms (x%.2f)\n",
+            (int)count, threads, ms, loopms / ms);
+        if (threads >= maxthreads)
+            break;
+        threads *= 2;
+        if (threads > maxthreads)
+            threads = maxthreads;
+    }
+    free(inputs);
+    free(results);
+    return 1;
+}
+
+static int bench_revisions(void) {
+    // A new revision of a 2000 paragraph document with one line
+    // changed, converted by a renderer that caches its blocks:
+    const char *unit = "Some *text* with a [link](x.html) and `code`,"
+        "\nover two lines.\n\n";
+    s3dw_markdown_tohtmloptions options = {0};
+    size_t inputlen = 0;
+    char *input = repeat_unit(unit, 2000, &inputlen);
+    s3dw_markdown_renderer *renderer = spew3dweb_markdown_NewRenderer();
+    if (!input || !renderer ||
+            !spew3dweb_markdown_RendererEnableFragmentCache(
+                renderer, 1)) {
+        fprintf(stderr, "error: out of memory\n");
+        free(input);
+        if (renderer)
+            spew3dweb_markdown_FreeRenderer(renderer);
+        return 0;
+    }
+    double fullms = time_tohtml_ms(input, inputlen);
+    char *middle = strstr(input + inputlen / 2, "Some");
+    const int revisions = 200;
+    clock_t start = clock();
+    int k = 0;
+    while (k < revisions) {
+        if (middle)
+            middle[0] = (k % 2 == 0 ? 'S' : 's');
+        if (!spew3dweb_markdown_RendererByteBufToHTML(
+                renderer, input, inputlen, &options, NULL)) {
+            fprintf(stderr, "error: conversion failed\n");
+            spew3dweb_markdown_FreeRenderer(renderer);
+            free(input);
+            return 0;
+        }
+        k += 1;
+    }
+    clock_t end = clock();
+    double revms = ((double)(end - start) * 1000.0) /
+        ((double)CLOCKS_PER_SEC * revisions);
+    printf("revisions %8d bytes: full %8.2f ms, revision %6.3f ms, "
+        "blocks reused %d rendered %d\n", (int)inputlen, fullms,
+        revms, (int)renderer->fragmentsreused,
+        (int)renderer->fragmentsrendered);
+    spew3dweb_markdown_FreeRenderer(renderer);
+    free(input);
+    return 1;
+}
+
+static size_t strip_tags(char *html, size_t htmllen) {
+    // What one would do without a text mode: drop all tags, then
+    // decode the entities.
+    size_t fill = 0;
+    size_t i = 0;
+    while (i < htmllen) {
+        if (html[i] == '<') {
+            while (i < htmllen && html[i] != '>')
+                i += 1;
+            i += 1;
+            continue;
+        }
+        html[fill] = html[i];
+        fill += 1;
+        i += 1;
+    }
+    return _internal_s3dw_markdown_DecodeEntities(html, html, fill);
+}
+
+static int bench_text(void) {
+    // A big document of mixed blocks turned into plain text, directly
+    // and by way of HTML. Like most READMEs it has plenty of links,
+    // which the text mode doesn't need to keep:
+    const char *unit = "## Section\n\nSome *text* with a [link](x.html)"
+        " and `code`,\nover two lines &amp; more.\n\n- a list\n"
+        "- of **things**\n\n    indented code\n\n```\nfenced\n```\n\n"
+        "|a|b|\n|-|-|\n|1|2|\n\n"
+        "Get it from [the releases](https://example.com/app/releases)"
+        " or [the docs](https://example.com/docs/install.html#linux),\n"
+        "![status](https://example.com/badge.svg) and [tests]"
+        "(https://example.com/ci/builds?branch=main).\n\n";
+    s3dw_markdown_tohtmloptions options = {0};
+    size_t inputlen = 0;
+    char *input = repeat_unit(unit, 50000, &inputlen);
+    if (!input) {
+        fprintf(stderr, "error: out of memory\n");
+        return 0;
+    }
+    clock_t start = clock();
+    size_t htmllen = 0;
+    char *html = spew3dweb_markdown_ByteBufToHTML(
+        input, inputlen, &options, &htmllen
+    );
+    if (!html) {
+        fprintf(stderr, "error: conversion failed\n");
+        free(input);
+        return 0;
+    }
+    size_t strippedlen = strip_tags(html, htmllen);
+    clock_t end = clock();
+    double stripms = ((double)(end - start) * 1000.0) /
+        (double)CLOCKS_PER_SEC;
+    free(html);
+    start = clock();
+    size_t textlen = 0;
+    char *text = spew3dweb_markdown_ByteBufToText(
+        input, inputlen, &options, 1, &textlen
+    );
+    end = clock();
+    double textms = ((double)(end - start) * 1000.0) /
+        (double)CLOCKS_PER_SEC;
+    if (!text) {
+        fprintf(stderr, "error: conversion failed\n");
+        free(input);
+        return 0;
+    }
+    free(text);
+    printf("text %8d bytes: HTML and strip %8.2f ms (%d bytes), "
+        "text %8.2f ms (%d bytes, x%.2f)\n", (int)inputlen, stripms,
+        (int)strippedlen, textms, (int)textlen, stripms / textms);
+    free(input);
+    return 1;
+}
+
+static int bench_links(void) {
+    // A big document with links, images and code, listing its links
+    // by rendering it versus by just scanning for them:
+    const char *unit = "## Section\n\nSome *text* with a [link](x.html)"
+        " and ![an image](y.png),\nthen [another\none](z.html).\n\n"
+        "- a [list](l.html)\n- of **things**\n\n    [indented](c.html)"
+        "\n\n```\n[fenced](f.html)\n```\n\n|a|b|\n|-|-|\n|1|2|\n\n";
+    s3dw_markdown_tohtmloptions options = {0};
+    size_t inputlen = 0;
+    char *input = repeat_unit(unit, 50000, &inputlen);
+    if (!input) {
+        fprintf(stderr, "error: out of memory\n");
+        return 0;
+    }
+    clock_t start = clock();
+    size_t htmllen = 0;
+    char *html = spew3dweb_markdown_ByteBufToHTML(
+        input, inputlen, &options, &htmllen
+    );
+    clock_t end = clock();
+    double renderms = ((double)(end - start) * 1000.0) /
+        (double)CLOCKS_PER_SEC;
+    if (!html) {
+        fprintf(stderr, "error: conversion failed\n");
+        free(input);
+        return 0;
+    }
+    free(html);
+    start = clock();
+    s3dw_markdown_links links;
+    if (!spew3dweb_markdown_ByteBufGetLinks(
+            input, inputlen, &links)) {
+        fprintf(stderr, "error: out of memory\n");
+        free(input);
+        return 0;
+    }
+    end = clock();
+    double linksms = ((double)(end - start) * 1000.0) /
+        (double)CLOCKS_PER_SEC;
+    printf("links %8d bytes: render %8.2f ms, scan %8.2f ms "
+        "(%d links, x%.2f)\n", (int)inputlen, renderms, linksms,
+        (int)links.count, renderms / linksms);
+    spew3dweb_markdown_FreeLinks(&links);
+    free(input);
+    return 1;
+}
+
+static int bench_brackets(void) {
+    // Comments, brackets and link URLs that are never closed, which
+    // the cleaner must still handle in linear time:
+    const char *units[] = {
+        "<!--", "<!-- a ", "[a ![", "[a](x/", "![a](", "[a](x/\n",
+        "[a](x(", "[a](x<", NULL
+    };
+    int k = 0;
+    while (units[k] != NULL) {
+        printf("brackets \"");
+        const char *c = units[k];
+        while (*c != '\0') {
+            if (*c == '\n')
+                printf("\\n");
+            else
+                printf("%c", *c);
+            c += 1;
+        }
+        printf("\":\n");
+        double lastms = -1;
+        size_t times = 16000;
+        while (times <= 256000) {
+            size_t inputlen = 0;
+            char *input = repeat_unit(units[k], times, &inputlen);
+            if (!input) {
+                fprintf(stderr, "error: out of memory\n");
+                return 0;
+            }
+            double ms = time_clean_ms(input, inputlen);
+            free(input);
+            if (lastms > 0 && ms > 0) {
+                printf("  %8d bytes: %9.2f ms (x%.2f)\n",
+                    (int)inputlen, ms, ms / lastms);
+            } else {
+                printf("  %8d bytes: %9.2f ms\n", (int)inputlen, ms);
+            }
+            lastms = ms;
+            times *= 2;
+        }
+        k += 1;
+    }
+    return 1;
+}
+
+static int bench_cleaner(void) {
+    // Many small posts, like in a forum, each cleaned on its own
+    // versus with one cleaner reused for all of them:
+    const char *posts[] = {
+        "Hi all,\n\nthis is a *short* post with a [link](x.html).\n",
+        "> Quoted text\n\nAnd an answer with `code` and\n"
+        "- a list\n- of things\n",
+        "See [this page](https://example.com/a/very/long/path/with/"
+        "several/parts/and/a/query?that=goes&on=and&on=for&quite=a&"
+        "while=longer&than=most) for details.\n", NULL
+    };
+    int postcount = 0;
+    while (posts[postcount] != NULL)
+        postcount += 1;
+    const int repeats = 200000;
+    size_t outbytes = 0;
+    clock_t start = clock();
+    int i = 0;
+    while (i < repeats) {
+        const char *post = posts[i % postcount];
+        size_t resultlen = 0;
+        char *result = spew3dweb_markdown_CleanByteBuf(
+            post, strlen(post), 1, 0, NULL, NULL, &resultlen, NULL
+        );
+        if (!result) {
+            fprintf(stderr, "error: cleaning failed\n");
+            return 0;
+        }
+        outbytes += resultlen;
+        free(result);
+        i += 1;
+    }
+    clock_t end = clock();
+    double singlems = ((double)(end - start) * 1000.0) /
+        (double)CLOCKS_PER_SEC;
+    s3dw_markdown_cleaner *cleaner = spew3dweb_markdown_NewCleaner(
+        1, 0, NULL, NULL
+    );
+    if (!cleaner) {
+        fprintf(stderr, "error: out of memory\n");
+        return 0;
+    }
+    size_t cleanerbytes = 0;
+    start = clock();
+    i = 0;
+    while (i < repeats) {
+        const char *post = posts[i % postcount];
+        size_t resultlen = 0;
+        if (!spew3dweb_markdown_CleanerCleanByteBuf(
+                cleaner, post, strlen(post), &resultlen)) {
+            fprintf(stderr, "error: cleaning failed\n");
+            spew3dweb_markdown_FreeCleaner(cleaner);
+            return 0;
+        }
+        cleanerbytes += resultlen;
+        i += 1;
+    }
+    end = clock();
+    double cleanerms = ((double)(end - start) * 1000.0) /
+        (double)CLOCKS_PER_SEC;
+    spew3dweb_markdown_FreeCleaner(cleaner);
+    if (cleanerbytes != outbytes) {
+        fprintf(stderr, "error: cleaner output differs\n");
+        return 0;
+    }
+    printf("cleaner %d posts: single %8.2f ms, reused cleaner %8.2f ms "
+        "(x%.2f)\n", repeats, singlems, cleanerms,
+        (cleanerms > 0 ? singlems / cleanerms : 0.0));
+    return 1;
+}
+
+int main(int argc, const char **argv) {
+    const char *mode = NULL;
+    int i = 1;
+    while (i < argc) {
+        if (strcmp(argv[i], "--help") == 0) {
+            printf("A small tool to time the markdown functions.\n"
+                "Usage: example_markdown_benchmark [mode]\n"
+                "Modes: emphasis, lines, edit, threads, batch, "
+                "revisions, text, links, brackets, cleaner\n");
+            return 0;
+        } else if (mode == NULL && argv[i][0] != '-') {
+            mode = argv[i];
+        } else {
+            fprintf(stderr, "warning: unrecognized "
+                "argument: %s\n", argv[i]);
+            return 1;
+        }
+        i += 1;
+    }
+
+    int all = (mode == NULL || strcmp(mode, "all") == 0);
+    int ran = 0;
+    if (all || strcmp(mode, "emphasis") == 0) {
+        if (!bench_emphasis())
+            return 1;
+        ran = 1;
+    }
+    if (all || strcmp(mode, "lines") == 0) {
+        if (!bench_lines())
+            return 1;
+        ran = 1;
+    }
+    if (all || strcmp(mode, "edit") == 0) {
+        if (!bench_edit())
+            return 1;
+        ran = 1;
+    }
+    if (all || strcmp(mode, "threads") == 0) {
+        if (!bench_threads())
+            return 1;
+        ran = 1;
+    }
+    if (all || strcmp(mode, "batch") == 0) {
+        if (!bench_batch())
+            return 1;
+        ran = 1;
+    }
+    if (all || strcmp(mode, "revisions") == 0) {
+        if (!bench_revisions())
+            return 1;
+        ran = 1;
+    }
+    if (all || strcmp(mode, "text") == 0) {
+        if (!bench_text())
+            return 1;
+        ran = 1;
+    }
+    if (all || strcmp(mode, "links") == 0) {
+        if (!bench_links())
+            return 1;
+        ran = 1;
+    }
+    if (all || strcmp(mode, "brackets") == 0) {
+        if (!bench_brackets())
+            return 1;
+        ran = 1;
+    }
+    if (all || strcmp(mode, "cleaner") == 0) {
+        if (!bench_cleaner())
+            return 1;
+        ran = 1;
+    }
+    if (!ran) {
+        fprintf(stderr, "error: unknown mode: %s\n", mode);
+        return 1;
+    }
+    return 0;
+}
@@ -116,17 +116,14 @@ int main(int argc, const char **argv) {
         }
         s3dw_markdown_tohtmloptions options = {0};
         options.uritransform_callback = our_little_uri_transform_helper;
-        char *html = (chunk ? spew3dweb_markdown_ToHTMLEx(
-            chunk, &options, NULL) : NULL);
-        if (!chunk || !html) {
+        if (!chunk || !spew3dweb_markdown_ByteBufToHTMLDiskFile(
+                chunk, chunklen, &options, stdout)) {
             free(chunk);
-            free(html);
             fprintf(stderr, "error: I/O or out of memory error\n");
             return 1;
         }
-        printf("%s\n", html);
+        printf("\n");
         free(chunk);
-        free(html);
     }
     fclose(f);
     return 0;
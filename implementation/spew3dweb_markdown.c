@@ -36,28 +36,55 @@ license, see accompanied LICENSE.md.
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#if !defined(SPEW3DWEB_OPTION_DISABLE_THREADS)
+#include <pthread.h>
+#endif
 
 #define INSC(insertchar) \
     (_internal_s3dw_markdown_bufappendchar(\
     &resultchunk, &resultalloc, &resultfill,\
     insertchar, 1))
 #define INS(insertstr) \
-    (_internal_s3dw_markdown_bufappendstr(\
+    (_S3D_MD_BUFAPPENDLIT(\
     &resultchunk, &resultalloc, &resultfill,\
     insertstr, 1))
 #define INSREP(insertstr, amount) \
-    (_internal_s3dw_markdown_bufappendstr(\
+    (_S3D_MD_BUFAPPENDLIT(\
     &resultchunk, &resultalloc, &resultfill,\
     insertstr, amount))
+#define INSSTR(insertstr) \
+    (_internal_s3dw_markdown_bufappendstr(\
+    &resultchunk, &resultalloc, &resultfill,\
+    insertstr, 1))
 #define INSBUF(insertbuf, insertbuflen) \
     (_internal_s3dw_markdown_bufappend(\
     &resultchunk, &resultalloc, &resultfill,\
     insertbuf, insertbuflen, 1))
-
-typedef struct _markdown_lineinfo {
-    const char *linestart;
-    int indentlen, indentedcontentlen;
-} _markdown_lineinfo;
+#define INSESC(insertbuf, insertbuflen, quotesonly) \
+    (!plaintext ? _internal_s3dw_markdown_bufappendescaped(\
+    &resultchunk, &resultalloc, &resultfill,\
+    insertbuf, insertbuflen, quotesonly) : INSBUF(\
+    insertbuf, insertbuflen))
+#define INSTEXT(insertbuf, insertbuflen) \
+    (!plaintext ? INSBUF(insertbuf, insertbuflen) : (\
+    _md2html_AppendDecoded(\
+    &resultchunk, &resultalloc, &resultfill,\
+    insertbuf, insertbuflen)))
+#define INSTAG(inserttag) \
+    (!plaintext ? INS(inserttag) : (\
+    state->eventcallback != NULL ||\
+    strchr(inserttag, '\n') == NULL ||\
+    _md2html_AppendTagLineBreaks(\
+    &resultchunk, &resultalloc, &resultfill, inserttag)))
+// Where a tag goes, report the element instead when making events.
+// The markup for it goes from at to atend in the clean block:
+#define EVENTENTER(element, level, text, textlen, at, atend) \
+    (state->eventcallback == NULL || _md2html_EventEnterSimple(\
+    state, &resultchunk, &resultfill, element, level,\
+    text, textlen, at, atend))
+#define EVENTLEAVE(element, at, atend) \
+    (state->eventcallback == NULL || _md2html_EventLeave(\
+    state, &resultchunk, &resultfill, element, at, atend))
 
 static int _getlinelen(const char *start, size_t max) {
     int linelen = 0;
@@ -75,44 +102,31 @@ static int _spew3dweb_markdown_GetLineHeadingUnderlineStrength(
         size_t linefill, size_t lineindex
         ) {
     size_t i = lineindex;
-    int indent = lineinfo[i].indentlen;
+    int indent = _S3D_MD_LINEINDENT(lineinfo, i);
     if (i + 1 >= linefill ||
-            lineinfo[i + 1].indentlen != indent)
+            _S3D_MD_LINEINDENT(lineinfo, i + 1) != indent)
         return 0;
-    size_t indentclen = lineinfo[i].indentedcontentlen;
+    size_t indentclen = _S3D_MD_LINECONTENTLEN(lineinfo, i);
     if (indentclen == 0 ||
-            (lineinfo[i].linestart[indentclen] == '#' &&
+            (_S3D_MD_LINESTART(lineinfo, i)[indentclen] == '#' &&
             (indentclen <= 1 ||
-            lineinfo[i].linestart[indentclen + 1] == ' ' ||
-            lineinfo[i].linestart[indentclen + 1] == '\t')))
+            _S3D_MD_LINESTART(lineinfo, i)[indentclen + 1] == ' ' ||
+            _S3D_MD_LINESTART(lineinfo, i)[indentclen + 1] == '\t')))
         return 0;
-    int indent2 = lineinfo[i + 1].indentlen;
-    size_t indentclen2 = lineinfo[i + 1].indentedcontentlen;
-    if (indentclen2 == 0 || (
-            lineinfo[i + 1].linestart[indent2] != '=' &&
-            lineinfo[i + 1].linestart[indent2] != '-'))
+    if ((lineinfo->flags[i + 1] & _S3D_MD_LINEFLAG_UNDERLINE) == 0)
         return 0;
-    char headingchar = lineinfo[i + 1].linestart[indent2];
-    if (indentclen > 1 && (indentclen2 <= 1 ||
-            lineinfo[i + 1].linestart[indent2 + 1] != headingchar))
+    if (indentclen > 1 && _S3D_MD_LINECONTENTLEN(lineinfo, i + 1) <= 1)
         return 0;
-    size_t k = indent2;
-    while (k < indent2 + indentclen2) {
-        if (lineinfo[i + 1].linestart[k] != headingchar)
-            return 0;
-        k += 1;
-    }
+    char headingchar = (
+        _S3D_MD_LINESTART(lineinfo, i + 1)[_S3D_MD_LINEINDENT(lineinfo, i + 1)]
+    );
     return ((headingchar == '=') ? 1 : 2);
 }
 
-static int _m2html_GetListBulletNumberLen(
-        _markdown_lineinfo *lineinfo, int lineindex,
-        int *numval
+static int _m2html_GetBulletNumberLen(
+        const char *p, size_t ipastend, int *numval
         ) {
     size_t i = 0;
-    size_t ipastend = lineinfo[lineindex].indentedcontentlen;
-    const char *p = (lineinfo[lineindex].linestart +
-        lineinfo[lineindex].indentlen);
     if (i >= ipastend ||
             (p[i] < '1' || p[i] > '9'))
         return 0;
@@ -133,6 +147,108 @@ static int _m2html_GetListBulletNumberLen(
     return i;
 }
 
+static int _m2html_GetListBulletNumberLen(
+        _markdown_lineinfo *lineinfo, int lineindex,
+        int *numval
+        ) {
+    return _m2html_GetBulletNumberLen(
+        _S3D_MD_LINESTART(lineinfo, lineindex) +
+        _S3D_MD_LINEINDENT(lineinfo, lineindex),
+        _S3D_MD_LINECONTENTLEN(lineinfo, lineindex), numval
+    );
+}
+
+S3DHID int _internal_s3dw_markdown_ClassifyLineContent(
+        const char *p, int len
+        ) {
+    int flags = 0;
+    if (len <= 0)
+        return flags;
+    if (len >= 2 && (p[0] == '-' || p[0] == '*') && p[1] == ' ')
+        flags |= _S3D_MD_LINEFLAG_BULLET;
+    if (len >= 2 && p[0] == '>' && p[1] == ' ')
+        flags |= _S3D_MD_LINEFLAG_QUOTE;
+    if (p[0] >= '1' && p[0] <= '9' &&
+            _m2html_GetBulletNumberLen(p, len, NULL) > 0)
+        flags |= _S3D_MD_LINEFLAG_NUMBERED;
+    if (len >= 3 && p[0] == '`' && p[1] == '`' && p[2] == '`')
+        flags |= _S3D_MD_LINEFLAG_FENCE;
+    if (len >= 3 && p[0] == '#' && (p[1] == ' ' || p[2] == '#'))
+        flags |= _S3D_MD_LINEFLAG_HEADING;
+    if (p[0] == '=' || p[0] == '-') {
+        int k = 1;
+        while (k < len && p[k] == p[0])
+            k += 1;
+        if (k >= len)
+            flags |= _S3D_MD_LINEFLAG_UNDERLINE;
+    }
+    if (p[0] == '|') {
+        // Check for the kind of line that can be in a table:
+        char lastnonwhitespacechar = '\0';
+        int foundnotpipe = 0;
+        int pipecount = 0;
+        int k = 0;
+        while (k < len) {
+            if (p[k] == '|') {
+                pipecount += 1;
+                lastnonwhitespacechar = '|';
+            } else {
+                foundnotpipe = 1;
+                if (p[k] != ' ' && p[k] != '\t')
+                    lastnonwhitespacechar = p[k];
+            }
+            k += 1;
+        }
+        if (foundnotpipe && lastnonwhitespacechar == '|' &&
+                pipecount >= 2)
+            flags |= _S3D_MD_LINEFLAG_TABLEROW;
+    }
+    if (p[0] == '|' || p[0] == '-') {
+        // Check for a table header separator:
+        int pipecount = 0;
+        int dashcount = 0;
+        int k = 0;
+        while (k < len && (p[k] == '|' || p[k] == '-')) {
+            if (p[k] == '|')
+                pipecount += 1;
+            else
+                dashcount += 1;
+            k += 1;
+        }
+        while (k < len && (p[k] == ' ' || p[k] == '\t'))
+            k += 1;
+        if (dashcount >= 1 && pipecount >= 2 && k >= len)
+            flags |= _S3D_MD_LINEFLAG_TABLESEP;
+    }
+
+    // These don't continue a paragraph from the line before:
+    if ((flags & _S3D_MD_LINEFLAG_NUMBERED) != 0 ||
+            (p[0] == '-' && (len <= 1 ||
+                p[1] == '-' || p[1] == ' ' || p[1] == '\t')) ||
+            (p[0] == '*' && (len <= 1 ||
+                p[1] == ' ' || p[1] == '\t' || (p[1] == '*' && (
+                len <= 2 ||
+                p[2] == '*' || p[2] == ' ' || p[2] == '\t')))) ||
+            (p[0] == '>' && (len <= 1 || p[1] == ' ')) ||
+            (p[0] == '#' && (len <= 1 ||
+                p[1] == '#' || p[1] == ' ' || p[1] == '\t')) ||
+            (flags & _S3D_MD_LINEFLAG_FENCE) != 0)
+        flags |= _S3D_MD_LINEFLAG_ENDSPARAGRAPH;
+    return flags;
+}
+
+static void _md2html_ClassifyLine(
+        _markdown_lineinfo *lineinfo, int lineindex
+        ) {
+    lineinfo->flags[lineindex] = (
+        (lineinfo->flags[lineindex] & _S3D_MD_LINEFLAG_NOBREAK) |
+        _internal_s3dw_markdown_ClassifyLineContent(
+            _S3D_MD_LINESTART(lineinfo, lineindex) +
+            _S3D_MD_LINEINDENT(lineinfo, lineindex),
+            _S3D_MD_LINECONTENTLEN(lineinfo, lineindex)
+        ));
+}
+
 #define _FORMAT_TYPE_ASTERISK1 1
 #define _FORMAT_TYPE_ASTERISK2 2
 #define _FORMAT_TYPE_UNDERLINE2 3
@@ -142,6 +258,13 @@ static int _md2html_fmt_type_len(int type) {
     return (type == _FORMAT_TYPE_ASTERISK1 ? 1 : 2);
 }
 
+static int _md2html_fmt_type_element(int type) {
+    if (type == _FORMAT_TYPE_ASTERISK1)
+        return S3DW_MD_ELEMENT_EMPHASIS;
+    return (type == _FORMAT_TYPE_TILDE2 ?
+        S3DW_MD_ELEMENT_STRIKETHROUGH : S3DW_MD_ELEMENT_STRONG);
+}
+
 static char _md2html_GetInlineFormattingTypeFromChar(
         const char *linebuf, size_t ipastend, size_t i,
         int *out_canopen, int *out_canclose
@@ -198,19 +321,19 @@ static int _spew3dweb_markdown_CheckLineHasProperLink(
         _markdown_lineinfo *lineinfo, size_t linei, size_t i
         ) {
     size_t starti = i;
-    size_t len = (lineinfo[linei].indentlen +
-        lineinfo[linei].indentedcontentlen);
+    size_t len = (_S3D_MD_LINEINDENT(lineinfo, linei) +
+        _S3D_MD_LINECONTENTLEN(lineinfo, linei));
     while (i < len) {
-        if (lineinfo[linei].linestart[i] == '[') {
+        if (_S3D_MD_LINESTART(lineinfo, linei)[i] == '[') {
             size_t linklen = (
                 _internal_spew3dweb_markdown_GetLinkOrImgLen(
-                    lineinfo[linei].linestart, len, i, 1,
+                    _S3D_MD_LINESTART(lineinfo, linei), len, i, 1,
                     NULL, NULL, NULL, NULL, NULL, NULL, NULL,
                     NULL, NULL
                 ));
             if (linklen > 0)
                 return 1;
-        } else if (lineinfo[linei].linestart[i] == '\\') {
+        } else if (_S3D_MD_LINESTART(lineinfo, linei)[i] == '\\') {
             i += 2;
             continue;
         }
@@ -241,19 +364,517 @@ static int _m2html_IsGuaranteedExternalLink(
     return 0;
 }
 
+#if defined(SPEW3DWEB_OPTION_MARKDOWN_SCAN_STATS)
+static uint64_t _md2html_scanstat_steps = 0;
+#endif
+
+S3DEXP uint64_t spew3dweb_markdown_GetScanStats(void) {
+    #if defined(SPEW3DWEB_OPTION_MARKDOWN_SCAN_STATS)
+    return __atomic_load_n(&_md2html_scanstat_steps, __ATOMIC_RELAXED);
+    #else
+    return 0;
+    #endif
+}
+
+S3DEXP void spew3dweb_markdown_ResetScanStats(void) {
+    #if defined(SPEW3DWEB_OPTION_MARKDOWN_SCAN_STATS)
+    __atomic_store_n(&_md2html_scanstat_steps, 0, __ATOMIC_RELAXED);
+    #endif
+}
+
+typedef struct _md2html_endscanmemoslot {
+    uint32_t pos;  // (0 means unused, otherwise the position plus one)
+    uint32_t key, inst;
+} _md2html_endscanmemoslot;
+
+typedef struct _md2html_endscanmemo {
+    int enabled, broken;
+    const char *base;
+
+    // Hash table from a scan position and state to a formatting instance:
+    _md2html_endscanmemoslot *slots;
+    size_t slotalloc, slotfill;
+    int slotbits;
+
+    // Where each formatting instance ended. The line is -1 if
+    // that isn't known yet, or -2 if it never ends:
+    int32_t *instline, *instpastidx;
+    size_t installoc, instfill;
+} _md2html_endscanmemo;
+
+static void _md2html_FreeEndScanMemo(_md2html_endscanmemo *memo) {
+    free(memo->slots);
+    free(memo->instline);
+    free(memo->instpastidx);
+    memset(memo, 0, sizeof(*memo));
+}
+
+static uint32_t _md2html_GetEndScanMemoKey(
+        int depth, int toptype, int incode,
+        int linktitleminimumnesting
+        ) {
+    assert(depth > 0 && depth < 8);
+    assert(toptype > 0 && toptype < 8);
+    assert(linktitleminimumnesting >= -1 &&
+        linktitleminimumnesting < 7);
+    return ((uint32_t)(incode != 0) |
+        ((uint32_t)depth << 1) | ((uint32_t)toptype << 4) |
+        ((uint32_t)(linktitleminimumnesting + 1) << 7));
+}
+
+static uint32_t _md2html_NewEndScanMemoInst(
+        _md2html_endscanmemo *memo
+        ) {
+    if (!memo->enabled || memo->broken ||
+            memo->instfill >= INT32_MAX)
+        return 0;
+    if (memo->instfill + 1 > memo->installoc) {
+        size_t newalloc = memo->installoc * 2 + 64;
+        int32_t *newinstline = realloc(
+            memo->instline, sizeof(*newinstline) * newalloc
+        );
+        if (!newinstline) {
+            memo->broken = 1;
+            return 0;
+        }
+        memo->instline = newinstline;
+        int32_t *newinstpastidx = realloc(
+            memo->instpastidx, sizeof(*newinstpastidx) * newalloc
+        );
+        if (!newinstpastidx) {
+            memo->broken = 1;
+            return 0;
+        }
+        memo->instpastidx = newinstpastidx;
+        memo->installoc = newalloc;
+    }
+    memo->instline[memo->instfill] = -1;
+    memo->instpastidx[memo->instfill] = -1;
+    memo->instfill += 1;
+    return memo->instfill;
+}
+
+static void _md2html_EndEndScanMemoInst(
+        _md2html_endscanmemo *memo, uint32_t inst,
+        int32_t endline, int32_t pastidx
+        ) {
+    if (inst == 0)
+        return;
+    assert(inst <= memo->instfill);
+    memo->instline[inst - 1] = endline;
+    memo->instpastidx[inst - 1] = pastidx;
+}
+
+static _md2html_endscanmemoslot *_md2html_GetEndScanMemoSlot(
+        _md2html_endscanmemo *memo, uint32_t pos, uint32_t key
+        ) {
+    assert(memo->slotalloc > 0);
+    uint64_t hash = (((uint64_t)key << 32) | pos) *
+        UINT64_C(0x9E3779B97F4A7C15);
+    size_t k = (size_t)(hash >> (64 - memo->slotbits));
+    while (memo->slots[k].pos != 0 && (
+            memo->slots[k].pos != pos + 1 ||
+            memo->slots[k].key != key))
+        k = (k + 1) & (memo->slotalloc - 1);
+    return &memo->slots[k];
+}
+
+static uint32_t _md2html_FindEndScanMemoInst(
+        _md2html_endscanmemo *memo, uint32_t pos, uint32_t key
+        ) {
+    if (memo->slotalloc == 0)
+        return 0;
+    _md2html_endscanmemoslot *slot = (
+        _md2html_GetEndScanMemoSlot(memo, pos, key)
+    );
+    if (slot->pos == 0)
+        return 0;
+    return slot->inst;
+}
+
+static void _md2html_AddEndScanMemoInst(
+        _md2html_endscanmemo *memo, uint32_t pos, uint32_t key,
+        uint32_t inst
+        ) {
+    if (!memo->enabled || memo->broken || inst == 0 ||
+            pos >= UINT32_MAX - 1)
+        return;
+    if ((memo->slotfill + 1) * 2 > memo->slotalloc) {
+        // Grow the table, and re-add all entries:
+        _md2html_endscanmemoslot *oldslots = memo->slots;
+        size_t oldalloc = memo->slotalloc;
+        int newbits = (oldalloc > 0 ? memo->slotbits + 1 : 10);
+        _md2html_endscanmemoslot *newslots = calloc(
+            (size_t)1 << newbits, sizeof(*newslots)
+        );
+        if (!newslots) {
+            memo->broken = 1;
+            return;
+        }
+        memo->slots = newslots;
+        memo->slotalloc = (size_t)1 << newbits;
+        memo->slotbits = newbits;
+        size_t k = 0;
+        while (k < oldalloc) {
+            if (oldslots[k].pos != 0)
+                *_md2html_GetEndScanMemoSlot(
+                    memo, oldslots[k].pos - 1, oldslots[k].key
+                ) = oldslots[k];
+            k += 1;
+        }
+        free(oldslots);
+    }
+    _md2html_endscanmemoslot *slot = (
+        _md2html_GetEndScanMemoSlot(memo, pos, key)
+    );
+    if (slot->pos == 0)
+        memo->slotfill += 1;
+    slot->pos = pos + 1;
+    slot->key = key;
+    slot->inst = inst;
+}
+
+/// Whether the inline content scan never does anything with this
+/// character other than copying it.
+static int _md2html_IsPlainInlineChar(char c) {
+    return (c != '*' && c != '_' && c != '~' && c != '`' &&
+        c != '\\' && c != '!' && c != '[');
+}
+
+typedef struct _md2html_renderstate {
+    int nestingstypes[_S3D_MD_MAX_LIST_NESTING];
+    int nestingsdepth;
+    int insidecodeindent;
+    int lastnonemptynoncodeindent;
+    int insidefenceticks;
+    int insidefencebaseindent;
+
+    // Hash set of the anchors so far, for unique_heading_anchors:
+    _markdown_anchorslot *anchorslots;
+    size_t anchorslotalloc, anchorcount;
+
+    // Where headings are collected, if anyone wants them, and how
+    // much output was handed off already such that offsets are
+    // counted from the very start:
+    s3dw_markdown_toc *toc;
+    size_t tocoutputbase;
+
+    // For spew3dweb_markdown_ByteBufToText(), which leaves out all
+    // tags and maybe code:
+    int plaintext, plaintextnocode;
+
+    // For spew3dweb_markdown_ByteBufToEvents(), which gathers text
+    // like plaintext mode but reports elements to this callback where
+    // the tags would go, see _md2html_EventEnter():
+    int (*eventcallback)(
+        const s3dw_markdown_event *event, void *userdata
+    );
+    void *eventuserdata;
+    int *eventstack;  // The elements entered and not left yet.
+    size_t eventdepth, eventstackalloc;
+    char *eventscratch;  // For URLs and anchor names.
+    size_t eventscratchalloc;
+    // The cleaner's position map, and where in the input the text
+    // gathered so far started:
+    const _markdown_cleanstate *eventclean;
+    size_t eventtextoffset;
+    // An image waiting for the end of its alt text:
+    s3dw_markdown_event eventimage;
+    size_t eventimageoffset;
+    char eventimagesize[32];
+
+    _markdown_lineinfo lineinfo;
+    int lineinfoheap;
+    uint32_t _lineinfo_staticbuf[16 * 2];  // (Fits 16 lines.)
+} _md2html_renderstate;
+
+/// Where the given spot in the clean block being rendered is in the
+/// caller's input. NULL is for the end of the input.
+static size_t _md2html_EventOffset(
+        _md2html_renderstate *state, const char *at
+        ) {
+    const _markdown_cleanstate *clean = state->eventclean;
+    if (!at)
+        return clean->posmap[clean->posmapfill];
+    assert(at >= clean->resultchunk &&
+        (size_t)(at - clean->resultchunk) <= clean->posmapfill);
+    return clean->posmap[at - clean->resultchunk];
+}
+
+static int _md2html_EventEmit(
+        _md2html_renderstate *state, s3dw_markdown_event *event,
+        char **resultchunkptr
+        ) {
+    if (!state->eventcallback(event, state->eventuserdata)) {
+        // Stopping is handled just like an error:
+        free(*resultchunkptr);
+        *resultchunkptr = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+/// Report the text gathered in the result buffer, which ends at the
+/// given spot in the clean block, and start gathering anew at atend.
+/// Like the append helpers, returns 0 on error or when stopped, and
+/// the result buffer is gone then.
+static int _md2html_EventText(
+        _md2html_renderstate *state,
+        char **resultchunkptr, size_t *resultfillptr,
+        const char *at, const char *atend
+        ) {
+    if (*resultfillptr > 0) {
+        s3dw_markdown_event event;
+        memset(&event, 0, sizeof(event));
+        event.type = S3DW_MD_EVENT_TEXT;
+        event.text = *resultchunkptr;
+        event.textlen = *resultfillptr;
+        event.offset = state->eventtextoffset;
+        size_t end = _md2html_EventOffset(state, at);
+        event.length = (end > event.offset ? end - event.offset : 0);
+        *resultfillptr = 0;
+        if (!_md2html_EventEmit(state, &event, resultchunkptr))
+            return 0;
+    }
+    state->eventtextoffset = _md2html_EventOffset(state, atend);
+    return 1;
+}
+
+/// Report entering the element of the given event at the markup from
+/// at to atend in the clean block. Returns 0 like _md2html_EventText().
+static int _md2html_EventEnter(
+        _md2html_renderstate *state,
+        char **resultchunkptr, size_t *resultfillptr,
+        s3dw_markdown_event *event, const char *at, const char *atend
+        ) {
+    if (!_md2html_EventText(
+            state, resultchunkptr, resultfillptr, at, atend))
+        return 0;
+    if (state->eventdepth >= state->eventstackalloc) {
+        size_t newalloc = (state->eventstackalloc > 0 ?
+            state->eventstackalloc * 2 : 16);
+        int *newstack = realloc(
+            state->eventstack, sizeof(*newstack) * newalloc
+        );
+        if (!newstack) {
+            free(*resultchunkptr);
+            *resultchunkptr = NULL;
+            return 0;
+        }
+        state->eventstack = newstack;
+        state->eventstackalloc = newalloc;
+    }
+    state->eventstack[state->eventdepth] = event->element;
+    state->eventdepth += 1;
+    event->type = S3DW_MD_EVENT_ENTER;
+    event->offset = _md2html_EventOffset(state, at);
+    event->length = (state->eventtextoffset > event->offset ?
+        state->eventtextoffset - event->offset : 0);
+    return _md2html_EventEmit(state, event, resultchunkptr);
+}
+
+static int _md2html_EventEnterSimple(
+        _md2html_renderstate *state,
+        char **resultchunkptr, size_t *resultfillptr,
+        int element, int level, const char *text, size_t textlen,
+        const char *at, const char *atend
+        ) {
+    s3dw_markdown_event event;
+    memset(&event, 0, sizeof(event));
+    event.element = element;
+    event.level = level;
+    event.text = text;
+    event.textlen = textlen;
+    return _md2html_EventEnter(
+        state, resultchunkptr, resultfillptr, &event, at, atend
+    );
+}
+
+/// Report leaving all elements entered after the given stack depth.
+/// The last one left gets the markup from at to atend.
+static int _md2html_EventLeaveTo(
+        _md2html_renderstate *state,
+        char **resultchunkptr, size_t *resultfillptr,
+        size_t newdepth, const char *at, const char *atend
+        ) {
+    if (!_md2html_EventText(
+            state, resultchunkptr, resultfillptr, at, atend))
+        return 0;
+    size_t offset = _md2html_EventOffset(state, at);
+    while (state->eventdepth > newdepth) {
+        state->eventdepth -= 1;
+        s3dw_markdown_event event;
+        memset(&event, 0, sizeof(event));
+        event.type = S3DW_MD_EVENT_LEAVE;
+        event.element = state->eventstack[state->eventdepth];
+        event.offset = offset;
+        if (state->eventdepth == newdepth &&
+                state->eventtextoffset > offset)
+            event.length = state->eventtextoffset - offset;
+        if (!_md2html_EventEmit(state, &event, resultchunkptr))
+            return 0;
+    }
+    return 1;
+}
+
+/// Report leaving the innermost entered element of the given type,
+/// which leaves everything entered inside it too. The HTML isn't
+/// always closed in order, so if there's no such element this does
+/// nothing. Returns 0 like _md2html_EventText().
+static int _md2html_EventLeave(
+        _md2html_renderstate *state,
+        char **resultchunkptr, size_t *resultfillptr,
+        int element, const char *at, const char *atend
+        ) {
+    size_t k = state->eventdepth;
+    while (k > 0 && state->eventstack[k - 1] != element)
+        k -= 1;
+    if (k == 0)
+        return 1;
+    return _md2html_EventLeaveTo(
+        state, resultchunkptr, resultfillptr, k - 1, at, atend
+    );
+}
+
+/// Copy a URL with its entities decoded into the event scratch space.
+/// Returns 0 on allocation failure, and the result buffer is gone then.
+static int _md2html_EventDecodeURL(
+        _md2html_renderstate *state, char **resultchunkptr,
+        s3dw_markdown_event *event
+        ) {
+    if (!_internal_s3dw_markdown_ensurebufsize(
+            &state->eventscratch, &state->eventscratchalloc,
+            event->textlen + 1)) {
+        state->eventscratch = NULL;
+        state->eventscratchalloc = 0;
+        free(*resultchunkptr);
+        *resultchunkptr = NULL;
+        return 0;
+    }
+    event->textlen = _internal_s3dw_markdown_DecodeEntities(
+        state->eventscratch, event->text, event->textlen
+    );
+    event->text = state->eventscratch;
+    return 1;
+}
+
+static int _md2html_EventEnterLink(
+        _md2html_renderstate *state,
+        char **resultchunkptr, size_t *resultfillptr,
+        const char *url, size_t urllen, const char *at, const char *atend
+        ) {
+    s3dw_markdown_event event;
+    memset(&event, 0, sizeof(event));
+    event.element = S3DW_MD_ELEMENT_LINK;
+    event.text = url;
+    event.textlen = urllen;
+    if (!_md2html_EventDecodeURL(state, resultchunkptr, &event))
+        return 0;
+    return _md2html_EventEnter(
+        state, resultchunkptr, resultfillptr, &event, at, atend
+    );
+}
+
+/// Start an image at the given spot in the clean block. It's only
+/// reported once its alt text is gathered, see _md2html_EventImageEnd().
+static int _md2html_EventImageStart(
+        _md2html_renderstate *state,
+        char **resultchunkptr, size_t *resultfillptr,
+        const char *at, const char *url, size_t urllen,
+        int width, char widthformat, int height, char heightformat
+        ) {
+    if (!_md2html_EventText(
+            state, resultchunkptr, resultfillptr, at, at))
+        return 0;
+    s3dw_markdown_event *event = &state->eventimage;
+    memset(event, 0, sizeof(*event));
+    event->element = S3DW_MD_ELEMENT_IMAGE;
+    event->text = url;  // (Decoded once it's reported.)
+    event->textlen = urllen;
+    const size_t half = sizeof(state->eventimagesize) / 2;
+    event->width = state->eventimagesize;
+    event->height = state->eventimagesize + half;
+    if (widthformat != '\0')
+        event->widthlen = snprintf(state->eventimagesize, half, "%d%s",
+            width, (widthformat == '%' ? "%" : "px"));
+    if (heightformat != '\0')
+        event->heightlen = snprintf(state->eventimagesize + half, half,
+            "%d%s", height, (heightformat == '%' ? "%" : "px"));
+    state->eventimageoffset = _md2html_EventOffset(state, at);
+    return 1;
+}
+
+/// Report the image started before, which ends at the given spot in
+/// the clean block, with the text gathered since as its alt text.
+static int _md2html_EventImageEnd(
+        _md2html_renderstate *state,
+        char **resultchunkptr, size_t *resultfillptr,
+        const char *atend
+        ) {
+    s3dw_markdown_event event = state->eventimage;
+    if (!_md2html_EventDecodeURL(state, resultchunkptr, &event))
+        return 0;
+    event.alt = *resultchunkptr;
+    event.altlen = *resultfillptr;
+    event.type = S3DW_MD_EVENT_ENTER;
+    event.offset = state->eventimageoffset;
+    state->eventtextoffset = _md2html_EventOffset(state, atend);
+    event.length = (state->eventtextoffset > event.offset ?
+        state->eventtextoffset - event.offset : 0);
+    *resultfillptr = 0;
+    if (!_md2html_EventEmit(state, &event, resultchunkptr))
+        return 0;
+    memset(&event, 0, sizeof(event));
+    event.type = S3DW_MD_EVENT_LEAVE;
+    event.element = S3DW_MD_ELEMENT_IMAGE;
+    event.offset = state->eventtextoffset;
+    return _md2html_EventEmit(state, &event, resultchunkptr);
+}
+
+/// In plain text mode, markdown text goes out with its entities
+/// decoded, since there's no HTML around it that would need them.
+static int _md2html_AppendDecoded(
+        char **bufptr, size_t *bufalloc, size_t *buffill,
+        const char *s, size_t slen
+        ) {
+    if (!_internal_s3dw_markdown_ensurebufsize(
+            bufptr, bufalloc, *buffill + slen + 1))
+        return 0;
+    *buffill += _internal_s3dw_markdown_DecodeEntities(
+        *bufptr + *buffill, s, slen
+    );
+    return 1;
+}
+
+/// In plain text mode, tags are replaced by just the line breaks
+/// that went with them.
+static int _md2html_AppendTagLineBreaks(
+        char **bufptr, size_t *bufalloc, size_t *buffill,
+        const char *tag
+        ) {
+    while ((tag = strchr(tag, '\n')) != NULL) {
+        if (!_internal_s3dw_markdown_bufappendchar(
+                bufptr, bufalloc, buffill, '\n', 1))
+            return 0;
+        tag += 1;
+    }
+    return 1;
+}
+
 static int _spew3d_markdown_process_inline_content(
         char **resultchunkptr, size_t *resultfillptr,
         size_t *resultallocptr,
-        _markdown_lineinfo *lineinfo, size_t lineinfofill,
+        _markdown_lineinfo *lineinfo,
         int startline, int endbeforeline,
         int start_at_content_index, int end_at_content_index,
-        int as_code, int isinheading,
+        int as_code, int isinheading, _md2html_renderstate *state,
         s3dw_markdown_tohtmloptions *options,
         int *out_endlineidx
         ) {
     char *resultchunk = *resultchunkptr;
     size_t resultfill = *resultfillptr;
     size_t resultalloc = *resultallocptr;
+    const int plaintext = state->plaintext;
 
     int headingbylinebelow = 0;
     int endline = startline;
@@ -269,54 +890,32 @@ static int _spew3d_markdown_process_inline_content(
     size_t inside_imgtitle_ends_at = 0;
     size_t past_image_idx = 0;
 
-    #define LINEC(l, c) \
-        (lineinfo[l].linestart[\
-            lineinfo[l].indentlen + c\
-        ])
-
     while (endline + 1 < endbeforeline &&
             !as_code &&
-            lineinfo[endline + 1].indentlen ==
-            lineinfo[startline].indentlen &&
-            lineinfo[endline + 1].indentedcontentlen > 0 &&
-            (LINEC(endline + 1, 0) != '-' || (
-                lineinfo[endline + 1].indentedcontentlen > 1 &&
-                LINEC(endline + 1, 1) != '-' &&
-                LINEC(endline + 1, 1) != ' ' &&
-                LINEC(endline + 1, 1) != '\t')) &&
-            (LINEC(endline + 1, 0) != '*' || (
-                lineinfo[endline + 1].indentedcontentlen > 1 &&
-                LINEC(endline + 1, 1) != ' ' &&
-                LINEC(endline + 1, 1) != '\t' &&
-                (LINEC(endline + 1, 1) != '*' ||
-                 lineinfo[endline + 1].indentedcontentlen > 2 &&
-                 LINEC(endline + 1, 2) != '*' &&
-                 LINEC(endline + 1, 2) != ' ' &&
-                 LINEC(endline + 1, 2) != '\t'))) &&
-            (LINEC(endline + 1, 0) != '>' || (
-                lineinfo[endline + 1].indentedcontentlen > 1 &&
-                LINEC(endline + 1, 1) != ' ')) &&
-            (LINEC(endline + 1, 0) != '#' || (
-                lineinfo[endline + 1].indentedcontentlen > 1 &&
-                LINEC(endline + 1, 1) != '#' &&
-                LINEC(endline + 1, 1) != ' ' &&
-                LINEC(endline + 1, 1) != '\t')) &&
-            (LINEC(endline + 1, 0) != '`' || (
-                lineinfo[endline + 1].indentedcontentlen < 3 ||
-                LINEC(endline + 1, 1) != '`' ||
-                LINEC(endline + 1, 2) != '`')) &&
-            (_spew3dweb_markdown_GetLineHeadingUnderlineStrength(
-                lineinfo, lineinfofill, endline + 1) >= 0) &&
-            (_m2html_GetListBulletNumberLen(
-                lineinfo, endline + 1, NULL) <= 0))
+            _S3D_MD_LINEINDENT(lineinfo, endline + 1) ==
+            _S3D_MD_LINEINDENT(lineinfo, startline) &&
+            _S3D_MD_LINECONTENTLEN(lineinfo, endline + 1) > 0 &&
+            (lineinfo->flags[endline + 1] &
+                _S3D_MD_LINEFLAG_ENDSPARAGRAPH) == 0)
         endline += 1;
-    #undef LINEC
     /*printf("_spew3d_markdown_process_inline_content on "
         "'%s' line range %d to %d\n",
-        lineinfo[startline].linestart + lineinfo[startline].indentlen,
-        startline, endline);*/
+        _S3D_MD_LINESTART(lineinfo, startline) +
+        _S3D_MD_LINEINDENT(lineinfo, startline), startline, endline);*/
     char fnestings[_S3D_MD_MAX_FORMAT_NESTING];
     int fnestingsdepth = 0;
+
+    // Scanning ahead for the end of each formatting start would take
+    // quadratic time for lots of unmatched ones. However, when the
+    // innermost formatting of such a scan ends only depends on the
+    // position, the nesting depth, its type, and whether we're in
+    // inline code. So once scans get long, we remember that for all
+    // formatting started during a scan, and later scans reaching the
+    // same position and state can skip ahead right away:
+    _md2html_endscanmemo endscanmemo;
+    memset(&endscanmemo, 0, sizeof(endscanmemo));
+    endscanmemo.base = _S3D_MD_LINESTART(lineinfo, startline);
+
     size_t iline = startline;
     while (iline <= endline) {
         /*printf("_spew3d_markdown_process_inline_content "
@@ -324,26 +923,38 @@ static int _spew3d_markdown_process_inline_content(
         if (iline > startline) {
             if (!INSC(' ')) {
                 errorquit: ;
+                _md2html_FreeEndScanMemo(&endscanmemo);
                 *resultchunkptr = resultchunk;
                 *resultfillptr = resultfill;
                 *resultallocptr = resultalloc;
                 return 0;
             }
         }
-        size_t i = lineinfo[iline].indentlen;
+        size_t i = _S3D_MD_LINEINDENT(lineinfo, iline);
         if (start_at_content_index > 0)
             i = (size_t)start_at_content_index;
         size_t ipastend = (
-            lineinfo[iline].indentedcontentlen +
-            lineinfo[iline].indentlen);
+            _S3D_MD_LINECONTENTLEN(lineinfo, iline) +
+            _S3D_MD_LINEINDENT(lineinfo, iline));
         if (end_at_content_index >= 0)
             ipastend = end_at_content_index;
-        const char *linebuf = lineinfo[iline].linestart;
+        const char *linebuf = _S3D_MD_LINESTART(lineinfo, iline);
+        if (as_code) {
+            // Code is only ever escaped, never formatted:
+            if (!INSESC(linebuf + i, ipastend - i, 0))
+                goto errorquit;
+            iline += 1;
+            continue;
+        }
         while (i < ipastend) {
             if (inside_linktitle_ends_at > 0 &&
                     i >= inside_linktitle_ends_at) {
                 linkend: ;
-                if (!INS("</a>"))  // Close link title
+                if (!INSTAG("</a>"))  // Close link title
+                    goto errorquit;
+                if (!EVENTLEAVE(S3DW_MD_ELEMENT_LINK,
+                        linebuf + inside_linktitle_ends_at,
+                        linebuf + past_link_idx))
                     goto errorquit;
                 i = past_link_idx;
                 inside_linktitle_ends_at = 0;
@@ -355,7 +966,11 @@ static int _spew3d_markdown_process_inline_content(
             if (inside_imgtitle_ends_at > 0 &&
                     i >= inside_imgtitle_ends_at) {
                 imgend: ;
-                if (!INS("'/>"))  // Close 'alt' attribute
+                if (!INSTAG("'/>"))  // Close 'alt' attribute
+                    goto errorquit;
+                if (state->eventcallback && !_md2html_EventImageEnd(
+                        state, &resultchunk, &resultfill,
+                        linebuf + past_image_idx))
                     goto errorquit;
                 i = past_image_idx;
                 inside_imgtitle_ends_at = 0;
@@ -384,20 +999,94 @@ static int _spew3d_markdown_process_inline_content(
                 int previousnesting = fnestingsdepth;
                 fnestingsdepth++;
                 fnestings[fnestingsdepth - 1] = _fmttype;
+                uint32_t scaninsts[_S3D_MD_MAX_FORMAT_NESTING] = {0};
+                scaninsts[fnestingsdepth - 1] = (
+                    _md2html_NewEndScanMemoInst(&endscanmemo)
+                );
+                const int linktitlemin = (
+                    inside_linktitle_ends_at > 0 ?
+                    inside_linktitle_minimum_fnesting : -1
+                );
                 size_t i2 = i + _md2html_fmt_type_len(_fmttype);
                 size_t i2pastend = ipastend;
                 if (scantruncate > 0 &&
                         i2pastend > scantruncate)
                     i2pastend = scantruncate;
+                const size_t scanfirsti2 = i2;
+                size_t scansteps = 0;
+                int memoafterend = 0;
+                int knownnoend = 0;
                 size_t foundendinline = 0;
                 int foundpastidx = -1;
                 int incode = 0;
                 size_t iline2 = iline;
-                const char *linebuf2 = lineinfo[iline2].linestart;
+                const char *linebuf2 = _S3D_MD_LINESTART(lineinfo, iline2);
                 while (iline2 <= endline &&
                         (scantruncate == 0 ||
                         iline2 == iline)) {
                     while (i2 < i2pastend) {
+                        scansteps += 1;
+                        if (scansteps > 64)
+                            endscanmemo.enabled = 1;
+                        if (endscanmemo.enabled && scantruncate == 0 &&
+                                (iline2 != iline || i2 != scanfirsti2) &&
+                                (memoafterend || linebuf2[i2] == '*' ||
+                                linebuf2[i2] == '_' ||
+                                linebuf2[i2] == '~' ||
+                                linebuf2[i2] == '`')) {
+                            // (The first position is special, see
+                            // below, so it's never used for the memo.)
+                            memoafterend = 0;
+                            uint32_t pos = (
+                                (linebuf2 + i2) - endscanmemo.base
+                            );
+                            uint32_t key = _md2html_GetEndScanMemoKey(
+                                fnestingsdepth,
+                                fnestings[fnestingsdepth - 1],
+                                incode, linktitlemin
+                            );
+                            uint32_t inst = (
+                                _md2html_FindEndScanMemoInst(
+                                    &endscanmemo, pos, key
+                                ));
+                            if (inst != 0 &&
+                                    endscanmemo.instline[inst - 1] == -2) {
+                                // Innermost one never ends, so neither
+                                // will the one we're looking for:
+                                knownnoend = 1;
+                                break;
+                            } else if (inst != 0 &&
+                                    endscanmemo.instline[inst - 1] >= 0) {
+                                // Innermost one has a known end, skip:
+                                assert(endscanmemo.instline[inst - 1] >=
+                                    iline2);
+                                _md2html_EndEndScanMemoInst(
+                                    &endscanmemo,
+                                    scaninsts[fnestingsdepth - 1],
+                                    endscanmemo.instline[inst - 1],
+                                    endscanmemo.instpastidx[inst - 1]
+                                );
+                                fnestingsdepth--;
+                                iline2 = endscanmemo.instline[inst - 1];
+                                i2 = endscanmemo.instpastidx[inst - 1];
+                                linebuf2 = _S3D_MD_LINESTART(lineinfo, iline2);
+                                i2pastend = (
+                                    _S3D_MD_LINEINDENT(lineinfo, iline2) +
+                                    _S3D_MD_LINECONTENTLEN(lineinfo, iline2));
+                                incode = 0;
+                                if (fnestingsdepth <= previousnesting) {
+                                    foundpastidx = i2;
+                                    foundendinline = iline2;
+                                    break;
+                                }
+                                memoafterend = 1;
+                                continue;
+                            }
+                            _md2html_AddEndScanMemoInst(
+                                &endscanmemo, pos, key,
+                                scaninsts[fnestingsdepth - 1]
+                            );
+                        }
                         if (linebuf2[i2] == '\\') {
                             i2 += 2;
                             continue;
@@ -436,6 +1125,11 @@ static int _spew3d_markdown_process_inline_content(
                                 (inside_linktitle_ends_at <= 0 ||
                                 fnestingsdepth >
                                 inside_linktitle_minimum_fnesting)) {
+                            _md2html_EndEndScanMemoInst(
+                                &endscanmemo,
+                                scaninsts[fnestingsdepth - 1], iline2,
+                                i2 + _md2html_fmt_type_len(_innerfmt)
+                            );
                             fnestingsdepth--;
                             if (fnestingsdepth <= previousnesting) {
                                 foundpastidx = i2 + (
@@ -445,6 +1139,7 @@ static int _spew3d_markdown_process_inline_content(
                                 break;
                             }
                             i2 += _md2html_fmt_type_len(_innerfmt);
+                            memoafterend = 1;
                             continue;
                         } else if (_innerfmt > 0 && !incode &&
                                 _innercanopen &&
@@ -452,19 +1147,36 @@ static int _spew3d_markdown_process_inline_content(
                                 _S3D_MD_MAX_FORMAT_NESTING) {
                             fnestingsdepth++;
                             fnestings[fnestingsdepth - 1] = _innerfmt;
+                            scaninsts[fnestingsdepth - 1] = (
+                                _md2html_NewEndScanMemoInst(&endscanmemo)
+                            );
                             i2 += _md2html_fmt_type_len(_innerfmt);
                             continue;
                         }
                         i2 += 1;
                     }
-                    if (foundpastidx >= 0)
+                    if (foundpastidx >= 0 || knownnoend)
                         break;
                     iline2 += 1;
                     if (iline2 <= endline) {
-                        i2 = lineinfo[iline2].indentlen;
-                        i2pastend = (lineinfo[iline2].indentlen +
-                        lineinfo[iline2].indentedcontentlen);
-                        linebuf2 = lineinfo[iline2].linestart;
+                        i2 = _S3D_MD_LINEINDENT(lineinfo, iline2);
+                        i2pastend = (_S3D_MD_LINEINDENT(lineinfo, iline2) +
+                            _S3D_MD_LINECONTENTLEN(lineinfo, iline2));
+                        linebuf2 = _S3D_MD_LINESTART(lineinfo, iline2);
+                    }
+                }
+                #if defined(SPEW3DWEB_OPTION_MARKDOWN_SCAN_STATS)
+                __atomic_fetch_add(&_md2html_scanstat_steps,
+                    (uint64_t)scansteps, __ATOMIC_RELAXED);
+                #endif
+                if (foundpastidx < 0) {
+                    // Everything still open in this scan never ends:
+                    int k = previousnesting;
+                    while (k < fnestingsdepth) {
+                        _md2html_EndEndScanMemoInst(
+                            &endscanmemo, scaninsts[k], -2, -1
+                        );
+                        k += 1;
                     }
                 }
                 if (foundpastidx < 0) {
@@ -481,18 +1193,22 @@ static int _spew3d_markdown_process_inline_content(
                 fnestingsdepth = previousnesting + 1;
                 fnestings[fnestingsdepth - 1] = _fmttype;
                 if (_fmttype == _FORMAT_TYPE_ASTERISK1) {
-                    if (!INS("<em>"))
+                    if (!INSTAG("<em>"))
                         goto errorquit;
                 } else if (_fmttype == _FORMAT_TYPE_ASTERISK2 ||
                         _fmttype == _FORMAT_TYPE_UNDERLINE2) {
-                    if (!INS("<strong>"))
+                    if (!INSTAG("<strong>"))
                         goto errorquit;
                 } else if (_fmttype == _FORMAT_TYPE_TILDE2) {
-                    if (!INS("<strike>"))
+                    if (!INSTAG("<strike>"))
                         goto errorquit;
                 } else {
                     assert(0);
                 }
+                if (!EVENTENTER(_md2html_fmt_type_element(_fmttype),
+                        0, NULL, 0, linebuf + i,
+                        linebuf + i + _md2html_fmt_type_len(_fmttype)))
+                    goto errorquit;
                 i += _md2html_fmt_type_len(_fmttype);
                 continue;
             } else if (fnestingsdepth > 0 && !as_code &&
@@ -508,47 +1224,46 @@ static int _spew3d_markdown_process_inline_content(
                 // Close corresponding formatting again.
                 fnestingsdepth -= 1;
                 if (_fmttype == _FORMAT_TYPE_ASTERISK1) {
-                    if (!INS("</em>"))
+                    if (!INSTAG("</em>"))
                         goto errorquit;
                 } else if (_fmttype == _FORMAT_TYPE_ASTERISK2 ||
                         _fmttype == _FORMAT_TYPE_UNDERLINE2) {
-                    if (!INS("</strong>"))
+                    if (!INSTAG("</strong>"))
                         goto errorquit;
                 } else if (_fmttype == _FORMAT_TYPE_TILDE2) {
-                    if (!INS("</strike>"))
+                    if (!INSTAG("</strike>"))
                         goto errorquit;
                 } else {
                     assert(0);
                 }
+                if (!EVENTLEAVE(_md2html_fmt_type_element(_fmttype),
+                        linebuf + i,
+                        linebuf + i + _md2html_fmt_type_len(_fmttype)))
+                    goto errorquit;
                 i += _md2html_fmt_type_len(_fmttype);
                 continue;
             }
             if (linebuf[i] == '`' && !as_code &&
                     inside_imgtitle_ends_at == 0) {
-                if (!INS("<code>"))
+                if (!INSTAG("<code>"))
+                    goto errorquit;
+                if (!EVENTENTER(S3DW_MD_ELEMENT_CODE, 0, NULL, 0,
+                        linebuf + i, linebuf + i + 1))
                     goto errorquit;
                 i += 1;
+                const char *closingtick = NULL;
                 while (iline <= endline) {
-                    while (i < ipastend &&
-                            linebuf[i] != '`') {
-                        if (linebuf[i] == '<') {
-                            if (!INS("&lt;"))
-                                goto errorquit;
-                        } else if (linebuf[i] == '>') {
-                            if (!INS("&gt;"))
-                                goto errorquit;
-                        } else if (linebuf[i] == '&') {
-                            if (!INS("&amp;"))
-                                goto errorquit;
-                        } else {
-                            if (!INSC(linebuf[i]))
-                                goto errorquit;
-                        }
-                        i += 1;
-                    }
+                    const char *tick = memchr(
+                        linebuf + i, '`', ipastend - i
+                    );
+                    size_t codeend = (tick ? (size_t)(tick - linebuf) :
+                        ipastend);
+                    if (!INSESC(linebuf + i, codeend - i, 0))
+                        goto errorquit;
+                    i = codeend;
                     if (i < ipastend && linebuf[i] == '`') {
-                        if (i < ipastend && linebuf[i] == '`')
-                            i += 1;
+                        closingtick = linebuf + i;
+                        i += 1;
                         break;
                     }
                     iline += 1;
@@ -556,20 +1271,28 @@ static int _spew3d_markdown_process_inline_content(
                         if (!INS(" "))
                             goto errorquit;
                         ipastend = (
-                            lineinfo[iline].indentedcontentlen +
-                            lineinfo[iline].indentlen
+                            _S3D_MD_LINECONTENTLEN(lineinfo, iline) +
+                            _S3D_MD_LINEINDENT(lineinfo, iline)
                         );
-                        linebuf = lineinfo[iline].linestart;
-                        i = lineinfo[iline].indentlen;
+                        linebuf = _S3D_MD_LINESTART(lineinfo, iline);
+                        i = _S3D_MD_LINEINDENT(lineinfo, iline);
                     }
                 }
-                if (!INS("</code>"))
+                if (!INSTAG("</code>"))
+                    goto errorquit;
+                if (!EVENTLEAVE(S3DW_MD_ELEMENT_CODE,
+                        (closingtick ? closingtick : linebuf + i),
+                        linebuf + i))
                     goto errorquit;
-                if (iline > endline)
+                if (iline > endline) {
+                    // It ran to the end, so we're on the last line:
+                    iline = endline;
                     break;
+                }
                 continue;
             } else if (linebuf[i] == '\\' && !as_code) {
-                if (i < ipastend) {
+                // (One at the very end escapes nothing, and is kept.)
+                if (i + 1 < ipastend) {
                     i += 1;
                     if (inside_linktitle_ends_at > 0 &&
                             i >= inside_linktitle_ends_at)
@@ -577,22 +1300,21 @@ static int _spew3d_markdown_process_inline_content(
                     if (inside_imgtitle_ends_at > 0 &&
                             i >= inside_imgtitle_ends_at)
                         goto imgend;
-                    if (linebuf[i] == '<') {
-                        if (!INS("&lt;"))
-                            goto errorquit;
-                    } else if (linebuf[i] == '>') {
-                        if (!INS("&gt;"))
-                            goto errorquit;
-                    } else if (linebuf[i] == '&') {
-                        if (!INS("&amp;"))
+                    if (linebuf[i] == '<' || linebuf[i] == '>' ||
+                            linebuf[i] == '&') {
+                        if (!INSESC(linebuf + i, 1, 0))
                             goto errorquit;
                     } else {
                         if (linebuf[i] != '[' && linebuf[i] != '(' &&
                                 linebuf[i] != '#' && linebuf[i] != '|')
                             if (!INSC('\\'))
                                 goto errorquit;
-                        if (!INSC(linebuf[i]))
+                        if (inside_imgtitle_ends_at > 0) {
+                            if (!INSESC(linebuf + i, 1, 1))
+                                goto errorquit;
+                        } else if (!INSC(linebuf[i])) {
                             goto errorquit;
+                        }
                     }
                 }
             } else if ((linebuf[i] == '!' && !as_code &&
@@ -630,7 +1352,7 @@ static int _spew3d_markdown_process_inline_content(
                     i += 1;
                     continue;
                 } else {
-                    if (isimage) {
+                    if (isimage && !plaintext) {
                         if (!INS("<img"))
                             goto errorquit;
                         char numbuf[16];
@@ -639,7 +1361,7 @@ static int _spew3d_markdown_process_inline_content(
                                 goto errorquit;
                             snprintf(numbuf, sizeof(numbuf) - 1,
                                 "%d", imgwidth);
-                            if (!INS(numbuf))
+                            if (!INSSTR(numbuf))
                                 goto errorquit;
                             if (imgwidthformat == '%') {
                                 if (!INSC('%'))
@@ -658,7 +1380,7 @@ static int _spew3d_markdown_process_inline_content(
                                 goto errorquit;
                             snprintf(numbuf, sizeof(numbuf) - 1,
                                 "%d", imgheight);
-                            if (!INS(numbuf))
+                            if (!INSSTR(numbuf))
                                 goto errorquit;
                             if (imgheightformat == '%') {
                                 if (!INSC('%'))
@@ -675,12 +1397,12 @@ static int _spew3d_markdown_process_inline_content(
                         if (!INS(" src='"))
                             goto errorquit;
                     }
-                    if (!isimage)
+                    if (!isimage && !plaintext)
                         if (!INS("<a href='"))
                             goto errorquit;
                     int add_rel_noopener = 0;
                     int add_target_blank = 0;
-                    if (_m2html_IsGuaranteedExternalLink(
+                    if (!plaintext && _m2html_IsGuaranteedExternalLink(
                             linebuf + url_start, url_len
                             )) {
                         if (!options->externallinks_no_target_blank)
@@ -688,18 +1410,31 @@ static int _spew3d_markdown_process_inline_content(
                         if (!options->externallinks_no_rel_noopener)
                             add_rel_noopener = 1;
                     }
-                    if (!INSBUF(linebuf + url_start,
-                            url_len))
+                    if (!plaintext && !INSESC(linebuf + url_start,
+                            url_len, 1))
+                        goto errorquit;
+                    if (isimage && state->eventcallback &&
+                            !_md2html_EventImageStart(
+                                state, &resultchunk, &resultfill,
+                                linebuf + linkstarti,
+                                linebuf + url_start, url_len,
+                                imgwidth, imgwidthformat,
+                                imgheight, imgheightformat))
                         goto errorquit;
                     if (isimage && title_len == 0) {
                         // Done already.
-                        if (!INS("'/>"))
+                        if (!INSTAG("'/>"))
+                            goto errorquit;
+                        if (state->eventcallback &&
+                                !_md2html_EventImageEnd(
+                                    state, &resultchunk, &resultfill,
+                                    linebuf + linkstarti + linklen))
                             goto errorquit;
                         i += linklen;
                         continue;
                     } else {
                         if (isimage) {
-                            if (!INS("' alt='"))
+                            if (!INSTAG("' alt='"))
                                 goto errorquit;
                             i = title_start;
                             inside_imgtitle_ends_at = (
@@ -715,42 +1450,53 @@ static int _spew3d_markdown_process_inline_content(
                             );
                             i = title_start;
                             past_link_idx = linkstarti + linklen;
-                            if (!INS("'"))
+                            if (!INSTAG("'"))
                                 goto errorquit;
                             if (add_rel_noopener)
-                                if (!INS(" rel=noopener"))
+                                if (!INSTAG(" rel=noopener"))
                                     goto errorquit;
                             if (add_target_blank)
-                                if (!INS(" target=_blank"))
+                                if (!INSTAG(" target=_blank"))
                                     goto errorquit;
-                            if (!INS(">"))
+                            if (!INSTAG(">"))
+                                goto errorquit;
+                            if (state->eventcallback &&
+                                    !_md2html_EventEnterLink(
+                                        state, &resultchunk, &resultfill,
+                                        linebuf + url_start, url_len,
+                                        linebuf + linkstarti,
+                                        linebuf + title_start))
                                 goto errorquit;
                         }
                         continue;
                     }
                 }
-            } else if (linebuf[i] == '<' && as_code) {
-                if (!INS("&lt;"))
-                    goto errorquit;
-                i += 1;
-                continue;
-            } else if (linebuf[i] == '>' && as_code) {
-                if (!INS("&gt;"))
-                    goto errorquit;
-                i += 1;
-                continue;
-            } else if (linebuf[i] == '&' && as_code) {
-                if (!INS("&amp;"))
-                    goto errorquit;
-                i += 1;
-                continue;
             }
-            if (!INSC(linebuf[i]))
+            // Copy this and any plain characters after it in one go,
+            // since all of them would just end up here one by one:
+            size_t runend = i + 1;
+            size_t runlimit = ipastend;
+            if (inside_linktitle_ends_at > 0 &&
+                    runlimit > inside_linktitle_ends_at)
+                runlimit = inside_linktitle_ends_at;
+            if (inside_imgtitle_ends_at > 0 &&
+                    runlimit > inside_imgtitle_ends_at)
+                runlimit = inside_imgtitle_ends_at;
+            while (runend < runlimit &&
+                    _md2html_IsPlainInlineChar(linebuf[runend]))
+                runend += 1;
+            if (inside_imgtitle_ends_at > 0 && !plaintext) {
+                // Inside the 'alt' attribute, so quotes can't stay:
+                if (!INSESC(linebuf + i, runend - i, 1))
+                    goto errorquit;
+            } else if (!INSTEXT(linebuf + i, runend - i)) {
                 goto errorquit;
-            i += 1;
+            }
+            i = runend;
         }
         iline += 1;
     }
+    _md2html_FreeEndScanMemo(&endscanmemo);
     *resultchunkptr = resultchunk;
     *resultfillptr = resultfill;
     *resultallocptr = resultalloc;
@@ -764,74 +1510,85 @@ static int _spew3d_markdown_process_inline_content(
 #undef _FORMAT_TYPE_UNDERLINE2
 #undef _FORMAT_TYPE_TILDE2
 
-S3DEXP char *spew3dweb_markdown_MarkdownBytesToAnchor(
+static int _md2html_WriteAnchor(
+        char **bufptr, size_t *bufalloc, size_t *buffill,
         const char *bytebuf, size_t bytebuflen
         ) {
-    int resultalloc = 64;
-    int resultfill = 0;
-    char *result = malloc(resultalloc);
-    if (!result)
-        return NULL;
+    // Each input byte gives at most one output byte, except for
+    // non-ASCII letters which are reserved for separately below:
+    if (!_internal_s3dw_markdown_ensurebufsize(
+            bufptr, bufalloc, (*buffill) + bytebuflen + 1))
+        return 0;
+    const size_t anchorstart = *buffill;
+    size_t fill = *buffill;
+    char *buf = *bufptr;
     size_t i = 0;
     while (i < bytebuflen) {
-        if (resultfill + 2 >= resultalloc) {
-            char *newresult = realloc(result, resultalloc * 2);
-            if (!newresult) {
-                free(result);
-                return NULL;
+        const unsigned char c = (unsigned char)bytebuf[i];
+        if (c >= 128) {
+            if (!_internal_s3dw_markdown_ensurebufsize(
+                    bufptr, bufalloc,
+                    fill + (bytebuflen - i) + UTF8_CP_MAX_BYTES + 1))
+                return 0;
+            buf = *bufptr;
+            int origlen = 0;
+            int lowerlen = 0;
+            utf8_char_to_lowercase(
+                bytebuf + i, (int)(bytebuflen - i),
+                &origlen, &lowerlen, buf + fill
+            );
+            if (origlen < 1) {
+                // Not valid UTF-8, so just keep the byte as is:
+                buf[fill] = (char)c;
+                origlen = 1;
+                lowerlen = 1;
             }
-            resultalloc *= 2;
+            fill += lowerlen;
+            i += origlen;
+            continue;
         }
-        if (bytebuf[i] == ' ' || bytebuf[i] < 32 ||
-                bytebuf[i] == '>' || bytebuf[i] == '<' ||
-                bytebuf[i] == '(' || bytebuf[i] == ')' ||
-                bytebuf[i] == '[' || bytebuf[i] == ']' ||
-                bytebuf[i] == ',' || bytebuf[i] == ';' ||
-                bytebuf[i] == ':' || bytebuf[i] == '.' ||
-                bytebuf[i] == '\r' || bytebuf[i] == '/' || (
-                bytebuf[i] == '\\' && i + 1 < bytebuflen &&
+        if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')) {
+            buf[fill] = (char)c;
+            fill += 1;
+        } else if (c >= 'A' && c <= 'Z') {
+            buf[fill] = (char)(c + ('a' - 'A'));
+            fill += 1;
+        } else if (c == ' ' || c < 32 ||
+                c == '>' || c == '<' ||
+                c == '(' || c == ')' ||
+                c == '[' || c == ']' ||
+                c == ',' || c == ';' ||
+                c == ':' || c == '.' || c == '/' || (
+                c == '\\' && i + 1 < bytebuflen &&
                 bytebuf[i + 1] == '\\')) {
-            if (resultfill > 0 && result[resultfill - 1] != '-') {
-                result[resultfill] = '-';
-                resultfill += 1;
+            if (fill > anchorstart && buf[fill - 1] != '-') {
+                buf[fill] = '-';
+                fill += 1;
             }
-            i += 1;
-            continue;
-        } else if (bytebuf[i] == '\\' || (bytebuf[i] < 127 &&
-                (bytebuf[i] < 'a' || bytebuf[i] > 'z') &&
-                (bytebuf[i] < 'A' || bytebuf[i] > 'Z') &&
-                (bytebuf[i] < '0' || bytebuf[i] > '9'))) {
-            i += 1;
-            continue;
+        } else if (c == 127) {
+            buf[fill] = (char)c;
+            fill += 1;
         }
-        result[resultfill] = bytebuf[i];
-        resultfill += 1;
         i += 1;
     }
-    while (resultfill > 0 &&
-            result[resultfill - 1] == '-')
-        resultfill--;
-    result[resultfill] = '\0';
-
-    char *lowercaseresult = malloc(
-        resultfill * UTF8_CP_MAX_BYTES + 1
-    );
-    int iorig = 0;
-    int ilower = 0;
-    while (iorig < resultfill) {
-        int out_origlen = 0;
-        int out_lowerlen = 0;
-        utf8_char_to_lowercase(
-            result + iorig, (resultfill - iorig),
-            &out_origlen,
-            &out_lowerlen, lowercaseresult + ilower
-        );
-        iorig += out_origlen;
-        ilower += out_lowerlen;
-    }
-    lowercaseresult[ilower] = '\0';
-    free(result);
-    return lowercaseresult;
+    while (fill > anchorstart && buf[fill - 1] == '-')
+        fill -= 1;
+    *buffill = fill;
+    return 1;
+}
+
+S3DEXP char *spew3dweb_markdown_MarkdownBytesToAnchor(
+        const char *bytebuf, size_t bytebuflen
+        ) {
+    char *result = NULL;
+    size_t resultalloc = 0;
+    size_t resultfill = 0;
+    if (!_md2html_WriteAnchor(
+            &result, &resultalloc, &resultfill,
+            bytebuf, bytebuflen))
+        return NULL;
+    result[resultfill] = '\0';
+    return result;
 }
 
 static int _line_start_like_list_entry(
@@ -841,16 +1598,12 @@ static int _line_start_like_list_entry(
     int _numentryvalue = 0;
     int _numentrylen = 0;
     int i = lineindex;
-    if (lineinfo[i].indentedcontentlen >= 2 &&
-            (((
-            lineinfo[i].linestart[lineinfo[i].indentlen] == '-' ||
-            lineinfo[i].linestart[lineinfo[i].indentlen] == '>' ||
-            lineinfo[i].linestart[lineinfo[i].indentlen] == '*') &&
-            lineinfo[i].linestart[lineinfo[i].indentlen + 1] == ' ') ||
+    if ((lineinfo->flags[i] & (_S3D_MD_LINEFLAG_BULLET |
+            _S3D_MD_LINEFLAG_QUOTE)) != 0 ||
+            ((lineinfo->flags[i] & _S3D_MD_LINEFLAG_NUMBERED) != 0 &&
             (_numentrylen = _m2html_GetListBulletNumberLen(
                 lineinfo, i, &_numentryvalue
-            )) > 0
-            )) {
+            )) > 0)) {
         if (out_number) *out_number = _numentryvalue;
         if (out_numentrylen) *out_numentrylen = _numentrylen;
         return 1;
@@ -858,154 +1611,477 @@ static int _line_start_like_list_entry(
     return 0;
 }
 
-S3DEXP char *spew3dweb_markdown_ByteBufToHTML(
-        const char *uncleaninput, size_t uncleaninputlen,
+static void _md2html_InitLineInfo(_md2html_renderstate *state) {
+    memset(&state->lineinfo, 0, sizeof(state->lineinfo));
+    const size_t alloc = 16;
+    assert(sizeof(state->_lineinfo_staticbuf) >= alloc * (
+        sizeof(uint32_t) + sizeof(uint16_t) * 2));
+    state->lineinfo.start = state->_lineinfo_staticbuf;
+    state->lineinfo.indent = (uint16_t *)(state->lineinfo.start + alloc);
+    state->lineinfo.flags = state->lineinfo.indent + alloc;
+    state->lineinfo.alloc = alloc;
+    state->lineinfoheap = 0;
+}
+
+static void _md2html_FreeLineInfo(_md2html_renderstate *state) {
+    if (state->lineinfoheap)
+        free(state->lineinfo.start);
+    free(state->lineinfo.wideindent);
+    _md2html_InitLineInfo(state);
+}
+
+static int _md2html_GrowLineInfo(
+        _md2html_renderstate *state, size_t newalloc
+        ) {
+    _markdown_lineinfo *li = &state->lineinfo;
+    assert(newalloc > li->alloc);
+    // All arrays go into one allocation, the 32-bit ones first:
+    uint32_t *newstart = malloc(newalloc * (
+        sizeof(uint32_t) + sizeof(uint16_t) * 2));
+    if (!newstart)
+        return 0;
+    int32_t *newwideindent = NULL;
+    if (li->wideindent) {
+        newwideindent = malloc(sizeof(*newwideindent) * newalloc);
+        if (!newwideindent) {
+            free(newstart);
+            return 0;
+        }
+        memcpy(newwideindent, li->wideindent,
+            sizeof(*newwideindent) * li->alloc);
+    }
+    uint16_t *newindent = (uint16_t *)(newstart + newalloc);
+    uint16_t *newflags = newindent + newalloc;
+    memcpy(newstart, li->start, sizeof(*newstart) * li->alloc);
+    memcpy(newindent, li->indent, sizeof(*newindent) * li->alloc);
+    memcpy(newflags, li->flags, sizeof(*newflags) * li->alloc);
+    if (state->lineinfoheap)
+        free(li->start);
+    free(li->wideindent);
+    li->start = newstart;
+    li->indent = newindent;
+    li->flags = newflags;
+    li->wideindent = newwideindent;
+    li->alloc = newalloc;
+    state->lineinfoheap = 1;
+    return 1;
+}
+
+static int _md2html_SetLineIndent(
+        _markdown_lineinfo *lineinfo, size_t lineindex, int indent
+        ) {
+    assert(indent >= 0);
+    if (!lineinfo->wideindent && indent > UINT16_MAX) {
+        // Rare enough that we just switch to 32-bit for all lines:
+        lineinfo->wideindent = malloc(
+            sizeof(*lineinfo->wideindent) * lineinfo->alloc
+        );
+        if (!lineinfo->wideindent)
+            return 0;
+        size_t k = 0;
+        while (k < lineinfo->alloc) {
+            lineinfo->wideindent[k] = lineinfo->indent[k];
+            k += 1;
+        }
+    }
+    if (lineinfo->wideindent)
+        lineinfo->wideindent[lineindex] = indent;
+    else
+        lineinfo->indent[lineindex] = indent;
+    return 1;
+}
+
+static _markdown_anchorslot *_md2html_FindAnchorSlot(
+        _markdown_anchorslot *slots, size_t slotalloc, uint64_t hash
+        ) {
+    size_t k = hash & (slotalloc - 1);
+    while (slots[k].hash != 0 && slots[k].hash != hash)
+        k = (k + 1) & (slotalloc - 1);
+    return &slots[k];
+}
+
+static int _md2html_AddAnchorHash(
+        _md2html_renderstate *state, uint64_t hash
+        ) {
+    if ((state->anchorcount + 1) * 2 > state->anchorslotalloc) {
+        size_t newalloc = (state->anchorslotalloc > 0 ?
+            state->anchorslotalloc * 2 : 64);
+        _markdown_anchorslot *newslots = malloc(
+            sizeof(*newslots) * newalloc);
+        if (!newslots)
+            return 0;
+        memset(newslots, 0, sizeof(*newslots) * newalloc);
+        size_t i = 0;
+        while (i < state->anchorslotalloc) {
+            if (state->anchorslots[i].hash != 0)
+                *_md2html_FindAnchorSlot(newslots, newalloc,
+                    state->anchorslots[i].hash) = state->anchorslots[i];
+            i += 1;
+        }
+        free(state->anchorslots);
+        state->anchorslots = newslots;
+        state->anchorslotalloc = newalloc;
+    }
+    _markdown_anchorslot *slot = _md2html_FindAnchorSlot(
+        state->anchorslots, state->anchorslotalloc, hash
+    );
+    assert(slot->hash == 0);
+    slot->hash = hash;
+    slot->suffixes = 0;
+    state->anchorcount += 1;
+    return 1;
+}
+
+static uint64_t _md2html_AnchorHash(const char *anchor, size_t len) {
+    uint64_t hash = _internal_s3dw_markdown_Hash64(anchor, len, 0);
+    return (hash != 0 ? hash : 1);
+}
+
+/// Write the "<a name='...' href='#...'>" for a heading. With the
+/// unique_heading_anchors option, an anchor that was used before
+/// gets a "-1", "-2", ... suffix. Returns 0 on error, and the
+/// result buffer is gone then.
+static int _md2html_InsertHeadingAnchor(
+        _md2html_renderstate *state,
+        char **resultchunkptr, size_t *resultfillptr,
+        size_t *resultallocptr,
+        const char *heading, size_t headinglen,
         s3dw_markdown_tohtmloptions *options,
-        size_t *out_len
+        size_t *out_namestart, size_t *out_namelen
+        ) {
+    if (!_S3D_MD_BUFAPPENDLIT(
+            resultchunkptr, resultallocptr, resultfillptr,
+            "<a name='", 1))
+        return 0;
+    const size_t namestart = *resultfillptr;
+    if (!_md2html_WriteAnchor(
+            resultchunkptr, resultallocptr, resultfillptr,
+            heading, headinglen))
+        return 0;
+    if (options->unique_heading_anchors) {
+        // (Only hashes are kept, a 64-bit collision is unlikely
+        // enough to not matter for anchor names.)
+        uint64_t hash = _md2html_AnchorHash(
+            *resultchunkptr + namestart, *resultfillptr - namestart
+        );
+        _markdown_anchorslot *slot = NULL;
+        if (state->anchorslotalloc > 0)
+            slot = _md2html_FindAnchorSlot(
+                state->anchorslots, state->anchorslotalloc, hash);
+        if (slot && slot->hash == hash) {
+            const size_t namelen = *resultfillptr - namestart;
+            uint32_t suffix = slot->suffixes;
+            uint64_t suffixedhash = 0;
+            while (1) {
+                // Try the next number, unless a heading itself
+                // already used that name:
+                suffix += 1;
+                char suffixbuf[16];
+                int suffixlen = snprintf(
+                    suffixbuf, sizeof(suffixbuf), "-%u",
+                    (unsigned int)suffix);
+                *resultfillptr = namestart + namelen;
+                if (!_internal_s3dw_markdown_bufappend(
+                        resultchunkptr, resultallocptr, resultfillptr,
+                        suffixbuf, suffixlen, 1))
+                    return 0;
+                suffixedhash = _md2html_AnchorHash(
+                    *resultchunkptr + namestart,
+                    *resultfillptr - namestart
+                );
+                _markdown_anchorslot *other = _md2html_FindAnchorSlot(
+                    state->anchorslots, state->anchorslotalloc,
+                    suffixedhash
+                );
+                if (other->hash != suffixedhash)
+                    break;
+            }
+            slot->suffixes = suffix;
+            hash = suffixedhash;
+        }
+        if (!_md2html_AddAnchorHash(state, hash)) {
+            free(*resultchunkptr);
+            *resultchunkptr = NULL;
+            return 0;
+        }
+    }
+    const size_t namelen = *resultfillptr - namestart;
+    *out_namestart = namestart;
+    *out_namelen = namelen;
+    if (!_S3D_MD_BUFAPPENDLIT(
+            resultchunkptr, resultallocptr, resultfillptr,
+            "' href='#", 1))
+        return 0;
+    // Make room first, since the name is copied from the same buffer:
+    if (!_internal_s3dw_markdown_ensurebufsize(
+            resultchunkptr, resultallocptr,
+            (*resultfillptr) + namelen + 1))
+        return 0;
+    memcpy(*resultchunkptr + *resultfillptr,
+        *resultchunkptr + namestart, namelen);
+    *resultfillptr += namelen;
+    return _S3D_MD_BUFAPPENDLIT(
+        resultchunkptr, resultallocptr, resultfillptr, "'>", 1);
+}
+
+/// Report entering a heading, with its anchor name if doanchor is set.
+/// Returns 0 on error or when stopped, and the result buffer is gone
+/// then.
+static int _md2html_EventEnterHeading(
+        _md2html_renderstate *state,
+        char **resultchunkptr, size_t *resultfillptr,
+        int level, int doanchor, const char *heading, size_t headinglen,
+        s3dw_markdown_tohtmloptions *options,
+        const char *at, const char *atend
         ) {
-    // First, clean up the input:
-    size_t inputlen = 0;
-    char *input = _internal_spew3dweb_markdown_CleanByteBufEx(
-        uncleaninput, uncleaninputlen,
-        1, 1, !options->block_unsafe_html, 1,
-        options->uritransform_callback,
-        options->uritransform_callback_userdata,
-        &inputlen, NULL
+    size_t namestart = 0;
+    size_t namelen = 0;
+    size_t scratchfill = 0;
+    if (doanchor && !_md2html_InsertHeadingAnchor(
+            state, &state->eventscratch, &scratchfill,
+            &state->eventscratchalloc, heading, headinglen, options,
+            &namestart, &namelen)) {
+        state->eventscratch = NULL;
+        state->eventscratchalloc = 0;
+        free(*resultchunkptr);
+        *resultchunkptr = NULL;
+        return 0;
+    }
+    return _md2html_EventEnterSimple(
+        state, resultchunkptr, resultfillptr,
+        S3DW_MD_ELEMENT_HEADING, level,
+        (namelen > 0 ? state->eventscratch + namestart : NULL), namelen,
+        at, atend
     );
-    if (!input)
-        return NULL;
+}
+
+/// A spot in the given line, but never past its end.
+static const char *_md2html_LineSpot(
+        _markdown_lineinfo *lineinfo, size_t line, int column
+        ) {
+    const char *spot = _S3D_MD_LINESTART(lineinfo, line) + column;
+    if (spot > _S3D_MD_LINEEND(lineinfo, line))
+        spot = _S3D_MD_LINEEND(lineinfo, line);
+    return spot;
+}
+
+static int _md2html_AddTOCEntry(
+        _md2html_renderstate *state, int level,
+        size_t offset, size_t namestart, size_t namelen,
+        size_t textstart, size_t textend
+        ) {
+    s3dw_markdown_toc *toc = state->toc;
+    if (toc->count >= toc->alloc) {
+        size_t newalloc = (toc->alloc > 0 ? toc->alloc * 2 : 16);
+        s3dw_markdown_tocentry *newentries = realloc(
+            toc->entries, sizeof(*newentries) * newalloc
+        );
+        if (!newentries)
+            return 0;
+        toc->entries = newentries;
+        toc->alloc = newalloc;
+    }
+    s3dw_markdown_tocentry *entry = &toc->entries[toc->count];
+    entry->level = level;
+    entry->offset = state->tocoutputbase + offset;
+    entry->anchorstart = (namelen > 0 ?
+        state->tocoutputbase + namestart : 0);
+    entry->anchorlen = namelen;
+    entry->textstart = state->tocoutputbase + textstart;
+    entry->textlen = textend - textstart;
+    toc->count += 1;
+    return 1;
+}
+
+static int _md2html_RenderCleanBlock(
+        _md2html_renderstate *state,
+        char **resultchunkptr, size_t *resultfillptr,
+        size_t *resultallocptr,
+        const char *input, size_t inputlen,
+        int islastblock,
+        s3dw_markdown_tohtmloptions *options
+        ) {
+    char *resultchunk = *resultchunkptr;
+    size_t resultfill = *resultfillptr;
+    size_t resultalloc = *resultallocptr;
+    const int plaintext = state->plaintext;
 
     // First, extract info about each line in the markdown:
+    if (inputlen >= UINT32_MAX) {
+        // Our line table can't address this.
+        free(resultchunk);
+        return 0;
+    }
     size_t lineinfofill = 0;
-    size_t lineinfoalloc = 12;
-    int lineinfoheap = 0;
-    _markdown_lineinfo _lineinfo_staticbuf[12];
-    _markdown_lineinfo *lineinfo = (void *)_lineinfo_staticbuf;
+    _markdown_lineinfo *lineinfo = &state->lineinfo;
+    lineinfo->base = input;
+    free(lineinfo->wideindent);
+    lineinfo->wideindent = NULL;
+    const size_t linebreaksmax = 64;
+    size_t linebreaks[64];
+    size_t linebreaksfill = _internal_s3dw_markdown_FindLineBreaks(
+        input, inputlen, 0, linebreaks, linebreaksmax
+    );
+    size_t linebreaksidx = 0;
     size_t currentlinestart = 0;
-    ssize_t currentlinecontentstart = -1;
-    size_t currentindent = 0;
-    size_t i = 0;
-    while (i <= inputlen) {
-        if (i >= inputlen || input[i] == '\n' || input[i] == '\r') {
-            // Line end. Register this line's info:
-            if (lineinfofill + 2 > lineinfoalloc) {
-                size_t newalloc = lineinfofill * 2 + 1;
-                if (newalloc < 512)
-                    newalloc = 512;
-                _markdown_lineinfo *newlineinfo = NULL;
-                if (lineinfoheap) {
-                    newlineinfo = realloc(
-                        lineinfo, sizeof(*lineinfo) * newalloc
-                    );
-                } else {
-                    newlineinfo = malloc(
-                        sizeof(*lineinfo) * newalloc
-                    );
-                    if (newlineinfo)
-                        memcpy(newlineinfo, lineinfo,
-                            sizeof(*lineinfo) * lineinfoalloc);
-                }
-                if (!newlineinfo) {
-                    if (lineinfoheap)
-                        free(lineinfo);
-                    free(input);
-                    return NULL;
-                }
-                lineinfo = newlineinfo;
-                lineinfoheap = 1;
-                lineinfoalloc = newalloc;
-            }
-            lineinfo[lineinfofill].linestart = (
-                input + currentlinestart
+    while (1) {
+        // Get the position of the next line end, if any:
+        if (linebreaksidx >= linebreaksfill &&
+                linebreaksfill == linebreaksmax) {
+            linebreaksfill = _internal_s3dw_markdown_FindLineBreaks(
+                input, inputlen, linebreaks[linebreaksfill - 1] + 1,
+                linebreaks, linebreaksmax
             );
-            lineinfo[lineinfofill].indentedcontentlen = (
-                i - currentlinestart
-            );
-            if (currentlinecontentstart < 0) {
-                lineinfo[lineinfofill].indentlen = 0;
-            } else {
-                lineinfo[lineinfofill].indentlen = (
-                    currentindent
-                );
-                lineinfo[lineinfofill].indentedcontentlen -= (
-                    lineinfo[lineinfofill].indentlen
-                );
+            linebreaksidx = 0;
+        }
+        size_t lineend = inputlen;
+        if (linebreaksidx < linebreaksfill)
+            lineend = linebreaks[linebreaksidx];
+
+        // Register this line's info, along with where the next line
+        // starts since that's where this one ends:
+        if (lineinfofill + 3 > lineinfo->alloc) {
+            size_t newalloc = lineinfofill * 2 + 1;
+            if (newalloc < 512)
+                newalloc = 512;
+            if (!_md2html_GrowLineInfo(state, newalloc)) {
+                free(resultchunk);
+                return 0;
             }
-            /*{
-                int len = lineinfo[lineinfofill].indentlen +
-                    lineinfo[lineinfofill].indentedcontentlen;
-                if (len > 127) len = 127;
-                char lineb[128];
-                memcpy(lineb, lineinfo[lineinfofill].linestart, len);
-                lineb[len] = '\0';
-                printf("spew3d_markdown.h: debug: "
-                    "spew3dweb_markdown_ByteBufToHTML() "
-                    "precomputed line (indent %d): %s\n",
-                    lineinfo[lineinfofill].indentlen, lineb);
-            }*/
-            lineinfofill += 1;
-
-            // Start next line, if any:
-            if (i >= inputlen)
-                break;
-            if (input[i] == '\r' && i + 1 < inputlen &&
-                    input[i] == '\n')
-                i += 1;
-            i += 1;
-            currentlinestart = i;
-            currentlinecontentstart = -1;
-            currentindent = 0;
-            continue;
         }
-        if (currentlinecontentstart < 0 && (
-                input[i] == ' ' || input[i] == '\t'))
-            currentindent += 1;
-        if (currentlinecontentstart < 0 &&
-                input[i] != '\t' && input[i] != ' ') {
-            // Remember where actual contents of this line started:
-            currentlinecontentstart = i;
-            i += 1;
-            continue;
+        size_t indent = 0;
+        while (currentlinestart + indent < lineend && (
+                input[currentlinestart + indent] == ' ' ||
+                input[currentlinestart + indent] == '\t'))
+            indent += 1;
+        if (currentlinestart + indent >= lineend) {
+            // Only whitespace, so we don't count it as indent:
+            indent = 0;
         }
-        i += 1;
+        lineinfo->start[lineinfofill] = currentlinestart;
+        if (lineend < inputlen) {
+            lineinfo->start[lineinfofill + 1] = lineend + 1;
+            lineinfo->flags[lineinfofill] = 0;
+        } else {
+            lineinfo->start[lineinfofill + 1] = lineend;
+            lineinfo->flags[lineinfofill] = _S3D_MD_LINEFLAG_NOBREAK;
+        }
+        if (!_md2html_SetLineIndent(lineinfo, lineinfofill, indent)) {
+            free(resultchunk);
+            return 0;
+        }
+        _md2html_ClassifyLine(lineinfo, lineinfofill);
+        /*{
+            int len = _S3D_MD_LINEINDENT(lineinfo, lineinfofill) +
+                _S3D_MD_LINECONTENTLEN(lineinfo, lineinfofill);
+            if (len > 127) len = 127;
+            char lineb[128];
+            memcpy(lineb, _S3D_MD_LINESTART(lineinfo, lineinfofill), len);
+            lineb[len] = '\0';
+            printf("spew3d_markdown.h: debug: "
+                "spew3dweb_markdown_ByteBufToHTML() "
+                "precomputed line (indent %d): %s\n",
+                _S3D_MD_LINEINDENT(lineinfo, lineinfofill), lineb);
+        }*/
+        lineinfofill += 1;
+
+        // Start next line, if any:
+        if (lineend >= inputlen)
+            break;
+        linebreaksidx += 1;
+        currentlinestart = lineend + 1;
+    }
+    // Add an empty line at the end, which points at the terminating
+    // null byte that the input must have:
+    assert(lineinfofill + 1 < lineinfo->alloc);
+    assert(input[inputlen] == '\0');
+    lineinfo->start[lineinfofill] = inputlen;
+    lineinfo->start[lineinfofill + 1] = inputlen;
+    if (!_md2html_SetLineIndent(lineinfo, lineinfofill, 0)) {
+        free(resultchunk);
+        return 0;
     }
-    assert(lineinfofill < lineinfoalloc);
-    char zerostringbuf[1] = "";
-    lineinfo[lineinfofill].indentedcontentlen = 0;
-    lineinfo[lineinfofill].indentlen = 0;
-    lineinfo[lineinfofill].linestart = zerostringbuf;
+    lineinfo->flags[lineinfofill] = _S3D_MD_LINEFLAG_NOBREAK;
 
     // Now process the markdown and spit out HTML:
-    char *resultchunk = NULL;
-    size_t resultfill = 0;
-    size_t resultalloc = 0;
-    if (!_internal_s3dw_markdown_ensurebufsize(
-            &resultchunk, &resultalloc, 1
-            )) {
-        if (lineinfoheap)
-            free(lineinfo);
-        free(input);
-        return NULL;
-    }
-    int nestingstypes[_S3D_MD_MAX_LIST_NESTING] = {0};
-    int nestingsdepth = 0;
-    int insidecodeindent = -1;
-    int lastnonemptynoncodeindent = 0;
+    int *nestingstypes = state->nestingstypes;
+    int nestingsdepth = state->nestingsdepth;
+    int insidecodeindent = state->insidecodeindent;
+    int lastnonemptynoncodeindent = state->lastnonemptynoncodeindent;
     int enteredlistinlineidx = -1;
-    i = 0;
-    while (i <= lineinfofill) {
+    size_t i = 0;
+    while (i < lineinfofill || (islastblock && i == lineinfofill)) {
         /*{
             char lineb[2048];
-            size_t copylen = (lineinfo[i].indentlen +
-                lineinfo[i].indentedcontentlen);
+            size_t copylen = (_S3D_MD_LINEINDENT(lineinfo, i) +
+                _S3D_MD_LINECONTENTLEN(lineinfo, i));
             if (copylen >= sizeof(lineb)) copylen = sizeof(lineb);
-            memcpy(lineb, lineinfo[i].linestart, copylen);
+            memcpy(lineb, _S3D_MD_LINESTART(lineinfo, i), copylen);
             lineb[copylen] = '\0';
             printf("spew3d_markdown.h: debug: "
                 "spew3dweb_markdown_ByteBufToHTML() at line %d ("
                 "indent %d): '%s'\n",
-                i, lineinfo[i].indentlen, lineb);
+                i, _S3D_MD_LINEINDENT(lineinfo, i), lineb);
         }*/
+        if (state->insidefenceticks > 0) {
+            // We're inside a ``` code block, possibly one that
+            // was started in an earlier block:
+            if (i >= lineinfofill) {
+                assert(islastblock);
+                if (!INSTAG("</code></pre>"))
+                    goto errorquit;
+                if (!EVENTLEAVE(S3DW_MD_ELEMENT_CODEBLOCK,
+                        _S3D_MD_LINESTART(lineinfo, i),
+                        _S3D_MD_LINESTART(lineinfo, i)))
+                    goto errorquit;
+                state->insidefenceticks = 0;
+                continue;
+            }
+            int j = _S3D_MD_LINEINDENT(lineinfo, i);
+            int _foundticks = 0;
+            while (j < _S3D_MD_LINEINDENT(lineinfo, i) +
+                    _S3D_MD_LINECONTENTLEN(lineinfo, i) &&
+                    _S3D_MD_LINESTART(lineinfo, i)[j] == '`') {
+                _foundticks += 1;
+                j += 1;
+            }
+            if (_foundticks >= state->insidefenceticks) {
+                if (!EVENTLEAVE(S3DW_MD_ELEMENT_CODEBLOCK,
+                        _S3D_MD_LINESTART(lineinfo, i),
+                        _S3D_MD_LINEEND(lineinfo, i)))
+                    goto errorquit;
+                i += 1;
+                if (!INSTAG("</code></pre>"))
+                    goto errorquit;
+                state->insidefenceticks = 0;
+                continue;
+            }
+            if (state->plaintextnocode) {
+                i += 1;
+                continue;
+            }
+            // Add indent of this line:
+            int incodeindent = (
+                _S3D_MD_LINEINDENT(lineinfo, i) -
+                state->insidefencebaseindent);
+            if (incodeindent < 0)
+                incodeindent = 0;
+            if (!INSREP(" ", incodeindent))
+                goto errorquit;
+            // Add in the contents of this line:
+            int endlineidx = -1;
+            if (!_spew3d_markdown_process_inline_content(
+                    &resultchunk, &resultfill, &resultalloc,
+                    lineinfo, i, i, 0, -1,
+                    1, 0, state, options,
+                    &endlineidx))
+                goto errorquit;
+            assert(endlineidx == i);
+            if (!INS("\n"))
+                goto errorquit;
+            i += 1;
+            continue;
+        }
         char currentlinefoundbullet = '\0';
         int currentlineindentafterbullet = 0;
         int enteredlistinthisline = (
@@ -1017,7 +2093,7 @@ S3DEXP char *spew3dweb_markdown_ByteBufToHTML(
         int currentlookslikelistnolen = 0;
         int currentlookslikelist = 0;
         int currentlookslikeinnerindent = (
-            lineinfo[i].indentlen
+            _S3D_MD_LINEINDENT(lineinfo, i)
         );
         assert(currentlookslikeinnerindent >= 0);
         if (!enteredlistinthisline) {
@@ -1026,7 +2102,7 @@ S3DEXP char *spew3dweb_markdown_ByteBufToHTML(
                 &currentlookslikelistno
             );
             if (insidecodeindent > 0 &&
-                    lineinfo[i].indentlen >= insidecodeindent) {
+                    _S3D_MD_LINEINDENT(lineinfo, i) >= insidecodeindent) {
                 currentlookslikelist = 0;
                 currentlookslikelistno = 0;
                 currentlookslikelistnolen = 0;
@@ -1042,13 +2118,17 @@ S3DEXP char *spew3dweb_markdown_ByteBufToHTML(
 
         if ((currentlookslikeinnerindent <= lastnonemptynoncodeindent - 3 ||
                 (insidecodeindent > 0 &&
-                lineinfo[i].indentlen <= insidecodeindent - 4)) &&
-                (lineinfo[i].indentedcontentlen > 0 ||
+                _S3D_MD_LINEINDENT(lineinfo, i) <= insidecodeindent - 4)) &&
+                (_S3D_MD_LINECONTENTLEN(lineinfo, i) > 0 ||
                 i == lineinfofill)) {
             // We're leaving a higher nesting, either list or code.
-            int referenceindent = lineinfo[i].indentlen;
+            int referenceindent = _S3D_MD_LINEINDENT(lineinfo, i);
+            const char *leaveat = _S3D_MD_LINESTART(lineinfo, i);
             if (insidecodeindent >= 0) {
-                if (!INS("</code></pre>\n"))
+                if (!INSTAG("</code></pre>\n"))
+                    goto errorquit;
+                if (!EVENTLEAVE(S3DW_MD_ELEMENT_CODEBLOCK,
+                        leaveat, leaveat))
                     goto errorquit;
                 referenceindent = insidecodeindent - 4;
                 insidecodeindent = -1;
@@ -1056,23 +2136,32 @@ S3DEXP char *spew3dweb_markdown_ByteBufToHTML(
             int nestreduce = (lastnonemptynoncodeindent -
                 referenceindent) / 4;
             assert(nestreduce >= 0);
-            while (nestreduce > 0) {
+            while (nestreduce > 0 && nestingsdepth > 0) {
                 assert(nestingsdepth >= nestreduce);
                 const int di = nestingsdepth - 1;
                 if (nestingstypes[di] != '>' &&
                         nestingstypes[di] != '1') {
-                    if (!INS("</li></ul>\n")) {
+                    if (!INSTAG("</li></ul>\n")) {
                         errorquit: ;
-                        if (lineinfoheap)
-                            free(lineinfo);
-                        free(input);
-                        return NULL;
+                        *resultchunkptr = resultchunk;
+                        *resultfillptr = resultfill;
+                        *resultallocptr = resultalloc;
+                        return 0;
                     }
+                    if (!EVENTLEAVE(S3DW_MD_ELEMENT_LIST,
+                            leaveat, leaveat))
+                        goto errorquit;
                 } else if (nestingstypes[di] == '1') {
-                    if (!INS("</li></ol>\n"))
+                    if (!INSTAG("</li></ol>\n"))
+                        goto errorquit;
+                    if (!EVENTLEAVE(S3DW_MD_ELEMENT_ORDEREDLIST,
+                            leaveat, leaveat))
                         goto errorquit;
                 } else if (nestingstypes[di] == '>') {
-                    if (!INS("</blockquote>\n"))
+                    if (!INSTAG("</blockquote>\n"))
+                        goto errorquit;
+                    if (!EVENTLEAVE(S3DW_MD_ELEMENT_BLOCKQUOTE,
+                            leaveat, leaveat))
                         goto errorquit;
                 } else {
                     assert(0 && "Should never happen.");
@@ -1088,119 +2177,105 @@ S3DEXP char *spew3dweb_markdown_ByteBufToHTML(
         int potentialtablecells = 0;
         if (insidecodeindent < 0 && i < lineinfofill) {
             // Check for everything allowed outside of a code block:
-            if (lineinfo[i].indentlen >=
+            if (_S3D_MD_LINEINDENT(lineinfo, i) >=
                         lastnonemptynoncodeindent + 4 &&
                     insidecodeindent < 0) {
                 // Start of 4 space code block!
                 insidecodeindent = lastnonemptynoncodeindent + 4;
-                if (!INS("<pre><code>"))
+                if (!INSTAG("<pre><code>"))
+                    goto errorquit;
+                if (!EVENTENTER(S3DW_MD_ELEMENT_CODEBLOCK, 0, NULL, 0,
+                        _S3D_MD_LINESTART(lineinfo, i),
+                        _S3D_MD_LINESTART(lineinfo, i) +
+                        _S3D_MD_LINEINDENT(lineinfo, i)))
                     goto errorquit;
-                if (!INSBUF(
-                        lineinfo[i].linestart + lineinfo[i].indentlen,
-                        lineinfo[i].indentedcontentlen))
+                if (state->plaintextnocode) {
+                    i += 1;
+                    continue;
+                }
+                // Escaped just like the code lines that follow:
+                if (!INSESC(_S3D_MD_LINESTART(lineinfo, i) +
+                        _S3D_MD_LINEINDENT(lineinfo, i),
+                        _S3D_MD_LINECONTENTLEN(lineinfo, i), 0))
                     goto errorquit;
                 if (!INS("\n"))
                     goto errorquit;
                 i += 1;
                 continue;
-            } else if (lineinfo[i].indentedcontentlen >= 3 &&
-                    lineinfo[i].linestart[
-                    lineinfo[i].indentlen] == '`' &&
-                    lineinfo[i].linestart[
-                    lineinfo[i].indentlen + 1] == '`' &&
-                    lineinfo[i].linestart[
-                    lineinfo[i].indentlen + 2] == '`') {
+            } else if ((lineinfo->flags[i] &
+                    _S3D_MD_LINEFLAG_FENCE) != 0) {
                 // This is a special fenced code block:
-                int baseindent = lineinfo[i].indentlen;
-                int j = lineinfo[i].indentlen + 3;
+                int baseindent = _S3D_MD_LINEINDENT(lineinfo, i);
+                int j = _S3D_MD_LINEINDENT(lineinfo, i) + 3;
                 int ticks = 3;
-                while (j < lineinfo[i].indentedcontentlen &&
-                        lineinfo[i].linestart[j] == '`') {
+                while (j < _S3D_MD_LINEINDENT(lineinfo, i) +
+                        _S3D_MD_LINECONTENTLEN(lineinfo, i) &&
+                        _S3D_MD_LINESTART(lineinfo, i)[j] == '`') {
                     ticks += 1;
                     j += 1;
                 }
                 int langnamelen = (
                     spew3dweb_markdown_GetBacktickByteBufLangPrefixLen(
-                        lineinfo[i].linestart,
-                        lineinfo[i].indentlen +
-                        lineinfo[i].indentedcontentlen, j
+                        _S3D_MD_LINESTART(lineinfo, i),
+                        _S3D_MD_LINEINDENT(lineinfo, i) +
+                        _S3D_MD_LINECONTENTLEN(lineinfo, i), j
                     ));
-                if (!INS("<pre><code"))
+                if (!INSTAG("<pre><code"))
+                    goto errorquit;
+                if (!EVENTENTER(S3DW_MD_ELEMENT_CODEBLOCK, 0,
+                        (langnamelen > 0 ?
+                        _S3D_MD_LINESTART(lineinfo, i) + j : NULL),
+                        (langnamelen > 0 ? langnamelen : 0),
+                        _S3D_MD_LINESTART(lineinfo, i),
+                        _S3D_MD_LINEEND(lineinfo, i)))
                     goto errorquit;
-                if (langnamelen > 0) {
+                if (langnamelen > 0 && !plaintext) {
                     if (!INS(" lang='"))
                         goto errorquit;
                     int jend = j + langnamelen;
                     while (j < jend) {
-                        if (lineinfo[i].linestart[j] == '&') {
+                        if (_S3D_MD_LINESTART(lineinfo, i)[j] == '&') {
                             if (!INS("&amp;"))
                                 goto errorquit;
-                        } else if (lineinfo[i].linestart[j] != '\'') {
-                            if (!INSC(lineinfo[i].linestart[j]))
+                        } else if (_S3D_MD_LINESTART(lineinfo, i)[j] != '\'') {
+                            if (!INSC(_S3D_MD_LINESTART(lineinfo, i)[j]))
                                 goto errorquit;
                         }
                         j += 1;
                     }
-                    if (!INS("'>"))
+                    if (!INSTAG("'>"))
                         goto errorquit;
                 } else {
-                    if (!INS(">"))
+                    if (!INSTAG(">"))
                         goto errorquit;
                 }
+                // The following lines are handled at the loop start,
+                // since the code may continue into the next block:
+                state->insidefenceticks = ticks;
+                state->insidefencebaseindent = baseindent;
                 i += 1;
-                while (i < lineinfofill) {
-                    j = lineinfo[i].indentlen;
-                    int _foundticks = 0;
-                    while (j < lineinfo[i].indentlen +
-                            lineinfo[i].indentedcontentlen &&
-                            lineinfo[i].linestart[j] == '`') {
-                        _foundticks += 1;
-                        j += 1;
-                    }
-                    if (_foundticks >= ticks) {
-                        i += 1;
-                        break;
-                    } else {
-                        // Add indent of this line:
-                        int incodeindent = (
-                            lineinfo[i].indentlen -
-                            baseindent);
-                        if (incodeindent < 0)
-                            incodeindent = 0;
-                        if (!INSREP(" ", incodeindent))
-                            goto errorquit;
-                        // Add in the contents of this line:
-                        int endlineidx = -1;
-                        if (!_spew3d_markdown_process_inline_content(
-                                &resultchunk, &resultfill, &resultalloc,
-                                lineinfo, lineinfofill, i, i, 0, -1,
-                                1, 0, options,
-                                &endlineidx))
-                            goto errorquit;
-                        assert(endlineidx == i);
-                        if (!INS("\n"))
-                            goto errorquit;
-                    }
-                    i += 1;
-                }
-                if (!INS("</code></pre>"))
-                    goto errorquit;
                 continue;
             } else if (!enteredlistinthisline && currentlookslikelist) {
                 // Start of a list entry!
                 char bullettype = (
                     (currentlookslikelistnolen > 0 ? '1' :
-                    lineinfo[i].linestart[lineinfo[i].indentlen])
+                    _S3D_MD_LINESTART(lineinfo, i)[
+                        _S3D_MD_LINEINDENT(lineinfo, i)])
                 );
                 currentlinefoundbullet = bullettype;
                 int listbasenesting = (
                     (bullettype == '1' ? (
-                        (lineinfo[i].indentlen / 4) + 1
-                    ) : ((lineinfo[i].indentlen - 2) / 4) + 1)
+                        (_S3D_MD_LINEINDENT(lineinfo, i) / 4) + 1
+                    ) : ((_S3D_MD_LINEINDENT(lineinfo, i) - 2) / 4) + 1)
                 );
                 currentlineindentafterbullet = (
-                    lineinfo[i].indentlen + 2 + (
+                    _S3D_MD_LINEINDENT(lineinfo, i) + 2 + (
                         bullettype == '1' ? 2 : 0));
+                const char *bulletat = (_S3D_MD_LINESTART(lineinfo, i) +
+                    _S3D_MD_LINEINDENT(lineinfo, i));
+                const char *bulletend = _md2html_LineSpot(
+                    lineinfo, i, currentlineindentafterbullet
+                );
                 // Previous code should have descended out of nested lists:
                 assert(nestingsdepth <= listbasenesting);
                 lastnonemptynoncodeindent = (
@@ -1215,127 +2290,149 @@ S3DEXP char *spew3dweb_markdown_ByteBufToHTML(
                     assert(bullettype != 0);
                     nestingstypes[nestingsdepth - 1] = bullettype;
                     if (bullettype == '>') {
-                        if (!INS("<blockquote>"))
+                        if (!INSTAG("<blockquote>"))
+                            goto errorquit;
+                        if (!EVENTENTER(S3DW_MD_ELEMENT_BLOCKQUOTE, 0,
+                                NULL, 0, bulletat, bulletend))
                             goto errorquit;
                     } else if (bullettype == '1') {
-                        if (!INS("<ol start="))
+                        if (!INSTAG("<ol start="))
                             goto errorquit;
                         char startval[16];
                         snprintf(startval, sizeof(startval) - 1,
                             "%d", currentlookslikelistno);
-                        if (!INS(startval))
+                        if (!plaintext && !INSSTR(startval))
+                            goto errorquit;
+                        if (!INSTAG(">"))
                             goto errorquit;
-                        if (!INS(">"))
+                        if (!EVENTENTER(S3DW_MD_ELEMENT_ORDEREDLIST,
+                                currentlookslikelistno, NULL, 0,
+                                bulletat, bulletat))
                             goto errorquit;
                     } else {
-                        if (!INS("<ul>"))
+                        if (!INSTAG("<ul>"))
+                            goto errorquit;
+                        if (!EVENTENTER(S3DW_MD_ELEMENT_LIST, 0, NULL, 0,
+                                bulletat, bulletat))
                             goto errorquit;
                     }
                 }
                 if (bullettype != '>') {
-                    if (!enteredlistinthisline)
-                        if (!INS("</li>"))
+                    if (!enteredlistinthisline) {
+                        if (!INSTAG("</li>"))
+                            goto errorquit;
+                        if (!EVENTLEAVE(S3DW_MD_ELEMENT_LISTITEM,
+                                bulletat, bulletat))
                             goto errorquit;
-                    if (!INS("<li>"))
+                    }
+                    if (!INSTAG("<li>"))
+                        goto errorquit;
+                    if (!EVENTENTER(S3DW_MD_ELEMENT_LISTITEM, 0, NULL, 0,
+                            bulletat, bulletend))
                         goto errorquit;
                 }
-                int oldindentlen = lineinfo[i].indentlen;
+                int oldindentlen = _S3D_MD_LINEINDENT(lineinfo, i);
                 assert(oldindentlen <= currentlineindentafterbullet);
-                lineinfo[i].indentlen = currentlineindentafterbullet;
-                lineinfo[i].indentedcontentlen -= (
-                    currentlineindentafterbullet - oldindentlen
-                );
+                if (!_md2html_SetLineIndent(lineinfo, i,
+                        currentlineindentafterbullet)) {
+                    free(resultchunk);
+                    goto errorquit;
+                }
+                _md2html_ClassifyLine(lineinfo, i);
                 // No i += 1 increase here! We want to process
                 // the line again for list item content:
                 continue;
-            } else if (lineinfo[i].indentedcontentlen >= 3 &&
-                    lineinfo[i].linestart[
-                        lineinfo[i].indentlen] == '#' && (
-                    lineinfo[i].linestart[
-                        lineinfo[i].indentlen + 1] == ' ' ||
-                    lineinfo[i].linestart[
-                        lineinfo[i].indentlen + 2] == '#')) {
+            } else if ((lineinfo->flags[i] &
+                    _S3D_MD_LINEFLAG_HEADING) != 0) {
                 // Check if this is a heading:
                 int headingtype = 1;
-                size_t i2 = lineinfo[i].indentlen + 1;
-                while (i2 < lineinfo[i].indentedcontentlen &&
-                        lineinfo[i].linestart[i2] == '#') {
+                size_t i2 = _S3D_MD_LINEINDENT(lineinfo, i) + 1;
+                while (i2 < _S3D_MD_LINECONTENTLEN(lineinfo, i) &&
+                        _S3D_MD_LINESTART(lineinfo, i)[i2] == '#') {
                     headingtype += 1;
                     i2 += 1;
                 }
                 if (headingtype > 6) headingtype = 6;
-                if (i2 < lineinfo[i].indentlen +
-                        lineinfo[i].indentedcontentlen && (
-                        lineinfo[i].linestart[i2] == ' ' ||
-                        lineinfo[i].linestart[i2] == '\t')) {
-                    while (i2 < lineinfo[i].indentlen +
-                            lineinfo[i].indentedcontentlen && (
-                            lineinfo[i].linestart[i2] == ' ' ||
-                            lineinfo[i].linestart[i2] == '\t')) {
+                if (i2 < _S3D_MD_LINEINDENT(lineinfo, i) +
+                        _S3D_MD_LINECONTENTLEN(lineinfo, i) && (
+                        _S3D_MD_LINESTART(lineinfo, i)[i2] == ' ' ||
+                        _S3D_MD_LINESTART(lineinfo, i)[i2] == '\t')) {
+                    while (i2 < _S3D_MD_LINEINDENT(lineinfo, i) +
+                            _S3D_MD_LINECONTENTLEN(lineinfo, i) && (
+                            _S3D_MD_LINESTART(lineinfo, i)[i2] == ' ' ||
+                            _S3D_MD_LINESTART(lineinfo, i)[i2] == '\t')) {
                         i2 += 1;
                     }
-                    if (i2 < lineinfo[i].indentlen +
-                            lineinfo[i].indentedcontentlen &&
-                            lineinfo[i].linestart[i2] != '#') {
+                    if (i2 < _S3D_MD_LINEINDENT(lineinfo, i) +
+                            _S3D_MD_LINECONTENTLEN(lineinfo, i) &&
+                            _S3D_MD_LINESTART(lineinfo, i)[i2] != '#') {
                         // This is indeed a heading. Process insides:
                         int doanchor = 0;
-                        if (!options->disable_heading_anchors) {
+                        if (!options->disable_heading_anchors &&
+                                (!plaintext || state->eventcallback)) {
                             doanchor = (
                                 !_spew3dweb_markdown_CheckLineHasProperLink(
                                     lineinfo, i, 0
                                 )
                             );
                         }
-                        if (!INS("<h"))
+                        const size_t headingoffset = resultfill;
+                        size_t namestart = 0;
+                        size_t namelen = 0;
+                        if (!INSTAG("<h"))
                             goto errorquit;
-                        if (!INSC('0' + headingtype))
+                        if (!plaintext && !INSC('0' + headingtype))
                             goto errorquit;
-                        if (!INS(">"))
+                        if (!INSTAG(">"))
                             goto errorquit;
-                        if (doanchor) {
-                            char *name = (
-                                spew3dweb_markdown_MarkdownBytesToAnchor(
-                                    lineinfo[i].linestart + i2,
-                                    (lineinfo[i].indentlen +
-                                    lineinfo[i].indentedcontentlen) - i2
-                                ));
-                            if (!name)
-                                goto errorquit;
-                            if (!INS("<a name='")) {
-                                free(name);
-                                goto errorquit;
-                            }
-                            if (!INS(name)) {
-                                free(name);
-                                goto errorquit;
-                            }
-                            if (!INS("' href='#")) {
-                                free(name);
-                                goto errorquit;
-                            }
-                            if (!INS(name)) {
-                                free(name);
-                                goto errorquit;
-                            }
-                            free(name);
-                            if (!INS("'>"))
-                                goto errorquit;
-                        }
+                        if (doanchor && !state->eventcallback &&
+                                !_md2html_InsertHeadingAnchor(
+                                state, &resultchunk, &resultfill,
+                                &resultalloc,
+                                _S3D_MD_LINESTART(lineinfo, i) + i2,
+                                (_S3D_MD_LINEINDENT(lineinfo, i) +
+                                _S3D_MD_LINECONTENTLEN(lineinfo, i)) - i2,
+                                options, &namestart, &namelen))
+                            goto errorquit;
+                        if (state->eventcallback &&
+                                !_md2html_EventEnterHeading(
+                                state, &resultchunk, &resultfill,
+                                headingtype, doanchor,
+                                _S3D_MD_LINESTART(lineinfo, i) + i2,
+                                (_S3D_MD_LINEINDENT(lineinfo, i) +
+                                _S3D_MD_LINECONTENTLEN(lineinfo, i)) - i2,
+                                options, _S3D_MD_LINESTART(lineinfo, i),
+                                _S3D_MD_LINESTART(lineinfo, i) + i2))
+                            goto errorquit;
+                        const size_t textstart = resultfill;
                         int endlineidx = -1;
                         if (!_spew3d_markdown_process_inline_content(
                                 &resultchunk, &resultfill, &resultalloc,
-                                lineinfo, lineinfofill, i, i + 1,
-                                i2, -1, 0, 1, options, &endlineidx))
+                                lineinfo, i, i + 1,
+                                i2, -1, 0, 1, state, options,
+                                &endlineidx))
+                            goto errorquit;
+                        if (state->toc && !_md2html_AddTOCEntry(
+                                state, headingtype, headingoffset,
+                                namestart, namelen, textstart,
+                                resultfill)) {
+                            free(resultchunk);
+                            resultchunk = NULL;
                             goto errorquit;
+                        }
                         if (doanchor) {
-                            if (!INS("</a>"))
+                            if (!INSTAG("</a>"))
                                 goto errorquit;
                         }
-                        if (!INS("</h"))
+                        if (!INSTAG("</h"))
+                            goto errorquit;
+                        if (!plaintext && !INSC('0' + headingtype))
                             goto errorquit;
-                        if (!INSC('0' + headingtype))
+                        if (!INSTAG(">\n"))
                             goto errorquit;
-                        if (!INS(">\n"))
+                        if (!EVENTLEAVE(S3DW_MD_ELEMENT_HEADING,
+                                _S3D_MD_LINEEND(lineinfo, i),
+                                _S3D_MD_LINEEND(lineinfo, i)))
                             goto errorquit;
                         assert(endlineidx == i);
                         i += 1;
@@ -1349,7 +2446,11 @@ S3DEXP char *spew3dweb_markdown_ByteBufToHTML(
                 const int cellcount = potentialtablecells;
                 assert(i + 1 < lineinfofill);
                 assert(cellcount > 0);
-                if (!INS("<table>"))
+                if (!INSTAG("<table>"))
+                    goto errorquit;
+                if (!EVENTENTER(S3DW_MD_ELEMENT_TABLE, 0, NULL, 0,
+                        _S3D_MD_LINESTART(lineinfo, i),
+                        _S3D_MD_LINESTART(lineinfo, i)))
                     goto errorquit;
                 int firstrowidx = i;
                 int mustskipidx = i + 1;
@@ -1361,7 +2462,11 @@ S3DEXP char *spew3dweb_markdown_ByteBufToHTML(
                         i += 1;
                         continue;
                     }
-                    if (!INS("\n<tr>"))
+                    if (!INSTAG("\n<tr>"))
+                        goto errorquit;
+                    if (!EVENTENTER(S3DW_MD_ELEMENT_TABLEROW, 0, NULL, 0,
+                            _S3D_MD_LINESTART(lineinfo, i),
+                            _S3D_MD_LINESTART(lineinfo, i)))
                         goto errorquit;
                     int cellidx = 0;
                     while (cellidx < cellcount) {
@@ -1370,47 +2475,75 @@ S3DEXP char *spew3dweb_markdown_ByteBufToHTML(
                             lineinfo, i, lineinfofill, cellidx + 1,
                             &cell_start, &cell_len
                         );
+                        if (plaintext && !state->eventcallback &&
+                                cellidx > 0 && !INSC(' '))
+                            goto errorquit;
                         if (i == firstrowidx) {
-                            if (!INS("<th>"))
+                            if (!INSTAG("<th>"))
                                 goto errorquit;
                         } else {
-                            if (!INS("<td>"))
+                            if (!INSTAG("<td>"))
                                 goto errorquit;
                         }
+                        const int cellelement = (i == firstrowidx ?
+                            S3DW_MD_ELEMENT_TABLEHEADERCELL :
+                            S3DW_MD_ELEMENT_TABLECELL);
+                        const char *cellat = (
+                            _S3D_MD_LINESTART(lineinfo, i) + cell_start
+                        );
+                        if (!EVENTENTER(cellelement, 0, NULL, 0,
+                                cellat, cellat))
+                            goto errorquit;
                         if (cell_len == 0) {
+                            if (!EVENTLEAVE(cellelement, cellat, cellat))
+                                goto errorquit;
                             cellidx += 1;
                             continue;
                         }
                         int endlineidx;
                         if (!_spew3d_markdown_process_inline_content(
                                 &resultchunk, &resultfill, &resultalloc,
-                                lineinfo, lineinfofill, i, i,
+                                lineinfo, i, i,
                                 cell_start, cell_start + cell_len,
-                                0, 1, options, &endlineidx))
+                                0, 1, state, options, &endlineidx))
                             goto errorquit;
                         assert(endlineidx == i);
                         if (i == firstrowidx) {
-                            if (!INS("</th>"))
+                            if (!INSTAG("</th>"))
                                 goto errorquit;
                         } else {
-                            if (!INS("</td>"))
+                            if (!INSTAG("</td>"))
                                 goto errorquit;
                         }
+                        if (!EVENTLEAVE(cellelement, cellat + cell_len,
+                                cellat + cell_len))
+                            goto errorquit;
                         cellidx += 1;
                     }
-                    if (!INS("</tr>"))
+                    if (!INSTAG("</tr>"))
+                        goto errorquit;
+                    if (!EVENTLEAVE(S3DW_MD_ELEMENT_TABLEROW,
+                            _S3D_MD_LINEEND(lineinfo, i),
+                            _S3D_MD_LINEEND(lineinfo, i)))
                         goto errorquit;
                     i += 1;
                 }
-                if (!INS("\n</table>\n"))
+                if (!INSTAG("\n</table>\n"))
+                    goto errorquit;
+                if (!EVENTLEAVE(S3DW_MD_ELEMENT_TABLE,
+                        _S3D_MD_LINESTART(lineinfo, i),
+                        _S3D_MD_LINESTART(lineinfo, i)))
                     goto errorquit;
                 continue;
             }
         }
-        if (insidecodeindent >= 0) {
+        if (insidecodeindent >= 0 && state->plaintextnocode) {
+            // Code is left out of plain text entirely.
+            assert(i < lineinfofill);
+        } else if (insidecodeindent >= 0) {
             assert(i < lineinfofill);
             // First, handle the indent but relative to the code base:
-            int actualindent = (lineinfo[i].indentlen -
+            int actualindent = (_S3D_MD_LINEINDENT(lineinfo, i) -
                 insidecodeindent);
             if (actualindent < 0)
                 actualindent = 0;
@@ -1420,107 +2553,1759 @@ S3DEXP char *spew3dweb_markdown_ByteBufToHTML(
             int endlineidx = -1;
             if (!_spew3d_markdown_process_inline_content(
                     &resultchunk, &resultfill, &resultalloc,
-                    lineinfo, lineinfofill, i, i + 1, 0, -1,
+                    lineinfo, i, i + 1, 0, -1,
                     1 /* as code, no formatting */,
-                    0, options, &endlineidx))
+                    0, state, options, &endlineidx))
                 goto errorquit;
             if (!INS("\n"))
                 goto errorquit;
         } else if (insidecodeindent < 0 && i < lineinfofill &&
-                lineinfo[i].indentedcontentlen > 0) {
+                _S3D_MD_LINECONTENTLEN(lineinfo, i) > 0) {
             // Add in regular inline content:
-            lastnonemptynoncodeindent = lineinfo[i].indentlen;
+            lastnonemptynoncodeindent = _S3D_MD_LINEINDENT(lineinfo, i);
             int headingtype = (
                 _spew3dweb_markdown_GetLineHeadingUnderlineStrength(
                     lineinfo, lineinfofill, i
                 ));
             int doanchor = 0;
+            const size_t headingoffset = resultfill;
+            size_t namestart = 0;
+            size_t namelen = 0;
             if (headingtype > 0) {
-                if (!options->disable_heading_anchors)
+                if (!options->disable_heading_anchors &&
+                        (!plaintext || state->eventcallback))
                     doanchor = !_spew3dweb_markdown_CheckLineHasProperLink(
                         lineinfo, i, 0
                     );
-                if (!INS("<h"))
+                if (!INSTAG("<h"))
                     goto errorquit;
-                if (!INSC('0' + headingtype))
+                if (!plaintext && !INSC('0' + headingtype))
                     goto errorquit;
-                if (!INS(">"))
+                if (!INSTAG(">"))
+                    goto errorquit;
+                if (doanchor && !state->eventcallback &&
+                        !_md2html_InsertHeadingAnchor(
+                        state, &resultchunk, &resultfill, &resultalloc,
+                        _S3D_MD_LINESTART(lineinfo, i),
+                        (_S3D_MD_LINEINDENT(lineinfo, i) +
+                        _S3D_MD_LINECONTENTLEN(lineinfo, i)),
+                        options, &namestart, &namelen))
+                    goto errorquit;
+                if (state->eventcallback && !_md2html_EventEnterHeading(
+                        state, &resultchunk, &resultfill,
+                        headingtype, doanchor,
+                        _S3D_MD_LINESTART(lineinfo, i),
+                        (_S3D_MD_LINEINDENT(lineinfo, i) +
+                        _S3D_MD_LINECONTENTLEN(lineinfo, i)),
+                        options, _S3D_MD_LINESTART(lineinfo, i),
+                        _S3D_MD_LINESTART(lineinfo, i) +
+                        _S3D_MD_LINEINDENT(lineinfo, i)))
                     goto errorquit;
-                if (doanchor) {
-                    char *name = (
-                        spew3dweb_markdown_MarkdownBytesToAnchor(
-                            lineinfo[i].linestart,
-                            (lineinfo[i].indentlen +
-                            lineinfo[i].indentedcontentlen)
-                        ));
-                    if (!name)
-                        goto errorquit;
-                    if (!INS("<a name='")) {
-                        free(name);
-                        goto errorquit;
-                    }
-                    if (!INS(name)) {
-                        free(name);
-                        goto errorquit;
-                    }
-                    if (!INS("' href='#")) {
-                        free(name);
-                        goto errorquit;
-                    }
-                    if (!INS(name)) {
-                        free(name);
-                        goto errorquit;
-                    }
-                    free(name);
-                    if (!INS("'>"))
-                        goto errorquit;
-                }
             } else {
-                if (!INS("<p>"))
+                if (!INSTAG("<p>"))
+                    goto errorquit;
+                if (!EVENTENTER(S3DW_MD_ELEMENT_PARAGRAPH, 0, NULL, 0,
+                        _S3D_MD_LINESTART(lineinfo, i) +
+                        _S3D_MD_LINEINDENT(lineinfo, i),
+                        _S3D_MD_LINESTART(lineinfo, i) +
+                        _S3D_MD_LINEINDENT(lineinfo, i)))
                     goto errorquit;
             }
+            const size_t textstart = resultfill;
             int endlineidx = -1;
             if (!_spew3d_markdown_process_inline_content(
                     &resultchunk, &resultfill, &resultalloc,
-                    lineinfo, lineinfofill, i, lineinfofill,
+                    lineinfo, i, lineinfofill,
                     0, -1,
-                    0, (headingtype != 0), options,
+                    0, (headingtype != 0), state, options,
                     &endlineidx))
                 goto errorquit;
             if (headingtype != 0) {
                 assert(endlineidx == i);
+                if (state->toc && !_md2html_AddTOCEntry(
+                        state, headingtype, headingoffset,
+                        namestart, namelen, textstart, resultfill)) {
+                    free(resultchunk);
+                    resultchunk = NULL;
+                    goto errorquit;
+                }
                 if (doanchor) {
-                    if (!INS("</a>"))
+                    if (!INSTAG("</a>"))
                         goto errorquit;
                 }
-                if (!INS("</h"))
+                if (!INSTAG("</h"))
                     goto errorquit;
-                if (!INSC('0' + headingtype))
+                if (!plaintext && !INSC('0' + headingtype))
                     goto errorquit;
-                if (!INS(">\n"))
+                if (!INSTAG(">\n"))
+                    goto errorquit;
+                if (!EVENTLEAVE(S3DW_MD_ELEMENT_HEADING,
+                        _S3D_MD_LINESTART(lineinfo, endlineidx + 1),
+                        _S3D_MD_LINEEND(lineinfo, endlineidx + 1)))
                     goto errorquit;
                 i = endlineidx + 2;  // Skip past underline
                 continue;
             } else {
                 i = endlineidx;
-                if (!INS("</p>\n"))
+                if (!INSTAG("</p>\n"))
+                    goto errorquit;
+                if (!EVENTLEAVE(S3DW_MD_ELEMENT_PARAGRAPH,
+                        _S3D_MD_LINEEND(lineinfo, i),
+                        _S3D_MD_LINEEND(lineinfo, i)))
                     goto errorquit;
             }
         }
         i += 1;
     }
-    if (lineinfoheap)
-        free(lineinfo);
-    free(input);
-    resultchunk[resultfill] = '\0';
-    if (out_len) *out_len = resultfill;
-    return resultchunk;
+    state->nestingsdepth = nestingsdepth;
+    state->insidecodeindent = insidecodeindent;
+    state->lastnonemptynoncodeindent = lastnonemptynoncodeindent;
+    *resultchunkptr = resultchunk;
+    *resultfillptr = resultfill;
+    *resultallocptr = resultalloc;
+    return 1;
+}
+
+S3DHID size_t _internal_s3dw_markdown_DecodeEntities(
+        char *out, const char *s, size_t slen
+        ) {
+    // Since an entity is never shorter than what it decodes to,
+    // this never writes ahead of where it reads:
+    size_t fill = 0;
+    size_t i = 0;
+    while (i < slen) {
+        if (s[i] != '&') {
+            const char *amp = memchr(s + i, '&', slen - i);
+            size_t runlen = (amp ? (size_t)(amp - (s + i)) : slen - i);
+            if (out + fill != s + i)
+                memmove(out + fill, s + i, runlen);
+            fill += runlen;
+            i += runlen;
+            continue;
+        }
+        size_t end = i + 1;
+        while (end < slen && end < i + 12 && s[end] != ';' &&
+                s[end] != '&')
+            end += 1;
+        if (end >= slen || s[end] != ';') {
+            out[fill] = s[i];
+            fill += 1;
+            i += 1;
+            continue;
+        }
+        const char *ent = s + i + 1;
+        size_t entlen = end - i - 1;
+        uint32_t cp = 0;
+        if (entlen == 2 && memcmp(ent, "lt", 2) == 0) {
+            cp = '<';
+        } else if (entlen == 2 && memcmp(ent, "gt", 2) == 0) {
+            cp = '>';
+        } else if (entlen == 3 && memcmp(ent, "amp", 3) == 0) {
+            cp = '&';
+        } else if (entlen == 4 && memcmp(ent, "quot", 4) == 0) {
+            cp = '"';
+        } else if (entlen == 4 && memcmp(ent, "apos", 4) == 0) {
+            cp = '\'';
+        } else if (entlen >= 2 && ent[0] == '#') {
+            int hex = (ent[1] == 'x' || ent[1] == 'X');
+            size_t k = (hex ? 2 : 1);
+            if (k >= entlen)
+                cp = 0;
+            while (k < entlen && cp <= 0x10FFFF) {
+                char c = ent[k];
+                int digit = -1;
+                if (c >= '0' && c <= '9')
+                    digit = c - '0';
+                else if (hex && c >= 'a' && c <= 'f')
+                    digit = c - 'a' + 10;
+                else if (hex && c >= 'A' && c <= 'F')
+                    digit = c - 'A' + 10;
+                if (digit < 0) {
+                    cp = 0;
+                    break;
+                }
+                cp = cp * (hex ? 16 : 10) + (uint32_t)digit;
+                k += 1;
+            }
+            if (cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF))
+                cp = 0;
+        }
+        if (cp == 0) {
+            // Not one we know, so leave it as it is:
+            memmove(out + fill, s + i, end + 1 - i);
+            fill += end + 1 - i;
+        } else if (cp < 0x80) {
+            out[fill] = (char)cp;
+            fill += 1;
+        } else if (cp < 0x800) {
+            out[fill] = (char)(0xC0 | (cp >> 6));
+            out[fill + 1] = (char)(0x80 | (cp & 0x3F));
+            fill += 2;
+        } else if (cp < 0x10000) {
+            out[fill] = (char)(0xE0 | (cp >> 12));
+            out[fill + 1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+            out[fill + 2] = (char)(0x80 | (cp & 0x3F));
+            fill += 3;
+        } else {
+            out[fill] = (char)(0xF0 | (cp >> 18));
+            out[fill + 1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+            out[fill + 2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+            out[fill + 3] = (char)(0x80 | (cp & 0x3F));
+            fill += 4;
+        }
+        i = end + 1;
+    }
+    return fill;
+}
+
+S3DHID uint64_t _internal_s3dw_markdown_Hash64(
+        const char *bytes, size_t len, uint64_t seed
+        ) {
+    // A simple multiply and shift mix over 8 bytes at a time, which
+    // is much faster than rendering:
+    const uint64_t m = 0x9E3779B97F4A7C15ULL;
+    uint64_t h = seed ^ ((uint64_t)len * m);
+    size_t i = 0;
+    while (i + 8 <= len) {
+        uint64_t v;
+        memcpy(&v, bytes + i, 8);
+        h = (h ^ v) * m;
+        h ^= h >> 29;
+        i += 8;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, bytes + i, len - i);
+    h = (h ^ tail) * m;
+    h ^= h >> 32;
+    h *= m;
+    h ^= h >> 29;
+    return h;
+}
+
+S3DHID uint64_t _internal_s3dw_markdown_OptionsSeed(
+        const s3dw_markdown_tohtmloptions *options
+        ) {
+    uint64_t seed = (
+        (options->block_unsafe_html != 0) |
+        ((options->disable_heading_anchors != 0) << 1) |
+        ((options->externallinks_no_target_blank != 0) << 2) |
+        ((options->externallinks_no_rel_noopener != 0) << 3) |
+        ((options->unique_heading_anchors != 0) << 4)
+    );
+    if (options->uritransform_callback)
+        seed ^= (uint64_t)(uintptr_t)options->uritransform_callback;
+    if (options->uritransform_batch_callback)
+        seed ^= (uint64_t)(uintptr_t)(
+            options->uritransform_batch_callback) << 3;
+    seed ^= (uint64_t)(uintptr_t)(
+        options->uritransform_callback_userdata) << 7;
+    return seed;
+}
+
+S3DHID int _internal_s3dw_markdown_OptionsEqual(
+        const s3dw_markdown_tohtmloptions *a,
+        const s3dw_markdown_tohtmloptions *b
+        ) {
+    return ((a->block_unsafe_html != 0) == (b->block_unsafe_html != 0) &&
+        (a->disable_heading_anchors != 0) ==
+            (b->disable_heading_anchors != 0) &&
+        (a->externallinks_no_target_blank != 0) ==
+            (b->externallinks_no_target_blank != 0) &&
+        (a->externallinks_no_rel_noopener != 0) ==
+            (b->externallinks_no_rel_noopener != 0) &&
+        (a->unique_heading_anchors != 0) ==
+            (b->unique_heading_anchors != 0) &&
+        a->uritransform_callback == b->uritransform_callback &&
+        a->uritransform_batch_callback ==
+            b->uritransform_batch_callback &&
+        a->uritransform_callback_userdata ==
+            b->uritransform_callback_userdata);
+}
+
+// Everything needed to continue cleaning and rendering where an
+// earlier block stopped. (Don't move it once initialized, since
+// the line info may point into the struct itself.)
+typedef struct _md2html_stream {
+    _markdown_cleanstate cleanstate;
+    _md2html_renderstate renderstate;
+    size_t blockstart;
+} _md2html_stream;
+
+/// If opt_uribatch is given, URIs are looked up in there rather than
+/// passed to the options' uritransform_callback.
+static void _md2html_InitStream(
+        _md2html_stream *stream, s3dw_markdown_tohtmloptions *options,
+        _markdown_uribatch *opt_uribatch
+        ) {
+    _internal_spew3dweb_markdown_InitCleanState(
+        &stream->cleanstate, 1, 1, !options->block_unsafe_html, 1,
+        (opt_uribatch ? _internal_s3dw_markdown_UriBatchLookup :
+            options->uritransform_callback),
+        (opt_uribatch ? (void *)opt_uribatch :
+            options->uritransform_callback_userdata)
+    );
+    stream->cleanstate.uritransformborrowed = (opt_uribatch != NULL);
+    memset(&stream->renderstate, 0, sizeof(stream->renderstate));
+    _md2html_InitLineInfo(&stream->renderstate);
+    stream->renderstate.insidecodeindent = -1;
+    stream->blockstart = 0;
+}
+
+static void _md2html_FreeStream(_md2html_stream *stream) {
+    _md2html_FreeLineInfo(&stream->renderstate);
+    free(stream->renderstate.anchorslots);
+    stream->renderstate.anchorslots = NULL;
+    stream->renderstate.anchorslotalloc = 0;
+    stream->renderstate.anchorcount = 0;
+    free(stream->renderstate.eventstack);
+    stream->renderstate.eventstack = NULL;
+    stream->renderstate.eventstackalloc = 0;
+    stream->renderstate.eventdepth = 0;
+    free(stream->renderstate.eventscratch);
+    stream->renderstate.eventscratch = NULL;
+    stream->renderstate.eventscratchalloc = 0;
+    free(stream->cleanstate.resultchunk);
+    stream->cleanstate.resultchunk = NULL;
+    stream->cleanstate.resultfill = 0;
+    stream->cleanstate.resultalloc = 0;
+    free(stream->cleanstate.posmap);
+    stream->cleanstate.posmap = NULL;
+    stream->cleanstate.posmapfill = 0;
+    stream->cleanstate.posmapalloc = 0;
+}
+
+/// How much output to allocate for rendering inputlen bytes at once.
+/// If it's handed off per block, only about a block ever needs to fit.
+static size_t _md2html_PredictOutputSize(
+        _md2html_stream *stream, size_t inputlen, int handedoffperblock
+        ) {
+    if (handedoffperblock && inputlen > _S3D_MD_CLEAN_BLOCK_SIZE * 2)
+        inputlen = _S3D_MD_CLEAN_BLOCK_SIZE * 2;
+    return _internal_s3dw_markdown_predictbufsize(
+        inputlen, (stream->renderstate.plaintext ?
+        _S3D_MD_TEXT_EXPANSION_PERCENT : _S3D_MD_HTML_EXPANSION_PERCENT)
+    );
+}
+
+/// Clean and render the input from *inputpos on, appending to the
+/// result buffer. If pauseatinputpos is non-zero, this stops at the
+/// first safe pause point at or after it rather than at the end.
+/// Returns 0 on error, and the result buffer is gone then.
+static int _md2html_RenderStream(
+        _md2html_stream *stream,
+        const char *uncleaninput, size_t uncleaninputlen,
+        size_t *inputpos, size_t pauseatinputpos,
+        s3dw_markdown_tohtmloptions *options,
+        char **resultchunkptr, size_t *resultfillptr,
+        size_t *resultallocptr,
+        int (*opt_write_func)(
+            const char *buff, size_t amount, void *userdata
+        ),
+        void *opt_write_userdata
+        ) {
+    _markdown_cleanstate *cleanstate = &stream->cleanstate;
+
+    // Allocate about what we'll need up front, rather than growing
+    // bit by bit:
+    size_t expectlen = uncleaninputlen - *inputpos;
+    if (pauseatinputpos > *inputpos &&
+            pauseatinputpos - *inputpos < expectlen)
+        expectlen = pauseatinputpos - *inputpos;
+    size_t blockexpectlen = expectlen;
+    if (blockexpectlen > _S3D_MD_CLEAN_BLOCK_SIZE * 2)
+        blockexpectlen = _S3D_MD_CLEAN_BLOCK_SIZE * 2;
+    if (!_internal_s3dw_markdown_ensurebufsize(
+            &cleanstate->resultchunk, &cleanstate->resultalloc,
+            cleanstate->resultfill + _internal_s3dw_markdown_predictbufsize(
+                blockexpectlen, _S3D_MD_CLEAN_EXPANSION_PERCENT))) {
+        cleanstate->resultchunk = NULL;
+        cleanstate->resultalloc = 0;
+        cleanstate->resultfill = 0;
+        free(*resultchunkptr);
+        *resultchunkptr = NULL;
+        return 0;
+    }
+    if (!_internal_s3dw_markdown_ensurebufsize(
+            resultchunkptr, resultallocptr,
+            *resultfillptr + _md2html_PredictOutputSize(
+                stream, expectlen, opt_write_func != NULL))) {
+        *resultchunkptr = NULL;
+        return 0;
+    }
+
+    while (1) {
+        if (!_internal_spew3dweb_markdown_CleanByteBufPart(
+                cleanstate, uncleaninput, uncleaninputlen,
+                inputpos, stream->blockstart + _S3D_MD_CLEAN_BLOCK_SIZE,
+                pauseatinputpos
+                )) {
+            free(*resultchunkptr);
+            *resultchunkptr = NULL;
+            return 0;
+        }
+        int islastblock = (*inputpos >= uncleaninputlen);
+        cleanstate->resultchunk[cleanstate->resultfill] = '\0';
+        size_t blocklen = cleanstate->resultfill - stream->blockstart;
+        if (!islastblock) {
+            // Leave out the final line break, such that the
+            // last line of the block is the empty one:
+            assert(blocklen > 0 && cleanstate->resultchunk[
+                cleanstate->resultfill - 1] == '\n');
+            blocklen -= 1;
+            cleanstate->resultchunk[cleanstate->resultfill - 1] = '\0';
+        }
+        if (!_md2html_RenderCleanBlock(
+                &stream->renderstate, resultchunkptr, resultfillptr,
+                resultallocptr,
+                cleanstate->resultchunk + stream->blockstart, blocklen,
+                islastblock, options
+                )) {
+            // (It frees the buffer itself on failure, like the
+            // append helpers do.)
+            *resultchunkptr = NULL;
+            return 0;
+        }
+        if (!islastblock)
+            cleanstate->resultchunk[cleanstate->resultfill - 1] = '\n';
+        if (opt_write_func && *resultfillptr > 0) {
+            // Hand off what we got so far, to keep our buffer small:
+            if (!opt_write_func(*resultchunkptr, *resultfillptr,
+                    opt_write_userdata)) {
+                free(*resultchunkptr);
+                *resultchunkptr = NULL;
+                return 0;
+            }
+            stream->renderstate.tocoutputbase += *resultfillptr;
+            *resultfillptr = 0;
+        }
+        if (islastblock)
+            return 1;
+
+        // Drop the rendered part, but keep the last empty line
+        // since the cleaner may look back at the previous line:
+        assert(cleanstate->resultfill >= 2);
+        memmove(cleanstate->resultchunk, cleanstate->resultchunk +
+            cleanstate->resultfill - 2, 2);
+        if (cleanstate->keepposmap) {
+            // (It has one more entry, for where the input stopped.)
+            assert(cleanstate->posmapfill == cleanstate->resultfill);
+            memmove(cleanstate->posmap, cleanstate->posmap +
+                cleanstate->resultfill - 2,
+                sizeof(*cleanstate->posmap) * 3);
+            cleanstate->posmapfill = 2;
+        }
+        cleanstate->resultfill = 2;
+        stream->blockstart = 2;
+        if (pauseatinputpos > 0 && *inputpos >= pauseatinputpos)
+            return 1;
+    }
+}
+
+S3DEXP char *spew3dweb_markdown_ByteBufToText(
+        const char *uncleaninput, size_t uncleaninputlen,
+        s3dw_markdown_tohtmloptions *options, int includecode,
+        size_t *out_len
+        ) {
+    _md2html_stream stream;
+    _md2html_InitStream(&stream, options, NULL);
+    stream.renderstate.plaintext = 1;
+    stream.renderstate.plaintextnocode = !includecode;
+    // No URL ever shows up in the text, so the cleaner can mostly
+    // leave them out rather than escape them:
+    stream.cleanstate.opt_uritransformcallback = NULL;
+    stream.cleanstate.plaintextonly = 1;
+
+    char *resultchunk = NULL;
+    size_t resultfill = 0;
+    size_t resultalloc = 0;
+    size_t inputpos = 0;
+    if (!_internal_s3dw_markdown_ensurebufsize(
+            &resultchunk, &resultalloc, _md2html_PredictOutputSize(
+                &stream, uncleaninputlen, 0)
+            )) {
+        _md2html_FreeStream(&stream);
+        return NULL;
+    }
+    if (!_md2html_RenderStream(
+            &stream, uncleaninput, uncleaninputlen, &inputpos, 0,
+            options, &resultchunk, &resultfill, &resultalloc,
+            NULL, NULL
+            )) {
+        _md2html_FreeStream(&stream);
+        return NULL;
+    }
+    _md2html_FreeStream(&stream);
+    resultchunk[resultfill] = '\0';
+    if (out_len) *out_len = resultfill;
+    return resultchunk;
+}
+
+S3DEXP int spew3dweb_markdown_ByteBufToEvents(
+        const char *uncleaninput, size_t uncleaninputlen,
+        s3dw_markdown_tohtmloptions *options,
+        int (*event_callback)(
+            const s3dw_markdown_event *event, void *userdata
+        ),
+        void *userdata
+        ) {
+    _md2html_stream stream;
+    _md2html_InitStream(&stream, options, NULL);
+    // Text is gathered like for plain text, and goes out as a text
+    // event whenever an element is entered or left:
+    stream.renderstate.plaintext = 1;
+    stream.renderstate.eventcallback = event_callback;
+    stream.renderstate.eventuserdata = userdata;
+    stream.renderstate.eventclean = &stream.cleanstate;
+    stream.cleanstate.keepposmap = 1;
+
+    char *resultchunk = NULL;
+    size_t resultfill = 0;
+    size_t resultalloc = 0;
+    size_t inputpos = 0;
+    if (!_md2html_RenderStream(
+            &stream, uncleaninput, uncleaninputlen, &inputpos, 0,
+            options, &resultchunk, &resultfill, &resultalloc,
+            NULL, NULL
+            ) || !_md2html_EventLeaveTo(
+            &stream.renderstate, &resultchunk, &resultfill, 0,
+            NULL, NULL
+            )) {
+        _md2html_FreeStream(&stream);
+        return 0;
+    }
+    _md2html_FreeStream(&stream);
+    free(resultchunk);
+    return 1;
+}
+
+/// Write all that affects how a paused stream continues, which is
+/// everything but the buffers and options, to a flat array. Streams
+/// that continue the same way always give the same array.
+static void _md2html_SaveStreamState(
+        const _md2html_stream *stream, int32_t *out
+        ) {
+    const _markdown_cleanstate *c = &stream->cleanstate;
+    const _md2html_renderstate *r = &stream->renderstate;
+    memset(out, 0, sizeof(*out) * _S3D_MD_STREAMSTATE_INTS);
+    assert(c->resultfill <= 2 && stream->blockstart <= 2);
+    int32_t *w = out;
+    *(w++) = (int32_t)c->resultfill;
+    *(w++) = (c->resultfill > 0 ? c->resultchunk[0] : 0);
+    *(w++) = (c->resultfill > 1 ? c->resultchunk[1] : 0);
+    *(w++) = (int32_t)stream->blockstart;
+    *(w++) = c->currentlineisblockinterruptor;
+    *(w++) = c->in_list_logical_nesting_depth;
+    *(w++) = c->currentlinehadlistbullet;
+    *(w++) = c->currentlineeffectiveindent;
+    *(w++) = c->currentlineorigindent;
+    *(w++) = c->currentlinehadnonwhitespace;
+    *(w++) = c->currentlinehadnonwhitespaceotherthanbullet;
+    *(w++) = c->currentlineiscode;
+    *(w++) = c->lastnonemptylineeffectiveindent;
+    *(w++) = c->lastnonemptylineorigindent;
+    *(w++) = c->lastnonemptylinewascode;
+    *(w++) = c->lastlinewasemptyorblockinterruptor;
+    *(w++) = c->lastlinehadlistbullet;
+    *(w++) = r->nestingsdepth;
+    *(w++) = r->insidecodeindent;
+    *(w++) = r->lastnonemptynoncodeindent;
+    *(w++) = r->insidefenceticks;
+    *(w++) = r->insidefencebaseindent;
+    // Entries past the current depth are never read, so leave
+    // them out for the comparisons:
+    int i = 0;
+    while (i < _S3D_MD_MAX_LIST_NESTING) {
+        if (i < c->in_list_logical_nesting_depth) {
+            w[i * 2] = c->in_list_with_orig_indent[i];
+            w[i * 2 + 1] = c->in_list_with_orig_bullet_indent[i];
+        }
+        if (i < r->nestingsdepth)
+            w[_S3D_MD_MAX_LIST_NESTING * 2 + i] = r->nestingstypes[i];
+        i += 1;
+    }
+    assert(w + _S3D_MD_MAX_LIST_NESTING * 3 ==
+        out + _S3D_MD_STREAMSTATE_INTS);
+}
+
+/// Put a stream into a state written by _md2html_SaveStreamState(),
+/// keeping its buffers. Returns 0 on allocation failure.
+static int _md2html_LoadStreamState(
+        _md2html_stream *stream, const int32_t *state
+        ) {
+    _markdown_cleanstate *c = &stream->cleanstate;
+    _md2html_renderstate *r = &stream->renderstate;
+    if (!_internal_s3dw_markdown_ensurebufsize(
+            &c->resultchunk, &c->resultalloc, 3
+            )) {
+        c->resultchunk = NULL;
+        c->resultalloc = 0;
+        c->resultfill = 0;
+        return 0;
+    }
+    const int32_t *rd = state;
+    c->resultfill = (size_t)*(rd++);
+    c->resultchunk[0] = (char)*(rd++);
+    c->resultchunk[1] = (char)*(rd++);
+    stream->blockstart = (size_t)*(rd++);
+    c->currentlineisblockinterruptor = *(rd++);
+    c->in_list_logical_nesting_depth = *(rd++);
+    c->currentlinehadlistbullet = *(rd++);
+    c->currentlineeffectiveindent = *(rd++);
+    c->currentlineorigindent = *(rd++);
+    c->currentlinehadnonwhitespace = *(rd++);
+    c->currentlinehadnonwhitespaceotherthanbullet = *(rd++);
+    c->currentlineiscode = *(rd++);
+    c->lastnonemptylineeffectiveindent = *(rd++);
+    c->lastnonemptylineorigindent = *(rd++);
+    c->lastnonemptylinewascode = *(rd++);
+    c->lastlinewasemptyorblockinterruptor = *(rd++);
+    c->lastlinehadlistbullet = *(rd++);
+    r->nestingsdepth = *(rd++);
+    r->insidecodeindent = *(rd++);
+    r->lastnonemptynoncodeindent = *(rd++);
+    r->insidefenceticks = *(rd++);
+    r->insidefencebaseindent = *(rd++);
+    int i = 0;
+    while (i < _S3D_MD_MAX_LIST_NESTING) {
+        c->in_list_with_orig_indent[i] = rd[i * 2];
+        c->in_list_with_orig_bullet_indent[i] = rd[i * 2 + 1];
+        r->nestingstypes[i] = rd[_S3D_MD_MAX_LIST_NESTING * 2 + i];
+        i += 1;
+    }
+    return 1;
+}
+
+static size_t _md2html_FindBlockSplit(
+        const char *input, size_t inputlen, size_t start, size_t minpos
+        ) {
+    // Same rules as the chunk splitter in spew3dweb_markdown_clean.c:
+    // a blank line outside of ``` that is followed by a line that
+    // isn't indented. Returns where that line starts, or inputlen.
+    // Lines that look like they're inside a list or quote aren't
+    // used before a split, since the next piece won't start in a
+    // plain state then and needs to be rendered again.
+    unsigned int inside_backticks_of_len = 0;
+    size_t linestart = start;
+    size_t k = start;
+    while (k < inputlen) {
+        if (input[k] == '\n' || input[k] == '\r') {
+            char c = input[linestart];
+            int plainline = (
+                linestart < k && c != ' ' && c != '\t' &&
+                c != '-' && c != '*' && c != '+' && c != '>' &&
+                (c < '0' || c > '9')
+            );
+            linestart = k + 1;
+            if (k < minpos || inside_backticks_of_len != 0 ||
+                    !plainline) {
+                k += 1;
+                continue;
+            }
+            int isblank = (
+                (input[k] == '\r' && k + 1 < inputlen &&
+                input[k + 1] == '\r') ||
+                (input[k] == '\n' && k + 1 < inputlen &&
+                input[k + 1] == '\n') ||
+                (input[k] == '\r' && k + 3 < inputlen &&
+                input[k + 1] == '\n' && input[k + 2] == '\r' &&
+                input[k + 3] == '\n'));
+            if (isblank) {
+                size_t j = k;
+                while (j < inputlen &&
+                        (input[j] == '\r' || input[j] == '\n'))
+                    j += 1;
+                if (j < inputlen && input[j] != ' ' &&
+                        input[j] != '\t')
+                    return j;
+                linestart = j;
+                k = j;
+                continue;
+            }
+            k += 1;
+            continue;
+        }
+        if (input[k] == '`' && k + 2 < inputlen &&
+                input[k + 1] == '`' && input[k + 2] == '`') {
+            unsigned int tickscount = 3;
+            k += 3;
+            while (k < inputlen && input[k] == '`') {
+                k += 1;
+                tickscount += 1;
+            }
+            if (tickscount == inside_backticks_of_len) {
+                inside_backticks_of_len = 0;
+            } else if (inside_backticks_of_len == 0) {
+                inside_backticks_of_len = tickscount;
+            }
+            continue;
+        }
+        k += 1;
+    }
+    return inputlen;
+}
+
+typedef struct _md2html_fragment {
+    uint64_t hash;
+    uint64_t generation;
+    int32_t startstate[_S3D_MD_STREAMSTATE_INTS];
+    int32_t endstate[_S3D_MD_STREAMSTATE_INTS];
+    s3dw_markdown_tohtmloptions options;
+    int islast;
+    const char *source;
+    size_t sourcelen;
+    const char *html;
+    size_t htmllen;
+    struct _md2html_fragment *hashnext;
+} _md2html_fragment;
+
+struct _markdown_fragmentcache {
+    _md2html_fragment **buckets;
+    size_t bucketcount, count;
+    uint64_t generation;
+};
+
+static struct _markdown_fragmentcache *_md2html_NewFragmentCache(void) {
+    struct _markdown_fragmentcache *cache = malloc(sizeof(*cache));
+    if (!cache)
+        return NULL;
+    memset(cache, 0, sizeof(*cache));
+    cache->bucketcount = 64;
+    cache->buckets = malloc(sizeof(*cache->buckets) * cache->bucketcount);
+    if (!cache->buckets) {
+        free(cache);
+        return NULL;
+    }
+    memset(cache->buckets, 0,
+        sizeof(*cache->buckets) * cache->bucketcount);
+    return cache;
+}
+
+static void _md2html_FreeFragmentCache(
+        struct _markdown_fragmentcache *cache
+        ) {
+    if (!cache)
+        return;
+    size_t i = 0;
+    while (i < cache->bucketcount) {
+        _md2html_fragment *fragment = cache->buckets[i];
+        while (fragment) {
+            _md2html_fragment *next = fragment->hashnext;
+            free(fragment);
+            fragment = next;
+        }
+        i += 1;
+    }
+    free(cache->buckets);
+    free(cache);
+}
+
+static _md2html_fragment *_md2html_FindFragment(
+        struct _markdown_fragmentcache *cache, uint64_t hash,
+        const int32_t *startstate, int islast,
+        const s3dw_markdown_tohtmloptions *options,
+        const char *source, size_t sourcelen
+        ) {
+    _md2html_fragment *fragment = cache->buckets[
+        hash & (cache->bucketcount - 1)];
+    while (fragment) {
+        if (fragment->hash == hash && fragment->islast == islast &&
+                fragment->sourcelen == sourcelen &&
+                memcmp(fragment->startstate, startstate,
+                    sizeof(fragment->startstate)) == 0 &&
+                _internal_s3dw_markdown_OptionsEqual(
+                    &fragment->options, options) &&
+                memcmp(fragment->source, source, sourcelen) == 0)
+            return fragment;
+        fragment = fragment->hashnext;
+    }
+    return NULL;
+}
+
+static void _md2html_AddFragment(
+        struct _markdown_fragmentcache *cache, uint64_t hash,
+        const int32_t *startstate, const _md2html_stream *endstream,
+        const s3dw_markdown_tohtmloptions *options,
+        const char *source, size_t sourcelen,
+        const char *html, size_t htmllen
+        ) {
+    if (cache->count >= cache->bucketcount) {
+        size_t newcount = cache->bucketcount * 2;
+        _md2html_fragment **newbuckets = malloc(
+            sizeof(*newbuckets) * newcount);
+        if (newbuckets) {
+            memset(newbuckets, 0, sizeof(*newbuckets) * newcount);
+            size_t i = 0;
+            while (i < cache->bucketcount) {
+                _md2html_fragment *fragment = cache->buckets[i];
+                while (fragment) {
+                    _md2html_fragment *next = fragment->hashnext;
+                    size_t k = fragment->hash & (newcount - 1);
+                    fragment->hashnext = newbuckets[k];
+                    newbuckets[k] = fragment;
+                    fragment = next;
+                }
+                i += 1;
+            }
+            free(cache->buckets);
+            cache->buckets = newbuckets;
+            cache->bucketcount = newcount;
+        }
+    }
+    _md2html_fragment *fragment = malloc(
+        sizeof(*fragment) + sourcelen + htmllen);
+    if (!fragment)
+        return;  // Then we'll just render it again next time.
+    memset(fragment, 0, sizeof(*fragment));
+    fragment->hash = hash;
+    fragment->generation = cache->generation;
+    memcpy(fragment->startstate, startstate,
+        sizeof(fragment->startstate));
+    fragment->islast = (endstream == NULL);
+    if (endstream)
+        _md2html_SaveStreamState(endstream, fragment->endstate);
+    fragment->options = *options;
+    char *copy = (char *)fragment + sizeof(*fragment);
+    memcpy(copy, source, sourcelen);
+    fragment->source = copy;
+    fragment->sourcelen = sourcelen;
+    memcpy(copy + sourcelen, html, htmllen);
+    fragment->html = copy + sourcelen;
+    fragment->htmllen = htmllen;
+    size_t k = hash & (cache->bucketcount - 1);
+    fragment->hashnext = cache->buckets[k];
+    cache->buckets[k] = fragment;
+    cache->count += 1;
+}
+
+static void _md2html_PruneFragments(
+        struct _markdown_fragmentcache *cache
+        ) {
+    // Only keep what the latest revision used:
+    size_t i = 0;
+    while (i < cache->bucketcount) {
+        _md2html_fragment **ptr = &cache->buckets[i];
+        while (*ptr) {
+            _md2html_fragment *fragment = *ptr;
+            if (fragment->generation != cache->generation) {
+                *ptr = fragment->hashnext;
+                free(fragment);
+                cache->count -= 1;
+                continue;
+            }
+            ptr = &fragment->hashnext;
+        }
+        i += 1;
+    }
+}
+
+static int _md2html_RenderStreamWithFragments(
+        s3dw_markdown_renderer *renderer, _md2html_stream *stream,
+        const char *uncleaninput, size_t uncleaninputlen,
+        s3dw_markdown_tohtmloptions *options,
+        char **resultchunkptr, size_t *resultfillptr,
+        size_t *resultallocptr
+        ) {
+    struct _markdown_fragmentcache *cache = renderer->fragmentcache;
+    cache->generation += 1;
+    renderer->fragmentsreused = 0;
+    renderer->fragmentsrendered = 0;
+    const uint64_t optionsseed = _internal_s3dw_markdown_OptionsSeed(
+        options
+    );
+    int32_t startstate[_S3D_MD_STREAMSTATE_INTS];
+    size_t pos = 0;
+    while (pos < uncleaninputlen) {
+        // Each top-level block is looked up by its bytes together
+        // with the state it starts in, e.g. the list nesting:
+        size_t end = _md2html_FindBlockSplit(
+            uncleaninput, uncleaninputlen, pos, pos + 1
+        );
+        int islast = (end >= uncleaninputlen);
+        _md2html_SaveStreamState(stream, startstate);
+        uint64_t hash = _internal_s3dw_markdown_Hash64(
+            uncleaninput + pos, end - pos,
+            _internal_s3dw_markdown_Hash64(
+                (const char *)startstate, sizeof(startstate),
+                optionsseed ^ (uint64_t)islast)
+        );
+        _md2html_fragment *fragment = _md2html_FindFragment(
+            cache, hash, startstate, islast, options,
+            uncleaninput + pos, end - pos
+        );
+        if (fragment) {
+            if (!_internal_s3dw_markdown_bufappend(
+                    resultchunkptr, resultallocptr, resultfillptr,
+                    fragment->html, fragment->htmllen, 1)) {
+                *resultchunkptr = NULL;
+                return 0;
+            }
+            if (!islast && !_md2html_LoadStreamState(
+                    stream, fragment->endstate)) {
+                free(*resultchunkptr);
+                *resultchunkptr = NULL;
+                return 0;
+            }
+            fragment->generation = cache->generation;
+            renderer->fragmentsreused += 1;
+            pos = end;
+            continue;
+        }
+        size_t htmlstart = *resultfillptr;
+        size_t newpos = pos;
+        if (!_md2html_RenderStream(
+                stream, uncleaninput, uncleaninputlen, &newpos,
+                (islast ? 0 : end), options, resultchunkptr,
+                resultfillptr, resultallocptr, NULL, NULL
+                ))
+            return 0;
+        renderer->fragmentsrendered += 1;
+        if (newpos == end) {
+            // (If it went on further, e.g. due to an unclosed HTML
+            // comment, the result isn't just from this block.)
+            _md2html_AddFragment(
+                cache, hash, startstate, (islast ? NULL : stream),
+                options, uncleaninput + pos, end - pos,
+                *resultchunkptr + htmlstart, *resultfillptr - htmlstart
+            );
+        }
+        pos = newpos;
+    }
+    if (uncleaninputlen == 0) {
+        if (!_md2html_RenderStream(
+                stream, uncleaninput, uncleaninputlen, &pos, 0,
+                options, resultchunkptr, resultfillptr,
+                resultallocptr, NULL, NULL
+                ))
+            return 0;
+    }
+    _md2html_PruneFragments(cache);
+    return 1;
+}
+
+/// Take over the renderer's buffers from earlier runs. They're handed
+/// back by _md2html_ReturnRendererBuffers(), and on error they are just
+/// gone. Unless keepanchors is set, the anchors seen so far are reset.
+static void _md2html_TakeRendererBuffers(
+        s3dw_markdown_renderer *renderer, _md2html_stream *stream,
+        char **resultchunkptr, size_t *resultallocptr, int keepanchors
+        ) {
+    stream->cleanstate.resultchunk = renderer->cleanbuf;
+    stream->cleanstate.resultalloc = renderer->cleanbufalloc;
+    renderer->cleanbuf = NULL;
+    renderer->cleanbufalloc = 0;
+    if (renderer->lineinfo.start) {
+        stream->renderstate.lineinfo = renderer->lineinfo;
+        stream->renderstate.lineinfoheap = 1;
+        memset(&renderer->lineinfo, 0, sizeof(renderer->lineinfo));
+    }
+    *resultchunkptr = renderer->resultbuf;
+    *resultallocptr = renderer->resultbufalloc;
+    renderer->resultbuf = NULL;
+    renderer->resultbufalloc = 0;
+    if (renderer->anchorslots) {
+        stream->renderstate.anchorslots = renderer->anchorslots;
+        stream->renderstate.anchorslotalloc = renderer->anchorslotalloc;
+        if (keepanchors)
+            stream->renderstate.anchorcount = renderer->anchorcount;
+        else
+            memset(stream->renderstate.anchorslots, 0,
+                sizeof(*stream->renderstate.anchorslots) *
+                stream->renderstate.anchorslotalloc);
+        renderer->anchorslots = NULL;
+        renderer->anchorslotalloc = 0;
+    }
+    renderer->anchorcount = 0;
+    // (The cleaner grows this one in place, so it's never taken over.)
+    stream->cleanstate.uriscratch = &renderer->uriscratch;
+    stream->cleanstate.uriscratchalloc = &renderer->uriscratchalloc;
+}
+
+/// Hand the buffers back after _md2html_TakeRendererBuffers(), which
+/// must only be done after a successful run.
+static void _md2html_ReturnRendererBuffers(
+        s3dw_markdown_renderer *renderer, _md2html_stream *stream,
+        char *resultchunk, size_t resultalloc
+        ) {
+    _md2html_renderstate *renderstate = &stream->renderstate;
+    free(renderstate->lineinfo.wideindent);
+    renderstate->lineinfo.wideindent = NULL;
+    if (renderstate->lineinfoheap)
+        renderer->lineinfo = renderstate->lineinfo;
+    renderer->cleanbuf = stream->cleanstate.resultchunk;
+    renderer->cleanbufalloc = stream->cleanstate.resultalloc;
+    renderer->resultbuf = resultchunk;
+    renderer->resultbufalloc = resultalloc;
+    renderer->anchorslots = renderstate->anchorslots;
+    renderer->anchorslotalloc = renderstate->anchorslotalloc;
+    renderer->anchorcount = renderstate->anchorcount;
+}
+
+static char *_spew3dweb_markdown_ByteBufToHTMLEx(
+        s3dw_markdown_renderer *opt_renderer,
+        const char *uncleaninput, size_t uncleaninputlen,
+        s3dw_markdown_tohtmloptions *options,
+        s3dw_markdown_toc *opt_toc,
+        int (*opt_write_func)(
+            const char *buff, size_t amount, void *userdata
+        ),
+        void *opt_write_userdata,
+        size_t *out_len
+        ) {
+    // With a batch callback, all URIs are transformed in one go first:
+    _markdown_uribatch uribatch;
+    _markdown_uribatch *opt_uribatch = NULL;
+    if (options->uritransform_batch_callback) {
+        _internal_s3dw_markdown_InitUriBatch(&uribatch, options);
+        opt_uribatch = &uribatch;
+        if (!_internal_s3dw_markdown_FillUriBatch(
+                opt_uribatch, uncleaninput, uncleaninputlen
+                )) {
+            _internal_s3dw_markdown_FreeUriBatch(opt_uribatch);
+            return NULL;
+        }
+    }
+
+    // We clean up the input and render it block by block, such that
+    // we never need a cleaned copy or line info of the entire input:
+    _md2html_stream stream;
+    _md2html_InitStream(&stream, options, opt_uribatch);
+    stream.renderstate.toc = opt_toc;
+
+    char *resultchunk = NULL;
+    size_t resultfill = 0;
+    size_t resultalloc = 0;
+    if (opt_renderer)
+        _md2html_TakeRendererBuffers(
+            opt_renderer, &stream, &resultchunk, &resultalloc, 0
+        );
+    if (!_internal_s3dw_markdown_ensurebufsize(
+            &resultchunk, &resultalloc, _md2html_PredictOutputSize(
+                &stream, uncleaninputlen, opt_write_func != NULL)
+            )) {
+        _md2html_FreeStream(&stream);
+        if (opt_uribatch)
+            _internal_s3dw_markdown_FreeUriBatch(opt_uribatch);
+        return NULL;
+    }
+    size_t inputpos = 0;
+    int success = 0;
+    if (opt_renderer && opt_renderer->fragmentcache &&
+            !options->unique_heading_anchors && !opt_toc) {
+        // (With unique anchors, a block's HTML depends on all the
+        // headings before it, so it can't be reused on its own.)
+        success = _md2html_RenderStreamWithFragments(
+            opt_renderer, &stream, uncleaninput, uncleaninputlen,
+            options, &resultchunk, &resultfill, &resultalloc
+        );
+    } else {
+        if (opt_renderer) {
+            opt_renderer->fragmentsreused = 0;
+            opt_renderer->fragmentsrendered = 0;
+        }
+        success = _md2html_RenderStream(
+            &stream, uncleaninput, uncleaninputlen, &inputpos, 0,
+            options, &resultchunk, &resultfill, &resultalloc,
+            opt_write_func, opt_write_userdata
+        );
+    }
+    if (!success) {
+        _md2html_FreeStream(&stream);
+        if (opt_uribatch)
+            _internal_s3dw_markdown_FreeUriBatch(opt_uribatch);
+        return NULL;
+    }
+    if (opt_uribatch)
+        _internal_s3dw_markdown_FreeUriBatch(opt_uribatch);
+    resultchunk[resultfill] = '\0';
+    if (out_len) *out_len = resultfill;
+    if (opt_renderer) {
+        _md2html_ReturnRendererBuffers(
+            opt_renderer, &stream, resultchunk, resultalloc
+        );
+        return resultchunk;
+    }
+    _md2html_FreeStream(&stream);
+    return resultchunk;
+}
+
+S3DHID const char *_internal_s3dw_markdown_RendererRenderBlock(
+        s3dw_markdown_renderer *renderer,
+        const char *uncleaninput, size_t uncleaninputlen,
+        size_t *inputpos, const int32_t *opt_startstate,
+        int32_t *out_endstate, int keepanchors,
+        s3dw_markdown_tohtmloptions *options, size_t *out_len
+        ) {
+    // Split the same way as the fragment cache does:
+    size_t end = _md2html_FindBlockSplit(
+        uncleaninput, uncleaninputlen, *inputpos, *inputpos + 1
+    );
+    int islast = (end >= uncleaninputlen);
+    _markdown_uribatch uribatch;
+    _markdown_uribatch *opt_uribatch = NULL;
+    if (options->uritransform_batch_callback) {
+        // (If the block runs on past its end, the URIs after it are
+        // just looked up one by one.)
+        _internal_s3dw_markdown_InitUriBatch(&uribatch, options);
+        opt_uribatch = &uribatch;
+        if (!_internal_s3dw_markdown_FillUriBatch(
+                opt_uribatch, uncleaninput + *inputpos, end - *inputpos
+                )) {
+            _internal_s3dw_markdown_FreeUriBatch(opt_uribatch);
+            return NULL;
+        }
+    }
+    _md2html_stream stream;
+    _md2html_InitStream(&stream, options, opt_uribatch);
+    char *resultchunk = NULL;
+    size_t resultfill = 0;
+    size_t resultalloc = 0;
+    _md2html_TakeRendererBuffers(
+        renderer, &stream, &resultchunk, &resultalloc, keepanchors
+    );
+    int success = 1;
+    if (opt_startstate && !_md2html_LoadStreamState(
+            &stream, opt_startstate)) {
+        free(resultchunk);
+        success = 0;
+    }
+    if (success && !_md2html_RenderStream(
+            &stream, uncleaninput, uncleaninputlen, inputpos,
+            (islast ? 0 : end), options, &resultchunk, &resultfill,
+            &resultalloc, NULL, NULL))
+        success = 0;
+    if (opt_uribatch)
+        _internal_s3dw_markdown_FreeUriBatch(opt_uribatch);
+    if (!success) {
+        _md2html_FreeStream(&stream);
+        return NULL;
+    }
+    if (*inputpos < uncleaninputlen)
+        _md2html_SaveStreamState(&stream, out_endstate);
+    resultchunk[resultfill] = '\0';
+    if (out_len) *out_len = resultfill;
+    _md2html_ReturnRendererBuffers(
+        renderer, &stream, resultchunk, resultalloc
+    );
+    return resultchunk;
+}
+
+S3DEXP char *spew3dweb_markdown_ByteBufToHTML(
+        const char *uncleaninput, size_t uncleaninputlen,
+        s3dw_markdown_tohtmloptions *options,
+        size_t *out_len
+        ) {
+    return _spew3dweb_markdown_ByteBufToHTMLEx(
+        NULL, uncleaninput, uncleaninputlen, options,
+        NULL, NULL, NULL, out_len
+    );
+}
+
+S3DEXP char *spew3dweb_markdown_ByteBufToHTMLWithTOC(
+        const char *uncleaninput, size_t uncleaninputlen,
+        s3dw_markdown_tohtmloptions *options,
+        s3dw_markdown_toc *out_toc, size_t *out_len
+        ) {
+    memset(out_toc, 0, sizeof(*out_toc));
+    char *result = _spew3dweb_markdown_ByteBufToHTMLEx(
+        NULL, uncleaninput, uncleaninputlen, options,
+        out_toc, NULL, NULL, out_len
+    );
+    if (!result)
+        spew3dweb_markdown_FreeTOC(out_toc);
+    return result;
+}
+
+S3DEXP void spew3dweb_markdown_FreeTOC(s3dw_markdown_toc *toc) {
+    free(toc->entries);
+    memset(toc, 0, sizeof(*toc));
+}
+
+typedef struct _md2html_workpool {
+    size_t count, next;
+    int workers;
+    void (*runfunc)(void *userdata, int worker, size_t index);
+    void *userdata;
+    #if !defined(SPEW3DWEB_OPTION_DISABLE_THREADS)
+    pthread_mutex_t lock;
+    #endif
+} _md2html_workpool;
+
+typedef struct _md2html_workerinfo {
+    _md2html_workpool *pool;
+    int worker;
+} _md2html_workerinfo;
+
+static int _md2html_ThreadCount(int threads) {
+    #if defined(SPEW3DWEB_OPTION_DISABLE_THREADS)
+    return 1;
+    #else
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (cpus > 0 ? (cpus < 256 ? (int)cpus : 256) : 1);
+    }
+    return threads;
+    #endif
+}
+
+static void *_md2html_PoolWorker(void *userdata) {
+    _md2html_workerinfo *info = userdata;
+    _md2html_workpool *pool = info->pool;
+    while (1) {
+        // Take a run of items at once while there are many left,
+        // and single ones towards the end so everyone finishes
+        // at about the same time:
+        #if !defined(SPEW3DWEB_OPTION_DISABLE_THREADS)
+        pthread_mutex_lock(&pool->lock);
+        #endif
+        size_t first = pool->next;
+        size_t claim = (pool->count - first) / (
+            (size_t)pool->workers * 4);
+        if (claim < 1)
+            claim = 1;
+        if (claim > 64)
+            claim = 64;
+        if (claim > pool->count - first)
+            claim = pool->count - first;
+        pool->next += claim;
+        #if !defined(SPEW3DWEB_OPTION_DISABLE_THREADS)
+        pthread_mutex_unlock(&pool->lock);
+        #endif
+        if (claim == 0)
+            return NULL;
+        size_t i = first;
+        while (i < first + claim) {
+            pool->runfunc(pool->userdata, info->worker, i);
+            i += 1;
+        }
+    }
+}
+
+/// Run runfunc for every index below count, spread over up to the
+/// given number of threads including the calling one. The worker
+/// number passed along is always below threads, and no two threads
+/// use the same one at once.
+static void _md2html_RunOnWorkers(
+        int threads, size_t count,
+        void (*runfunc)(void *userdata, int worker, size_t index),
+        void *userdata
+        ) {
+    if ((size_t)threads > count)
+        threads = (int)count;
+    if (threads < 1)
+        threads = 1;
+    _md2html_workpool pool;
+    memset(&pool, 0, sizeof(pool));
+    pool.count = count;
+    pool.workers = threads;
+    pool.runfunc = runfunc;
+    pool.userdata = userdata;
+    _md2html_workerinfo maininfo;
+    maininfo.pool = &pool;
+    maininfo.worker = 0;
+    #if !defined(SPEW3DWEB_OPTION_DISABLE_THREADS)
+    pthread_t *workers = NULL;
+    _md2html_workerinfo *infos = NULL;
+    int workercount = 0;
+    if (threads > 1 && pthread_mutex_init(&pool.lock, NULL) == 0) {
+        workers = malloc(sizeof(*workers) * (threads - 1));
+        infos = malloc(sizeof(*infos) * (threads - 1));
+        while (workers && infos && workercount < threads - 1) {
+            infos[workercount].pool = &pool;
+            infos[workercount].worker = workercount + 1;
+            if (pthread_create(&workers[workercount], NULL,
+                    _md2html_PoolWorker, &infos[workercount]) != 0)
+                break;  // We'll just do with the ones we have.
+            workercount += 1;
+        }
+        _md2html_PoolWorker(&maininfo);
+        int k = 0;
+        while (k < workercount) {
+            pthread_join(workers[k], NULL);
+            k += 1;
+        }
+        free(workers);
+        free(infos);
+        pthread_mutex_destroy(&pool.lock);
+        return;
+    }
+    #endif
+    _md2html_PoolWorker(&maininfo);
+}
+
+// Pieces for ByteBufToHTMLParallel are at least this long:
+#define _S3D_MD_PARALLEL_MIN_PIECE (64 * 1024)
+
+static int _md2html_PrimeStream(
+        _md2html_stream *stream, s3dw_markdown_tohtmloptions *options
+        ) {
+    // Bring a fresh stream into the state it has after a plain
+    // paragraph and an empty line, which is what most places
+    // after a blank line in real documents end up with:
+    const char prefix[] = "x\n\nx";
+    char *html = NULL;
+    size_t htmlfill = 0;
+    size_t htmlalloc = 0;
+    if (!_internal_s3dw_markdown_ensurebufsize(&html, &htmlalloc, 1))
+        return 0;
+    size_t pos = 0;
+    if (!_md2html_RenderStream(
+            stream, prefix, strlen(prefix), &pos, 3, options,
+            &html, &htmlfill, &htmlalloc, NULL, NULL
+            ))
+        return 0;
+    free(html);
+    assert(pos == 3);
+    return 1;
+}
+
+static int _md2html_SplitFollowsParagraph(
+        const char *input, size_t split
+        ) {
+    // Check that all lines of the paragraph before the blank lines at
+    // a block split are plain, so it's not the continuation of some
+    // list entry or quote. Then the split is at the top level, the
+    // same as after _md2html_PrimeStream():
+    size_t k = split;
+    while (k > 0 && (input[k - 1] == '\n' || input[k - 1] == '\r'))
+        k -= 1;
+    while (1) {
+        size_t linestart = k;
+        while (linestart > 0 && input[linestart - 1] != '\n' &&
+                input[linestart - 1] != '\r')
+            linestart -= 1;
+        if (linestart == k)
+            return 1;
+        char c = input[linestart];
+        if (c == ' ' || c == '\t' || c == '-' || c == '*' ||
+                c == '+' || c == '>' || (c >= '0' && c <= '9'))
+            return 0;
+        if (linestart == 0)
+            return 1;
+        k = linestart - 1;
+        if (input[k] == '\n' && k > 0 && input[k - 1] == '\r')
+            k -= 1;
+    }
+}
+
+typedef struct _md2html_parallelpiece {
+    size_t start, end;
+    _md2html_stream stream;
+    size_t endpos;
+    char *html;
+    size_t htmlfill, htmlalloc;
+    int rendered;
+} _md2html_parallelpiece;
+
+typedef struct _md2html_paralleljob {
+    const char *input;
+    size_t inputlen;
+    s3dw_markdown_tohtmloptions *options;
+    _md2html_parallelpiece *pieces;
+    size_t piececount;
+} _md2html_paralleljob;
+
+static void _md2html_RenderParallelPiece(
+        void *userdata, int worker, size_t index
+        ) {
+    (void)worker;
+    _md2html_paralleljob *job = userdata;
+    _md2html_parallelpiece *piece = &job->pieces[index];
+    if (!_internal_s3dw_markdown_ensurebufsize(
+            &piece->html, &piece->htmlalloc, 1
+            )) {
+        piece->html = NULL;
+        return;
+    }
+    // Every piece but the first one guesses it starts after a
+    // plain paragraph. Whether that was right is checked later:
+    if (index > 0 && !_md2html_PrimeStream(&piece->stream,
+            job->options)) {
+        free(piece->html);
+        piece->html = NULL;
+        return;
+    }
+    size_t pos = piece->start;
+    if (!_md2html_RenderStream(
+            &piece->stream, job->input, job->inputlen, &pos,
+            (index + 1 < job->piececount ? piece->end : 0),
+            job->options, &piece->html, &piece->htmlfill,
+            &piece->htmlalloc, NULL, NULL
+            ))
+        return;
+    piece->endpos = pos;
+    piece->rendered = 1;
+}
+
+S3DHID char *_internal_spew3dweb_markdown_ByteBufToHTMLParallelEx(
+        const char *uncleaninput, size_t uncleaninputlen,
+        s3dw_markdown_tohtmloptions *options, int threads,
+        size_t minpiecelen, size_t *out_len
+        ) {
+    threads = _md2html_ThreadCount(threads);
+    if (minpiecelen < 1)
+        minpiecelen = 1;
+    // (Unique anchors need all earlier headings, so that's serial.)
+    if (threads <= 1 || uncleaninputlen / 2 < minpiecelen ||
+            options->unique_heading_anchors)
+        return spew3dweb_markdown_ByteBufToHTML(
+            uncleaninput, uncleaninputlen, options, out_len
+        );
+
+    // Cut into a few pieces per thread, so it still balances out
+    // if some pieces are slower to render than others:
+    size_t piecemax = (size_t)threads * 4;
+    size_t targetlen = uncleaninputlen / piecemax;
+    if (targetlen < minpiecelen)
+        targetlen = minpiecelen;
+    piecemax = uncleaninputlen / targetlen + 1;
+    // With a batch callback, all URIs are transformed once up front
+    // and the pieces only look them up:
+    _markdown_uribatch uribatch;
+    _markdown_uribatch *opt_uribatch = NULL;
+    if (options->uritransform_batch_callback) {
+        _internal_s3dw_markdown_InitUriBatch(&uribatch, options);
+        opt_uribatch = &uribatch;
+    }
+    _md2html_paralleljob job;
+    memset(&job, 0, sizeof(job));
+    job.input = uncleaninput;
+    job.inputlen = uncleaninputlen;
+    job.options = options;
+    job.pieces = malloc(sizeof(*job.pieces) * piecemax);
+    if (!job.pieces)
+        return NULL;
+    size_t pos = 0;
+    while (pos < uncleaninputlen && job.piececount < piecemax) {
+        _md2html_parallelpiece *piece = &job.pieces[job.piececount];
+        memset(piece, 0, sizeof(*piece));
+        piece->start = pos;
+        piece->end = _md2html_FindBlockSplit(
+            uncleaninput, uncleaninputlen, pos, pos + targetlen
+        );
+        // Pieces are rendered guessing they start at the top level,
+        // and starting deep inside a list from there goes wrong:
+        while (piece->end < uncleaninputlen &&
+                !_md2html_SplitFollowsParagraph(uncleaninput,
+                    piece->end))
+            piece->end = _md2html_FindBlockSplit(
+                uncleaninput, uncleaninputlen, piece->end,
+                piece->end + 1
+            );
+        if (job.piececount + 1 >= piecemax)
+            piece->end = uncleaninputlen;
+        _md2html_InitStream(&piece->stream, options, opt_uribatch);
+        job.piececount += 1;
+        pos = piece->end;
+    }
+    if (job.piececount <= 1) {
+        if (job.piececount == 1)
+            _md2html_FreeStream(&job.pieces[0].stream);
+        free(job.pieces);
+        return spew3dweb_markdown_ByteBufToHTML(
+            uncleaninput, uncleaninputlen, options, out_len
+        );
+    }
+    if (opt_uribatch && !_internal_s3dw_markdown_FillUriBatch(
+            opt_uribatch, uncleaninput, uncleaninputlen
+            )) {
+        size_t i = 0;
+        while (i < job.piececount) {
+            _md2html_FreeStream(&job.pieces[i].stream);
+            i += 1;
+        }
+        free(job.pieces);
+        _internal_s3dw_markdown_FreeUriBatch(opt_uribatch);
+        return NULL;
+    }
+    _md2html_RunOnWorkers(
+        threads, job.piececount, _md2html_RenderParallelPiece, &job
+    );
+
+    // Stitch the pieces together in order. Where a piece didn't
+    // really start in the state it guessed, e.g. if it followed an
+    // unfinished list or code block, it's rendered again right here
+    // continuing from the actual state:
+    _md2html_stream primed;
+    _md2html_InitStream(&primed, options, opt_uribatch);
+    int32_t primedstate[_S3D_MD_STREAMSTATE_INTS];
+    int32_t currentstate[_S3D_MD_STREAMSTATE_INTS];
+    char *resultchunk = NULL;
+    size_t resultfill = 0;
+    size_t resultalloc = 0;
+    int success = (
+        _md2html_PrimeStream(&primed, options) &&
+        _internal_s3dw_markdown_ensurebufsize(
+            &resultchunk, &resultalloc, 1)
+    );
+    if (!success)
+        resultchunk = NULL;
+    else
+        _md2html_SaveStreamState(&primed, primedstate);
+    _md2html_stream *current = NULL;
+    size_t currentpos = 0;
+    size_t i = 0;
+    while (success && i < job.piececount &&
+            currentpos < uncleaninputlen) {
+        _md2html_parallelpiece *piece = &job.pieces[i];
+        int islastpiece = (i + 1 >= job.piececount);
+        if (i > 0)
+            _md2html_SaveStreamState(current, currentstate);
+        if (piece->rendered && currentpos == piece->start &&
+                (i == 0 || memcmp(currentstate, primedstate,
+                    sizeof(currentstate)) == 0)) {
+            if (!_internal_s3dw_markdown_bufappend(
+                    &resultchunk, &resultalloc, &resultfill,
+                    piece->html, piece->htmlfill, 1)) {
+                resultchunk = NULL;
+                success = 0;
+                break;
+            }
+            current = &piece->stream;
+            currentpos = piece->endpos;
+            i += 1;
+            continue;
+        }
+        if (current == NULL) {
+            // The first piece failed, so start over from scratch:
+            _md2html_FreeStream(&piece->stream);
+            _md2html_InitStream(&piece->stream, options, opt_uribatch);
+            current = &piece->stream;
+        }
+        if (currentpos < piece->end || islastpiece) {
+            if (!_md2html_RenderStream(
+                    current, uncleaninput, uncleaninputlen,
+                    &currentpos, (islastpiece ? 0 : piece->end),
+                    options, &resultchunk, &resultfill, &resultalloc,
+                    NULL, NULL
+                    )) {
+                success = 0;
+                break;
+            }
+        }
+        i += 1;
+    }
+    _md2html_FreeStream(&primed);
+    i = 0;
+    while (i < job.piececount) {
+        _md2html_FreeStream(&job.pieces[i].stream);
+        free(job.pieces[i].html);
+        i += 1;
+    }
+    free(job.pieces);
+    if (opt_uribatch)
+        _internal_s3dw_markdown_FreeUriBatch(opt_uribatch);
+    if (!success) {
+        free(resultchunk);
+        return NULL;
+    }
+    resultchunk[resultfill] = '\0';
+    if (out_len) *out_len = resultfill;
+    return resultchunk;
+}
+
+S3DEXP char *spew3dweb_markdown_ByteBufToHTMLParallel(
+        const char *uncleaninput, size_t uncleaninputlen,
+        s3dw_markdown_tohtmloptions *options, int threads,
+        size_t *out_len
+        ) {
+    return _internal_spew3dweb_markdown_ByteBufToHTMLParallelEx(
+        uncleaninput, uncleaninputlen, options, threads,
+        _S3D_MD_PARALLEL_MIN_PIECE, out_len
+    );
+}
+
+typedef struct _md2html_batchjob {
+    const char **inputs;
+    const size_t *inputlens;
+    s3dw_markdown_tohtmloptions *options;
+    s3dw_markdown_renderer **renderers;
+    char **results;
+    size_t *resultlens;
+} _md2html_batchjob;
+
+static void _md2html_RenderBatchItem(
+        void *userdata, int worker, size_t index
+        ) {
+    _md2html_batchjob *job = userdata;
+    // Each worker keeps its own renderer, so the buffers it grew
+    // for one input are reused for all the next ones:
+    if (!job->renderers[worker]) {
+        job->renderers[worker] = spew3dweb_markdown_NewRenderer();
+        if (!job->renderers[worker])
+            return;
+    }
+    const char *input = job->inputs[index];
+    size_t inputlen = (job->inputlens ? job->inputlens[index] :
+        strlen(input));
+    size_t htmllen = 0;
+    const char *html = spew3dweb_markdown_RendererByteBufToHTML(
+        job->renderers[worker], input, inputlen, job->options,
+        &htmllen
+    );
+    if (!html)
+        return;
+    char *result = malloc(htmllen + 1);
+    if (!result)
+        return;
+    memcpy(result, html, htmllen + 1);
+    job->results[index] = result;
+    job->resultlens[index] = htmllen;
+}
+
+S3DEXP int spew3dweb_markdown_ByteBufsToHTML(
+        const char **markdownbytes, const size_t *markdownbyteslens,
+        size_t count, s3dw_markdown_tohtmloptions *options,
+        int threads, char **out_results, size_t *out_lens
+        ) {
+    size_t i = 0;
+    while (i < count) {
+        out_results[i] = NULL;
+        i += 1;
+    }
+    if (count == 0)
+        return 1;
+    threads = _md2html_ThreadCount(threads);
+    if ((size_t)threads > count)
+        threads = (int)count;
+    _md2html_batchjob job;
+    memset(&job, 0, sizeof(job));
+    job.inputs = markdownbytes;
+    job.inputlens = markdownbyteslens;
+    job.options = options;
+    job.results = out_results;
+    job.resultlens = out_lens;
+    if (!job.resultlens)
+        job.resultlens = malloc(sizeof(*job.resultlens) * count);
+    job.renderers = malloc(sizeof(*job.renderers) * threads);
+    if (!job.resultlens || !job.renderers) {
+        if (job.resultlens != out_lens)
+            free(job.resultlens);
+        free(job.renderers);
+        return 0;
+    }
+    memset(job.renderers, 0, sizeof(*job.renderers) * threads);
+    _md2html_RunOnWorkers(
+        threads, count, _md2html_RenderBatchItem, &job
+    );
+    int k = 0;
+    while (k < threads) {
+        spew3dweb_markdown_FreeRenderer(job.renderers[k]);
+        k += 1;
+    }
+    free(job.renderers);
+    if (job.resultlens != out_lens)
+        free(job.resultlens);
+    int success = 1;
+    i = 0;
+    while (i < count) {
+        if (!out_results[i])
+            success = 0;
+        i += 1;
+    }
+    if (success)
+        return 1;
+    i = 0;
+    while (i < count) {
+        free(out_results[i]);
+        out_results[i] = NULL;
+        i += 1;
+    }
+    return 0;
+}
+
+S3DEXP int spew3dweb_markdown_ByteBufToHTMLCustomIO(
+        const char *uncleaninput, size_t uncleaninputlen,
+        s3dw_markdown_tohtmloptions *options,
+        int (*write_func)(
+            const char *buff, size_t amount, void *userdata
+        ),
+        void *userdata
+        ) {
+    char *result = _spew3dweb_markdown_ByteBufToHTMLEx(
+        NULL, uncleaninput, uncleaninputlen, options,
+        NULL, write_func, userdata, NULL
+    );
+    if (!result)
+        return 0;
+    free(result);
+    return 1;
+}
+
+S3DEXP s3dw_markdown_renderer *spew3dweb_markdown_NewRenderer(void) {
+    s3dw_markdown_renderer *renderer = malloc(sizeof(*renderer));
+    if (!renderer)
+        return NULL;
+    memset(renderer, 0, sizeof(*renderer));
+    return renderer;
+}
+
+S3DEXP void spew3dweb_markdown_FreeRenderer(
+        s3dw_markdown_renderer *renderer
+        ) {
+    if (!renderer)
+        return;
+    free(renderer->cleanbuf);
+    free(renderer->lineinfo.start);
+    free(renderer->resultbuf);
+    free(renderer->anchorslots);
+    free(renderer->uriscratch);
+    _md2html_FreeFragmentCache(renderer->fragmentcache);
+    free(renderer);
+}
+
+S3DEXP int spew3dweb_markdown_RendererEnableFragmentCache(
+        s3dw_markdown_renderer *renderer, int enable
+        ) {
+    if (!enable) {
+        _md2html_FreeFragmentCache(renderer->fragmentcache);
+        renderer->fragmentcache = NULL;
+        return 1;
+    }
+    if (!renderer->fragmentcache)
+        renderer->fragmentcache = _md2html_NewFragmentCache();
+    return (renderer->fragmentcache != NULL);
+}
+
+S3DEXP const char *spew3dweb_markdown_RendererByteBufToHTML(
+        s3dw_markdown_renderer *renderer,
+        const char *uncleaninput, size_t uncleaninputlen,
+        s3dw_markdown_tohtmloptions *options,
+        size_t *out_len
+        ) {
+    return _spew3dweb_markdown_ByteBufToHTMLEx(
+        renderer, uncleaninput, uncleaninputlen, options,
+        NULL, NULL, NULL, out_len
+    );
+}
+
+static int _md2html_diskfile_writer(
+        const char *buff, size_t amount, void *userdata
+        ) {
+    FILE *f = userdata;
+    return (fwrite(buff, 1, amount, f) == amount);
+}
+
+S3DEXP int spew3dweb_markdown_ByteBufToHTMLDiskFile(
+        const char *uncleaninput, size_t uncleaninputlen,
+        s3dw_markdown_tohtmloptions *options,
+        FILE *f
+        ) {
+    return spew3dweb_markdown_ByteBufToHTMLCustomIO(
+        uncleaninput, uncleaninputlen, options,
+        _md2html_diskfile_writer, f
+    );
 }
 
 #undef INSC
 #undef INS
 #undef INSREP
 #undef INSBUF
+#undef INSSTR
+#undef INSESC
+#undef INSTEXT
+#undef INSTAG
+#undef EVENTENTER
+#undef EVENTLEAVE
 
 S3DEXP char *spew3dweb_markdown_ToHTMLEx(
         const char *uncleaninput,
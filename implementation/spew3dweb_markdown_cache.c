@@ -0,0 +1,313 @@
+/* Copyright (c) 2023, ellie/@ell1e & Spew3D Web Team (see AUTHORS.md).
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+Alternatively, at your option, this file is offered under the Apache 2
+license, see accompanied LICENSE.md.
+*/
+
+#ifdef SPEW3DWEB_IMPLEMENTATION
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#if !defined(SPEW3DWEB_OPTION_DISABLE_THREADS)
+#include <pthread.h>
+#endif
+
+typedef struct _md2html_cacheentry {
+    uint64_t hash;
+    s3dw_markdown_tohtmloptions options;
+    const char *input;
+    size_t inputlen;
+    const char *html;
+    size_t htmllen;
+    size_t cost;
+    // One for being in the cache, plus one for each hit that is still
+    // copying out the HTML. Whoever drops the last one frees it:
+    int refs;
+    struct _md2html_cacheentry *hashnext;
+    struct _md2html_cacheentry *lruprev, *lrunext;
+} _md2html_cacheentry;
+
+struct s3dw_markdown_rendercache {
+    size_t budget, used, entries;
+    _md2html_cacheentry **buckets;
+    size_t bucketcount;
+    // The most recently used entry is first:
+    _md2html_cacheentry *lrufirst, *lrulast;
+    uint64_t hits, misses, evictions;
+    #if !defined(SPEW3DWEB_OPTION_DISABLE_THREADS)
+    pthread_mutex_t lock;
+    #endif
+};
+
+static void _md2html_CacheLock(s3dw_markdown_rendercache *cache) {
+    #if !defined(SPEW3DWEB_OPTION_DISABLE_THREADS)
+    pthread_mutex_lock(&cache->lock);
+    #endif
+}
+
+static void _md2html_CacheUnlock(s3dw_markdown_rendercache *cache) {
+    #if !defined(SPEW3DWEB_OPTION_DISABLE_THREADS)
+    pthread_mutex_unlock(&cache->lock);
+    #endif
+}
+
+S3DEXP s3dw_markdown_rendercache *spew3dweb_markdown_NewRenderCache(
+        size_t budgetbytes
+        ) {
+    s3dw_markdown_rendercache *cache = malloc(sizeof(*cache));
+    if (!cache)
+        return NULL;
+    memset(cache, 0, sizeof(*cache));
+    cache->budget = budgetbytes;
+    cache->bucketcount = 64;
+    cache->buckets = malloc(sizeof(*cache->buckets) * cache->bucketcount);
+    if (!cache->buckets) {
+        free(cache);
+        return NULL;
+    }
+    memset(cache->buckets, 0,
+        sizeof(*cache->buckets) * cache->bucketcount);
+    #if !defined(SPEW3DWEB_OPTION_DISABLE_THREADS)
+    if (pthread_mutex_init(&cache->lock, NULL) != 0) {
+        free(cache->buckets);
+        free(cache);
+        return NULL;
+    }
+    #endif
+    return cache;
+}
+
+S3DEXP void spew3dweb_markdown_FreeRenderCache(
+        s3dw_markdown_rendercache *cache
+        ) {
+    if (!cache)
+        return;
+    _md2html_cacheentry *entry = cache->lrufirst;
+    while (entry) {
+        _md2html_cacheentry *next = entry->lrunext;
+        free(entry);
+        entry = next;
+    }
+    free(cache->buckets);
+    #if !defined(SPEW3DWEB_OPTION_DISABLE_THREADS)
+    pthread_mutex_destroy(&cache->lock);
+    #endif
+    free(cache);
+}
+
+static void _md2html_CacheUnlinkLRU(
+        s3dw_markdown_rendercache *cache, _md2html_cacheentry *entry
+        ) {
+    if (entry->lruprev)
+        entry->lruprev->lrunext = entry->lrunext;
+    else
+        cache->lrufirst = entry->lrunext;
+    if (entry->lrunext)
+        entry->lrunext->lruprev = entry->lruprev;
+    else
+        cache->lrulast = entry->lruprev;
+    entry->lruprev = NULL;
+    entry->lrunext = NULL;
+}
+
+static void _md2html_CacheLinkLRUFirst(
+        s3dw_markdown_rendercache *cache, _md2html_cacheentry *entry
+        ) {
+    entry->lruprev = NULL;
+    entry->lrunext = cache->lrufirst;
+    if (cache->lrufirst)
+        cache->lrufirst->lruprev = entry;
+    else
+        cache->lrulast = entry;
+    cache->lrufirst = entry;
+}
+
+static _md2html_cacheentry *_md2html_CacheFind(
+        s3dw_markdown_rendercache *cache, uint64_t hash,
+        const char *input, size_t inputlen,
+        const s3dw_markdown_tohtmloptions *options
+        ) {
+    _md2html_cacheentry *entry = cache->buckets[
+        hash & (cache->bucketcount - 1)];
+    while (entry) {
+        if (entry->hash == hash && entry->inputlen == inputlen &&
+                _internal_s3dw_markdown_OptionsEqual(
+                    &entry->options, options) &&
+                memcmp(entry->input, input, inputlen) == 0)
+            return entry;
+        entry = entry->hashnext;
+    }
+    return NULL;
+}
+
+static void _md2html_CacheRemove(
+        s3dw_markdown_rendercache *cache, _md2html_cacheentry *entry
+        ) {
+    _md2html_cacheentry **ptr = &cache->buckets[
+        entry->hash & (cache->bucketcount - 1)];
+    while (*ptr != entry) {
+        assert(*ptr != NULL);
+        ptr = &(*ptr)->hashnext;
+    }
+    *ptr = entry->hashnext;
+    _md2html_CacheUnlinkLRU(cache, entry);
+    assert(cache->used >= entry->cost && cache->entries > 0);
+    cache->used -= entry->cost;
+    cache->entries -= 1;
+    entry->refs -= 1;
+    if (entry->refs == 0)
+        free(entry);
+}
+
+static void _md2html_CacheGrowBuckets(s3dw_markdown_rendercache *cache) {
+    size_t newcount = cache->bucketcount * 2;
+    _md2html_cacheentry **newbuckets = malloc(
+        sizeof(*newbuckets) * newcount);
+    if (!newbuckets)
+        return;  // Longer chains, but it still works.
+    memset(newbuckets, 0, sizeof(*newbuckets) * newcount);
+    size_t i = 0;
+    while (i < cache->bucketcount) {
+        _md2html_cacheentry *entry = cache->buckets[i];
+        while (entry) {
+            _md2html_cacheentry *next = entry->hashnext;
+            size_t k = entry->hash & (newcount - 1);
+            entry->hashnext = newbuckets[k];
+            newbuckets[k] = entry;
+            entry = next;
+        }
+        i += 1;
+    }
+    free(cache->buckets);
+    cache->buckets = newbuckets;
+    cache->bucketcount = newcount;
+}
+
+S3DEXP char *spew3dweb_markdown_RenderCacheByteBufToHTML(
+        s3dw_markdown_rendercache *cache,
+        const char *uncleaninput, size_t uncleaninputlen,
+        s3dw_markdown_tohtmloptions *options,
+        size_t *out_len
+        ) {
+    uint64_t hash = _internal_s3dw_markdown_Hash64(
+        uncleaninput, uncleaninputlen,
+        _internal_s3dw_markdown_OptionsSeed(options)
+    );
+    _md2html_CacheLock(cache);
+    _md2html_cacheentry *entry = _md2html_CacheFind(
+        cache, hash, uncleaninput, uncleaninputlen, options
+    );
+    if (entry) {
+        // Keep the entry alive while copying it without the lock,
+        // so that readers of large pages don't wait on each other:
+        entry->refs += 1;
+        _md2html_CacheUnlinkLRU(cache, entry);
+        _md2html_CacheLinkLRUFirst(cache, entry);
+        cache->hits += 1;
+        _md2html_CacheUnlock(cache);
+        char *result = malloc(entry->htmllen + 1);
+        if (result) {
+            memcpy(result, entry->html, entry->htmllen + 1);
+            if (out_len) *out_len = entry->htmllen;
+        }
+        _md2html_CacheLock(cache);
+        entry->refs -= 1;
+        int unused = (entry->refs == 0);
+        _md2html_CacheUnlock(cache);
+        if (unused)
+            free(entry);  // It was evicted meanwhile.
+        return result;
+    }
+    cache->misses += 1;
+    _md2html_CacheUnlock(cache);
+
+    // Render without holding the lock, so others can keep going:
+    size_t htmllen = 0;
+    char *html = spew3dweb_markdown_ByteBufToHTML(
+        uncleaninput, uncleaninputlen, options, &htmllen
+    );
+    if (!html)
+        return NULL;
+    if (out_len) *out_len = htmllen;
+    size_t cost = sizeof(*entry) + uncleaninputlen + htmllen + 1;
+    if (cost > cache->budget)
+        return html;
+    entry = malloc(cost);
+    if (!entry)
+        return html;  // Just don't remember it.
+    memset(entry, 0, sizeof(*entry));
+    entry->hash = hash;
+    entry->options = *options;
+    char *copy = (char *)entry + sizeof(*entry);
+    memcpy(copy, uncleaninput, uncleaninputlen);
+    entry->input = copy;
+    entry->inputlen = uncleaninputlen;
+    memcpy(copy + uncleaninputlen, html, htmllen + 1);
+    entry->html = copy + uncleaninputlen;
+    entry->htmllen = htmllen;
+    entry->cost = cost;
+    entry->refs = 1;
+
+    _md2html_CacheLock(cache);
+    if (_md2html_CacheFind(
+            cache, hash, uncleaninput, uncleaninputlen, options
+            )) {
+        // Another thread rendered the same thing meanwhile.
+        _md2html_CacheUnlock(cache);
+        free(entry);
+        return html;
+    }
+    while (cache->lrulast && cache->used + cost > cache->budget) {
+        _md2html_CacheRemove(cache, cache->lrulast);
+        cache->evictions += 1;
+    }
+    if (cache->entries >= cache->bucketcount)
+        _md2html_CacheGrowBuckets(cache);
+    size_t k = hash & (cache->bucketcount - 1);
+    entry->hashnext = cache->buckets[k];
+    cache->buckets[k] = entry;
+    _md2html_CacheLinkLRUFirst(cache, entry);
+    cache->used += cost;
+    cache->entries += 1;
+    _md2html_CacheUnlock(cache);
+    return html;
+}
+
+S3DEXP void spew3dweb_markdown_RenderCacheGetStats(
+        s3dw_markdown_rendercache *cache,
+        s3dw_markdown_rendercachestats *out_stats
+        ) {
+    _md2html_CacheLock(cache);
+    out_stats->hits = cache->hits;
+    out_stats->misses = cache->misses;
+    out_stats->evictions = cache->evictions;
+    out_stats->entries = cache->entries;
+    out_stats->bytesused = cache->used;
+    out_stats->bytesbudget = cache->budget;
+    _md2html_CacheUnlock(cache);
+}
+
+#endif  // SPEW3DWEB_IMPLEMENTATION
@@ -430,56 +430,6 @@ S3DEXP char *spew3dweb_markdown_GetIChunkFromDiskFile(
     );
 }
 
-S3DHID int _internal_s3dw_markdown_ensurebufsize(
-        char **bufptr, size_t *bufalloc, size_t new_size
-        ) {
-    size_t oldalloc = *bufalloc;
-    if (!*bufptr || oldalloc < new_size) {
-        size_t new_alloc = (oldalloc + (oldalloc / 4) + 256);
-        if (new_alloc < new_size)
-            new_alloc = new_size;
-        char *newbuf = realloc(*bufptr, new_alloc);
-        if (!newbuf) {
-            if (*bufptr) free(*bufptr);
-            return 0;
-        }
-        *bufptr = newbuf;
-        *bufalloc = new_alloc;
-    }
-    return 1;
-}
-
-S3DHID int _internal_s3dw_markdown_bufappend(
-        char **bufptr, size_t *bufalloc, size_t *buffill,
-        const char *appendbuf, size_t appendbuflen, size_t amount
-        ) {
-    if (amount == 0)
-        return 1;
-    if (!_internal_s3dw_markdown_ensurebufsize(
-            bufptr, bufalloc,
-            (*buffill) + appendbuflen * amount + 1))
-        return 0;
-    assert(*bufalloc > (*buffill) + appendbuflen * amount);
-    char *write = (*bufptr) + (*buffill);
-    size_t k = 0;
-    while (k < amount) {
-        memcpy(write, appendbuf, appendbuflen);
-        write += appendbuflen;
-        k++;
-    }
-    (*buffill) += appendbuflen * amount;
-    return 1;
-}
-
-S3DHID int _internal_s3dw_markdown_bufappendstr(
-        char **bufptr, size_t *bufalloc, size_t *buffill,
-        const char *appendstr, size_t amount
-        ) {
-    return _internal_s3dw_markdown_bufappend(
-        bufptr, bufalloc, buffill,
-        appendstr, strlen(appendstr), amount);
-}
-
 S3DHID void _internal_spew3dweb_markdown_IsListOrCodeIndentEx(
         size_t pos, const char *buf,
         size_t buflen,
@@ -883,30 +833,88 @@ static int _linestandaloneheadingdepth(
     return rating;
 }
 
-S3DHID int _internal_s3dw_markdown_bufappendchar(
-        char **bufptr, size_t *bufallocptr, size_t *buffillptr,
-        char appendc, size_t amount
+static int _isinlinespecialchar(char c) {
+    // See _internal_s3dw_markdown_FindInlineSpecialChar().
+    return (c == '\n' || c == '\r' || c == '\0' || c == '`' ||
+        c == '<' || c == '>' || c == '&' || c == '\\' ||
+        c == '!' || c == '[');
+}
+
+// The check mode is rarely used, so keep it out of line rather than
+// bloating every single append site:
+#if defined(__GNUC__) || defined(__clang__)
+#define _S3D_MD_CHECKNOINLINE __attribute__((noinline))
+#else
+#define _S3D_MD_CHECKNOINLINE
+#endif
+
+_S3D_MD_CHECKNOINLINE static int _cleancompare(
+        const char *checkagainst, size_t checkagainstlen,
+        size_t *buffill, const char *appendbuf, size_t appendbuflen,
+        size_t amount
         ) {
-    char cbuf[1];
-    cbuf[0] = appendc;
-    return _internal_s3dw_markdown_bufappend(
-        bufptr, bufallocptr, buffillptr,
-        cbuf, 1, amount);
+    // Compare to what the output would be if it was unchanged, instead
+    // of appending anything:
+    size_t k = 0;
+    while (k < amount) {
+        if (appendbuflen > checkagainstlen - (*buffill) ||
+                memcmp(checkagainst + (*buffill), appendbuf,
+                    appendbuflen) != 0)
+            return 0;
+        (*buffill) += appendbuflen;
+        k += 1;
+    }
+    return 1;
 }
+
+_S3D_MD_CHECKNOINLINE static int _cleancomparechar(
+        const char *checkagainst, size_t checkagainstlen,
+        size_t *buffill, char appendc, size_t amount
+        ) {
+    if (amount > checkagainstlen - (*buffill))
+        return 0;
+    size_t k = 0;
+    while (k < amount) {
+        if (checkagainst[(*buffill) + k] != appendc)
+            return 0;
+        k += 1;
+    }
+    (*buffill) += amount;
+    return 1;
+}
+
 #define INSC(insertchar) \
-    (_internal_s3dw_markdown_bufappendchar(\
+    (checkagainst ? _cleancomparechar(\
+    checkagainst, checkagainstlen, &resultfill, insertchar, 1) :\
+    _internal_s3dw_markdown_bufappendchar(\
     &resultchunk, &resultalloc, &resultfill,\
     insertchar, 1))
 #define INS(insertstr) \
-    (_internal_s3dw_markdown_bufappendstr(\
+    (checkagainst ? _cleancompare(\
+    checkagainst, checkagainstlen, &resultfill,\
+    "" insertstr, sizeof(insertstr) - 1, 1) :\
+    _S3D_MD_BUFAPPENDLIT(\
     &resultchunk, &resultalloc, &resultfill,\
     insertstr, 1))
 #define INSREP(insertstr, amount) \
-    (_internal_s3dw_markdown_bufappendstr(\
+    (checkagainst ? _cleancompare(\
+    checkagainst, checkagainstlen, &resultfill,\
+    "" insertstr, sizeof(insertstr) - 1, amount) :\
+    _S3D_MD_BUFAPPENDLIT(\
     &resultchunk, &resultalloc, &resultfill,\
     insertstr, amount))
+#define INSSTR(insertstr) \
+    (checkagainst ? _cleancompare(\
+    checkagainst, checkagainstlen, &resultfill,\
+    insertstr, strlen(insertstr), 1) :\
+    _internal_s3dw_markdown_bufappendstr(\
+    &resultchunk, &resultalloc, &resultfill,\
+    insertstr, 1))
 #define INSBUF(insertbuf, insertbuflen) \
-    (_internal_s3dw_markdown_bufappend(\
+    (checkagainst ? _cleancompare(\
+    checkagainst, checkagainstlen, &resultfill,\
+    insertbuf, insertbuflen, 1) :\
+    _internal_s3dw_markdown_bufappend(\
     &resultchunk, &resultalloc, &resultfill,\
     insertbuf, insertbuflen, 1))
 
@@ -989,7 +997,7 @@ S3DEXP int spew3dweb_markdown_IsStrImage(const char *test_str) {
     return (len == test_str_len);
 }
 
-static int _internal_spew3dweb_skipmarkdownhtmlcomment(
+S3DHID int _internal_spew3dweb_skipmarkdownhtmlcomment(
         const char *input, size_t inputlen, size_t startpos
         ) {
     if (startpos + 3 >= inputlen ||
@@ -1001,9 +1009,122 @@ static int _internal_spew3dweb_skipmarkdownhtmlcomment(
         i += 1;
     if (i + 2 < inputlen)
         i += 3;
+    else
+        i = inputlen;  // Not closed, so it runs to the end.
     return (int)(i - startpos);
 }
 
+S3DHID size_t _internal_spew3dweb_markdown_GetInlineCodeLen(
+        const char *input, size_t inputlen, size_t startpos,
+        int origindent, int *out_ticks
+        ) {
+    size_t i = startpos;
+    if (i >= inputlen || input[i] != '`' ||
+            (i + 2 < inputlen && input[i + 1] == '`' &&
+            input[i + 2] == '`'))
+        return 0;
+    int ticks = 1;
+    if (i + 1 < inputlen && input[i + 1] == '`') {
+        ticks += 1;
+        i += 1;
+    }
+    i += 1;
+
+    // To verify, find the end of our inline code.
+    size_t codestart = i;
+    while (i < inputlen) {
+        if (input[i] == '`' && (
+                (ticks == 1 && (i + 1 >= inputlen ||
+                    input[i + 1] != '`')) ||
+                (ticks == 2 && i + 1 < inputlen &&
+                    input[i + 1] == '`' &&
+                    (i + 2 >= inputlen || input[i + 2] != '`')))) {
+            if (i == codestart)
+                return 0;
+            if (out_ticks != NULL)
+                *out_ticks = ticks;
+            return (i + ticks) - startpos;
+        }
+        if (input[i] == '\r' || input[i] == '\n') {
+            size_t i2 = i;
+            if (input[i2] == '\r' && i2 + 1 < inputlen &&
+                    input[i2 + 1] == '\n')
+                i2 += 1;
+            i2 += 1;
+            int nextline_indent = 0;
+            while (i2 < inputlen) {
+                if (input[i2] == '\t') {
+                    nextline_indent += 4;
+                } else if (input[i2] == ' ') {
+                    nextline_indent += 1;
+                } else {
+                    break;
+                }
+                i2 += 1;
+            }
+            // If next line continues with an obvious new
+            // block or unfitting indent then abort:
+            if (i2 >= inputlen || input[i2] == '\r' ||
+                    input[i2] == '\n' ||
+                    input[i2] == '#' || input[i2] == '*' ||
+                    input[i2] == '-' || input[i2] == '=' ||
+                    input[i2] == '`' ||
+                    nextline_indent < origindent ||
+                    nextline_indent > origindent + 3)
+                return 0;
+            // Okay, this line looks non-suspicious. Continue!
+            i = i2;
+            continue;
+        }
+        i += 1;
+    }
+    return 0;
+}
+
+S3DHID int _internal_spew3dweb_markdown_IsFenceClose(
+        const char *input, size_t inputlen, size_t pos, int ticks
+        ) {
+    size_t i = pos;
+    while (i < inputlen && i < pos + ticks && input[i] == '`')
+        i += 1;
+    return (i == pos + ticks);
+}
+
+/// For a comment that isn't closed before inputlen, when more input
+/// follows later: returns its last line break from pos on, where the
+/// cleaning can stop and go on later. If the comment only starts at
+/// pos, this also needs a blank line inside it, since until then
+/// a link in front of it might still end up reaching past it.
+/// Returns -1 if there's no such spot.
+static ssize_t _getcommentpausepos(
+        const char *input, size_t inputlen, size_t pos, int isstart
+        ) {
+    size_t i = inputlen;
+    while (i > pos && input[i - 1] != '\n' && input[i - 1] != '\r')
+        i -= 1;
+    if (i <= pos)
+        return -1;
+    size_t pausepos = i - 1;
+    if (!isstart)
+        return pausepos;
+    i = pos;
+    while (i < pausepos) {
+        if (input[i] != '\n' && input[i] != '\r') {
+            i += 1;
+            continue;
+        }
+        size_t i2 = i + 1;
+        if (input[i] == '\r' && input[i2] == '\n')
+            i2 += 1;
+        while (i2 < pausepos && (input[i2] == ' ' || input[i2] == '\t'))
+            i2 += 1;
+        if (i2 <= pausepos && (input[i2] == '\n' || input[i2] == '\r'))
+            return pausepos;
+        i = i2;
+    }
+    return -1;
+}
+
 S3DHID ssize_t _internal_spew3dweb_markdown_AddInlineAreaClean(
         const char *input, size_t inputlen, size_t startpos,
         char **resultchunkptr, size_t *resultfillptr,
@@ -1018,7 +1139,12 @@ S3DHID ssize_t _internal_spew3dweb_markdown_AddInlineAreaClean(
         char *(*opt_uritransformcallback)(
             const char *uri, void *userdata
         ),
-        void *opt_uritransform_userdata
+        void *opt_uritransform_userdata,
+        int opt_uritransformborrowed,
+        int opt_plaintextonly,
+        int *opt_pausedincomment,
+        const char *checkagainst, size_t checkagainstlen,
+        char **uriscratch, size_t *uriscratchalloc
         ) {
     assert(!opt_adjustindentinside || opt_allowmultiline);
     assert(!opt_squashmultiline || opt_allowmultiline);
@@ -1029,6 +1155,25 @@ S3DHID ssize_t _internal_spew3dweb_markdown_AddInlineAreaClean(
 
     size_t i = startpos;
     while (i < inputlen) {
+        // Copy the plain text up to the next char that needs a closer
+        // look in one go, rather than char by char. Most runs between
+        // markup are short, so only longer ones use the vector search:
+        size_t plainend = i;
+        while (plainend < inputlen && plainend < i + 16 &&
+                !_isinlinespecialchar(input[plainend]))
+            plainend += 1;
+        if (plainend == i + 16)
+            plainend = _internal_s3dw_markdown_FindInlineSpecialChar(
+                input, inputlen, plainend
+            );
+        if (plainend > i) {
+            if (!INSBUF(input + i, plainend - i))
+                goto errorquit;
+            i = plainend;
+            if (i >= inputlen)
+                break;
+        }
+
         // All line break and end of inline handling:
         if (((input[i] == '\n' || input[i] == '\r') &&
                 !opt_allowmultiline) ||
@@ -1086,15 +1231,28 @@ S3DHID ssize_t _internal_spew3dweb_markdown_AddInlineAreaClean(
                     _internal_spew3dweb_skipmarkdownhtmlcomment(
                         input, inputlen, i
                 )) > 0) {
-            if (opt_stripcomments) {
-                i += _commentskip;
-                continue;
-            } else {
-                if (!INSBUF(input + i, _commentskip))
-                    goto errorquit;
-                i += _commentskip;
-                continue;
+            size_t commentend = i + _commentskip;
+            if (opt_pausedincomment && commentend >= inputlen) {
+                // It isn't closed yet, but more input follows:
+                ssize_t pausepos = _getcommentpausepos(
+                    input, inputlen, i, 1
+                );
+                if (pausepos >= 0) {
+                    commentend = pausepos;
+                    *opt_pausedincomment = 1;
+                }
             }
+            if (!opt_stripcomments &&
+                    !INSBUF(input + i, commentend - i))
+                goto errorquit;
+            i = commentend;
+            if (opt_pausedincomment && *opt_pausedincomment) {
+                *resultchunkptr = resultchunk;
+                *resultfillptr = resultfill;
+                *resultallocptr = resultalloc;
+                return i;
+            }
+            continue;
         } else if (input[i] == '\\' && !currentlineiscode) {
             i += 1;
             if (i < inputlen) {
@@ -1146,62 +1304,13 @@ S3DHID ssize_t _internal_spew3dweb_markdown_AddInlineAreaClean(
                 (i + 2 >= inputlen || input[i + 1] != '`' ||
                 input[i + 2] != '`')) {
             // Possibly inline code!
-            size_t i2 = i;
             int ticks = 1;
-            if (i2 + 1 < inputlen && input[i2 + 1] == '`') {
-                ticks += 1;
-                i2 += 1;
-            }
-            i2 += 1;
-
-            // To verify, find the end of our inline code.
-            size_t codestart = i2;
-            size_t codeend = 0;
-            while (i2 < inputlen) {
-                if (input[i2] == '`' && (
-                        (ticks == 1 && (i2 + 1 >= inputlen ||
-                            input[i2 + 1] != '`')) ||
-                        (ticks == 2 && input[i2 + 1] == '`' &&
-                            (i2 + 2 >= inputlen ||
-                            input[i2 + 2] != '`')))) {
-                    codeend = i2;
-                    break;
-                }
-                if (input[i2] == '\r' || input[i2] == '\n') {
-                    size_t i3 = i2;
-                    if (input[i3] == '\r' && i3 + 1 < inputlen &&
-                            input[i3 + 1] == '\n')
-                        i3 += 1;
-                    i3 += 1;
-                    int nextline_indent = 0;
-                    while (i3 < inputlen) {
-                        if (input[i3] == '\t') {
-                            nextline_indent += 4;
-                        } else if (input[i3] == ' ') {
-                            nextline_indent += 1;
-                        } else {
-                            break;
-                        }
-                        i3 += 1;
-                    }
-                    // If next line continues with an obvious new
-                    // block or unfitting indent then abort:
-                    if (i3 >= inputlen || input[i3] == '\r' ||
-                            input[i3] == '\n' ||
-                            input[i3] == '#' || input[i3] == '*' ||
-                            input[i3] == '-' || input[i3] == '=' ||
-                            input[i3] == '`' ||
-                            nextline_indent < origindent ||
-                            nextline_indent > origindent + 3)
-                        break;
-                    // Okay, this line looks non-suspicious. Continue!
-                    i2 = i3;
-                    continue;
-                }
-                i2 += 1;
-            }
-            if (codeend > 0 &&
-                    codeend - codestart > 0) {  // Valid inline code:
+            size_t codelen = _internal_spew3dweb_markdown_GetInlineCodeLen(
+                input, inputlen, i, origindent, &ticks
+            );
+            if (codelen > 0) {  // Valid inline code:
+                size_t codestart = i + ticks;
+                size_t codeend = i + codelen - ticks;
                 assert(input[i] == '`');
 
                 if (!INSREP("`", ticks))
@@ -1219,13 +1328,15 @@ S3DHID ssize_t _internal_spew3dweb_markdown_AddInlineAreaClean(
                         opt_escapeunambiguousentities,
                         opt_allowunsafehtml,
                         opt_stripcomments,
-                        NULL, NULL));
+                        NULL, NULL, 0, opt_plaintextonly, NULL,
+                        checkagainst, checkagainstlen,
+                        uriscratch, uriscratchalloc));
                 assert(result == -1 || result == codeend);
                 if (result < 0)
                     goto errorquit;
                 if (!INSREP("`", ticks))
                     goto errorquit;
-                i = i2 + ticks;
+                i += codelen;
                 continue;
             } else {
                 // Must escape invalid.
@@ -1379,7 +1490,9 @@ S3DHID ssize_t _internal_spew3dweb_markdown_AddInlineAreaClean(
                         opt_escapeunambiguousentities,
                         opt_allowunsafehtml,
                         opt_stripcomments,
-                        NULL, NULL
+                        NULL, NULL, 0, opt_plaintextonly, NULL,
+                        checkagainst, checkagainstlen,
+                        uriscratch, uriscratchalloc
                     ));
                 assert(result == -1 || result == title_start + title_len);
                 if (result < 0)
@@ -1394,6 +1507,25 @@ S3DHID ssize_t _internal_spew3dweb_markdown_AddInlineAreaClean(
                     goto errorquit;
             }
             i3 = url_start;
+            if (opt_plaintextonly && (maybeimage || title_len > 0) &&
+                    imgwidthformat == '\0' && imgheightformat == '\0') {
+                // Plain text never shows the URL, so leave it out if
+                // it's plain enough to not change anything else:
+                while (i3 < url_start + url_len && (
+                        (input[i3] >= 'a' && input[i3] <= 'z') ||
+                        (input[i3] >= 'A' && input[i3] <= 'Z') ||
+                        (input[i3] >= '0' && input[i3] <= '9') ||
+                        input[i3] == '/' || input[i3] == '.' ||
+                        input[i3] == ':' || input[i3] == '?' ||
+                        input[i3] == '=' || input[i3] == '#' ||
+                        input[i3] == '%' || input[i3] == '-' ||
+                        input[i3] == '+' || input[i3] == ',' ||
+                        input[i3] == ';' || input[i3] == '@'))
+                    i3 += 1;
+                if (i3 >= url_start + url_len)
+                    goto urldone;
+                i3 = url_start;
+            }
             assert(i3 < inputlen);
             assert(url_start + url_len <= inputlen);
 
@@ -1423,10 +1555,30 @@ S3DHID ssize_t _internal_spew3dweb_markdown_AddInlineAreaClean(
             size_t uribuffill = 0;
             int uribufonheap = 0;
             while (i3 < url_start + url_len) {
-                if (uribuffill + 5 > uribufalloc) {
+                if (uribuffill + 5 > uribufalloc && uriscratch) {
+                    // Continue in the caller's scratch space instead:
+                    if (*uriscratchalloc < uribufalloc * 4) {
+                        char *uribufnew = realloc(
+                            *uriscratch, uribufalloc * 4
+                        );
+                        if (!uribufnew)
+                            goto uriallocfail;
+                        *uriscratch = uribufnew;
+                        *uriscratchalloc = uribufalloc * 4;
+                    }
+                    if (uribuf == _uribuf_stack)
+                        memcpy(*uriscratch, uribuf, uribuffill + 1);
+                    uribuf = *uriscratch;
+                    uribufalloc = *uriscratchalloc;
+                } else if (uribuffill + 5 > uribufalloc) {
                     char *uribufnew = malloc(uribufalloc * 4);
                     if (!uribufnew) {
                         if (uribufonheap) free(uribuf);
+                        uriallocfail: ;
+                        // Like the append helpers, don't leave the
+                        // result buffer behind on failure:
+                        if (!checkagainst) free(resultchunk);
+                        resultchunk = NULL;
                         goto errorquit;
                     }
                     memcpy(uribufnew, uribuf, uribuffill + 1);
@@ -1514,23 +1666,29 @@ S3DHID ssize_t _internal_spew3dweb_markdown_AddInlineAreaClean(
                 uribuffill += 1;
                 i3 += 1;
             }
+            const char *finaluri = uribuf;
+            char *transformed_uri = NULL;
             if (opt_uritransformcallback != NULL) {
-                char *transformed_uri = (
-                    opt_uritransformcallback(uribuf,    
+                transformed_uri = (
+                    opt_uritransformcallback(uribuf,
                         opt_uritransform_userdata));
                 if (!transformed_uri) {
                     if (uribufonheap) free(uribuf);
+                    if (!checkagainst) free(resultchunk);
+                    resultchunk = NULL;
                     goto errorquit;
                 }
-                if (uribufonheap) free(uribuf);
-                uribuf = transformed_uri;
-                uribufonheap = 1;
-            }
-            if (!INS(uribuf)) {
-                if (uribufonheap) free(uribuf);
-                goto errorquit;
+                finaluri = transformed_uri;
+                // A borrowed result may even be uribuf itself:
+                if (opt_uritransformborrowed)
+                    transformed_uri = NULL;
             }
+            int finaluriadded = INSSTR(finaluri);
             if (uribufonheap) free(uribuf);
+            free(transformed_uri);
+            if (!finaluriadded)
+                goto errorquit;
+            urldone: ;
             if (!INS(")"))
                 goto errorquit;
             if (imgwidthformat != '\0' ||
@@ -1543,7 +1701,7 @@ S3DHID ssize_t _internal_spew3dweb_markdown_AddInlineAreaClean(
                         "%d", imgwidth);
                     if (!INS("width="))
                         goto errorquit;
-                    if (!INS(numbuf))
+                    if (!INSSTR(numbuf))
                         goto errorquit;
                     if (imgwidthformat == '%') {
                         if (!INS("%"))
@@ -1563,7 +1721,7 @@ S3DHID ssize_t _internal_spew3dweb_markdown_AddInlineAreaClean(
                         "%d", imgheight);
                     if (!INS("height="))
                         goto errorquit;
-                    if (!INS(numbuf))
+                    if (!INSSTR(numbuf))
                         goto errorquit;
                     if (imgheightformat == '%') {
                         if (!INS("%"))
@@ -1677,16 +1835,26 @@ S3DHID ssize_t _internal_spew3dweb_markdown_GetInlineEndBracket(
             i += 1;
             continue;
         }
-        if (isurl && input[i] == '(') roundbracketnest += 1;
-        if (isurl && input[i] == '[') squarebracketnest += 1;
-        if (isurl && input[i] == '{') curlybracketnest += 1;
-        if (isurl && input[i] == ')') roundbracketnest -= 1;
-        if (isurl && input[i] == ']') squarebracketnest -= 1;
-        if (isurl && input[i] == '}') curlybracketnest -= 1;
-        if (roundbracketnest < 0 ||
-                squarebracketnest < 0 ||
-                curlybracketnest < 0)
-            return -1;
+        if (isurl) {
+            if (input[i] == '(') roundbracketnest += 1;
+            if (input[i] == '[') squarebracketnest += 1;
+            if (input[i] == '{') curlybracketnest += 1;
+            if (input[i] == ')') roundbracketnest -= 1;
+            if (input[i] == ']') squarebracketnest -= 1;
+            if (input[i] == '}') curlybracketnest -= 1;
+            if (roundbracketnest < 0 ||
+                    squarebracketnest < 0 ||
+                    curlybracketnest < 0)
+                return -1;
+            if (roundbracketnest > _S3D_MD_MAX_URL_BRACKET_NESTING ||
+                    squarebracketnest >
+                        _S3D_MD_MAX_URL_BRACKET_NESTING ||
+                    curlybracketnest > _S3D_MD_MAX_URL_BRACKET_NESTING)
+                // No real URL nests like that, and giving up here keeps
+                // unclosed links from making this quadratic. (Only for
+                // URLs, titles and inline code never track nesting.)
+                return -1;
+        }
         if (input[i] == '`' && i + 2 < inputlen &&
                 input[i + 1] == '`' && input[i + 2] == '`')
             // We ran into a code block element, looks invalid, bail.
@@ -1961,8 +2129,8 @@ S3DHID int _internal_spew3dweb_markdown_GetLinkOrImgLen(
     return (i - offset);
 }
 
-S3DHID char *_internal_spew3dweb_markdown_CleanByteBufEx(
-        const char *input, size_t inputlen,
+S3DHID void _internal_spew3dweb_markdown_InitCleanState(
+        _markdown_cleanstate *state,
         int opt_forcenolinebreaklinks,
         int opt_forceescapeunambiguousentities,
         int opt_allowunsafehtml,
@@ -1970,37 +2138,206 @@ S3DHID char *_internal_spew3dweb_markdown_CleanByteBufEx(
         char *(*opt_uritransformcallback)(
             const char *uri, void *userdata
         ),
-        void *opt_uritransform_userdata,
-        size_t *out_len, size_t *out_alloc
+        void *opt_uritransform_userdata
         ) {
-    char *resultchunk = NULL;
-    size_t resultfill = 0;
-    size_t resultalloc = 0;
-    if (!_internal_s3dw_markdown_ensurebufsize(
-            &resultchunk, &resultalloc, 1))
-        return NULL;
+    memset(state, 0, sizeof(*state));
+    state->opt_forcenolinebreaklinks = opt_forcenolinebreaklinks;
+    state->opt_forceescapeunambiguousentities = (
+        opt_forceescapeunambiguousentities
+    );
+    state->opt_allowunsafehtml = opt_allowunsafehtml;
+    state->opt_stripcomments = opt_stripcomments;
+    state->opt_uritransformcallback = opt_uritransformcallback;
+    state->opt_uritransform_userdata = opt_uritransform_userdata;
+}
+
+static int _posmapresyncs(
+        const char *a, size_t alen, const char *b, size_t blen
+        ) {
+    // Two equal bytes in a row are taken as being back in step, or
+    // one if both end right after it:
+    size_t n = (alen < blen ? alen : blen);
+    if (n > 2)
+        n = 2;
+    return (n > 0 && (n == 2 || alen == blen) &&
+        memcmp(a, b, n) == 0);
+}
+
+/// Note down for the output since the last call where in the input
+/// from inputstart to inputend it came from. The cleaner mostly
+/// copies, so output is lined up with the input bytes it equals, and
+/// whatever got added, dropped or replaced in between is stepped over
+/// as briefly as possible. Returns 0 on allocation failure.
+static int _mapoutputtoinput(
+        _markdown_cleanstate *state,
+        const char *resultchunk, size_t resultfill,
+        const char *input, size_t inputstart, size_t inputend
+        ) {
+    if (state->posmapfill > resultfill)
+        state->posmapfill = resultfill;  // Some was taken back.
+    if (resultfill + 1 > state->posmapalloc) {
+        size_t newalloc = state->posmapalloc * 2;
+        if (newalloc < resultfill + 64)
+            newalloc = resultfill + 64;
+        size_t *newmap = realloc(
+            state->posmap, sizeof(*newmap) * newalloc
+        );
+        if (!newmap)
+            return 0;
+        state->posmap = newmap;
+        state->posmapalloc = newalloc;
+    }
+    const size_t lookahead = 16;
+    size_t k = state->posmapfill;
+    size_t j = inputstart;
+    while (k < resultfill) {
+        if (j < inputend && resultchunk[k] == input[j]) {
+            state->posmap[k] = j;
+            k += 1;
+            j += 1;
+            continue;
+        }
+        // Find the shortest way back in step, either by skipping
+        // added output or by skipping dropped input:
+        size_t added = 1;
+        while (added <= lookahead && k + added < resultfill &&
+                !_posmapresyncs(resultchunk + k + added,
+                    resultfill - (k + added), input + j, inputend - j))
+            added += 1;
+        size_t dropped = 1;
+        while (dropped < added && j + dropped < inputend &&
+                !_posmapresyncs(resultchunk + k, resultfill - k,
+                    input + j + dropped, inputend - (j + dropped)))
+            dropped += 1;
+        if (dropped < added && j + dropped < inputend) {
+            j += dropped;
+        } else if (added <= lookahead && k + added < resultfill) {
+            while (added > 0) {
+                state->posmap[k] = j;
+                k += 1;
+                added -= 1;
+            }
+        } else {
+            // Neither, so take it as replaced:
+            state->posmap[k] = j;
+            k += 1;
+            if (j < inputend)
+                j += 1;
+        }
+    }
+    state->posmap[resultfill] = inputend;
+    state->posmapfill = resultfill;
+    return 1;
+}
+
+S3DHID int _internal_spew3dweb_markdown_CleanByteBufPart(
+        _markdown_cleanstate *state,
+        const char *input, size_t inputlen,
+        size_t *inputpos, size_t opt_pauseatfill,
+        size_t opt_pauseatinputpos
+        ) {
+    const int opt_forcenolinebreaklinks = (
+        state->opt_forcenolinebreaklinks
+    );
+    const int opt_forceescapeunambiguousentities = (
+        state->opt_forceescapeunambiguousentities
+    );
+    const int opt_allowunsafehtml = state->opt_allowunsafehtml;
+    const int opt_stripcomments = state->opt_stripcomments;
+    char *(*opt_uritransformcallback)(
+        const char *uri, void *userdata
+    ) = state->opt_uritransformcallback;
+    void *opt_uritransform_userdata = (
+        state->opt_uritransform_userdata
+    );
+    const char *checkagainst = state->checkagainst;
+    size_t checkagainstlen = state->checkagainstlen;
+    char *resultchunk = state->resultchunk;
+    size_t resultfill = state->resultfill;
+    size_t resultalloc = state->resultalloc;
+    if (!checkagainst && !_internal_s3dw_markdown_ensurebufsize(
+            &resultchunk, &resultalloc, 1)) {
+        state->resultchunk = NULL;
+        state->resultfill = 0;
+        state->resultalloc = 0;
+        return 0;
+    }
 
-    int currentlineisblockinterruptor = 0;
-    int in_list_with_orig_indent[
-        _S3D_MD_MAX_LIST_NESTING
-    ] = {0};
-    int in_list_with_orig_bullet_indent[
-        _S3D_MD_MAX_LIST_NESTING
-    ] = {0};
-    int in_list_logical_nesting_depth = 0;
-    int currentlinehadlistbullet = 0;
-    int currentlineeffectiveindent = 0;
-    int currentlineorigindent = 0;
-    int currentlinehadnonwhitespace = 0;
-    int currentlinehadnonwhitespaceotherthanbullet = 0;
-    int currentlineiscode = 0;
-    int lastnonemptylineeffectiveindent = 0;
-    int lastnonemptylineorigindent = 0;
-    int lastnonemptylinewascode = 0;
-    int lastlinewasemptyorblockinterruptor = 0;
-    int lastlinehadlistbullet = 0;
-    size_t i = 0;
+    int currentlineisblockinterruptor = (
+        state->currentlineisblockinterruptor
+    );
+    int *in_list_with_orig_indent = (
+        state->in_list_with_orig_indent
+    );
+    int *in_list_with_orig_bullet_indent = (
+        state->in_list_with_orig_bullet_indent
+    );
+    int in_list_logical_nesting_depth = (
+        state->in_list_logical_nesting_depth
+    );
+    int currentlinehadlistbullet = state->currentlinehadlistbullet;
+    int currentlineeffectiveindent = (
+        state->currentlineeffectiveindent
+    );
+    int currentlineorigindent = state->currentlineorigindent;
+    int currentlinehadnonwhitespace = (
+        state->currentlinehadnonwhitespace
+    );
+    int currentlinehadnonwhitespaceotherthanbullet = (
+        state->currentlinehadnonwhitespaceotherthanbullet
+    );
+    int currentlineiscode = state->currentlineiscode;
+    int lastnonemptylineeffectiveindent = (
+        state->lastnonemptylineeffectiveindent
+    );
+    int lastnonemptylineorigindent = (
+        state->lastnonemptylineorigindent
+    );
+    int lastnonemptylinewascode = state->lastnonemptylinewascode;
+    int lastlinewasemptyorblockinterruptor = (
+        state->lastlinewasemptyorblockinterruptor
+    );
+    int lastlinehadlistbullet = state->lastlinehadlistbullet;
+    int pausedinfence = state->pausedinfence;
+    int pausedincomment = state->pausedincomment;
+    state->heldfenceticks = 0;
+    size_t i = *inputpos;
+    size_t mappedi = i;  // Input up to here is in the position map.
     while (i <= inputlen) {
+        if (state->keepposmap) {
+            if (!_mapoutputtoinput(state, resultchunk, resultfill,
+                    input, mappedi, (i < inputlen ? i : inputlen))) {
+                free(resultchunk);
+                goto errorquit;
+            }
+            mappedi = (i < inputlen ? i : inputlen);
+        }
+        if (pausedincomment) {
+            // Go on with the comment where the last call stopped:
+            size_t commentend = i;
+            while (commentend + 2 < inputlen &&
+                    memcmp(input + commentend, "-->", 3) != 0)
+                commentend += 1;
+            ssize_t pausepos = -1;
+            if (commentend + 2 < inputlen) {
+                commentend += 3;
+                pausedincomment = 0;
+            } else if (state->inputcontinues &&
+                    (pausepos = _getcommentpausepos(
+                        input, inputlen, i, 0)) >= 0) {
+                commentend = pausepos;
+            } else {
+                commentend = inputlen;
+                pausedincomment = 0;
+            }
+            if (!opt_stripcomments &&
+                    !INSBUF(input + i, commentend - i))
+                goto errorquit;
+            i = commentend;
+            if (pausedincomment)
+                break;
+            continue;
+        }
         const char c = (
             i < inputlen ? input[i] : '\0'
         );
@@ -2008,7 +2345,9 @@ S3DHID char *_internal_spew3dweb_markdown_CleanByteBufEx(
             (resultfill == 0 && i == 0) || (
             i > 0 && (input[i - 1] == '\n' ||
             input[i - 1] == '\r') &&
-            resultchunk[resultfill - 1] == '\n'));
+            // An empty chunk means the last block was just handed
+            // out, which only ever happens at the end of a line:
+            (resultfill == 0 || resultchunk[resultfill - 1] == '\n')));
         if (starts_new_line && i < inputlen &&
                 c != '\n' && c != '\r' && (
                 i + 1 >= inputlen ||
@@ -2097,7 +2436,7 @@ S3DHID char *_internal_spew3dweb_markdown_CleanByteBufEx(
                 // block is followed up by a 4 space code indent.
                 // Therefore, make sure to have a separating line.
                 if (!INS("\n"))
-                    return NULL;
+                    goto errorquit;
             } else if (!out_is_list_entry &&
                     out_is_in_list_depth == 0 &&
                     _linestandaloneheadingdepth(
@@ -2111,11 +2450,11 @@ S3DHID char *_internal_spew3dweb_markdown_CleanByteBufEx(
                 // dedent breaking out of a list item visually still
                 // as a continuation, so insert spacing here.
                 if (!INS("\n"))
-                    return NULL;
+                    goto errorquit;
             }
             lastlinewasemptyorblockinterruptor = 0;
             if (!INSREP(" ", out_write_this_many_spaces))
-                return NULL;
+                goto errorquit;
             if (out_is_list_entry) {
                 currentlinehadlistbullet = 1;
                 currentlinehadnonwhitespace = 1;
@@ -2125,21 +2464,21 @@ S3DHID char *_internal_spew3dweb_markdown_CleanByteBufEx(
                     snprintf(buf, sizeof(buf) - 1, "%d",
                         out_list_entry_num_value);
                     buf[sizeof(buf) - 1] = '\0';
-                    if (!INS(buf) || !INSC('.'))
-                        return NULL;
+                    if (!INSSTR(buf) || !INSC('.'))
+                        goto errorquit;
                     assert(strlen(buf) >= 1);
                     if (strlen(buf) == 1) {
                         if (!INS("  "))
-                            return NULL;
+                            goto errorquit;
                     } else {
                         if (!INS(" "))
-                            return NULL;
+                            goto errorquit;
                     }
                 } else {
                     if (!INSC(out_list_bullet_type))
-                        return NULL;
+                        goto errorquit;
                     if (!INS(" "))
-                        return NULL;
+                        goto errorquit;
                 }
                 assert(out_content_start > 0);
             }
@@ -2154,15 +2493,28 @@ S3DHID char *_internal_spew3dweb_markdown_CleanByteBufEx(
                 // We skipped forward, so restart iteration:
                 continue;
         }
-        if (c == '`' && i + 2 < inputlen && !currentlineiscode &&
-                input[i + 1] == '`' && input[i + 2] == '`') {
-            // Since we might be inside a list entry or block where
-            // orig indent will usually be adjusted to the block start
-            // but we want to place our code relative to the backticks,
-            // find actual backtick indent:
-            assert(input[i] == '`');
+        if (pausedinfence > 0 || (c == '`' && i + 2 < inputlen &&
+                !currentlineiscode &&
+                input[i + 1] == '`' && input[i + 2] == '`')) {
             int referenceindent = currentlineorigindent;
-            {
+            int ticks = 3;
+            int insidecontentsstart = i;
+            int insidecontentsend = -1;
+            int isfirstinnerline = 1;
+            if (pausedinfence > 0) {
+                // Go on where the last call stopped, on a line break.
+                // It only stops once the indent to add is known to be
+                // just currentlineeffectiveindent, see below.
+                ticks = pausedinfence;
+                pausedinfence = 0;
+                referenceindent = 0;
+                isfirstinnerline = 0;
+            } else {
+                // Since we might be inside a list entry or block where
+                // orig indent will usually be adjusted to the block
+                // start but we want to place our code relative to the
+                // backticks, find actual backtick indent:
+                assert(input[i] == '`');
                 int candidate_backtick_indent = 0;
                 int i3 = i;
                 while (i3 > 0 && (input[i3 - 1] == ' ' ||
@@ -2177,57 +2529,54 @@ S3DHID char *_internal_spew3dweb_markdown_CleanByteBufEx(
                         input[i3 - 1] == '\n' ||
                         input[i3 - 1] == '\r')))
                     referenceindent = candidate_backtick_indent;
-            }
 
-            // Parse ``` code block.
-            int ticks = 3;
-            i += 3;
-            while (i < inputlen && input[i] == '`') {
-                ticks += 1;
-                i += 1;
-            }
-            if (currentlinehadnonwhitespace) {
-                // Any opening ``` must be on separate line.
-                // Remember to cut trailing space from previous line:
-                while (resultfill > 0 && (
-                        resultchunk[resultfill - 1] == ' ' ||
-                        resultchunk[resultfill - 1] == '\t'))
-                    resultfill--;
-                if (!INS("\n"))
-                    return NULL;
-                if (!INSREP(" ", currentlineeffectiveindent))
-                    return NULL;
-                lastlinehadlistbullet = currentlinehadlistbullet;
-            }
-            if (!INSREP("`", ticks))
-                return NULL;
-            currentlinehadnonwhitespace = 1;
-            currentlineisblockinterruptor = 1;
-            currentlinehadlistbullet = 0;
-            currentlineiscode = 0;
-            currentlinehadnonwhitespaceotherthanbullet = 1;
-            int insidecontentsstart = i;
-            int insidecontentsend = -1;
-            int langnamelen = (
-                spew3dweb_markdown_GetBacktickByteBufLangPrefixLen(
-                    input, inputlen, i
-                )
-            );
-            if (langnamelen > 0) {
-                if (!INSBUF(input + i, langnamelen))
-                    return NULL;
-                i += langnamelen;
-                insidecontentsstart += langnamelen;
-            }
-            while (i < inputlen &&
-                    (input[i] == ' ' || input[i] == '\t')) {
-                i += 1;
-                insidecontentsstart += 1;
+                // Parse ``` code block.
+                i += 3;
+                while (i < inputlen && input[i] == '`') {
+                    ticks += 1;
+                    i += 1;
+                }
+                if (currentlinehadnonwhitespace) {
+                    // Any opening ``` must be on separate line.
+                    // Remember to cut trailing space from previous line:
+                    while (resultfill > 0 && (
+                            resultchunk[resultfill - 1] == ' ' ||
+                            resultchunk[resultfill - 1] == '\t'))
+                        resultfill--;
+                    if (!INS("\n"))
+                        goto errorquit;
+                    if (!INSREP(" ", currentlineeffectiveindent))
+                        goto errorquit;
+                    lastlinehadlistbullet = currentlinehadlistbullet;
+                }
+                if (!INSREP("`", ticks))
+                    goto errorquit;
+                currentlinehadnonwhitespace = 1;
+                currentlineisblockinterruptor = 1;
+                currentlinehadlistbullet = 0;
+                currentlineiscode = 0;
+                currentlinehadnonwhitespaceotherthanbullet = 1;
+                insidecontentsstart = i;
+                int langnamelen = (
+                    spew3dweb_markdown_GetBacktickByteBufLangPrefixLen(
+                        input, inputlen, i
+                    )
+                );
+                if (langnamelen > 0) {
+                    if (!INSBUF(input + i, langnamelen))
+                        goto errorquit;
+                    i += langnamelen;
+                    insidecontentsstart += langnamelen;
+                }
+                while (i < inputlen &&
+                        (input[i] == ' ' || input[i] == '\t')) {
+                    i += 1;
+                    insidecontentsstart += 1;
+                }
             }
 
             // Find inner content area, and find smallest indent:
             // (We're scanning ahead, not writing results yet)
-            int isfirstinnerline = 1;
             int firstinnerlineempty = 1;
             int innerlinestart = i;
             int innerlinecurrentindent = 0;
@@ -2253,19 +2602,14 @@ S3DHID char *_internal_spew3dweb_markdown_CleanByteBufEx(
                         !nonwhitespaceoninnerline) {
                     innerlinecurrentindent += 4;
                 } else {
-                    if (input[i] == '`') {
-                        size_t i2 = i;
-                        while (i2 < inputlen && i2 < i + ticks &&
-                                input[i2] == '`')
-                            i2 += 1;
-                        if (i2 == i + ticks) {
-                            lastinnerlineisblank = (
-                                !nonwhitespaceoninnerline
-                            );
-                            insidecontentsend = i;
-                            i = i2;
-                            break;
-                        }
+                    if (_internal_spew3dweb_markdown_IsFenceClose(
+                            input, inputlen, i, ticks)) {
+                        lastinnerlineisblank = (
+                            !nonwhitespaceoninnerline
+                        );
+                        insidecontentsend = i;
+                        i += ticks;
+                        break;
                     }
                     if (!nonwhitespaceoninnerline &&
                             !isfirstinnerline &&
@@ -2302,12 +2646,31 @@ S3DHID char *_internal_spew3dweb_markdown_CleanByteBufEx(
                 currentlineeffectiveindent -
                 referenceindent
             );
+            if (insidecontentsend < 0 && state->inputcontinues) {
+                // It's not closed yet. Unless a later line could still
+                // lower the smallest indent and with it all of them,
+                // write out what's complete and stop on the last line
+                // break, to go on there next time:
+                size_t pausepos = inputlen;
+                while (pausepos > (size_t)insidecontentsstart &&
+                        input[pausepos - 1] != '\n' &&
+                        input[pausepos - 1] != '\r')
+                    pausepos -= 1;
+                if (pausepos > (size_t)insidecontentsstart &&
+                        (referenceindent == 0 ||
+                        smallestinnerindentseen == 0)) {
+                    insidecontentsend = pausepos - 1;
+                    pausedinfence = ticks;
+                } else {
+                    state->heldfenceticks = ticks;
+                }
+            }
             size_t i2 = insidecontentsstart;
             if (!firstinnerlineempty) {
                 if (!INSC('\n'))
-                    return NULL;
+                    goto errorquit;
                 if (!INSREP(" ", currentlineeffectiveindent))
-                    return NULL;
+                    goto errorquit;
             }
             if (insidecontentsend < 0 ||
                     insidecontentsend > inputlen)
@@ -2320,7 +2683,7 @@ S3DHID char *_internal_spew3dweb_markdown_CleanByteBufEx(
                         i2 += 1;
                     i2 += 1;
                     if (!INSC('\n'))
-                        return NULL;
+                        goto errorquit;
                     int line_orig_indent = 0;
                     while (i2 < insidecontentsend &&
                                 (input[i2] == ' ' || input[i2] == '\t')) {
@@ -2331,7 +2694,7 @@ S3DHID char *_internal_spew3dweb_markdown_CleanByteBufEx(
                     if (i2 > insidecontentsend) {
                         // We must indent this to our final effective indent.
                         if (!INSREP(" ", currentlineeffectiveindent))
-                            return NULL;
+                            goto errorquit;
                         break;
                     }
                     int line_want_indent = line_orig_indent;
@@ -2339,35 +2702,39 @@ S3DHID char *_internal_spew3dweb_markdown_CleanByteBufEx(
                     if (line_want_indent < 0)
                         line_want_indent = 0;
                     if (!INSREP(" ", line_want_indent))
-                        return NULL;
+                        goto errorquit;
                     continue;
                 } else if (input[i2] == '\0') {
                     if (!INS("�"))
-                        return NULL;
+                        goto errorquit;
                 } else {
                     if (!INSC(input[i2]))
-                        return NULL;
+                        goto errorquit;
                 }
                 i2 += 1;
             }
+            if (pausedinfence > 0) {
+                i = insidecontentsend;
+                break;
+            }
             if (insidecontentsend < 0) insidecontentsend = inputlen;
             if (!lastinnerlineisblank) {
                 if (!INSC('\n'))
-                    return NULL;
+                    goto errorquit;
                 if (!INSREP(" ", currentlineeffectiveindent))
-                    return NULL;
+                    goto errorquit;
             }
             i2 = 0;
             while (i2 < ticks) {
                 if (!INSC('`'))
-                    return NULL;
+                    goto errorquit;
                 i2 += 1;
             }
             if (needlinebreakpastticks) {
                 if (!INSC('\n'))
-                    return NULL;
+                    goto errorquit;
                 if (!INSREP(" ", currentlineeffectiveindent))
-                    return NULL;
+                    goto errorquit;
             }
             continue;
         }
@@ -2397,9 +2764,9 @@ S3DHID char *_internal_spew3dweb_markdown_CleanByteBufEx(
                     i2 += 1;
                 int contentstart = i2;
                 if (!INSREP("#", headingnest))
-                    return NULL;
+                    goto errorquit;
                 if (!INS(" "))
-                    return NULL;
+                    goto errorquit;
                 i = i2;
                 continue;
             }
@@ -2419,13 +2786,16 @@ S3DHID char *_internal_spew3dweb_markdown_CleanByteBufEx(
                     i += 1;
                 currentlineisblockinterruptor = 1;
                 lastlinewasemptyorblockinterruptor = 1;
-                char heading[2] = {0};
-                heading[0] = c;
-                if (!INSREP(heading, _getlastoutputlinelen(
-                        resultchunk, resultfill, 1,
-                        lastlinehadlistbullet
-                        )))
-                    return NULL;
+                size_t rulerlen = _getlastoutputlinelen(
+                    resultchunk, resultfill, 1, lastlinehadlistbullet
+                );
+                if (checkagainst ? !_cleancomparechar(
+                        checkagainst, checkagainstlen, &resultfill,
+                        c, rulerlen) :
+                        !_internal_s3dw_markdown_bufappendchar(
+                        &resultchunk, &resultalloc, &resultfill,
+                        c, rulerlen))
+                    goto errorquit;
                 continue;
             }
             if (c != '#' && i + 2 < inputlen &&
@@ -2447,11 +2817,11 @@ S3DHID char *_internal_spew3dweb_markdown_CleanByteBufEx(
                     currentlineisblockinterruptor = 1;
                     lastlinewasemptyorblockinterruptor = 1;
                     if (!INSC(c))
-                        return NULL;
+                        goto errorquit;
                     if (!INSC(c))
-                        return NULL;
+                        goto errorquit;
                     if (!INSC(c))
-                        return NULL;
+                        goto errorquit;
                     continue;
                 }
             }
@@ -2468,13 +2838,24 @@ S3DHID char *_internal_spew3dweb_markdown_CleanByteBufEx(
                 opt_allowunsafehtml,
                 opt_stripcomments,
                 opt_uritransformcallback,
-                opt_uritransform_userdata
+                opt_uritransform_userdata,
+                state->uritransformborrowed,
+                state->plaintextonly,
+                (state->inputcontinues ? &pausedincomment : NULL),
+                checkagainst, checkagainstlen,
+                state->uriscratch, state->uriscratchalloc
             );
             if (i2 < 0)
-                return NULL;
+                goto errorquit;
             assert(i2 > i);
             currentlinehadnonwhitespace = 1;
             i = i2;
+            if (pausedincomment) {
+                // The rest of this line is all in the comment, so
+                // nothing past it may be taken as a heading:
+                currentlinehadnonwhitespaceotherthanbullet = 1;
+                break;
+            }
             continue;
         }
         if (c == '\r' || c == '\n' ||
@@ -2511,12 +2892,23 @@ S3DHID char *_internal_spew3dweb_markdown_CleanByteBufEx(
             // Fix the line break type:
             if (i < inputlen) {
                 if (!INSC('\n'))
-                    return NULL;
+                    goto errorquit;
                 if (c == '\r' &&
                         i + 1 < inputlen &&
                         input[i +  1] == '\n')
                     i++;
                 i++;
+                if (((opt_pauseatfill > 0 &&
+                        resultfill >= opt_pauseatfill) ||
+                        (opt_pauseatinputpos > 0 &&
+                        i >= opt_pauseatinputpos)) &&
+                        i < inputlen && resultfill >= 2 &&
+                        resultchunk[resultfill - 2] == '\n') {
+                    // The line we just ended is empty, so nothing
+                    // that follows can still change how the output
+                    // so far is read. Safe place to pause:
+                    break;
+                }
                 continue;
             } else {
                 break;
@@ -2528,19 +2920,92 @@ S3DHID char *_internal_spew3dweb_markdown_CleanByteBufEx(
         }
         if (c == '\0' && i < inputlen) {
             if (!INS("�"))
-                return NULL;
+                goto errorquit;
         } else {
             if (!INSC(c))
-                return NULL;
+                goto errorquit;
         }
         i++;
     }
-    resultchunk[resultfill] = '\0';
-    if (out_len) *out_len = resultfill;
-    if (out_alloc) *out_alloc = resultalloc;
-    return resultchunk;
+    if (i > inputlen)
+        i = inputlen;
+    if (state->keepposmap && !_mapoutputtoinput(
+            state, resultchunk, resultfill, input, mappedi, i)) {
+        free(resultchunk);
+        goto errorquit;
+    }
+    *inputpos = i;
+    state->resultchunk = resultchunk;
+    state->resultfill = resultfill;
+    state->resultalloc = resultalloc;
+    state->currentlineisblockinterruptor = currentlineisblockinterruptor;
+    state->in_list_logical_nesting_depth = in_list_logical_nesting_depth;
+    state->currentlinehadlistbullet = currentlinehadlistbullet;
+    state->currentlineeffectiveindent = currentlineeffectiveindent;
+    state->currentlineorigindent = currentlineorigindent;
+    state->currentlinehadnonwhitespace = currentlinehadnonwhitespace;
+    state->currentlinehadnonwhitespaceotherthanbullet = (
+        currentlinehadnonwhitespaceotherthanbullet
+    );
+    state->currentlineiscode = currentlineiscode;
+    state->lastnonemptylineeffectiveindent = (
+        lastnonemptylineeffectiveindent
+    );
+    state->lastnonemptylineorigindent = lastnonemptylineorigindent;
+    state->lastnonemptylinewascode = lastnonemptylinewascode;
+    state->lastlinewasemptyorblockinterruptor = (
+        lastlinewasemptyorblockinterruptor
+    );
+    state->lastlinehadlistbullet = lastlinehadlistbullet;
+    state->pausedinfence = pausedinfence;
+    state->pausedincomment = pausedincomment;
+    return 1;
+
+    errorquit: ;
+    // (The append helpers free the buffer themselves on failure.)
+    state->resultchunk = NULL;
+    state->resultfill = 0;
+    state->resultalloc = 0;
+    return 0;
 }
 
+S3DHID char *_internal_spew3dweb_markdown_CleanByteBufEx(
+        const char *input, size_t inputlen,
+        int opt_forcenolinebreaklinks,
+        int opt_forceescapeunambiguousentities,
+        int opt_allowunsafehtml,
+        int opt_stripcomments,
+        char *(*opt_uritransformcallback)(
+            const char *uri, void *userdata
+        ),
+        void *opt_uritransform_userdata,
+        size_t *out_len, size_t *out_alloc
+        ) {
+    _markdown_cleanstate state;
+    _internal_spew3dweb_markdown_InitCleanState(
+        &state, opt_forcenolinebreaklinks,
+        opt_forceescapeunambiguousentities,
+        opt_allowunsafehtml, opt_stripcomments,
+        opt_uritransformcallback, opt_uritransform_userdata
+    );
+    if (!_internal_s3dw_markdown_ensurebufsize(
+            &state.resultchunk, &state.resultalloc,
+            _internal_s3dw_markdown_predictbufsize(
+                inputlen, _S3D_MD_CLEAN_EXPANSION_PERCENT)))
+        return NULL;
+    size_t inputpos = 0;
+    if (!_internal_spew3dweb_markdown_CleanByteBufPart(
+            &state, input, inputlen, &inputpos, 0, 0
+            ))
+        return NULL;
+    assert(inputpos == inputlen);
+    state.resultchunk[state.resultfill] = '\0';
+    if (out_len) *out_len = state.resultfill;
+    if (out_alloc) *out_alloc = state.resultalloc;
+    return state.resultchunk;
+}
+
+
 S3DEXP char *spew3dweb_markdown_CleanEx(
         const char *inputstr, int opt_allowunsafehtml,
         int opt_stripcomments,
@@ -2569,10 +3034,45 @@ S3DEXP char *spew3dweb_markdown_Clean(
     );  
 }
 
+S3DEXP int spew3dweb_markdown_IsByteBufClean(
+        const char *input, size_t inputlen,
+        int opt_allowunsafehtml,
+        int opt_stripcomments,
+        char *(*opt_uritransformcallback)(
+            const char *uri, void *userdata
+        ),
+        void *opt_uritransform_userdata
+        ) {
+    _markdown_cleanstate state;
+    _internal_spew3dweb_markdown_InitCleanState(
+        &state, 0, 0, opt_allowunsafehtml, opt_stripcomments,
+        opt_uritransformcallback, opt_uritransform_userdata
+    );
+    // Nothing is written, and while all output so far matched, the
+    // input is what the cleaner would read back as its output:
+    state.checkagainst = input;
+    state.checkagainstlen = inputlen;
+    state.resultchunk = (char *)input;
+    size_t inputpos = 0;
+    if (!_internal_spew3dweb_markdown_CleanByteBufPart(
+            &state, input, inputlen, &inputpos, 0, 0
+            ))
+        return 0;
+    return (state.resultfill == inputlen);
+}
+
+S3DEXP int spew3dweb_markdown_IsClean(const char *inputstr) {
+    return spew3dweb_markdown_IsByteBufClean(
+        inputstr, strlen(inputstr), 1, 0, NULL, NULL
+    );
+}
+
 #undef INSC
 #undef INSREP
 #undef INS
 #undef INSBUF
+#undef INSSTR
+#undef _S3D_MD_CHECKNOINLINE
 
 #endif  // SPEW3DWEB_IMPLEMENTATION
 
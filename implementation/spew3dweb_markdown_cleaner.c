@@ -0,0 +1,102 @@
+/* Copyright (c) 2023, ellie/@ell1e & Spew3D Web Team (see AUTHORS.md).
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+Alternatively, at your option, this file is offered under the Apache 2
+license, see accompanied LICENSE.md.
+*/
+
+#ifdef SPEW3DWEB_IMPLEMENTATION
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+S3DEXP s3dw_markdown_cleaner *spew3dweb_markdown_NewCleaner(
+        int opt_allowunsafehtml,
+        int opt_stripcomments,
+        char *(*opt_uritransformcallback)(
+            const char *uri, void *userdata
+        ),
+        void *opt_uritransform_userdata
+        ) {
+    s3dw_markdown_cleaner *cleaner = malloc(sizeof(*cleaner));
+    if (!cleaner)
+        return NULL;
+    memset(cleaner, 0, sizeof(*cleaner));
+    cleaner->opt_allowunsafehtml = opt_allowunsafehtml;
+    cleaner->opt_stripcomments = opt_stripcomments;
+    cleaner->opt_uritransformcallback = opt_uritransformcallback;
+    cleaner->opt_uritransform_userdata = opt_uritransform_userdata;
+    return cleaner;
+}
+
+S3DEXP void spew3dweb_markdown_FreeCleaner(
+        s3dw_markdown_cleaner *cleaner
+        ) {
+    if (!cleaner)
+        return;
+    free(cleaner->result);
+    free(cleaner->uriscratch);
+    free(cleaner);
+}
+
+S3DEXP const char *spew3dweb_markdown_CleanerCleanByteBuf(
+        s3dw_markdown_cleaner *cleaner,
+        const char *uncleanbytes, size_t uncleanbyteslen,
+        size_t *out_len
+        ) {
+    // Same options as spew3dweb_markdown_CleanByteBuf() uses:
+    _markdown_cleanstate state;
+    _internal_spew3dweb_markdown_InitCleanState(
+        &state, 0, 0,
+        cleaner->opt_allowunsafehtml, cleaner->opt_stripcomments,
+        cleaner->opt_uritransformcallback,
+        cleaner->opt_uritransform_userdata
+    );
+    state.uriscratch = &cleaner->uriscratch;
+    state.uriscratchalloc = &cleaner->uriscratchalloc;
+
+    // The state takes over the buffer, since a failure frees it:
+    state.resultchunk = cleaner->result;
+    state.resultalloc = cleaner->resultalloc;
+    cleaner->result = NULL;
+    cleaner->resultalloc = 0;
+    if (!_internal_s3dw_markdown_ensurebufsize(
+            &state.resultchunk, &state.resultalloc,
+            _internal_s3dw_markdown_predictbufsize(
+                uncleanbyteslen, _S3D_MD_CLEAN_EXPANSION_PERCENT)))
+        return NULL;
+    size_t inputpos = 0;
+    if (!_internal_spew3dweb_markdown_CleanByteBufPart(
+            &state, uncleanbytes, uncleanbyteslen, &inputpos, 0, 0
+            ))
+        return NULL;
+    assert(inputpos == uncleanbyteslen);
+    state.resultchunk[state.resultfill] = '\0';
+    cleaner->result = state.resultchunk;
+    cleaner->resultalloc = state.resultalloc;
+    if (out_len) *out_len = state.resultfill;
+    return cleaner->result;
+}
+
+#endif  // SPEW3DWEB_IMPLEMENTATION
@@ -0,0 +1,300 @@
+/* Copyright (c) 2023, ellie/@ell1e & Spew3D Web Team (see AUTHORS.md).
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+Alternatively, at your option, this file is offered under the Apache 2
+license, see accompanied LICENSE.md.
+*/
+
+#ifdef SPEW3DWEB_IMPLEMENTATION
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+S3DEXP s3dw_markdown_cleanstream *spew3dweb_markdown_NewCleanStream(
+        int opt_allowunsafehtml,
+        int opt_stripcomments,
+        char *(*opt_uritransformcallback)(
+            const char *uri, void *userdata
+        ),
+        void *opt_uritransform_userdata
+        ) {
+    s3dw_markdown_cleanstream *stream = malloc(sizeof(*stream));
+    if (!stream)
+        return NULL;
+    memset(stream, 0, sizeof(*stream));
+    // Same options as spew3dweb_markdown_CleanByteBuf() uses:
+    _internal_spew3dweb_markdown_InitCleanState(
+        &stream->state, 0, 0,
+        opt_allowunsafehtml, opt_stripcomments,
+        opt_uritransformcallback, opt_uritransform_userdata
+    );
+    if (!_internal_s3dw_markdown_ensurebufsize(
+            &stream->state.resultchunk, &stream->state.resultalloc,
+            256)) {
+        free(stream);
+        return NULL;
+    }
+    return stream;
+}
+
+S3DEXP void spew3dweb_markdown_FreeCleanStream(
+        s3dw_markdown_cleanstream *stream
+        ) {
+    if (!stream)
+        return;
+    free(stream->state.resultchunk);
+    free(stream->pending);
+    free(stream->outheld);
+    free(stream);
+}
+
+/// Returns 1 if the input added since the last call completed a blank
+/// line, and remembers where the last such line ends. Only then can
+/// cleaning get any further than before, unless it goes on a line at
+/// a time, so where the last complete line ends is noted as well.
+static int _md2html_CleanStreamFindBlankLine(
+        s3dw_markdown_cleanstream *stream
+        ) {
+    const char *input = stream->pending;
+    size_t inputlen = stream->pendingfill;
+    size_t i = stream->blanklinecheckpos;
+    int found = 0;
+    while (i < inputlen) {
+        if (input[i] != '\n' && input[i] != '\r') {
+            i += 1;
+            continue;
+        }
+        size_t i2 = i + 1;
+        if (input[i] == '\r' && i2 < inputlen && input[i2] == '\n')
+            i2 += 1;
+        if (input[i] == '\r' && i2 >= inputlen)
+            break;  // Might still be a \r\n, so look again next time.
+        stream->lineend = i2;
+        while (i2 < inputlen && (input[i2] == ' ' ||
+                input[i2] == '\t'))
+            i2 += 1;
+        if (i2 >= inputlen || (input[i2] == '\r' &&
+                i2 + 1 >= inputlen))
+            break;  // Can't tell yet, so look again next time.
+        if (input[i2] == '\n' || input[i2] == '\r') {
+            found = 1;
+            stream->blanklineend = i2 + (input[i2] == '\r' &&
+                input[i2 + 1] == '\n' ? 2 : 1);
+        }
+        i = i2;
+    }
+    stream->blanklinecheckpos = i;
+    return found;
+}
+
+/// Returns 1 if a line added since the last call might end the held
+/// ``` block, or say how far to unindent it. That is any line with
+/// enough backticks, or any that isn't indented.
+static int _md2html_CleanStreamHeldFenceMayEnd(
+        s3dw_markdown_cleanstream *stream
+        ) {
+    const char *input = stream->pending;
+    size_t i = stream->heldcheckpos;
+    int linestart = 1;
+    int backticks = 0;
+    while (i < stream->lineend) {
+        if (input[i] == '\n' || input[i] == '\r') {
+            linestart = 1;
+        } else {
+            if (linestart && input[i] != ' ' && input[i] != '\t')
+                break;
+            linestart = 0;
+        }
+        backticks = (input[i] == '`' ? backticks + 1 : 0);
+        if (backticks >= stream->heldfenceticks)
+            break;
+        i += 1;
+    }
+    stream->heldcheckpos = i;
+    return (i < stream->lineend);
+}
+
+/// Cleans as far as is safe with the input so far. Only the input up
+/// to the last blank line is used, since neither links nor code spans
+/// reach past one. Everything after the last spot where the cleaner
+/// paused on its own at a blank line is rolled back, and is done
+/// again once more input is here. A ``` block or comment still can
+/// reach past blank lines, so when the cleaner stops inside one that
+/// isn't closed yet, that is kept, and from then on it goes on a line
+/// at a time until the block or comment ends.
+static int _md2html_CleanStreamRun(
+        s3dw_markdown_cleanstream *stream, int isfinal
+        ) {
+    _markdown_cleanstate *state = &stream->state;
+    size_t inputlen = (isfinal ? stream->pendingfill :
+        (stream->linewise ? stream->lineend : stream->blanklineend));
+    state->inputcontinues = !isfinal;
+    int isfirst = 1;
+    while (1) {
+        _markdown_cleanstate saved;
+        if (!isfinal)
+            memcpy(&saved, state, sizeof(saved));
+        size_t pos = stream->pendingpos;
+        if (!_internal_spew3dweb_markdown_CleanByteBufPart(
+                state, stream->pending, inputlen,
+                &pos, 0, (isfinal ? 0 : 1)))
+            return 0;
+        if (state->pausedinfence || state->pausedincomment) {
+            stream->pendingpos = pos;
+            stream->linewise = 1;
+            return 1;
+        }
+        if (!isfinal && pos >= inputlen) {
+            if (state->heldfenceticks > 0) {
+                // Don't try again before a line that may end it:
+                stream->heldfenceticks = state->heldfenceticks;
+                stream->heldcheckpos = inputlen;
+            }
+            saved.resultchunk = state->resultchunk;
+            saved.resultalloc = state->resultalloc;
+            memcpy(state, &saved, sizeof(saved));
+            if (isfirst && stream->outheldfill > 0)
+                // Trimming the line may have changed what was held:
+                memcpy(state->resultchunk, stream->outheld,
+                    stream->outheldfill);
+            stream->linewise = 0;
+            return 1;
+        }
+        isfirst = 0;
+        stream->pendingpos = pos;
+        if (isfinal)
+            return 1;
+    }
+}
+
+static const char *_md2html_CleanStreamStep(
+        s3dw_markdown_cleanstream *stream,
+        const char *uncleanbytes, size_t uncleanbyteslen,
+        int isfinal, size_t *out_len
+        ) {
+    if (!stream->state.resultchunk || stream->finished)
+        return NULL;
+    // The output of the last call was handed out already, except for
+    // any that was held back:
+    if (!_internal_s3dw_markdown_ensurebufsize(
+            &stream->state.resultchunk, &stream->state.resultalloc,
+            stream->outheldfill + 1)) {
+        stream->state.resultchunk = NULL;
+        return NULL;
+    }
+    if (stream->outheldfill > 0)
+        memcpy(stream->state.resultchunk, stream->outheld,
+            stream->outheldfill);
+    stream->state.resultfill = stream->outheldfill;
+    if (stream->pendingpos > 1) {
+        // Drop the input that is done, but keep the line break in
+        // front of where we continue since the cleaner checks it:
+        size_t drop = stream->pendingpos - 1;
+        memmove(stream->pending, stream->pending + drop,
+            stream->pendingfill - drop);
+        stream->pendingfill -= drop;
+        stream->pendingpos -= drop;
+        stream->blanklinecheckpos -= drop;
+        stream->blanklineend = (stream->blanklineend > drop ?
+            stream->blanklineend - drop : 0);
+        stream->lineend -= drop;
+        stream->heldcheckpos = (stream->heldcheckpos > drop ?
+            stream->heldcheckpos - drop : 0);
+    }
+    if (uncleanbyteslen > 0) {
+        if (!_internal_s3dw_markdown_bufappend(
+                &stream->pending, &stream->pendingalloc,
+                &stream->pendingfill, uncleanbytes,
+                uncleanbyteslen, 1)) {
+            // (The append helper freed the buffer.)
+            stream->pending = NULL;
+            stream->pendingfill = 0;
+            stream->pendingalloc = 0;
+            free(stream->state.resultchunk);
+            stream->state.resultchunk = NULL;
+            return NULL;
+        }
+    }
+    size_t lineendbefore = stream->lineend;
+    int run = _md2html_CleanStreamFindBlankLine(stream);
+    if (stream->linewise)
+        run = (stream->lineend > lineendbefore);
+    if (stream->heldfenceticks > 0) {
+        // Only a line that may end the held block changes anything:
+        run = _md2html_CleanStreamHeldFenceMayEnd(stream);
+        if (run) {
+            stream->heldfenceticks = 0;
+            stream->linewise = 1;
+        }
+    }
+    if (isfinal || run) {
+        if (!_md2html_CleanStreamRun(stream, isfinal))
+            return NULL;
+    }
+    if (isfinal)
+        stream->finished = 1;
+    char *out = stream->state.resultchunk;
+    size_t outlen = stream->state.resultfill;
+    stream->outheldfill = 0;
+    if (stream->state.pausedincomment) {
+        // Hold back the line the comment is on, since the cleaner will
+        // still look back at it, e.g. to trim trailing spaces once
+        // a removed comment turns out to end the line:
+        while (outlen > 0 && out[outlen - 1] != '\n')
+            outlen -= 1;
+        if (outlen < stream->state.resultfill &&
+                !_internal_s3dw_markdown_bufappend(
+                &stream->outheld, &stream->outheldalloc,
+                &stream->outheldfill, out + outlen,
+                stream->state.resultfill - outlen, 1)) {
+            // (The append helper freed the buffer.)
+            stream->outheld = NULL;
+            stream->outheldalloc = 0;
+            free(stream->state.resultchunk);
+            stream->state.resultchunk = NULL;
+            return NULL;
+        }
+    }
+    out[outlen] = '\0';
+    if (out_len) *out_len = outlen;
+    return out;
+}
+
+S3DEXP const char *spew3dweb_markdown_CleanStreamFeed(
+        s3dw_markdown_cleanstream *stream,
+        const char *uncleanbytes, size_t uncleanbyteslen,
+        size_t *out_len
+        ) {
+    return _md2html_CleanStreamStep(
+        stream, uncleanbytes, uncleanbyteslen, 0, out_len
+    );
+}
+
+S3DEXP const char *spew3dweb_markdown_CleanStreamFinish(
+        s3dw_markdown_cleanstream *stream, size_t *out_len
+        ) {
+    return _md2html_CleanStreamStep(stream, NULL, 0, 1, out_len);
+}
+
+#endif  // SPEW3DWEB_IMPLEMENTATION
@@ -0,0 +1,391 @@
+/* Copyright (c) 2023, ellie/@ell1e & Spew3D Web Team (see AUTHORS.md).
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+Alternatively, at your option, this file is offered under the Apache 2
+license, see accompanied LICENSE.md.
+*/
+
+#ifdef SPEW3DWEB_IMPLEMENTATION
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void _md2html_DocFreeBlocks(
+        _markdown_docblock *blocks, size_t count
+        ) {
+    size_t i = 0;
+    while (i < count) {
+        free(blocks[i].startstate);
+        free(blocks[i].html);
+        i += 1;
+    }
+}
+
+static int _md2html_DocBlockStateIs(
+        _markdown_docblock *block, const int32_t *state
+        ) {
+    if (!block->startstate || !state)
+        return (!block->startstate && !state);
+    return (memcmp(block->startstate, state,
+        sizeof(*state) * _S3D_MD_STREAMSTATE_INTS) == 0);
+}
+
+static int _md2html_DocRenderBlock(
+        s3dw_markdown_document *doc, _markdown_docblock *block,
+        const int32_t *opt_startstate, int32_t *out_endstate,
+        int keepanchors
+        ) {
+    if (opt_startstate) {
+        block->startstate = malloc(
+            sizeof(*block->startstate) * _S3D_MD_STREAMSTATE_INTS
+        );
+        if (!block->startstate)
+            return 0;
+        memcpy(block->startstate, opt_startstate,
+            sizeof(*block->startstate) * _S3D_MD_STREAMSTATE_INTS);
+    }
+    size_t pos = block->start;
+    size_t htmllen = 0;
+    const char *html = _internal_s3dw_markdown_RendererRenderBlock(
+        doc->renderer, doc->text, doc->textlen, &pos,
+        opt_startstate, out_endstate, keepanchors,
+        &doc->options, &htmllen
+    );
+    if (!html)
+        return 0;
+    assert(pos > block->start);
+    block->len = pos - block->start;
+    block->html = malloc(htmllen + 1);
+    if (!block->html)
+        return 0;
+    memcpy(block->html, html, htmllen + 1);
+    block->htmllen = htmllen;
+    return 1;
+}
+
+static int _md2html_DocBlockIsSame(
+        _markdown_docblock *oldblock, _markdown_docblock *newblock,
+        size_t shift
+        ) {
+    return (oldblock->start + shift == newblock->start &&
+        oldblock->len == newblock->len &&
+        oldblock->htmllen == newblock->htmllen &&
+        memcmp(oldblock->html, newblock->html, newblock->htmllen) == 0 &&
+        _md2html_DocBlockStateIs(oldblock, newblock->startstate));
+}
+
+S3DEXP s3dw_markdown_document *spew3dweb_markdown_NewDocument(
+        const char *markdownbytes, size_t markdownbyteslen,
+        s3dw_markdown_tohtmloptions *options
+        ) {
+    s3dw_markdown_document *doc = malloc(sizeof(*doc));
+    if (!doc)
+        return NULL;
+    memset(doc, 0, sizeof(*doc));
+    if (options)
+        memcpy(&doc->options, options, sizeof(*options));
+    doc->renderer = spew3dweb_markdown_NewRenderer();
+    doc->text = malloc(1);
+    if (!doc->renderer || !doc->text) {
+        spew3dweb_markdown_FreeDocument(doc);
+        return NULL;
+    }
+    doc->text[0] = '\0';
+    doc->textalloc = 1;
+    if (!spew3dweb_markdown_DocumentEdit(
+            doc, 0, 0, markdownbytes, markdownbyteslen,
+            NULL, NULL, NULL
+            )) {
+        spew3dweb_markdown_FreeDocument(doc);
+        return NULL;
+    }
+    return doc;
+}
+
+S3DEXP void spew3dweb_markdown_FreeDocument(
+        s3dw_markdown_document *doc
+        ) {
+    if (!doc)
+        return;
+    size_t i = 0;
+    while (i < doc->blockcount) {
+        free(doc->blocks[i].startstate);
+        free(doc->blocks[i].html);
+        i += 1;
+    }
+    free(doc->blocks);
+    free(doc->text);
+    free(doc->html);
+    spew3dweb_markdown_FreeRenderer(doc->renderer);
+    free(doc);
+}
+
+S3DEXP int spew3dweb_markdown_DocumentEdit(
+        s3dw_markdown_document *doc,
+        size_t offset, size_t removelen,
+        const char *insertbytes, size_t insertlen,
+        size_t *out_firstfragment, size_t *out_removedfragments,
+        size_t *out_addedfragments
+        ) {
+    if (offset > doc->textlen || removelen > doc->textlen - offset)
+        return 0;
+    size_t oldtextlen = doc->textlen;
+    size_t newtextlen = oldtextlen - removelen + insertlen;
+    if (newtextlen + 1 > doc->textalloc) {
+        size_t newalloc = doc->textalloc * 2;
+        if (newalloc < newtextlen + 1)
+            newalloc = newtextlen + 1;
+        char *newtext = realloc(doc->text, newalloc);
+        if (!newtext)
+            return 0;
+        doc->text = newtext;
+        doc->textalloc = newalloc;
+    }
+
+    // Find the block with the edit, and start one earlier since the
+    // split before the edited block may depend on its first line.
+    // Unique anchors depend on all headings before, so then we start
+    // at the very beginning:
+    int uniqueanchors = doc->options.unique_heading_anchors;
+    size_t firstblock = 0;
+    if (doc->blockcount > 0 && !uniqueanchors) {
+        size_t low = 0;
+        size_t high = doc->blockcount - 1;
+        while (low < high) {
+            size_t mid = (low + high + 1) / 2;
+            if (doc->blocks[mid].start <= offset)
+                low = mid;
+            else
+                high = mid - 1;
+        }
+        firstblock = (low > 0 ? low - 1 : 0);
+    }
+    size_t rescanstart = (doc->blockcount > 0 ?
+        doc->blocks[firstblock].start : 0);
+    // Blocks starting after the edit have unchanged text, so once we
+    // hit one's start again in the same state the rest stays as it is:
+    size_t keepblock = firstblock;
+    while (keepblock < doc->blockcount &&
+            doc->blocks[keepblock].start < offset + removelen)
+        keepblock += 1;
+
+    // Apply the edit, but keep what we removed in case we fail:
+    char *removed = NULL;
+    if (removelen > 0) {
+        removed = malloc(removelen);
+        if (!removed)
+            return 0;
+        memcpy(removed, doc->text + offset, removelen);
+    }
+    memmove(doc->text + offset + insertlen,
+        doc->text + offset + removelen,
+        oldtextlen - offset - removelen);
+    if (insertlen > 0)
+        memcpy(doc->text + offset, insertbytes, insertlen);
+    doc->text[newtextlen] = '\0';
+    doc->textlen = newtextlen;
+
+    // Render the changed area again, each block continuing in the state
+    // the one before it ended in:
+    _markdown_docblock *newblocks = NULL;
+    size_t newblockcount = 0;
+    size_t newblockalloc = 0;
+    size_t reused = 0;
+    size_t i = 0;
+    int32_t state[_S3D_MD_STREAMSTATE_INTS];
+    int hasstate = 0;
+    if (firstblock < doc->blockcount &&
+            doc->blocks[firstblock].startstate) {
+        memcpy(state, doc->blocks[firstblock].startstate, sizeof(state));
+        hasstate = 1;
+    }
+    size_t pos = rescanstart;
+    while (pos < newtextlen) {
+        while (keepblock < doc->blockcount &&
+                doc->blocks[keepblock].start + insertlen -
+                removelen < pos)
+            keepblock += 1;
+        if (!uniqueanchors && newblockcount > 0 &&
+                keepblock < doc->blockcount &&
+                doc->blocks[keepblock].start + insertlen -
+                removelen == pos &&
+                _md2html_DocBlockStateIs(&doc->blocks[keepblock],
+                    (hasstate ? state : NULL)))
+            break;
+        if (newblockcount >= newblockalloc) {
+            size_t newalloc = newblockalloc * 2 + 4;
+            _markdown_docblock *grown = realloc(
+                newblocks, sizeof(*newblocks) * newalloc
+            );
+            if (!grown)
+                goto errorquit;
+            newblocks = grown;
+            newblockalloc = newalloc;
+        }
+        memset(&newblocks[newblockcount], 0, sizeof(*newblocks));
+        newblocks[newblockcount].start = pos;
+        newblockcount += 1;
+        if (!_md2html_DocRenderBlock(doc, &newblocks[newblockcount - 1],
+                (hasstate ? state : NULL), state, newblockcount > 1))
+            goto errorquit;
+        hasstate = 1;
+        pos += newblocks[newblockcount - 1].len;
+    }
+    if (pos >= newtextlen)
+        keepblock = doc->blockcount;
+
+    // Make room for the new blocks:
+    size_t oldcount = doc->blockcount;
+    size_t newcount = oldcount - (keepblock - firstblock) + newblockcount;
+    if (newcount > doc->blockalloc) {
+        size_t newalloc = doc->blockalloc * 2;
+        if (newalloc < newcount)
+            newalloc = newcount;
+        _markdown_docblock *grown = realloc(
+            doc->blocks, sizeof(*doc->blocks) * newalloc
+        );
+        if (!grown)
+            goto errorquit;
+        doc->blocks = grown;
+        doc->blockalloc = newalloc;
+    }
+
+    // Blocks that came out the same at either end are left as they were,
+    // so they're not reported as changed:
+    while (reused < newblockcount && firstblock + reused < keepblock &&
+            _md2html_DocBlockIsSame(
+                &doc->blocks[firstblock + reused], &newblocks[reused], 0
+            ))
+        reused += 1;
+    while (newblockcount > reused && keepblock > firstblock + reused &&
+            _md2html_DocBlockIsSame(
+                &doc->blocks[keepblock - 1],
+                &newblocks[newblockcount - 1], insertlen - removelen
+            )) {
+        _md2html_DocFreeBlocks(&newblocks[newblockcount - 1], 1);
+        newblockcount -= 1;
+        keepblock -= 1;
+    }
+    _md2html_DocFreeBlocks(newblocks, reused);
+
+    // Splice the new blocks in:
+    size_t replacedcount = keepblock - firstblock;
+    _md2html_DocFreeBlocks(doc->blocks + firstblock + reused,
+        replacedcount - reused);
+    newcount = oldcount - replacedcount + newblockcount;
+    if (keepblock < oldcount)
+        memmove(doc->blocks + firstblock + newblockcount,
+            doc->blocks + keepblock,
+            sizeof(*doc->blocks) * (oldcount - keepblock));
+    if (reused < newblockcount)
+        memcpy(doc->blocks + firstblock + reused, newblocks + reused,
+            sizeof(*newblocks) * (newblockcount - reused));
+    doc->blockcount = newcount;
+    i = firstblock + newblockcount;
+    while (i < newcount) {
+        doc->blocks[i].start += insertlen;
+        doc->blocks[i].start -= removelen;
+        i += 1;
+    }
+    free(newblocks);
+    free(removed);
+    doc->htmlvalid = 0;
+    if (out_firstfragment) *out_firstfragment = firstblock + reused;
+    if (out_removedfragments)
+        *out_removedfragments = replacedcount - reused;
+    if (out_addedfragments) *out_addedfragments = newblockcount - reused;
+    return 1;
+
+    errorquit: ;
+    _md2html_DocFreeBlocks(newblocks, newblockcount);
+    free(newblocks);
+    // Undo our edit of the text:
+    memmove(doc->text + offset + removelen,
+        doc->text + offset + insertlen,
+        oldtextlen - offset - removelen);
+    if (removelen > 0)
+        memcpy(doc->text + offset, removed, removelen);
+    doc->text[oldtextlen] = '\0';
+    doc->textlen = oldtextlen;
+    free(removed);
+    return 0;
+}
+
+S3DEXP size_t spew3dweb_markdown_DocumentGetFragmentCount(
+        s3dw_markdown_document *doc
+        ) {
+    return doc->blockcount;
+}
+
+S3DEXP const char *spew3dweb_markdown_DocumentGetFragment(
+        s3dw_markdown_document *doc, size_t index, size_t *out_len
+        ) {
+    if (index >= doc->blockcount)
+        return NULL;
+    if (out_len) *out_len = doc->blocks[index].htmllen;
+    return doc->blocks[index].html;
+}
+
+S3DEXP const char *spew3dweb_markdown_DocumentGetHTML(
+        s3dw_markdown_document *doc, size_t *out_len
+        ) {
+    if (!doc->htmlvalid) {
+        size_t total = 0;
+        size_t i = 0;
+        while (i < doc->blockcount) {
+            total += doc->blocks[i].htmllen;
+            i += 1;
+        }
+        if (!doc->html || total + 1 > doc->htmlalloc) {
+            char *newhtml = realloc(doc->html, total + 1);
+            if (!newhtml)
+                return NULL;
+            doc->html = newhtml;
+            doc->htmlalloc = total + 1;
+        }
+        size_t fill = 0;
+        i = 0;
+        while (i < doc->blockcount) {
+            memcpy(doc->html + fill, doc->blocks[i].html,
+                doc->blocks[i].htmllen);
+            fill += doc->blocks[i].htmllen;
+            i += 1;
+        }
+        doc->html[fill] = '\0';
+        doc->htmllen = fill;
+        doc->htmlvalid = 1;
+    }
+    if (out_len) *out_len = doc->htmllen;
+    return doc->html;
+}
+
+S3DEXP const char *spew3dweb_markdown_DocumentGetMarkdown(
+        s3dw_markdown_document *doc, size_t *out_len
+        ) {
+    if (out_len) *out_len = doc->textlen;
+    return doc->text;
+}
+
+#endif  // SPEW3DWEB_IMPLEMENTATION
@@ -0,0 +1,428 @@
+/* Copyright (c) 2023, ellie/@ell1e & Spew3D Web Team (see AUTHORS.md).
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+Alternatively, at your option, this file is offered under the Apache 2
+license, see accompanied LICENSE.md.
+*/
+
+#ifdef SPEW3DWEB_IMPLEMENTATION
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(SPEW3DWEB_OPTION_DISABLE_SIMD) && \
+        (defined(__GNUC__) || defined(__clang__)) && \
+        (defined(__x86_64__) || defined(__i386__))
+#define _S3D_MD_LINESCAN_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+static size_t _md2html_FindLineBreaksScalar(
+        const char *buf, size_t buflen, size_t i,
+        size_t *out_positions, size_t maxpositions
+        ) {
+    size_t found = 0;
+    while (i < buflen) {
+        if (buf[i] == '\n' || buf[i] == '\r') {
+            out_positions[found] = i;
+            found += 1;
+            if (found >= maxpositions)
+                return found;
+        }
+        i += 1;
+    }
+    return found;
+}
+
+#ifdef _S3D_MD_LINESCAN_HAVE_X86
+__attribute__((target("sse2")))
+static size_t _md2html_FindLineBreaksSSE2(
+        const char *buf, size_t buflen, size_t i,
+        size_t *out_positions, size_t maxpositions
+        ) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i carriagereturn = _mm_set1_epi8('\r');
+    size_t found = 0;
+    while (i + 16 <= buflen) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(buf + i));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, newline),
+            _mm_cmpeq_epi8(chunk, carriagereturn))
+        );
+        while (mask != 0) {
+            out_positions[found] = i + __builtin_ctz(mask);
+            found += 1;
+            if (found >= maxpositions)
+                return found;
+            mask &= mask - 1;
+        }
+        i += 16;
+    }
+    return found + _md2html_FindLineBreaksScalar(
+        buf, buflen, i, out_positions + found, maxpositions - found
+    );
+}
+
+__attribute__((target("avx2")))
+static size_t _md2html_FindLineBreaksAVX2(
+        const char *buf, size_t buflen, size_t i,
+        size_t *out_positions, size_t maxpositions
+        ) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i carriagereturn = _mm256_set1_epi8('\r');
+    size_t found = 0;
+    while (i + 32 <= buflen) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(buf + i));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(chunk, newline),
+            _mm256_cmpeq_epi8(chunk, carriagereturn))
+        );
+        while (mask != 0) {
+            out_positions[found] = i + __builtin_ctz(mask);
+            found += 1;
+            if (found >= maxpositions)
+                return found;
+            mask &= mask - 1;
+        }
+        i += 32;
+    }
+    return found + _md2html_FindLineBreaksScalar(
+        buf, buflen, i, out_positions + found, maxpositions - found
+    );
+}
+#endif
+
+static int _md2html_IsEscapeChar(char c) {
+    return (c == '&' || c == '<' || c == '>' || c == '\'' || c == '"');
+}
+
+static size_t _md2html_FindEscapeCharSWAR(
+        const char *buf, size_t buflen, size_t i
+        ) {
+    // Check 8 bytes at once for any of the five, and only look at
+    // them one by one where there is one:
+    const uint64_t ones = 0x0101010101010101ULL;
+    const uint64_t highs = 0x8080808080808080ULL;
+    while (i + 8 <= buflen) {
+        uint64_t word;
+        memcpy(&word, buf + i, sizeof(word));
+        uint64_t amp = word ^ (ones * '&');
+        uint64_t lt = word ^ (ones * '<');
+        uint64_t gt = word ^ (ones * '>');
+        uint64_t apos = word ^ (ones * '\'');
+        uint64_t quot = word ^ (ones * '"');
+        uint64_t hit = (((amp - ones) & ~amp) | ((lt - ones) & ~lt) |
+            ((gt - ones) & ~gt) | ((apos - ones) & ~apos) |
+            ((quot - ones) & ~quot)) & highs;
+        if (hit != 0)
+            break;
+        i += 8;
+    }
+    while (i < buflen && !_md2html_IsEscapeChar(buf[i]))
+        i += 1;
+    return i;
+}
+
+#ifdef _S3D_MD_LINESCAN_HAVE_X86
+__attribute__((target("sse2")))
+static size_t _md2html_FindEscapeCharSSE2(
+        const char *buf, size_t buflen, size_t i
+        ) {
+    const __m128i amp = _mm_set1_epi8('&');
+    const __m128i lt = _mm_set1_epi8('<');
+    const __m128i gt = _mm_set1_epi8('>');
+    const __m128i apos = _mm_set1_epi8('\'');
+    const __m128i quot = _mm_set1_epi8('"');
+    while (i + 16 <= buflen) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(buf + i));
+        __m128i hit = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, amp),
+            _mm_cmpeq_epi8(chunk, lt)),
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, gt),
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, apos),
+            _mm_cmpeq_epi8(chunk, quot))));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(hit);
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+        i += 16;
+    }
+    return _md2html_FindEscapeCharSWAR(buf, buflen, i);
+}
+
+__attribute__((target("avx2")))
+static size_t _md2html_FindEscapeCharAVX2(
+        const char *buf, size_t buflen, size_t i
+        ) {
+    const __m256i amp = _mm256_set1_epi8('&');
+    const __m256i lt = _mm256_set1_epi8('<');
+    const __m256i gt = _mm256_set1_epi8('>');
+    const __m256i apos = _mm256_set1_epi8('\'');
+    const __m256i quot = _mm256_set1_epi8('"');
+    while (i + 32 <= buflen) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(buf + i));
+        __m256i hit = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(chunk, amp),
+            _mm256_cmpeq_epi8(chunk, lt)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(chunk, gt),
+            _mm256_or_si256(_mm256_cmpeq_epi8(chunk, apos),
+            _mm256_cmpeq_epi8(chunk, quot))));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(hit);
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+        i += 32;
+    }
+    // Not calling into the SSE2 version for the rest, since going from
+    // AVX to legacy SSE code can stall a lot on some CPUs:
+    while (i < buflen && !_md2html_IsEscapeChar(buf[i]))
+        i += 1;
+    return i;
+}
+#endif
+
+static int _md2html_IsInlineSpecialChar(char c) {
+    return (c == '\n' || c == '\r' || c == '\0' || c == '`' ||
+        c == '<' || c == '>' || c == '&' || c == '\\' ||
+        c == '!' || c == '[');
+}
+
+static size_t _md2html_FindInlineSpecialCharSWAR(
+        const char *buf, size_t buflen, size_t i
+        ) {
+    const uint64_t ones = 0x0101010101010101ULL;
+    const uint64_t highs = 0x8080808080808080ULL;
+    const char chars[] = "\n\r`<>&\\![";
+    while (i + 8 <= buflen) {
+        uint64_t word;
+        memcpy(&word, buf + i, sizeof(word));
+        // A zero byte is special too, so start out with that one:
+        uint64_t hit = (word - ones) & ~word;
+        int k = 0;
+        while (k < (int)sizeof(chars) - 1) {
+            uint64_t x = word ^ (ones * (unsigned char)chars[k]);
+            hit |= (x - ones) & ~x;
+            k += 1;
+        }
+        if ((hit & highs) != 0)
+            break;
+        i += 8;
+    }
+    while (i < buflen && !_md2html_IsInlineSpecialChar(buf[i]))
+        i += 1;
+    return i;
+}
+
+#ifdef _S3D_MD_LINESCAN_HAVE_X86
+__attribute__((target("sse2")))
+static size_t _md2html_FindInlineSpecialCharSSE2(
+        const char *buf, size_t buflen, size_t i
+        ) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i carriagereturn = _mm_set1_epi8('\r');
+    const __m128i backtick = _mm_set1_epi8('`');
+    const __m128i lt = _mm_set1_epi8('<');
+    const __m128i gt = _mm_set1_epi8('>');
+    const __m128i amp = _mm_set1_epi8('&');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i exclamation = _mm_set1_epi8('!');
+    const __m128i bracket = _mm_set1_epi8('[');
+    while (i + 16 <= buflen) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(buf + i));
+        __m128i hit = _mm_or_si128(
+            _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, zero),
+                _mm_cmpeq_epi8(chunk, newline)),
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, carriagereturn),
+                _mm_cmpeq_epi8(chunk, backtick))),
+            _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, lt),
+                _mm_cmpeq_epi8(chunk, gt)),
+                _mm_or_si128(
+                    _mm_or_si128(_mm_cmpeq_epi8(chunk, amp),
+                    _mm_cmpeq_epi8(chunk, backslash)),
+                    _mm_or_si128(_mm_cmpeq_epi8(chunk, exclamation),
+                    _mm_cmpeq_epi8(chunk, bracket)))));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(hit);
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+        i += 16;
+    }
+    return _md2html_FindInlineSpecialCharSWAR(buf, buflen, i);
+}
+
+__attribute__((target("avx2")))
+static size_t _md2html_FindInlineSpecialCharAVX2(
+        const char *buf, size_t buflen, size_t i
+        ) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i carriagereturn = _mm256_set1_epi8('\r');
+    const __m256i backtick = _mm256_set1_epi8('`');
+    const __m256i lt = _mm256_set1_epi8('<');
+    const __m256i gt = _mm256_set1_epi8('>');
+    const __m256i amp = _mm256_set1_epi8('&');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i exclamation = _mm256_set1_epi8('!');
+    const __m256i bracket = _mm256_set1_epi8('[');
+    while (i + 32 <= buflen) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(buf + i));
+        __m256i hit = _mm256_or_si256(
+            _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(chunk, zero),
+                _mm256_cmpeq_epi8(chunk, newline)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(chunk, carriagereturn),
+                _mm256_cmpeq_epi8(chunk, backtick))),
+            _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(chunk, lt),
+                _mm256_cmpeq_epi8(chunk, gt)),
+                _mm256_or_si256(
+                    _mm256_or_si256(_mm256_cmpeq_epi8(chunk, amp),
+                    _mm256_cmpeq_epi8(chunk, backslash)),
+                    _mm256_or_si256(
+                    _mm256_cmpeq_epi8(chunk, exclamation),
+                    _mm256_cmpeq_epi8(chunk, bracket)))));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(hit);
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+        i += 32;
+    }
+    while (i < buflen && !_md2html_IsInlineSpecialChar(buf[i]))
+        i += 1;
+    return i;
+}
+#endif
+
+S3DHID int _internal_s3dw_markdown_LineScanImplSupported(int impl) {
+    if (impl == _S3D_MD_LINESCAN_SCALAR)
+        return 1;
+    #ifdef _S3D_MD_LINESCAN_HAVE_X86
+    __builtin_cpu_init();
+    if (impl == _S3D_MD_LINESCAN_SSE2)
+        return (__builtin_cpu_supports("sse2") != 0);
+    if (impl == _S3D_MD_LINESCAN_AVX2)
+        return (__builtin_cpu_supports("avx2") != 0);
+    #endif
+    return 0;
+}
+
+static volatile int _md2html_linescan_impl = -1;
+
+static int _md2html_AutoLineScanImpl(void) {
+    int impl = _md2html_linescan_impl;
+    if (impl < 0) {
+        // First use, so pick the fastest one the CPU can do:
+        impl = _S3D_MD_LINESCAN_SCALAR;
+        if (_internal_s3dw_markdown_LineScanImplSupported(
+                _S3D_MD_LINESCAN_AVX2))
+            impl = _S3D_MD_LINESCAN_AVX2;
+        else if (_internal_s3dw_markdown_LineScanImplSupported(
+                _S3D_MD_LINESCAN_SSE2))
+            impl = _S3D_MD_LINESCAN_SSE2;
+        _md2html_linescan_impl = impl;
+    }
+    return impl;
+}
+
+S3DHID size_t _internal_s3dw_markdown_FindLineBreaksWith(
+        int impl, const char *buf, size_t buflen, size_t startpos,
+        size_t *out_positions, size_t maxpositions
+        ) {
+    assert(maxpositions > 0);
+    if (impl == _S3D_MD_LINESCAN_AUTO)
+        impl = _md2html_AutoLineScanImpl();
+    #ifdef _S3D_MD_LINESCAN_HAVE_X86
+    if (impl == _S3D_MD_LINESCAN_AVX2)
+        return _md2html_FindLineBreaksAVX2(
+            buf, buflen, startpos, out_positions, maxpositions
+        );
+    if (impl == _S3D_MD_LINESCAN_SSE2)
+        return _md2html_FindLineBreaksSSE2(
+            buf, buflen, startpos, out_positions, maxpositions
+        );
+    #endif
+    return _md2html_FindLineBreaksScalar(
+        buf, buflen, startpos, out_positions, maxpositions
+    );
+}
+
+S3DHID size_t _internal_s3dw_markdown_FindLineBreaks(
+        const char *buf, size_t buflen, size_t startpos,
+        size_t *out_positions, size_t maxpositions
+        ) {
+    return _internal_s3dw_markdown_FindLineBreaksWith(
+        _S3D_MD_LINESCAN_AUTO, buf, buflen, startpos,
+        out_positions, maxpositions
+    );
+}
+
+S3DHID size_t _internal_s3dw_markdown_FindEscapeCharWith(
+        int impl, const char *buf, size_t buflen, size_t startpos
+        ) {
+    if (impl == _S3D_MD_LINESCAN_AUTO)
+        impl = _md2html_AutoLineScanImpl();
+    #ifdef _S3D_MD_LINESCAN_HAVE_X86
+    if (impl == _S3D_MD_LINESCAN_AVX2)
+        return _md2html_FindEscapeCharAVX2(buf, buflen, startpos);
+    if (impl == _S3D_MD_LINESCAN_SSE2)
+        return _md2html_FindEscapeCharSSE2(buf, buflen, startpos);
+    #endif
+    return _md2html_FindEscapeCharSWAR(buf, buflen, startpos);
+}
+
+S3DHID size_t _internal_s3dw_markdown_FindEscapeChar(
+        const char *buf, size_t buflen, size_t startpos
+        ) {
+    return _internal_s3dw_markdown_FindEscapeCharWith(
+        _S3D_MD_LINESCAN_AUTO, buf, buflen, startpos
+    );
+}
+
+S3DHID size_t _internal_s3dw_markdown_FindInlineSpecialCharWith(
+        int impl, const char *buf, size_t buflen, size_t startpos
+        ) {
+    if (impl == _S3D_MD_LINESCAN_AUTO)
+        impl = _md2html_AutoLineScanImpl();
+    #ifdef _S3D_MD_LINESCAN_HAVE_X86
+    if (impl == _S3D_MD_LINESCAN_AVX2)
+        return _md2html_FindInlineSpecialCharAVX2(
+            buf, buflen, startpos
+        );
+    if (impl == _S3D_MD_LINESCAN_SSE2)
+        return _md2html_FindInlineSpecialCharSSE2(
+            buf, buflen, startpos
+        );
+    #endif
+    return _md2html_FindInlineSpecialCharSWAR(buf, buflen, startpos);
+}
+
+S3DHID size_t _internal_s3dw_markdown_FindInlineSpecialChar(
+        const char *buf, size_t buflen, size_t startpos
+        ) {
+    return _internal_s3dw_markdown_FindInlineSpecialCharWith(
+        _S3D_MD_LINESCAN_AUTO, buf, buflen, startpos
+    );
+}
+
+#endif  // SPEW3DWEB_IMPLEMENTATION
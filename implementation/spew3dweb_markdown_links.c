@@ -0,0 +1,604 @@
+/* Copyright (c) 2023, ellie/@ell1e & Spew3D Web Team (see AUTHORS.md).
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+Alternatively, at your option, this file is offered under the Apache 2
+license, see accompanied LICENSE.md.
+*/
+
+#ifdef SPEW3DWEB_IMPLEMENTATION
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct _md2html_linkscan {
+    const char *input;
+    size_t inputlen;
+    s3dw_markdown_links *links;
+    size_t line, linecountedupto;
+    size_t cleanspanend;  // End of the cleaner's current code span.
+    int incode;  // If the renderer is inside inline code right now.
+} _md2html_linkscan;
+
+static int _md2html_AddLinkEntry(
+        _md2html_linkscan *scan, int isimage, size_t offset,
+        size_t len, size_t textstart, size_t textlen,
+        size_t urlstart, size_t urllen
+        ) {
+    s3dw_markdown_links *links = scan->links;
+    if (links->count >= links->alloc) {
+        size_t newalloc = (links->alloc < 16 ? 16 :
+            links->alloc * 2);
+        s3dw_markdown_linkentry *newentries = realloc(
+            links->entries, sizeof(*newentries) * newalloc
+        );
+        if (!newentries)
+            return 0;
+        links->entries = newentries;
+        links->alloc = newalloc;
+    }
+    // Only count line breaks up to here, so this stays linear:
+    const char *input = scan->input;
+    size_t i = scan->linecountedupto;
+    while (i < offset) {
+        if (input[i] == '\n' || (input[i] == '\r' &&
+                (i + 1 >= offset || input[i + 1] != '\n')))
+            scan->line += 1;
+        i += 1;
+    }
+    scan->linecountedupto = offset;
+    s3dw_markdown_linkentry *entry = &links->entries[links->count];
+    entry->isimage = isimage;
+    entry->line = scan->line;
+    entry->offset = offset;
+    entry->len = len;
+    entry->textstart = textstart;
+    entry->textlen = textlen;
+    entry->urlstart = urlstart;
+    entry->urllen = urllen;
+    links->count += 1;
+    return 1;
+}
+
+static int _md2html_LinkScanLineOnlyChar(
+        const char *input, size_t inputlen, size_t i, char c
+        ) {
+    if (i >= inputlen || input[i] != c)
+        return 0;
+    while (i < inputlen && input[i] == c)
+        i += 1;
+    while (i < inputlen && (input[i] == ' ' ||
+            input[i] == '\t'))
+        i += 1;
+    return (i >= inputlen || input[i] == '\n' || input[i] == '\r');
+}
+
+static int _md2html_LinkScanCountPipes(
+        const char *input, size_t i, size_t lineend
+        ) {
+    int pipes = 0;
+    while (i < lineend) {
+        if (input[i] == '|')
+            pipes += 1;
+        i += 1;
+    }
+    return pipes;
+}
+
+static int _md2html_IsLinkScanChar(char c) {
+    // Line breaks and what may start markup. Everything up to '\r'
+    // is let through since one range test is quicker:
+    return ((unsigned char)c <= '\r' || c == '`' || c == '<' ||
+        c == '\\' || c == '!' || c == '[');
+}
+
+/// Walks an inline area the way the renderer sees it once it went
+/// through the cleaner, and notes down the links and images. Backticks
+/// the cleaner keeps toggle inline code like in the renderer, others
+/// get escaped by it and do nothing. Returns where it stopped, or -1
+/// when out of memory.
+static ssize_t _md2html_ScanInlineForLinks(
+        _md2html_linkscan *scan, size_t inputlen, size_t startpos,
+        int origindent, int insidelinktext
+        ) {
+    const char *input = scan->input;
+    size_t i = startpos;
+    while (i < inputlen) {
+        if (scan->incode) {
+            // The renderer's inline code runs to the very next backtick,
+            // or on to the next line of the same paragraph:
+            while (i < inputlen && input[i] != '`' &&
+                    ((input[i] != '\n' && input[i] != '\r') ||
+                    insidelinktext || i < scan->cleanspanend))
+                i += 1;
+            if (i >= inputlen || input[i] != '`' ||
+                    (i >= scan->cleanspanend && i + 2 < inputlen &&
+                    input[i + 1] == '`' && input[i + 2] == '`'))
+                return i;  // (A ``` starts a new block in the cleaner.)
+            if (i >= scan->cleanspanend &&
+                    (i == 0 || input[i - 1] != '\\')) {
+                // The cleaner may see a code span start right here:
+                scan->cleanspanend = i + (
+                    _internal_spew3dweb_markdown_GetInlineCodeLen(
+                        input, (insidelinktext ? inputlen :
+                        scan->inputlen), i, origindent, NULL
+                    ));
+            }
+            scan->incode = 0;
+            i += 1;
+            continue;
+        }
+        const char c = input[i];
+        if (!_md2html_IsLinkScanChar(c)) {
+            i += 1;
+            continue;
+        }
+        const int incleanspan = (i < scan->cleanspanend);
+        if ((c == '\n' || c == '\r') && !insidelinktext &&
+                !incleanspan)
+            return i;
+        if (c == '`' && !incleanspan && i + 2 < inputlen &&
+                input[i + 1] == '`' && input[i + 2] == '`')
+            return i;
+        int _commentskip = -1;
+        if (c == '<' && !incleanspan && (_commentskip =
+                _internal_spew3dweb_skipmarkdownhtmlcomment(
+                    input, inputlen, i
+                )) > 0) {
+            i += _commentskip;
+            continue;
+        } else if (c == '\\') {
+            i += 1;
+            if (i < inputlen && input[i] != '\r' &&
+                    input[i] != '\n' && input[i] != '\0')
+                i += 1;
+            continue;
+        } else if (c == '`') {
+            if (!incleanspan) {
+                // The cleaner sees past table cells, but not link texts:
+                size_t codelen = (
+                    _internal_spew3dweb_markdown_GetInlineCodeLen(
+                        input, (insidelinktext ? inputlen :
+                        scan->inputlen), i, origindent, NULL
+                    ));
+                if (codelen == 0) {
+                    // The cleaner escapes this one.
+                    i += 1;
+                    continue;
+                }
+                scan->cleanspanend = i + codelen;
+            }
+            scan->incode = 1;
+            i += 1;
+            continue;
+        } else if ((c == '!' && i + 1 < inputlen &&
+                input[i + 1] == '[') ||
+                (c == '[' && !insidelinktext)) {
+            int title_start, title_len;
+            int url_start, url_len;
+            int linklen = _internal_spew3dweb_markdown_GetLinkOrImgLen(
+                input, inputlen, i, 1,
+                &title_start, &title_len,
+                &url_start, &url_len,
+                NULL, NULL, NULL, NULL, NULL
+            );
+            if (linklen <= 0 || (c == '[' && title_len == 0)) {
+                // (The renderer doesn't make links without a text.)
+                i += (c == '!' ? 2 : 1);
+                continue;
+            }
+            if (!_md2html_AddLinkEntry(
+                    scan, (c == '!'), i, linklen,
+                    title_start, title_len, url_start, url_len))
+                return -1;
+            if (c == '[') {
+                // Images and code can sit inside a link's text, and the
+                // renderer goes on past the link when it's done:
+                ssize_t result = _md2html_ScanInlineForLinks(
+                    scan, title_start + title_len, title_start,
+                    origindent, 1
+                );
+                if (result < 0)
+                    return -1;
+                scan->incode = 0;
+            }
+            i += linklen;
+            continue;
+        }
+        i += 1;
+    }
+    return i;
+}
+
+/// Scans one table row the way the renderer does it, which is each
+/// cell on its own. Returns 0 when out of memory.
+static int _md2html_ScanTableRowForLinks(
+        _md2html_linkscan *scan, size_t rowstart, size_t rowend,
+        int cells, int origindent
+        ) {
+    const char *input = scan->input;
+    size_t i = rowstart;
+    int cell_no = 0;
+    while (i < rowend && cell_no < cells) {
+        if (input[i] != '|') {
+            i += 1;
+            continue;
+        }
+        i += 1;
+        size_t cellend = i;
+        while (cellend < rowend && input[cellend] != '|')
+            cellend += 1;
+        scan->incode = 0;
+        if (_md2html_ScanInlineForLinks(
+                scan, cellend, i, origindent, 0) < 0)
+            return 0;
+        i = cellend;
+        cell_no += 1;
+    }
+    scan->incode = 0;
+    return 1;
+}
+
+S3DEXP int spew3dweb_markdown_ByteBufGetLinks(
+        const char *markdownbytes, size_t markdownbyteslen,
+        s3dw_markdown_links *out_links
+        ) {
+    memset(out_links, 0, sizeof(*out_links));
+    const char *input = markdownbytes;
+    size_t inputlen = markdownbyteslen;
+    _md2html_linkscan scan = {0};
+    scan.input = input;
+    scan.inputlen = inputlen;
+    scan.links = out_links;
+    scan.line = 1;
+
+    // This follows the block structure the same way as
+    // _internal_spew3dweb_markdown_CleanByteBufPart(), so code blocks
+    // are skipped exactly where the renderer would skip them. Inline
+    // code can go on across the lines of a paragraph, and table cells
+    // are looked at one by one, both like in the renderer:
+    int in_list_with_orig_indent[_S3D_MD_MAX_LIST_NESTING] = {0};
+    int in_list_with_orig_bullet_indent[_S3D_MD_MAX_LIST_NESTING] = {0};
+    int in_list_logical_nesting_depth = 0;
+    int lastnonemptylineorigindent = 0;
+    int lastnonemptylineeffectiveindent = 0;
+    int lastnonemptylinewascode = 0;
+    int lastlinewasemptyorblockinterruptor = 0;
+    int rendertextindent = 0;
+    int rendercodeindent = -1;
+    int inparagraph = 0;
+    int paragraphindent = 0;
+    int tablecells = 0;
+    int tablemustskipline = 0;
+    size_t i = 0;
+    while (i < inputlen) {
+        if (input[i] == '\n' || input[i] == '\r') {
+            if (input[i] == '\r' && i + 1 < inputlen &&
+                    input[i + 1] == '\n')
+                i += 1;
+            i += 1;
+            lastlinewasemptyorblockinterruptor = 1;
+            inparagraph = 0;
+            tablecells = 0;
+            scan.incode = 0;
+            continue;
+        }
+        int out_is_in_list_depth;
+        int out_is_code;
+        int out_effective_indent;
+        int out_write_this_many_spaces;
+        int out_content_start;
+        int out_orig_indent;
+        int out_orig_bullet_indent;
+        int out_is_list_entry;
+        int out_list_entry_num_value;
+        char out_list_bullet_type = '\0';
+        _internal_spew3dweb_markdown_IsListOrCodeIndentEx(
+            i, input, inputlen,
+            lastnonemptylineorigindent,
+            lastnonemptylineeffectiveindent,
+            lastnonemptylinewascode,
+            lastlinewasemptyorblockinterruptor,
+            in_list_with_orig_indent,
+            in_list_with_orig_bullet_indent,
+            in_list_logical_nesting_depth,
+            &out_is_in_list_depth,
+            &out_is_code,
+            &out_effective_indent,
+            &out_write_this_many_spaces,
+            &out_content_start,
+            &out_orig_indent,
+            &out_orig_bullet_indent,
+            &out_is_list_entry,
+            &out_list_bullet_type,
+            &out_list_entry_num_value
+        );
+        if (out_is_in_list_depth > _S3D_MD_MAX_LIST_NESTING)
+            out_is_in_list_depth = _S3D_MD_MAX_LIST_NESTING;
+        if (out_is_in_list_depth >
+                in_list_logical_nesting_depth) {
+            in_list_with_orig_indent[out_is_in_list_depth - 1] = (
+                out_orig_indent
+            );
+            in_list_with_orig_bullet_indent[
+                out_is_in_list_depth - 1
+            ] = out_orig_bullet_indent;
+        }
+        in_list_logical_nesting_depth = out_is_in_list_depth;
+        if (!out_is_list_entry && (
+                i + out_content_start >= inputlen ||
+                input[i + out_content_start] == '\n' ||
+                input[i + out_content_start] == '\r')) {
+            // Only whitespace, so it counts as empty.
+            i += out_content_start;
+            lastlinewasemptyorblockinterruptor = 1;
+            inparagraph = 0;
+            tablecells = 0;
+            scan.incode = 0;
+            continue;
+        }
+        if (!out_is_code && !out_is_list_entry &&
+                input[i + out_content_start] == '<') {
+            // A line with only comments on it is stripped to nothing,
+            // which the cleaner then counts as an empty line:
+            size_t i2 = i + out_content_start;
+            int _commentskip;
+            while ((_commentskip =
+                    _internal_spew3dweb_skipmarkdownhtmlcomment(
+                        input, inputlen, i2)) > 0) {
+                i2 += _commentskip;
+                while (i2 < inputlen && (input[i2] == ' ' ||
+                        input[i2] == '\t'))
+                    i2 += 1;
+            }
+            if (i2 > i + out_content_start && (i2 >= inputlen ||
+                    input[i2] == '\n' || input[i2] == '\r')) {
+                i = i2;
+                lastlinewasemptyorblockinterruptor = 1;
+                inparagraph = 0;
+                tablecells = 0;
+                scan.incode = 0;
+                continue;
+            }
+        }
+        int currentlineisblockinterruptor = 0;
+        int currentlineorigindent = out_orig_indent;
+        lastnonemptylinewascode = out_is_code;
+        lastlinewasemptyorblockinterruptor = 0;
+        const size_t linestart = i;
+        i += out_content_start;
+
+        // The renderer finds 4 space code by itself from the indent in
+        // the clean text, which can come out different for odd indents.
+        // Only leave out code that both agree on. If the cleaner copied
+        // the line as code, all backticks on it are kept:
+        int cleanindent = out_write_this_many_spaces;
+        if (out_is_list_entry && out_list_bullet_type != '+') {
+            rendercodeindent = -1;
+            rendertextindent = out_effective_indent;
+            cleanindent = -1;
+        } else {
+            if (!out_is_code) {
+                // Comments in front are stripped, but not the space after:
+                size_t i2 = i;
+                int _commentskip;
+                while ((_commentskip =
+                        _internal_spew3dweb_skipmarkdownhtmlcomment(
+                            input, inputlen, i2)) > 0) {
+                    i2 += _commentskip;
+                    while (i2 < inputlen && (input[i2] == ' ' ||
+                            input[i2] == '\t')) {
+                        cleanindent += (input[i2] == '\t' ? 4 : 1);
+                        i2 += 1;
+                    }
+                }
+            }
+            if (rendercodeindent >= 0 &&
+                    cleanindent <= rendercodeindent - 4) {
+                rendertextindent = rendercodeindent - 4;
+                rendercodeindent = -1;
+            } else if (rendercodeindent < 0 &&
+                    cleanindent <= rendertextindent - 3) {
+                rendertextindent = cleanindent;
+            }
+            if (rendercodeindent < 0 &&
+                    cleanindent >= rendertextindent + 4)
+                rendercodeindent = rendertextindent + 4;
+        }
+        if (out_is_code && rendercodeindent < 0) {
+            out_is_code = 0;
+            scan.cleanspanend = i;
+            while (scan.cleanspanend < inputlen &&
+                    input[scan.cleanspanend] != '\n' &&
+                    input[scan.cleanspanend] != '\r')
+                scan.cleanspanend += 1;
+        }
+
+        // See what the renderer makes of this line, but only where it
+        // matters since it needs the whole line:
+        int flags = 0;
+        size_t lineend = i;
+        if (!out_is_code && (scan.incode || tablecells > 0 ||
+                input[i] == '|' || input[i] == '#')) {
+            while (lineend < inputlen && input[lineend] != '\n' &&
+                    input[lineend] != '\r')
+                lineend += 1;
+            flags = _internal_s3dw_markdown_ClassifyLineContent(
+                input + i, lineend - i
+            );
+        }
+        const int continuesparagraph = (
+            inparagraph && !out_is_code && !out_is_list_entry &&
+            out_effective_indent == paragraphindent &&
+            (flags & _S3D_MD_LINEFLAG_ENDSPARAGRAPH) == 0
+        );
+        if (!continuesparagraph)
+            scan.incode = 0;
+        if (tablecells > 0 && !tablemustskipline && (out_is_code ||
+                (flags & _S3D_MD_LINEFLAG_TABLEROW) == 0 ||
+                _md2html_LinkScanCountPipes(input, i, lineend) !=
+                tablecells + 1))
+            tablecells = 0;
+        if (tablecells == 0 && !continuesparagraph &&
+                (flags & _S3D_MD_LINEFLAG_TABLEROW) != 0) {
+            // A table needs a separator line with the same indent next:
+            size_t i2 = lineend;
+            if (i2 < inputlen && input[i2] == '\r' &&
+                    i2 + 1 < inputlen && input[i2 + 1] == '\n')
+                i2 += 1;
+            if (i2 < inputlen)
+                i2 += 1;
+            size_t nextcontent = i2;
+            while (nextcontent < inputlen &&
+                    (input[nextcontent] == ' ' ||
+                    input[nextcontent] == '\t'))
+                nextcontent += 1;
+            size_t nextend = nextcontent;
+            while (nextend < inputlen && input[nextend] != '\n' &&
+                    input[nextend] != '\r')
+                nextend += 1;
+            if (nextcontent - i2 == i - linestart &&
+                    (_internal_s3dw_markdown_ClassifyLineContent(
+                        input + nextcontent, nextend - nextcontent
+                    ) & _S3D_MD_LINEFLAG_TABLESEP) != 0) {
+                tablecells = _md2html_LinkScanCountPipes(
+                    input, i, lineend
+                ) - 1;
+                tablemustskipline = 2;
+            }
+        }
+        if (rendercodeindent < 0 && cleanindent >= 0 &&
+                tablecells == 0 &&
+                (flags & _S3D_MD_LINEFLAG_HEADING) == 0 &&
+                (i + 2 >= inputlen || input[i] != '`' ||
+                input[i + 1] != '`' || input[i + 2] != '`'))
+            rendertextindent = cleanindent;  // Not set for other blocks.
+        if (tablecells > 0) {
+            if (tablemustskipline != 1 &&
+                    !_md2html_ScanTableRowForLinks(
+                        &scan, i, lineend, tablecells,
+                        currentlineorigindent)) {
+                spew3dweb_markdown_FreeLinks(out_links);
+                return 0;
+            }
+            if (tablemustskipline > 0)
+                tablemustskipline -= 1;
+            i = lineend;
+            inparagraph = 0;
+        } else if (out_is_code) {
+            while (i < inputlen && input[i] != '\n' &&
+                    input[i] != '\r')
+                i += 1;
+            inparagraph = 0;
+        } else if (!continuesparagraph) {
+            inparagraph = ((flags & _S3D_MD_LINEFLAG_HEADING) == 0);
+            paragraphindent = out_effective_indent;
+        }
+        int atcontentstart = 1;
+        while (i < inputlen && input[i] != '\n' &&
+                input[i] != '\r') {
+            const char c = input[i];
+            if (c == '`' && i + 2 < inputlen &&
+                    input[i + 1] == '`' && input[i + 2] == '`') {
+                // A ``` code block, which ends at the next run of
+                // at least as many backticks:
+                int ticks = 3;
+                i += 3;
+                while (i < inputlen && input[i] == '`') {
+                    ticks += 1;
+                    i += 1;
+                }
+                while (i < inputlen &&
+                        !_internal_spew3dweb_markdown_IsFenceClose(
+                            input, inputlen, i, ticks))
+                    i += 1;
+                if (i < inputlen)
+                    i += ticks;
+                scan.incode = 0;
+                inparagraph = 0;
+                currentlineisblockinterruptor = 1;
+                atcontentstart = 0;
+                continue;
+            }
+            if (atcontentstart && (c == '-' || c == '=' || c == '*')) {
+                // Underlined headings and rulers end a paragraph,
+                // which matters for what is code afterwards:
+                if ((c != '*' && !lastlinewasemptyorblockinterruptor &&
+                        currentlineorigindent ==
+                        lastnonemptylineorigindent &&
+                        _md2html_LinkScanLineOnlyChar(
+                            input, inputlen, i, c)) ||
+                        (i + 2 < inputlen && input[i + 1] == c &&
+                        input[i + 2] == c &&
+                        _md2html_LinkScanLineOnlyChar(
+                            input, inputlen, i, c))) {
+                    while (i < inputlen && input[i] != '\n' &&
+                            input[i] != '\r')
+                        i += 1;
+                    currentlineisblockinterruptor = 1;
+                    lastlinewasemptyorblockinterruptor = 1;
+                    scan.incode = 0;
+                    inparagraph = 0;
+                    break;
+                }
+            }
+            atcontentstart = 0;
+            if (currentlineisblockinterruptor && !inparagraph &&
+                    c != ' ' && c != '\t') {
+                // Text after a ``` block is a new paragraph:
+                inparagraph = 1;
+                paragraphindent = out_effective_indent;
+            }
+            ssize_t i2 = _md2html_ScanInlineForLinks(
+                &scan, inputlen, i, currentlineorigindent, 0
+            );
+            if (i2 < 0) {
+                spew3dweb_markdown_FreeLinks(out_links);
+                return 0;
+            }
+            if ((size_t)i2 == i) {
+                // Stopped right at a ``` which is handled above.
+                assert(input[i] == '`');
+                continue;
+            }
+            i = i2;
+        }
+        lastnonemptylineeffectiveindent = out_effective_indent;
+        lastnonemptylineorigindent = currentlineorigindent;
+        if (!currentlineisblockinterruptor)
+            lastlinewasemptyorblockinterruptor = 0;
+        if (i < inputlen && input[i] == '\r' &&
+                i + 1 < inputlen && input[i + 1] == '\n')
+            i += 1;
+        if (i < inputlen)
+            i += 1;
+    }
+    return 1;
+}
+
+S3DEXP void spew3dweb_markdown_FreeLinks(s3dw_markdown_links *links) {
+    free(links->entries);
+    memset(links, 0, sizeof(*links));
+}
+
+#endif  // SPEW3DWEB_IMPLEMENTATION
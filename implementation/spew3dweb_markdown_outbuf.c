@@ -0,0 +1,205 @@
+/* Copyright (c) 2023, ellie/@ell1e & Spew3D Web Team (see AUTHORS.md).
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+Alternatively, at your option, this file is offered under the Apache 2
+license, see accompanied LICENSE.md.
+*/
+
+#ifdef SPEW3DWEB_IMPLEMENTATION
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(SPEW3DWEB_OPTION_MARKDOWN_BUFFER_STATS)
+static uint64_t _md2html_bufstat_reallocs = 0;
+static uint64_t _md2html_bufstat_bytesmoved = 0;
+#endif
+
+S3DEXP void spew3dweb_markdown_GetBufferStats(
+        uint64_t *out_reallocs, uint64_t *out_bytesmoved
+        ) {
+    #if defined(SPEW3DWEB_OPTION_MARKDOWN_BUFFER_STATS)
+    if (out_reallocs)
+        *out_reallocs = __atomic_load_n(
+            &_md2html_bufstat_reallocs, __ATOMIC_RELAXED);
+    if (out_bytesmoved)
+        *out_bytesmoved = __atomic_load_n(
+            &_md2html_bufstat_bytesmoved, __ATOMIC_RELAXED);
+    #else
+    if (out_reallocs) *out_reallocs = 0;
+    if (out_bytesmoved) *out_bytesmoved = 0;
+    #endif
+}
+
+S3DEXP void spew3dweb_markdown_ResetBufferStats(void) {
+    #if defined(SPEW3DWEB_OPTION_MARKDOWN_BUFFER_STATS)
+    __atomic_store_n(&_md2html_bufstat_reallocs, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&_md2html_bufstat_bytesmoved, 0, __ATOMIC_RELAXED);
+    #endif
+}
+
+S3DHID size_t _internal_s3dw_markdown_predictbufsize(
+        size_t inputlen, unsigned int expansionpercent
+        ) {
+    size_t predicted = (inputlen / 100) * expansionpercent +
+        ((inputlen % 100) * expansionpercent) / 100;
+    if (expansionpercent > 100 && predicted < inputlen)
+        return inputlen;  // Overflow, just go with the input length.
+    return predicted + 64;
+}
+
+S3DHID int _internal_s3dw_markdown_ensurebufsize(
+        char **bufptr, size_t *bufalloc, size_t new_size
+        ) {
+    size_t oldalloc = *bufalloc;
+    if (*bufptr && oldalloc >= new_size)
+        return 1;
+    // Grow by half of what we had each time, so that appending in
+    // many small steps stays linear in the total amount copied:
+    size_t new_alloc = oldalloc + (oldalloc / 2);
+    if (new_alloc < 256)
+        new_alloc = 256;
+    if (new_alloc < new_size)
+        new_alloc = new_size;
+    char *oldbuf = *bufptr;
+    char *newbuf = realloc(oldbuf, new_alloc);
+    if (!newbuf) {
+        if (oldbuf) free(oldbuf);
+        return 0;
+    }
+    #if defined(SPEW3DWEB_OPTION_MARKDOWN_BUFFER_STATS)
+    if (oldbuf) {
+        __atomic_fetch_add(
+            &_md2html_bufstat_reallocs, 1, __ATOMIC_RELAXED);
+        if (newbuf != oldbuf)
+            __atomic_fetch_add(&_md2html_bufstat_bytesmoved,
+                (uint64_t)oldalloc, __ATOMIC_RELAXED);
+    }
+    #endif
+    *bufptr = newbuf;
+    *bufalloc = new_alloc;
+    return 1;
+}
+
+S3DHID int _internal_s3dw_markdown_bufappend(
+        char **bufptr, size_t *bufalloc, size_t *buffill,
+        const char *appendbuf, size_t appendbuflen, size_t amount
+        ) {
+    if (amount == 1) {
+        // The common case, where most of the time no growing is needed:
+        if (!*bufptr || *bufalloc <= (*buffill) + appendbuflen) {
+            if (!_internal_s3dw_markdown_ensurebufsize(
+                    bufptr, bufalloc, (*buffill) + appendbuflen + 1))
+                return 0;
+        }
+        memcpy((*bufptr) + (*buffill), appendbuf, appendbuflen);
+        (*buffill) += appendbuflen;
+        return 1;
+    }
+    if (amount == 0)
+        return 1;
+    if (!_internal_s3dw_markdown_ensurebufsize(
+            bufptr, bufalloc,
+            (*buffill) + appendbuflen * amount + 1))
+        return 0;
+    assert(*bufalloc > (*buffill) + appendbuflen * amount);
+    char *write = (*bufptr) + (*buffill);
+    if (appendbuflen == 1) {
+        memset(write, appendbuf[0], amount);
+    } else {
+        size_t k = 0;
+        while (k < amount) {
+            memcpy(write, appendbuf, appendbuflen);
+            write += appendbuflen;
+            k++;
+        }
+    }
+    (*buffill) += appendbuflen * amount;
+    return 1;
+}
+
+S3DHID int _internal_s3dw_markdown_bufappendstr(
+        char **bufptr, size_t *bufalloc, size_t *buffill,
+        const char *appendstr, size_t amount
+        ) {
+    return _internal_s3dw_markdown_bufappend(
+        bufptr, bufalloc, buffill,
+        appendstr, strlen(appendstr), amount);
+}
+
+S3DHID int _internal_s3dw_markdown_bufappendchar(
+        char **bufptr, size_t *bufallocptr, size_t *buffillptr,
+        char appendc, size_t amount
+        ) {
+    char cbuf[1];
+    cbuf[0] = appendc;
+    return _internal_s3dw_markdown_bufappend(
+        bufptr, bufallocptr, buffillptr,
+        cbuf, 1, amount);
+}
+
+S3DHID int _internal_s3dw_markdown_bufappendescaped(
+        char **bufptr, size_t *bufalloc, size_t *buffill,
+        const char *appendbuf, size_t appendbuflen, int quotesonly
+        ) {
+    size_t i = 0;
+    while (i < appendbuflen) {
+        size_t next = _internal_s3dw_markdown_FindEscapeChar(
+            appendbuf, appendbuflen, i
+        );
+        while (quotesonly && next < appendbuflen &&
+                appendbuf[next] != '\'' && appendbuf[next] != '"')
+            next = _internal_s3dw_markdown_FindEscapeChar(
+                appendbuf, appendbuflen, next + 1
+            );
+        if (next > i && !_internal_s3dw_markdown_bufappend(
+                bufptr, bufalloc, buffill, appendbuf + i, next - i, 1))
+            return 0;
+        if (next >= appendbuflen)
+            break;
+        int ok = 0;
+        if (appendbuf[next] == '<')
+            ok = _S3D_MD_BUFAPPENDLIT(
+                bufptr, bufalloc, buffill, "&lt;", 1);
+        else if (appendbuf[next] == '>')
+            ok = _S3D_MD_BUFAPPENDLIT(
+                bufptr, bufalloc, buffill, "&gt;", 1);
+        else if (appendbuf[next] == '\'')
+            ok = _S3D_MD_BUFAPPENDLIT(
+                bufptr, bufalloc, buffill, "&#39;", 1);
+        else if (appendbuf[next] == '"')
+            ok = _S3D_MD_BUFAPPENDLIT(
+                bufptr, bufalloc, buffill, "&quot;", 1);
+        else
+            ok = _S3D_MD_BUFAPPENDLIT(
+                bufptr, bufalloc, buffill, "&amp;", 1);
+        if (!ok)
+            return 0;
+        i = next + 1;
+    }
+    return 1;
+}
+
+#endif  // SPEW3DWEB_IMPLEMENTATION
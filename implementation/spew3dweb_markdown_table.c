@@ -42,11 +42,11 @@ license, see accompanied LICENSE.md.
     &resultchunk, &resultalloc, &resultfill,\
     insertchar, 1))
 #define INS(insertstr) \
-    (_internal_s3dw_markdown_bufappendstr(\
+    (_S3D_MD_BUFAPPENDLIT(\
     &resultchunk, &resultalloc, &resultfill,\
     insertstr, 1))
 #define INSREP(insertstr, amount) \
-    (_internal_s3dw_markdown_bufappendstr(\
+    (_S3D_MD_BUFAPPENDLIT(\
     &resultchunk, &resultalloc, &resultfill,\
     insertstr, amount))
 #define INSBUF(insertbuf, insertbuflen) \
@@ -54,63 +54,36 @@ license, see accompanied LICENSE.md.
     &resultchunk, &resultalloc, &resultfill,\
     insertbuf, insertbuflen, 1))
 
-S3DHID int _internal_s3dw_markdown_LineStartsTable(
-        _markdown_lineinfo *lineinfo, size_t linei,
-        size_t linefill, int *out_cells
+static int _md2html_CountTablePipes(
+        _markdown_lineinfo *lineinfo, size_t linei
         ) {
-    size_t i = lineinfo[linei].indentlen;
-    size_t len = (lineinfo[linei].indentlen +
-        lineinfo[linei].indentedcontentlen);
-    int startswithpipe = (
-        i < len && lineinfo[linei].linestart[i] == '|'
-    );
-    char lastnonwhitespacechar = '\0';
-    int foundnotpipe = 0;
+    const char *p = _S3D_MD_LINESTART(lineinfo, linei);
+    size_t i = _S3D_MD_LINEINDENT(lineinfo, linei);
+    size_t len = (_S3D_MD_LINEINDENT(lineinfo, linei) +
+        _S3D_MD_LINECONTENTLEN(lineinfo, linei));
     int pipecount = 0;
     while (i < len) {
-        if (lineinfo[linei].linestart[i] == '|') {
+        if (p[i] == '|')
             pipecount += 1;
-            lastnonwhitespacechar = '|';
-        } else {
-            foundnotpipe = 1;
-            if (lineinfo[linei].linestart[i] != ' ' &&
-                    lineinfo[linei].linestart[i] != '\t')
-                lastnonwhitespacechar = (
-                    lineinfo[linei].linestart[i]
-                );
-        }
         i += 1;
     }
-    if (!foundnotpipe || pipecount < 2 || !startswithpipe ||
-            i < len || lastnonwhitespacechar != '|')
+    return pipecount;
+}
+
+S3DHID int _internal_s3dw_markdown_LineStartsTable(
+        _markdown_lineinfo *lineinfo, size_t linei,
+        size_t linefill, int *out_cells
+        ) {
+    if ((lineinfo->flags[linei] & _S3D_MD_LINEFLAG_TABLEROW) == 0)
         return 0;
-    int cells = (pipecount - 1);
+    int cells = (_md2html_CountTablePipes(lineinfo, linei) - 1);
     linei += 1;
     if (linei >= linefill)
         return 0;
 
-    i = lineinfo[linei].indentlen;
-    len = (lineinfo[linei].indentlen +
-        lineinfo[linei].indentedcontentlen);
-    pipecount = 0;
-    int dashcount = 0;
-    while (i < len) {
-        if (lineinfo[linei].linestart[i] == '|') {
-            pipecount += 1;
-        } else if (lineinfo[linei].linestart[i] == '-') {
-            dashcount += 1;
-        } else {
-            break;
-        }
-        i += 1;
-    }
-    while (i < len && (
-            lineinfo[linei].linestart[i] == ' ' ||
-            lineinfo[linei].linestart[i] == '\t'))
-        i += 1;
-    if (dashcount < 1 || pipecount < 2 || i < len ||
-            lineinfo[linei].indentlen !=
-            lineinfo[linei - 1].indentlen)
+    if ((lineinfo->flags[linei] & _S3D_MD_LINEFLAG_TABLESEP) == 0 ||
+            _S3D_MD_LINEINDENT(lineinfo, linei) !=
+            _S3D_MD_LINEINDENT(lineinfo, linei - 1))
         return 0;
     if (out_cells) *out_cells = cells;
     return 1;
@@ -120,32 +93,8 @@ S3DHID int _internal_s3dw_markdown_LineContinuesTable(
         _markdown_lineinfo *lineinfo, size_t linei,
         size_t linefill, int cells
         ) {
-    size_t i = lineinfo[linei].indentlen;
-    size_t len = (lineinfo[linei].indentlen +
-        lineinfo[linei].indentedcontentlen);
-    char lastnonwhitespacechar = '\0';
-    int startswithpipe = (
-        i < len && lineinfo[linei].linestart[i] == '|'
-    );
-    int foundnotpipe = 0;
-    int pipecount = 0;
-    while (i < len) {
-        if (lineinfo[linei].linestart[i] == '|') {
-            pipecount += 1;
-            lastnonwhitespacechar = '|';
-        } else {
-            foundnotpipe = 1;
-            if (lineinfo[linei].linestart[i] != '\t' &&
-                    lineinfo[linei].linestart[i] != ' ')
-                lastnonwhitespacechar = (
-                    lineinfo[linei].linestart[i]
-                );
-        }
-        i += 1;
-    }
-    if (!startswithpipe || foundnotpipe <= 0 ||
-            pipecount != cells + 1 ||
-            lastnonwhitespacechar != '|')
+    if ((lineinfo->flags[linei] & _S3D_MD_LINEFLAG_TABLEROW) == 0 ||
+            _md2html_CountTablePipes(lineinfo, linei) != cells + 1)
         return 0;
     return 1;
 }
@@ -155,31 +104,30 @@ S3DHID void _internal_s3dw_markdown_GetTableCell(
         size_t linefill, int cell_no,
         int *out_startoffset, int *out_byteslen
         ) {
-    size_t i = lineinfo[linei].indentlen;
-    size_t len = (lineinfo[linei].indentlen +
-        lineinfo[linei].indentedcontentlen);
-    int startswithpipe = (
-        i < len && lineinfo[linei].linestart[i] == '|'
-    );
+    size_t i = _S3D_MD_LINEINDENT(lineinfo, linei);
+    size_t len = (_S3D_MD_LINEINDENT(lineinfo, linei) +
+        _S3D_MD_LINECONTENTLEN(lineinfo, linei));
+    const char *p = _S3D_MD_LINESTART(lineinfo, linei);
+    int startswithpipe = (i < len && p[i] == '|');
     int foundnotpipe = 0;
     int pipecount = 0;
     while (i < len) {
-        if (lineinfo[linei].linestart[i] == '|') {
+        if (p[i] == '|') {
             pipecount += 1;
             if (pipecount == cell_no) {
                 i += 1;
                 while (i < len &&
-                        (lineinfo[linei].linestart[i] == ' ' ||
-                        lineinfo[linei].linestart[i] == '\t'))
+                        (p[i] == ' ' ||
+                        p[i] == '\t'))
                     i += 1;
                 int starti = i;
                 while (i < len &&
-                        lineinfo[linei].linestart[i] != '|')
+                        p[i] != '|')
                     i += 1;
                 if (i < len) {
                     while (i > starti &&
-                            (lineinfo[linei].linestart[i - 1] == ' ' ||
-                            lineinfo[linei].linestart[i - 1] == '\t'))
+                            (p[i - 1] == ' ' ||
+                            p[i - 1] == '\t'))
                         i -= 1;
                     if (out_startoffset)
                         *out_startoffset = starti;
@@ -0,0 +1,249 @@
+/* Copyright (c) 2023, ellie/@ell1e & Spew3D Web Team (see AUTHORS.md).
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+Alternatively, at your option, this file is offered under the Apache 2
+license, see accompanied LICENSE.md.
+*/
+
+#ifdef SPEW3DWEB_IMPLEMENTATION
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+S3DHID void _internal_s3dw_markdown_InitUriBatch(
+        _markdown_uribatch *batch,
+        const s3dw_markdown_tohtmloptions *options
+        ) {
+    memset(batch, 0, sizeof(*batch));
+    batch->options = options;
+}
+
+S3DHID void _internal_s3dw_markdown_FreeUriBatch(
+        _markdown_uribatch *batch
+        ) {
+    free(batch->arena);
+    free(batch->entries);
+    free(batch->slots);
+    memset(batch, 0, sizeof(*batch));
+}
+
+static uint64_t _md2html_UriHash(const char *uri, size_t urilen) {
+    uint64_t hash = _internal_s3dw_markdown_Hash64(uri, urilen, 0);
+    return (hash != 0 ? hash : 1);
+}
+
+/// Returns the slot where the URI is or would go. Unlike for anchors,
+/// the bytes are compared too, since a mixup would swap links.
+static size_t *_md2html_FindUriSlot(
+        const _markdown_uribatch *batch, uint64_t hash, const char *uri
+        ) {
+    size_t k = hash & (batch->slotalloc - 1);
+    while (batch->slots[k] != 0) {
+        const _markdown_uribatchentry *entry = (
+            &batch->entries[batch->slots[k] - 1]);
+        if (entry->hash == hash &&
+                strcmp(batch->arena + entry->urioffset, uri) == 0)
+            break;
+        k = (k + 1) & (batch->slotalloc - 1);
+    }
+    return &batch->slots[k];
+}
+
+static int _md2html_AddUri(
+        _markdown_uribatch *batch, const char *uri
+        ) {
+    size_t urilen = strlen(uri);
+    uint64_t hash = _md2html_UriHash(uri, urilen);
+    if (batch->slotalloc > 0 &&
+            *_md2html_FindUriSlot(batch, hash, uri) != 0)
+        return 1;  // Already have it.
+    if ((batch->entrycount + 1) * 2 > batch->slotalloc) {
+        size_t newalloc = (batch->slotalloc > 0 ?
+            batch->slotalloc * 2 : 64);
+        size_t *newslots = malloc(sizeof(*newslots) * newalloc);
+        if (!newslots)
+            return 0;
+        memset(newslots, 0, sizeof(*newslots) * newalloc);
+        free(batch->slots);
+        batch->slots = newslots;
+        batch->slotalloc = newalloc;
+        size_t i = 0;
+        while (i < batch->entrycount) {
+            *_md2html_FindUriSlot(
+                batch, batch->entries[i].hash,
+                batch->arena + batch->entries[i].urioffset
+            ) = i + 1;
+            i += 1;
+        }
+    }
+    if (batch->entrycount + 1 > batch->entryalloc) {
+        size_t newalloc = batch->entryalloc * 2 + 16;
+        _markdown_uribatchentry *newentries = realloc(
+            batch->entries, sizeof(*newentries) * newalloc);
+        if (!newentries)
+            return 0;
+        batch->entries = newentries;
+        batch->entryalloc = newalloc;
+    }
+    size_t urioffset = batch->arenafill;
+    if (!_internal_s3dw_markdown_bufappend(
+            &batch->arena, &batch->arenaalloc, &batch->arenafill,
+            uri, urilen + 1, 1)) {
+        batch->arena = NULL;
+        batch->arenaalloc = 0;
+        batch->arenafill = 0;
+        return 0;
+    }
+    _markdown_uribatchentry *entry = &batch->entries[batch->entrycount];
+    entry->hash = hash;
+    entry->urioffset = urioffset;
+    entry->resultoffset = urioffset;
+    batch->entrycount += 1;
+    *_md2html_FindUriSlot(batch, hash, uri) = batch->entrycount;
+    return 1;
+}
+
+static char *_md2html_CollectUri(const char *uri, void *userdata) {
+    if (!_md2html_AddUri(userdata, uri))
+        return NULL;
+    return (char *)uri;  // (Only borrowed, so the cleaner keeps it.)
+}
+
+S3DHID int _internal_s3dw_markdown_FillUriBatch(
+        _markdown_uribatch *batch,
+        const char *uncleaninput, size_t uncleaninputlen
+        ) {
+    const s3dw_markdown_tohtmloptions *options = batch->options;
+
+    // Clean everything once just to see the URIs, with the same cleaner
+    // options the renderer uses so that it finds exactly the same ones:
+    _markdown_cleanstate state;
+    _internal_spew3dweb_markdown_InitCleanState(
+        &state, 1, 1, !options->block_unsafe_html, 1,
+        _md2html_CollectUri, batch
+    );
+    state.uritransformborrowed = 1;
+    size_t inputpos = 0;
+    size_t blockstart = 0;
+    while (1) {
+        if (!_internal_spew3dweb_markdown_CleanByteBufPart(
+                &state, uncleaninput, uncleaninputlen, &inputpos,
+                blockstart + _S3D_MD_CLEAN_BLOCK_SIZE, 0
+                ))
+            return 0;
+        if (inputpos >= uncleaninputlen)
+            break;
+        // Drop what we got, but keep the last empty line since the
+        // cleaner may look back at the previous line:
+        assert(state.resultfill >= 2);
+        memmove(state.resultchunk, state.resultchunk +
+            state.resultfill - 2, 2);
+        state.resultfill = 2;
+        blockstart = 2;
+    }
+    free(state.resultchunk);
+    if (batch->entrycount == 0)
+        return 1;
+
+    // Now hand them all over in one go:
+    const size_t count = batch->entrycount;
+    const char **uris = malloc(sizeof(*uris) * count * 2);
+    if (!uris)
+        return 0;
+    const char **results = uris + count;
+    size_t i = 0;
+    while (i < count) {
+        uris[i] = batch->arena + batch->entries[i].urioffset;
+        results[i] = NULL;
+        i += 1;
+    }
+    if (!options->uritransform_batch_callback(
+            uris, count, results,
+            options->uritransform_callback_userdata)) {
+        free(uris);
+        return 0;
+    }
+
+    // Copy the results into the arena, growing it only once. (Results
+    // may point into the arena itself, so those are taken as offsets
+    // before it moves.)
+    size_t needed = batch->arenafill;
+    i = 0;
+    while (i < count) {
+        if (results[i] != NULL && results[i] >= batch->arena &&
+                results[i] < batch->arena + batch->arenafill) {
+            batch->entries[i].resultoffset = results[i] - batch->arena;
+            results[i] = NULL;
+        } else if (results[i] != NULL) {
+            needed += strlen(results[i]) + 1;
+        }
+        i += 1;
+    }
+    if (!_internal_s3dw_markdown_ensurebufsize(
+            &batch->arena, &batch->arenaalloc, needed)) {
+        batch->arena = NULL;
+        batch->arenaalloc = 0;
+        batch->arenafill = 0;
+        free(uris);
+        return 0;
+    }
+    i = 0;
+    while (i < count) {
+        if (results[i] != NULL) {
+            size_t resultlen = strlen(results[i]);
+            batch->entries[i].resultoffset = batch->arenafill;
+            memcpy(batch->arena + batch->arenafill, results[i],
+                resultlen + 1);
+            batch->arenafill += resultlen + 1;
+        }
+        i += 1;
+    }
+    free(uris);
+    return 1;
+}
+
+S3DHID char *_internal_s3dw_markdown_UriBatchLookup(
+        const char *uri, void *userdata
+        ) {
+    const _markdown_uribatch *batch = userdata;
+    if (batch->slotalloc > 0) {
+        size_t slot = *_md2html_FindUriSlot(
+            batch, _md2html_UriHash(uri, strlen(uri)), uri
+        );
+        if (slot != 0)
+            return (batch->arena +
+                batch->entries[slot - 1].resultoffset);
+    }
+    // Not seen when collecting, so just transform this one on its own.
+    // The result only needs to last until the cleaner copied it:
+    const char *result = NULL;
+    if (!batch->options->uritransform_batch_callback(
+            &uri, 1, &result,
+            batch->options->uritransform_callback_userdata))
+        return NULL;
+    return (char *)(result ? result : uri);
+}
+
+#endif  // SPEW3DWEB_IMPLEMENTATION
@@ -27,11 +27,14 @@ license, see accompanied LICENSE.md.
 
 #include <assert.h>
 #include <check.h>
+#include <pthread.h>
 
 #define SPEW3D_OPTION_DISABLE_SDL
 #define SPEW3D_IMPLEMENTATION
 #include "spew3d.h"
 #define SPEW3DWEB_IMPLEMENTATION
+#define SPEW3DWEB_OPTION_MARKDOWN_BUFFER_STATS
+#define SPEW3DWEB_OPTION_MARKDOWN_SCAN_STATS
 #include "spew3dweb.h"
 
 #include "testmain.h"
@@ -355,6 +358,16 @@ START_TEST(test_markdown_clean)
                       ) == 0);
         free(result);
     }
+    {
+        // An unclosed comment runs to the very end:
+        const char input[] = "a <!-- never closed\n\nat all";
+        result = spew3dweb_markdown_CleanByteBuf(
+            input, strlen(input), 0, 1, NULL, NULL, NULL, NULL
+        );
+        printf("test_markdown_clean result #31: <<%s>>\n", result);
+        assert(result != NULL && strcmp(result, "a") == 0);
+        free(result);
+    }
 }
 END_TEST
 
@@ -393,6 +406,22 @@ START_TEST(test_is_url_and_is_image)
     assert(spew3dweb_markdown_IsStrUrl(
         "[abc](abc[d]ef)"
     ));
+    assert(spew3dweb_markdown_IsStrUrl(
+        "[abc](a_(b_(c_(d))))"
+    ));
+    assert(!spew3dweb_markdown_IsStrUrl(
+        "[abc](a((((((((((b))))))))))"
+    ));
+    assert(spew3dweb_markdown_IsStrUrl(
+        "[abc](a((((((((b)))))))))"
+    ));
+    assert(!spew3dweb_markdown_IsStrUrl(
+        "[abc](a(((((((((b))))))))))"
+    ));
+    // The nesting limit is only for the url part:
+    assert(spew3dweb_markdown_IsStrUrl(
+        "[a((((((((((b)))))))))){{{{{{{{{{c}}}}}}}}}}](d)"
+    ));
     assert(spew3dweb_markdown_IsStrUrl(
         "[ **formatting test** <i>abc</i>](abc def)"
     ));
@@ -446,6 +475,27 @@ static int _s3dw_check_html_same(const char *p1, const char *p2) {
     }
 }
 
+struct _s3dw_test_writeinfo {
+    char *buf;
+    size_t fill;
+    int calls;
+};
+
+static int _s3dw_test_writer(
+        const char *buff, size_t amount, void *userdata
+        ) {
+    struct _s3dw_test_writeinfo *info = userdata;
+    char *newbuf = realloc(info->buf, info->fill + amount + 1);
+    if (!newbuf)
+        return 0;
+    info->buf = newbuf;
+    memcpy(info->buf + info->fill, buff, amount);
+    info->fill += amount;
+    info->buf[info->fill] = '\0';
+    info->calls += 1;
+    return 1;
+}
+
 START_TEST(test_markdown_tohtml)
 {
     assert(_s3dw_check_html_same("  <span>test\nbla",
@@ -720,9 +770,1561 @@ START_TEST(test_markdown_tohtml)
             ));
         free(result);
     }
+    {
+        // Long enough to be converted in multiple blocks, with
+        // some of them ending inside the code:
+        const char unit[] = "abc *def*\n\n```\nx\n\ny\n```\n\n";
+        const int unitcount = 4000;
+        char *input = malloc(strlen(unit) * unitcount + 1);
+        assert(input != NULL);
+        int k = 0;
+        while (k < unitcount) {
+            memcpy(input + strlen(unit) * k, unit, strlen(unit));
+            k += 1;
+        }
+        input[strlen(unit) * unitcount] = '\0';
+        char *unitresult = spew3dweb_markdown_ToHTML(unit);
+        assert(unitresult != NULL);
+        size_t resultlen = 0;
+        s3dw_markdown_tohtmloptions options = {0};
+        result = spew3dweb_markdown_ToHTMLEx(
+            input, &options, &resultlen
+        );
+        printf("test_markdown_tohtml result #27: <<%s>>\n", unitresult);
+        assert(result != NULL);
+        assert(resultlen == strlen(unitresult) * unitcount);
+        k = 0;
+        while (k < unitcount) {
+            assert(memcmp(result + strlen(unitresult) * k,
+                unitresult, strlen(unitresult)) == 0);
+            k += 1;
+        }
+        // Streamed output must match, and arrive in multiple parts:
+        struct _s3dw_test_writeinfo info = {0};
+        int writeresult = spew3dweb_markdown_ByteBufToHTMLCustomIO(
+            input, strlen(input), &options,
+            _s3dw_test_writer, &info
+        );
+        assert(writeresult != 0);
+        assert(info.calls > 1);
+        assert(info.fill == resultlen);
+        assert(memcmp(info.buf, result, resultlen) == 0);
+        free(info.buf);
+
+        // A reused renderer must give the same results, and not
+        // need to grow its buffers for a repeated conversion:
+        s3dw_markdown_renderer *renderer = (
+            spew3dweb_markdown_NewRenderer()
+        );
+        assert(renderer != NULL);
+        size_t renderlen = 0;
+        const char *rendered = spew3dweb_markdown_RendererByteBufToHTML(
+            renderer, unit, strlen(unit), &options, &renderlen
+        );
+        assert(rendered != NULL && strcmp(rendered, unitresult) == 0);
+        rendered = spew3dweb_markdown_RendererByteBufToHTML(
+            renderer, input, strlen(input), &options, &renderlen
+        );
+        assert(rendered != NULL && renderlen == resultlen);
+        assert(memcmp(rendered, result, resultlen) == 0);
+        char *oldcleanbuf = renderer->cleanbuf;
+        uint32_t *oldlinestarts = renderer->lineinfo.start;
+        const char *oldrendered = rendered;
+        rendered = spew3dweb_markdown_RendererByteBufToHTML(
+            renderer, input, strlen(input), &options, &renderlen
+        );
+        assert(rendered == oldrendered && renderlen == resultlen);
+        assert(memcmp(rendered, result, resultlen) == 0);
+        assert(renderer->cleanbuf == oldcleanbuf);
+        assert(renderer->lineinfo.start == oldlinestarts);
+
+        // Link URIs too long for the stack go to the renderer's scratch:
+        char longlink[512] = "[x](";
+        memset(longlink + strlen(longlink), 'a', 300);
+        strcpy(longlink + 4 + 300, ".html)");
+        rendered = spew3dweb_markdown_RendererByteBufToHTML(
+            renderer, longlink, strlen(longlink), &options, &renderlen
+        );
+        assert(rendered != NULL && strstr(rendered, "aaa.html") != NULL);
+        char *olduriscratch = renderer->uriscratch;
+        assert(olduriscratch != NULL);
+        rendered = spew3dweb_markdown_RendererByteBufToHTML(
+            renderer, longlink, strlen(longlink), &options, &renderlen
+        );
+        assert(rendered != NULL && renderer->uriscratch == olduriscratch);
+        spew3dweb_markdown_FreeRenderer(renderer);
+        free(unitresult);
+        free(result);
+        free(input);
+    }
+    {
+        // Long enough that the formatting end scans get reused:
+        const char unit[] = "*a **b* c** ~~d~~ ";
+        const char unithtml[] = "*a *<em>b</em> c** <strike>d</strike> ";
+        const int unitcount = 100;
+        char *input = malloc(strlen(unit) * unitcount + 64);
+        char *expected = malloc(strlen(unithtml) * unitcount + 64);
+        assert(input != NULL && expected != NULL);
+        input[0] = '\0';
+        strcpy(expected, "<p>");
+        int k = 0;
+        while (k < unitcount) {
+            strcat(input, unit);
+            strcat(expected, unithtml);
+            k += 1;
+        }
+        strcat(input, "*e* **f** *g");
+        strcat(expected, "<em>e</em> <strong>f</strong> *g</p>");
+        result = spew3dweb_markdown_ToHTML(input);
+        printf("test_markdown_tohtml result #28: <<%s>>\n", result);
+        assert(_s3dw_check_html_same(result, expected));
+        free(result);
+        free(expected);
+        free(input);
+    }
+    {
+        // The line kind must be known again after the bullet was cut:
+        result = spew3dweb_markdown_ToHTML(
+            "- # abc\n- |a|b|\n  |-|-|\n  |c|d|"
+        );
+        printf("test_markdown_tohtml result #29: <<%s>>\n", result);
+        assert(_s3dw_check_html_same(result,
+            "<ul><li><h1><a name='abc' href='#abc'>abc</a></h1>\n"
+            "</li><li><table>\n"
+            "<tr><th>a</th><th>b</th></tr>\n"
+            "<tr><td>c</td><td>d</td></tr>\n"
+            "</table>\n</li></ul>"
+            ));
+        free(result);
+    }
+    {
+        // Tags in the first line of indented code must be escaped
+        // just like in the lines after it:
+        s3dw_markdown_tohtmloptions options = {0};
+        options.block_unsafe_html = 1;
+        const char input[] = "a\n\n    <script>\n    </script>\n";
+        result = spew3dweb_markdown_ByteBufToHTML(
+            input, strlen(input), &options, NULL
+        );
+        printf("test_markdown_tohtml result #30: <<%s>>\n", result);
+        assert(result != NULL && strstr(result, "<script") == NULL);
+        assert(_s3dw_check_html_same(result,
+            "<p>a</p>\n<pre><code>&lt;script&gt;\n"
+            "&lt;/script&gt;\n</code></pre>"
+            ));
+        free(result);
+    }
+    {
+        // A line starting right after everything so far was dropped
+        // must not make the cleaner look before its buffer:
+        result = spew3dweb_markdown_ToHTML("<!--\r\n\n");
+        printf("test_markdown_tohtml result #31: <<%s>>\n", result);
+        assert(result != NULL && strcmp(result, "") == 0);
+        free(result);
+        result = spew3dweb_markdown_ToHTML("<!--\n\\\r\n\n");
+        printf("test_markdown_tohtml result #32: <<%s>>\n", result);
+        assert(result != NULL && strcmp(result, "") == 0);
+        free(result);
+    }
+    {
+        // A backslash at the very end escapes nothing, and is kept:
+        result = spew3dweb_markdown_ToHTML("a \\");
+        printf("test_markdown_tohtml result #33: <<%s>>\n", result);
+        assert(result != NULL && strcmp(result, "<p>a \\</p>\n") == 0);
+        free(result);
+    }
+}
+END_TEST
+
+START_TEST(test_markdown_linescan)
+{
+    // All line break finders must agree, including with unaligned
+    // starts, tails shorter than a vector, and a full output array:
+    char buf[301];
+    unsigned int seed = 1;
+    int k = 0;
+    while (k < (int)sizeof(buf) - 1) {
+        seed = seed * 1103515245u + 12345u;
+        int r = (seed >> 16) % 16;
+        buf[k] = (r == 0 ? '\n' : (r == 1 ? '\r' : 'a' + r));
+        k += 1;
+    }
+    buf[sizeof(buf) - 1] = '\0';
+    size_t expected[300];
+    size_t got[300];
+    size_t maxpositions = 1;
+    while (maxpositions <= 300) {
+        size_t start = 0;
+        while (start < 64) {
+            size_t expectedfill = (
+                _internal_s3dw_markdown_FindLineBreaksWith(
+                    _S3D_MD_LINESCAN_SCALAR, buf, sizeof(buf) - 1 - start,
+                    start, expected, maxpositions
+                ));
+            int impl = _S3D_MD_LINESCAN_AUTO;
+            while (impl <= _S3D_MD_LINESCAN_AVX2) {
+                if (impl == _S3D_MD_LINESCAN_AUTO ||
+                        _internal_s3dw_markdown_LineScanImplSupported(
+                            impl)) {
+                    size_t gotfill = (
+                        _internal_s3dw_markdown_FindLineBreaksWith(
+                            impl, buf, sizeof(buf) - 1 - start,
+                            start, got, maxpositions
+                        ));
+                    assert(gotfill == expectedfill);
+                    assert(memcmp(got, expected,
+                        sizeof(*got) * gotfill) == 0);
+                }
+                impl += 1;
+            }
+            start += 1;
+        }
+        maxpositions += 7;
+    }
+
+    // Same for the inline markup finder, with a NUL byte in the input:
+    const char special[] = "\n\r`<>&\\![";
+    k = 0;
+    while (k < (int)sizeof(buf) - 1) {
+        seed = seed * 1103515245u + 12345u;
+        int r = (seed >> 16) % 128;
+        buf[k] = (r < 9 ? special[r] : 'a' + (r % 26));
+        k += 1;
+    }
+    buf[150] = '\0';
+    size_t start = 0;
+    while (start < sizeof(buf) - 1) {
+        size_t expectedpos = start;
+        while (expectedpos < sizeof(buf) - 1 && buf[expectedpos] != '\0' &&
+                strchr(special, buf[expectedpos]) == NULL)
+            expectedpos += 1;
+        int impl = _S3D_MD_LINESCAN_AUTO;
+        while (impl <= _S3D_MD_LINESCAN_AVX2) {
+            if (impl == _S3D_MD_LINESCAN_AUTO ||
+                    _internal_s3dw_markdown_LineScanImplSupported(impl))
+                assert(_internal_s3dw_markdown_FindInlineSpecialCharWith(
+                    impl, buf, sizeof(buf) - 1, start) == expectedpos);
+            impl += 1;
+        }
+        start += 1;
+    }
+}
+END_TEST
+
+static int _s3dw_check_document_matches_full(
+        s3dw_markdown_document *doc
+        ) {
+    size_t textlen = 0;
+    const char *text = spew3dweb_markdown_DocumentGetMarkdown(
+        doc, &textlen
+    );
+    size_t htmllen = 0;
+    const char *html = spew3dweb_markdown_DocumentGetHTML(doc, &htmllen);
+    size_t fulllen = 0;
+    char *full = spew3dweb_markdown_ByteBufToHTML(
+        text, textlen, &doc->options, &fulllen
+    );
+    assert(html != NULL && full != NULL);
+    printf("test_markdown_document: %d fragments, result: <<%s>>\n",
+        (int)spew3dweb_markdown_DocumentGetFragmentCount(doc), html);
+    int same = (htmllen == fulllen && memcmp(html, full, fulllen) == 0);
+    free(full);
+    return same;
+}
+
+START_TEST(test_markdown_document)
+{
+    const char input[] = "# Title\n\nSome *text*.\n\n"
+        "- a\n- b\n\n    code\n\n\nEnd.\n";
+    s3dw_markdown_tohtmloptions options = {0};
+    s3dw_markdown_document *doc = spew3dweb_markdown_NewDocument(
+        input, strlen(input), &options
+    );
+    assert(doc != NULL);
+    assert(_s3dw_check_document_matches_full(doc));
+    size_t fragments = spew3dweb_markdown_DocumentGetFragmentCount(doc);
+    assert(fragments >= 3);
+
+    // Typing inside the paragraph must only change its fragment:
+    size_t first = 0, removed = 0, added = 0;
+    int result = spew3dweb_markdown_DocumentEdit(
+        doc, strlen("# Title\n\nSome"), 0, " more", 5,
+        &first, &removed, &added
+    );
+    assert(result != 0);
+    assert(first == 1 && removed == 1 && added == 1);
+    size_t fragmentlen = 0;
+    const char *fragment = spew3dweb_markdown_DocumentGetFragment(
+        doc, first, &fragmentlen
+    );
+    assert(fragment != NULL && strstr(fragment, "Some more") != NULL);
+    assert(spew3dweb_markdown_DocumentGetFragmentCount(doc) ==
+        fragments);
+    assert(_s3dw_check_document_matches_full(doc));
+
+    // Split a paragraph in two, then join them again:
+    size_t textlen = 0;
+    const char *text = spew3dweb_markdown_DocumentGetMarkdown(
+        doc, &textlen
+    );
+    size_t splitpos = strstr(text, "more") - text;
+    result = spew3dweb_markdown_DocumentEdit(
+        doc, splitpos, 0, "\n\n", 2, &first, &removed, &added
+    );
+    assert(result != 0 && added == removed + 1);
+    assert(_s3dw_check_document_matches_full(doc));
+    result = spew3dweb_markdown_DocumentEdit(
+        doc, splitpos, 2, NULL, 0, NULL, NULL, NULL
+    );
+    assert(result != 0);
+    assert(spew3dweb_markdown_DocumentGetFragmentCount(doc) ==
+        fragments);
+    assert(_s3dw_check_document_matches_full(doc));
+
+    // An opened fence swallows all that follows until it's closed:
+    result = spew3dweb_markdown_DocumentEdit(
+        doc, 0, 0, "```\n", 4, NULL, NULL, NULL
+    );
+    assert(result != 0);
+    assert(spew3dweb_markdown_DocumentGetFragmentCount(doc) == 1);
+    assert(_s3dw_check_document_matches_full(doc));
+    text = spew3dweb_markdown_DocumentGetMarkdown(doc, &textlen);
+    splitpos = strstr(text, "\n\nSome") - text;
+    result = spew3dweb_markdown_DocumentEdit(
+        doc, splitpos, 0, "\n```", 4, NULL, NULL, NULL
+    );
+    assert(result != 0);
+    assert(spew3dweb_markdown_DocumentGetFragmentCount(doc) ==
+        fragments);
+    assert(_s3dw_check_document_matches_full(doc));
+
+    // Remove everything across block borders, and then all of it:
+    text = spew3dweb_markdown_DocumentGetMarkdown(doc, &textlen);
+    result = spew3dweb_markdown_DocumentEdit(
+        doc, 5, textlen - 10, "x\n\ny", 4, NULL, NULL, NULL
+    );
+    assert(result != 0);
+    assert(_s3dw_check_document_matches_full(doc));
+    text = spew3dweb_markdown_DocumentGetMarkdown(doc, &textlen);
+    assert(spew3dweb_markdown_DocumentEdit(
+        doc, textlen, 1, NULL, 0, NULL, NULL, NULL
+    ) == 0);
+    result = spew3dweb_markdown_DocumentEdit(
+        doc, 0, textlen, NULL, 0, NULL, NULL, NULL
+    );
+    assert(result != 0);
+    assert(spew3dweb_markdown_DocumentGetFragmentCount(doc) == 0);
+    assert(_s3dw_check_document_matches_full(doc));
+    spew3dweb_markdown_FreeDocument(doc);
+}
+END_TEST
+
+START_TEST(test_markdown_document_context)
+{
+    // Blocks that continue a list, or headings that need an anchor
+    // different from an earlier one, must render like the whole text:
+    const char input[] = "# Same\n\n- a\n\n  - b\n\n        code\n\n"
+        "  - c\n\nEnd.\n\n<!--\n\n-->\n\n# Same\n\n1. x\n\n# Same\n";
+    int unique = 0;
+    while (unique <= 1) {
+        s3dw_markdown_tohtmloptions options = {0};
+        options.unique_heading_anchors = unique;
+        s3dw_markdown_document *doc = spew3dweb_markdown_NewDocument(
+            input, strlen(input), &options
+        );
+        assert(doc != NULL);
+        assert(_s3dw_check_document_matches_full(doc));
+        size_t textlen = 0;
+        const char *text = spew3dweb_markdown_DocumentGetMarkdown(
+            doc, &textlen
+        );
+        size_t editpos = strstr(text, "- b") - text;
+        int result = spew3dweb_markdown_DocumentEdit(
+            doc, editpos, 0, "1. ", 3, NULL, NULL, NULL
+        );
+        assert(result != 0);
+        assert(_s3dw_check_document_matches_full(doc));
+        text = spew3dweb_markdown_DocumentGetMarkdown(doc, &textlen);
+        editpos = strstr(text, "- c") - text;
+        result = spew3dweb_markdown_DocumentEdit(
+            doc, editpos, 2, "# Same ", 7, NULL, NULL, NULL
+        );
+        assert(result != 0);
+        assert(_s3dw_check_document_matches_full(doc));
+        text = spew3dweb_markdown_DocumentGetMarkdown(doc, &textlen);
+        editpos = strstr(text, "<!--") - text;
+        result = spew3dweb_markdown_DocumentEdit(
+            doc, editpos, 4, NULL, 0, NULL, NULL, NULL
+        );
+        assert(result != 0);
+        assert(_s3dw_check_document_matches_full(doc));
+
+        // Typing at the end only touches the last fragment:
+        size_t first = 0, removed = 0, added = 0;
+        text = spew3dweb_markdown_DocumentGetMarkdown(doc, &textlen);
+        result = spew3dweb_markdown_DocumentEdit(
+            doc, textlen - 1, 0, " x", 2, &first, &removed, &added
+        );
+        assert(result != 0);
+        assert(_s3dw_check_document_matches_full(doc));
+        assert(first + 1 ==
+            spew3dweb_markdown_DocumentGetFragmentCount(doc));
+        assert(removed == 1 && added == 1);
+        spew3dweb_markdown_FreeDocument(doc);
+        unique += 1;
+    }
+}
+END_TEST
+
+START_TEST(test_markdown_tohtml_parallel)
+{
+    // Pieces that start inside lists, code blocks, fences or
+    // comments must still come out exactly like the serial result:
+    const char *parts[] = {
+        "# Heading\n\nSome *text* [a link](b.md).\n\n",
+        "- item\n\n  continued\n\n- item two\n\n",
+        "1. one\n2. two\n\nafter list\n\n",
+        "    code\n\n    more code\n\nx\n\n",
+        "```\nfenced\n\nstill fenced\n```\n\n",
+        "> quote\n\n> more\n\n",
+        "<!--\ncomment\n\n-->\n\n",
+        "|a|b|\n|-|-|\n|1|2|\n\n",
+        "text\r\n\r\nwith CR LF\r\n\r\n",
+    };
+    const size_t partcount = sizeof(parts) / sizeof(parts[0]);
+    char input[4096];
+    size_t inputlen = 0;
+    size_t k = 0;
+    while (k < 60) {
+        const char *part = parts[(k * 7) % partcount];
+        assert(inputlen + strlen(part) < sizeof(input));
+        memcpy(input + inputlen, part, strlen(part));
+        inputlen += strlen(part);
+        k += 1;
+    }
+    s3dw_markdown_tohtmloptions options = {0};
+    size_t seriallen = 0;
+    char *serial = spew3dweb_markdown_ByteBufToHTML(
+        input, inputlen, &options, &seriallen
+    );
+    assert(serial != NULL);
+    int threads = 1;
+    while (threads <= 5) {
+        size_t minpiecelen = 1;
+        while (minpiecelen < inputlen) {
+            size_t resultlen = 0;
+            char *result = (
+                _internal_spew3dweb_markdown_ByteBufToHTMLParallelEx(
+                    input, inputlen, &options, threads,
+                    minpiecelen, &resultlen
+                ));
+            assert(result != NULL);
+            assert(resultlen == seriallen);
+            assert(memcmp(result, serial, seriallen) == 0);
+            free(result);
+            minpiecelen = minpiecelen * 3 + 1;
+        }
+        threads += 2;
+    }
+    free(serial);
+
+    // A long document of nested lists, with the default piece size:
+    const char *nestedparts[] = {
+        "- a\n", "  - b\n", "    - c\n", "lazy\n\n", "      - d\n",
+        "\n", "  1. e\n", "        code\n", "text\n\n", "> q\n\n",
+        "\nplain\n\n",
+    };
+    const size_t nestedpartcount = (
+        sizeof(nestedparts) / sizeof(nestedparts[0])
+    );
+    size_t nestedlen = 0;
+    char *nested = malloc(80 * 1024);
+    assert(nested != NULL);
+    k = 0;
+    while (nestedlen < 70 * 1024) {
+        const char *part = nestedparts[(k * k + k / 3) % nestedpartcount];
+        memcpy(nested + nestedlen, part, strlen(part));
+        nestedlen += strlen(part);
+        k += 1;
+    }
+    serial = spew3dweb_markdown_ByteBufToHTML(
+        nested, nestedlen, &options, &seriallen
+    );
+    assert(serial != NULL);
+    size_t resultlen = 0;
+    char *result = spew3dweb_markdown_ByteBufToHTMLParallel(
+        nested, nestedlen, &options, 4, &resultlen
+    );
+    assert(result != NULL && resultlen == seriallen);
+    assert(memcmp(result, serial, seriallen) == 0);
+    free(result);
+    result = _internal_spew3dweb_markdown_ByteBufToHTMLParallelEx(
+        nested, nestedlen, &options, 4, 1024, &resultlen
+    );
+    assert(result != NULL && resultlen == seriallen);
+    assert(memcmp(result, serial, seriallen) == 0);
+    free(result);
+    free(serial);
+    free(nested);
+
+    result = spew3dweb_markdown_ByteBufToHTMLParallel(
+        "", 0, &options, 0, &resultlen
+    );
+    assert(result != NULL && resultlen == 0);
+    free(result);
+}
+END_TEST
+
+START_TEST(test_markdown_tohtml_batch)
+{
+    const char *inputs[] = {
+        "# Hello\n\nWorld.", "", "- a\n- b\n", "    code\n",
+        "*x* [y](z.md)", "<b>unsafe</b>", "```\nfence\n```\n",
+    };
+    const size_t count = sizeof(inputs) / sizeof(inputs[0]);
+    s3dw_markdown_tohtmloptions options = {0};
+    options.block_unsafe_html = 1;
+    char *results[sizeof(inputs) / sizeof(inputs[0])];
+    size_t resultlens[sizeof(inputs) / sizeof(inputs[0])];
+    int threads = 0;
+    while (threads <= 4) {
+        int success = spew3dweb_markdown_ByteBufsToHTML(
+            inputs, NULL, count, &options, threads,
+            results, (threads % 2 == 0 ? resultlens : NULL)
+        );
+        assert(success != 0);
+        size_t i = 0;
+        while (i < count) {
+            size_t expectedlen = 0;
+            char *expected = spew3dweb_markdown_ByteBufToHTML(
+                inputs[i], strlen(inputs[i]), &options, &expectedlen
+            );
+            assert(expected != NULL && results[i] != NULL);
+            assert(strcmp(results[i], expected) == 0);
+            assert(threads % 2 != 0 || resultlens[i] == expectedlen);
+            free(expected);
+            free(results[i]);
+            i += 1;
+        }
+        threads += 1;
+    }
+    assert(spew3dweb_markdown_ByteBufsToHTML(
+        NULL, NULL, 0, &options, 2, NULL, NULL
+    ) != 0);
+}
+END_TEST
+
+static s3dw_markdown_rendercache *_s3dw_test_cache = NULL;
+
+static void *_s3dw_test_cache_worker(void *userdata) {
+    const char *inputs[] = {"# a", "*b*", "- c", "`d`"};
+    s3dw_markdown_tohtmloptions options = {0};
+    int i = 0;
+    while (i < 200) {
+        const char *input = inputs[(i + (intptr_t)userdata) % 4];
+        char *result = spew3dweb_markdown_RenderCacheByteBufToHTML(
+            _s3dw_test_cache, input, strlen(input), &options, NULL
+        );
+        char *expected = spew3dweb_markdown_ToHTML(input);
+        assert(result != NULL && expected != NULL);
+        assert(strcmp(result, expected) == 0);
+        free(result);
+        free(expected);
+        i += 1;
+    }
+    return NULL;
+}
+
+START_TEST(test_markdown_rendercache)
+{
+    s3dw_markdown_rendercache *cache = (
+        spew3dweb_markdown_NewRenderCache(64 * 1024));
+    assert(cache != NULL);
+    s3dw_markdown_tohtmloptions options = {0};
+    const char input[] = "# Title\n\nSome <b>text</b>.";
+    size_t resultlen = 0;
+    char *result = spew3dweb_markdown_RenderCacheByteBufToHTML(
+        cache, input, strlen(input), &options, &resultlen
+    );
+    char *expected = spew3dweb_markdown_ToHTML(input);
+    assert(result != NULL && strcmp(result, expected) == 0);
+    assert(resultlen == strlen(expected));
+    free(result);
+    resultlen = 0;
+    result = spew3dweb_markdown_RenderCacheByteBufToHTML(
+        cache, input, strlen(input), &options, &resultlen
+    );
+    assert(result != NULL && strcmp(result, expected) == 0);
+    assert(resultlen == strlen(expected));
+    free(result);
+    free(expected);
+
+    // Other options must not get the cached result:
+    options.block_unsafe_html = 1;
+    result = spew3dweb_markdown_RenderCacheByteBufToHTML(
+        cache, input, strlen(input), &options, NULL
+    );
+    assert(result != NULL && strstr(result, "<b>") == NULL);
+    free(result);
+    s3dw_markdown_rendercachestats stats;
+    spew3dweb_markdown_RenderCacheGetStats(cache, &stats);
+    assert(stats.hits == 1 && stats.misses == 2);
+    assert(stats.evictions == 0 && stats.entries == 2);
+    assert(stats.bytesused > 0 && stats.bytesused <= stats.bytesbudget);
+    spew3dweb_markdown_FreeRenderCache(cache);
+
+    // With a small budget, the oldest entries must go first:
+    cache = spew3dweb_markdown_NewRenderCache(1024);
+    assert(cache != NULL);
+    options.block_unsafe_html = 0;
+    char bigger[300];
+    int i = 0;
+    while (i < 20) {
+        memset(bigger, 'a' + i, sizeof(bigger) - 1);
+        bigger[sizeof(bigger) - 1] = '\0';
+        result = spew3dweb_markdown_RenderCacheByteBufToHTML(
+            cache, bigger, strlen(bigger), &options, NULL
+        );
+        assert(result != NULL);
+        free(result);
+        i += 1;
+    }
+    spew3dweb_markdown_RenderCacheGetStats(cache, &stats);
+    assert(stats.misses == 20 && stats.evictions > 0);
+    assert(stats.entries + stats.evictions == 20);
+    assert(stats.bytesused <= 1024);
+    // The newest one must still be there:
+    result = spew3dweb_markdown_RenderCacheByteBufToHTML(
+        cache, bigger, strlen(bigger), &options, NULL
+    );
+    assert(result != NULL);
+    free(result);
+    spew3dweb_markdown_RenderCacheGetStats(cache, &stats);
+    assert(stats.hits == 1);
+    spew3dweb_markdown_FreeRenderCache(cache);
+
+    // Use from multiple threads at once:
+    _s3dw_test_cache = spew3dweb_markdown_NewRenderCache(4096);
+    assert(_s3dw_test_cache != NULL);
+    pthread_t threads[4];
+    i = 0;
+    while (i < 4) {
+        int created = pthread_create(&threads[i], NULL,
+            _s3dw_test_cache_worker, (void *)(intptr_t)i);
+        assert(created == 0);
+        i += 1;
+    }
+    i = 0;
+    while (i < 4) {
+        pthread_join(threads[i], NULL);
+        i += 1;
+    }
+    spew3dweb_markdown_RenderCacheGetStats(_s3dw_test_cache, &stats);
+    assert(stats.hits + stats.misses == 800 && stats.hits > 0);
+    spew3dweb_markdown_FreeRenderCache(_s3dw_test_cache);
+    _s3dw_test_cache = NULL;
+}
+END_TEST
+
+START_TEST(test_markdown_fragmentcache)
+{
+    s3dw_markdown_renderer *renderer = spew3dweb_markdown_NewRenderer();
+    assert(renderer != NULL);
+    int enabled = spew3dweb_markdown_RendererEnableFragmentCache(
+        renderer, 1
+    );
+    assert(enabled);
+    s3dw_markdown_tohtmloptions options = {0};
+    char doc[] = ("# Title\n\nFirst paragraph.\n\n"
+        "- a list\n- b\n\n    indented code\n\n"
+        "1. first\n2. second\n\nLast paragraph.");
+    char *expected = spew3dweb_markdown_ToHTML(doc);
+    assert(expected != NULL);
+    size_t resultlen = 0;
+    const char *result = spew3dweb_markdown_RendererByteBufToHTML(
+        renderer, doc, strlen(doc), &options, &resultlen
+    );
+    assert(result != NULL && strcmp(result, expected) == 0);
+    assert(resultlen == strlen(expected));
+    assert(renderer->fragmentsreused == 0);
+    assert(renderer->fragmentsrendered > 1);
+    free(expected);
+
+    // Edit one paragraph, the other blocks should be reused:
+    char *edit = strstr(doc, "First");
+    assert(edit != NULL);
+    memcpy(edit, "Other", strlen("Other"));
+    expected = spew3dweb_markdown_ToHTML(doc);
+    assert(expected != NULL);
+    result = spew3dweb_markdown_RendererByteBufToHTML(
+        renderer, doc, strlen(doc), &options, &resultlen
+    );
+    assert(result != NULL && strcmp(result, expected) == 0);
+    assert(resultlen == strlen(expected));
+    assert(renderer->fragmentsreused > 0);
+    assert(renderer->fragmentsrendered >= 1);
+    assert(renderer->fragmentsrendered < renderer->fragmentsreused);
+    free(expected);
+
+    // Different options must not get the cached blocks:
+    options.block_unsafe_html = 1;
+    expected = spew3dweb_markdown_ToHTMLEx(doc, &options, NULL);
+    assert(expected != NULL);
+    result = spew3dweb_markdown_RendererByteBufToHTML(
+        renderer, doc, strlen(doc), &options, NULL
+    );
+    assert(result != NULL && strcmp(result, expected) == 0);
+    assert(renderer->fragmentsreused == 0);
+    free(expected);
+    spew3dweb_markdown_FreeRenderer(renderer);
+}
+END_TEST
+
+START_TEST(test_markdown_anchors)
+{
+    char *anchor = spew3dweb_markdown_MarkdownBytesToAnchor(
+        "Some Heading: Part (2)", strlen("Some Heading: Part (2)")
+    );
+    assert(anchor != NULL && strcmp(anchor, "some-heading-part-2") == 0);
+    free(anchor);
+    anchor = spew3dweb_markdown_MarkdownBytesToAnchor(
+        "über uns", strlen("über uns")
+    );
+    assert(anchor != NULL && strcmp(anchor, "über-uns") == 0);
+    free(anchor);
+    char longheading[300];
+    memset(longheading, 'A', sizeof(longheading));
+    anchor = spew3dweb_markdown_MarkdownBytesToAnchor(
+        longheading, sizeof(longheading)
+    );
+    assert(anchor != NULL && strlen(anchor) == sizeof(longheading));
+    assert(anchor[0] == 'a' && anchor[sizeof(longheading) - 1] == 'a');
+    free(anchor);
+
+    const char doc[] = "# A\n\n# A\n\n# A 1\n\n# A";
+    char *result = spew3dweb_markdown_ToHTML(doc);
+    assert(result != NULL);
+    const char *name = strstr(result, "name='a'");
+    assert(name != NULL && strstr(name + 1, "name='a'") != NULL);
+    free(result);
+    s3dw_markdown_tohtmloptions options = {0};
+    options.unique_heading_anchors = 1;
+    result = spew3dweb_markdown_ToHTMLEx(doc, &options, NULL);
+    assert(result != NULL);
+    name = strstr(result, "name='a'");
+    assert(name != NULL && strstr(name + 1, "name='a'") == NULL);
+    assert(strstr(result, "<a name='a-1' href='#a-1'>") != NULL);
+    assert(strstr(result, "<a name='a-1-1' href='#a-1-1'>") != NULL);
+    assert(strstr(result, "<a name='a-2' href='#a-2'>") != NULL);
+    free(result);
+
+    // A renderer must start over for each conversion:
+    s3dw_markdown_renderer *renderer = spew3dweb_markdown_NewRenderer();
+    assert(renderer != NULL);
+    int k = 0;
+    while (k < 2) {
+        const char *html = spew3dweb_markdown_RendererByteBufToHTML(
+            renderer, doc, strlen(doc), &options, NULL
+        );
+        assert(html != NULL && strstr(html, "name='a-3'") == NULL);
+        assert(strstr(html, "name='a-2'") != NULL);
+        k += 1;
+    }
+    spew3dweb_markdown_FreeRenderer(renderer);
+}
+END_TEST
+
+START_TEST(test_markdown_toc)
+{
+    const char doc[] = ("# Intro\n\nText.\n\nSub *part*\n---\n\n"
+        "# A [link](x.html)\n\n```\n# Not a heading\n```\n");
+    s3dw_markdown_tohtmloptions options = {0};
+    s3dw_markdown_toc toc;
+    size_t resultlen = 0;
+    char *result = spew3dweb_markdown_ByteBufToHTMLWithTOC(
+        doc, strlen(doc), &options, &toc, &resultlen
+    );
+    assert(result != NULL);
+    char *expected = spew3dweb_markdown_ToHTML(doc);
+    assert(expected != NULL && strcmp(result, expected) == 0);
+    free(expected);
+    assert(toc.count == 3);
+    assert(toc.entries[0].level == 1);
+    assert(strncmp(result + toc.entries[0].offset, "<h1>", 4) == 0);
+    assert(toc.entries[0].anchorlen == strlen("intro"));
+    assert(strncmp(result + toc.entries[0].anchorstart, "intro",
+        toc.entries[0].anchorlen) == 0);
+    assert(toc.entries[0].textlen == strlen("Intro"));
+    assert(strncmp(result + toc.entries[0].textstart, "Intro",
+        toc.entries[0].textlen) == 0);
+    assert(toc.entries[1].level == 2);
+    assert(strncmp(result + toc.entries[1].offset, "<h2>", 4) == 0);
+    assert(toc.entries[1].textlen == strlen("Sub <em>part</em>"));
+    assert(strncmp(result + toc.entries[1].textstart, "Sub <em>part</em>",
+        toc.entries[1].textlen) == 0);
+    assert(strncmp(result + toc.entries[1].anchorstart, "sub-part",
+        toc.entries[1].anchorlen) == 0);
+    // A heading with a link in it gets no anchor of its own:
+    assert(toc.entries[2].level == 1);
+    assert(toc.entries[2].anchorlen == 0);
+    assert(toc.entries[2].offset < resultlen);
+    spew3dweb_markdown_FreeTOC(&toc);
+    assert(toc.entries == NULL && toc.count == 0);
+    free(result);
+}
+END_TEST
+
+typedef struct eventlog {
+    char text[1024];
+    size_t fill;
+    int depth, maxdepth, stopafter, seen;
+    const char *source;
+    size_t sourcelen;
+    char markup[256];
+    size_t markupfill;
+} eventlog;
+
+static int _test_markdown_events_cb(
+        const s3dw_markdown_event *event, void *userdata
+        ) {
+    eventlog *log = userdata;
+    log->seen += 1;
+    if (log->stopafter > 0 && log->seen >= log->stopafter)
+        return 0;
+    if (log->source != NULL) {
+        // Remember the markup each event came from, to check offsets:
+        assert(event->offset + event->length <= log->sourcelen);
+        if (event->type != S3DW_MD_EVENT_TEXT && event->length > 0) {
+            assert(log->markupfill + event->length + 2 <
+                sizeof(log->markup));
+            memcpy(log->markup + log->markupfill,
+                log->source + event->offset, event->length);
+            log->markup[log->markupfill + event->length] = '|';
+            log->markupfill += event->length + 1;
+            log->markup[log->markupfill] = '\0';
+        }
+    }
+    char entry[256];
+    if (event->type == S3DW_MD_EVENT_ENTER) {
+        log->depth += 1;
+        if (log->depth > log->maxdepth)
+            log->maxdepth = log->depth;
+        snprintf(entry, sizeof(entry), "+%d:%.*s", event->element,
+            (int)event->textlen, (event->text ? event->text : ""));
+    } else if (event->type == S3DW_MD_EVENT_LEAVE) {
+        log->depth -= 1;
+        assert(log->depth >= 0);
+        snprintf(entry, sizeof(entry), "-%d", event->element);
+    } else {
+        assert(event->type == S3DW_MD_EVENT_TEXT);
+        snprintf(entry, sizeof(entry), "'%.*s'",
+            (int)event->textlen, event->text);
+    }
+    size_t len = strlen(entry);
+    assert(log->fill + len + 2 < sizeof(log->text));
+    memcpy(log->text + log->fill, entry, len);
+    log->text[log->fill + len] = ' ';
+    log->fill += len + 1;
+    log->text[log->fill] = '\0';
+    return 1;
+}
+
+START_TEST(test_markdown_events)
+{
+    const char doc[] = ("# Hi *there*\n\na < b [x](y.html) "
+        "![pic](p.png)\n\n- one\n\n```c\nint <b>;\n```\n");
+    s3dw_markdown_tohtmloptions options = {0};
+    eventlog log = {0};
+    log.source = doc;
+    log.sourcelen = strlen(doc);
+    int result = spew3dweb_markdown_ByteBufToEvents(
+        doc, strlen(doc), &options, _test_markdown_events_cb, &log
+    );
+    assert(result != 0);
+    assert(log.depth == 0);
+    assert(strcmp(log.markup,
+        "# |*|*|[|](y.html)|![pic](p.png)|- |```c|```|") == 0);
+    assert(strcmp(log.text,
+        "+2:hi-there 'Hi ' +14: 'there' -14 -2 "
+        "+1: 'a < b ' +12:y.html 'x' -12 ' ' +13:p.png -13 -1 "
+        "+3: +5: +1: 'one' -1 -5 -3 "
+        "+7:c 'int <b>;\n' -7 ") == 0);
+    assert(log.maxdepth == 3);
+    // A callback returning 0 stops it, which counts as failure:
+    memset(&log, 0, sizeof(log));
+    log.stopafter = 3;
+    result = spew3dweb_markdown_ByteBufToEvents(
+        doc, strlen(doc), &options, _test_markdown_events_cb, &log
+    );
+    assert(result == 0);
+    assert(log.seen == 3);
+}
+END_TEST
+
+START_TEST(test_markdown_totext)
+{
+    const char doc[] = ("# Hi *there*\n\na &lt; b [x](y.html) "
+        "![pic](p.png) end\n\n- one\n\n|a|b|\n|-|-|\n|1|2|\n\n"
+        "```c\nint <b>;\n```\n");
+    s3dw_markdown_tohtmloptions options = {0};
+    size_t resultlen = 0;
+    char *result = spew3dweb_markdown_ByteBufToText(
+        doc, strlen(doc), &options, 0, &resultlen
+    );
+    assert(result != NULL);
+    assert(resultlen == strlen(result));
+    assert(strcmp(result, "Hi there\na < b x pic end\none\n"
+        "\n\na b\n1 2\n\n") == 0);
+    free(result);
+    result = spew3dweb_markdown_ByteBufToText(
+        doc, strlen(doc), &options, 1, &resultlen
+    );
+    assert(result != NULL);
+    assert(strstr(result, "\nint <b>;\n") != NULL);
+    free(result);
+    // Code stays as it is, text has its entities decoded:
+    const char entities[] = "`&lt;` \\& &amp; ![&quot;'](x.png)";
+    result = spew3dweb_markdown_ByteBufToText(
+        entities, strlen(entities), &options, 0, &resultlen
+    );
+    assert(result != NULL);
+    assert(strcmp(result, "&lt; & & \"'\n") == 0);
+    free(result);
+    // Left out or not, no kind of URL ever shows up:
+    const char links[] = "[t](u v) [s](w.html) ![i](p.png){width=5px}";
+    result = spew3dweb_markdown_ByteBufToText(
+        links, strlen(links), &options, 0, &resultlen
+    );
+    assert(result != NULL);
+    assert(strcmp(result, "t s i\n") == 0);
+    free(result);
+}
+END_TEST
+
+START_TEST(test_markdown_escape)
+{
+    // All finders must agree with a plain loop, on runs long enough
+    // for the vector ones and from every start:
+    const char special[] = "&<>'\"";
+    char buf[301];
+    unsigned int seed = 1;
+    int k = 0;
+    while (k < (int)sizeof(buf) - 1) {
+        seed = seed * 1103515245u + 12345u;
+        int r = (seed >> 16) % 64;
+        buf[k] = (r < 5 ? special[r] : 'a' + (r % 26));
+        k += 1;
+    }
+    buf[sizeof(buf) - 1] = '\0';
+    size_t start = 0;
+    while (start < sizeof(buf) - 1) {
+        size_t expected = start;
+        while (expected < sizeof(buf) - 1 &&
+                strchr(special, buf[expected]) == NULL)
+            expected += 1;
+        int impl = _S3D_MD_LINESCAN_AUTO;
+        while (impl <= _S3D_MD_LINESCAN_AVX2) {
+            if (impl == _S3D_MD_LINESCAN_AUTO ||
+                    _internal_s3dw_markdown_LineScanImplSupported(impl))
+                assert(_internal_s3dw_markdown_FindEscapeCharWith(
+                    impl, buf, sizeof(buf) - 1, start) == expected);
+            impl += 1;
+        }
+        start += 1;
+    }
+
+    const char text[] = "a<b>&'c\" d &amp; e";
+    char *result = NULL;
+    size_t resultalloc = 0;
+    size_t resultfill = 0;
+    assert(_internal_s3dw_markdown_bufappendescaped(
+        &result, &resultalloc, &resultfill, text, strlen(text), 0));
+    result[resultfill] = '\0';
+    assert(strcmp(result, "a&lt;b&gt;&amp;&#39;c&quot; d &amp;amp; e") == 0);
+    resultfill = 0;
+    assert(_internal_s3dw_markdown_bufappendescaped(
+        &result, &resultalloc, &resultfill, text, strlen(text), 1));
+    result[resultfill] = '\0';
+    assert(strcmp(result, "a<b>&&#39;c&quot; d &amp; e") == 0);
+    free(result);
+
+    // Code is escaped but never gets links:
+    char *html = spew3dweb_markdown_ToHTML(
+        "    x & [l](u.html)\n    <y> 'z'\n"
+    );
+    assert(html != NULL);
+    assert(strstr(html,
+        "<code>x &amp; [l](u.html)\n&lt;y&gt; &#39;z&#39;") != NULL);
+    free(html);
+
+    // Quotes in image titles must not end the attribute:
+    html = spew3dweb_markdown_ToHTML("![a 'b' \"c\"](p.png)");
+    assert(html != NULL);
+    assert(strstr(html, "alt='a &#39;b&#39; &quot;c&quot;'") != NULL);
+    free(html);
+}
+END_TEST
+
+START_TEST(test_markdown_outbuf)
+{
+    char *buf = NULL;
+    size_t bufalloc = 0;
+    size_t buffill = 0;
+    assert(_S3D_MD_BUFAPPENDLIT(&buf, &bufalloc, &buffill, "ab", 1));
+    assert(_S3D_MD_BUFAPPENDLIT(&buf, &bufalloc, &buffill, "-", 3));
+    assert(_S3D_MD_BUFAPPENDLIT(&buf, &bufalloc, &buffill, "xy", 2));
+    assert(_internal_s3dw_markdown_bufappendchar(
+        &buf, &bufalloc, &buffill, 'z', 0));
+    assert(buffill == 9 && memcmp(buf, "ab---xyxy", 9) == 0);
+    assert(bufalloc > buffill);
+
+    // Many small appends must only regrow a few times:
+    spew3dweb_markdown_ResetBufferStats();
+    buffill = 0;
+    int i = 0;
+    while (i < 100000) {
+        assert(_S3D_MD_BUFAPPENDLIT(
+            &buf, &bufalloc, &buffill, "0123456789", 1));
+        i += 1;
+    }
+    uint64_t reallocs = 0;
+    uint64_t bytesmoved = 0;
+    spew3dweb_markdown_GetBufferStats(&reallocs, &bytesmoved);
+    assert(reallocs > 0 && reallocs < 30);
+    assert(bytesmoved <= (uint64_t)buffill * 3);
+    assert(buffill == 1000000 && bufalloc > buffill);
+    assert(memcmp(buf + buffill - 10, "0123456789", 10) == 0);
+    free(buf);
+
+    // A typical document gets its output allocated once up front:
+    const char unit[] = ("## Some heading\n\nA paragraph with *a bit* "
+        "of **markup** and a [link](page.html).\nIt goes on for "
+        "another line or two, like prose usually does,\nuntil at "
+        "some point it comes to an end.\n\n");
+    size_t unitlen = strlen(unit);
+    size_t doclen = unitlen * 200;
+    char *doc = malloc(doclen + 1);
+    assert(doc != NULL);
+    i = 0;
+    while (i < 200) {
+        memcpy(doc + unitlen * i, unit, unitlen);
+        i += 1;
+    }
+    doc[doclen] = '\0';
+    s3dw_markdown_tohtmloptions options = {0};
+    spew3dweb_markdown_ResetBufferStats();
+    size_t htmllen = 0;
+    char *html = spew3dweb_markdown_ByteBufToHTML(
+        doc, doclen, &options, &htmllen
+    );
+    assert(html != NULL && htmllen > doclen);
+    spew3dweb_markdown_GetBufferStats(&reallocs, NULL);
+    assert(reallocs == 0);
+    free(html);
+    spew3dweb_markdown_ResetBufferStats();
+    size_t cleanlen = 0;
+    char *clean = spew3dweb_markdown_CleanByteBuf(
+        doc, doclen, 1, 0, NULL, NULL, &cleanlen, NULL
+    );
+    assert(clean != NULL);
+    spew3dweb_markdown_GetBufferStats(&reallocs, NULL);
+    assert(reallocs == 0);
+    free(clean);
+    free(doc);
+}
+END_TEST
+
+START_TEST(test_markdown_scanbound)
+{
+    // Unmatched formatting must not make the scans for where it ends
+    // go over the rest of the paragraph again each time:
+    // (The short one first, so this fails quickly if it's broken.)
+    const char *units[] = {
+        "*a ", "*a ", "**a *b ~~c ", "*a\n", "*`a ", "*a [x](y) ", NULL
+    };
+    const int unitcounts[] = {
+        2000, 512000, 64000, 128000, 128000, 64000
+    };
+    int k = 0;
+    while (units[k] != NULL) {
+        size_t unitlen = strlen(units[k]);
+        size_t inputlen = unitlen * unitcounts[k];
+        char *input = malloc(inputlen + 1);
+        assert(input != NULL);
+        int i = 0;
+        while (i < unitcounts[k]) {
+            memcpy(input + unitlen * i, units[k], unitlen);
+            i += 1;
+        }
+        input[inputlen] = '\0';
+        s3dw_markdown_tohtmloptions options = {0};
+        spew3dweb_markdown_ResetScanStats();
+        size_t resultlen = 0;
+        char *result = spew3dweb_markdown_ByteBufToHTML(
+            input, inputlen, &options, &resultlen
+        );
+        assert(result != NULL);
+        uint64_t scansteps = spew3dweb_markdown_GetScanStats();
+        printf("test_markdown_scanbound: unit #%d, %zu bytes, "
+            "%llu scan steps\n", k, inputlen,
+            (unsigned long long)scansteps);
+        assert(scansteps > 0);
+        assert(scansteps <= (uint64_t)inputlen * 16);
+        free(result);
+        free(input);
+        k += 1;
+    }
+}
+END_TEST
+
+typedef struct uribatchlog {
+    int calls;
+    size_t uris;
+    int fail;
+    char results[8][64];
+} uribatchlog;
+
+static int _test_markdown_uribatch_cb(
+        const char **uris, size_t count, const char **out_uris,
+        void *userdata
+        ) {
+    uribatchlog *log = userdata;
+    log->calls += 1;
+    log->uris += count;
+    if (log->fail)
+        return 0;
+    size_t i = 0;
+    while (i < count && i < 8) {
+        if (strcmp(uris[i], "same.html") == 0) {
+            out_uris[i] = uris[i];
+        } else if (strcmp(uris[i], "keep.html") != 0) {
+            snprintf(log->results[i], sizeof(log->results[i]),
+                "/x/%s", uris[i]);
+            out_uris[i] = log->results[i];
+        }
+        i += 1;
+    }
+    return 1;
+}
+
+static char *_test_markdown_urione_cb(
+        const char *uri, void *userdata
+        ) {
+    char *result = malloc(strlen(uri) + 4);
+    if (!result)
+        return NULL;
+    if (strcmp(uri, "same.html") == 0 || strcmp(uri, "keep.html") == 0)
+        strcpy(result, uri);
+    else
+        sprintf(result, "/x/%s", uri);
+    return result;
+}
+
+START_TEST(test_markdown_uribatch)
+{
+    const char doc[] = ("[a](one.html) [b](two.png) ![c](two.png)\n\n"
+        "[d](one.html) [e](keep.html) [f](same.html)\n\n"
+        "    [code](three.html)\n\n`[x](four.html)`\n");
+    uribatchlog log = {0};
+    s3dw_markdown_tohtmloptions options = {0};
+    options.uritransform_batch_callback = _test_markdown_uribatch_cb;
+    options.uritransform_callback_userdata = &log;
+    size_t htmllen = 0;
+    char *html = spew3dweb_markdown_ByteBufToHTML(
+        doc, strlen(doc), &options, &htmllen
+    );
+    assert(html != NULL);
+    // Each distinct URI is handed over once, and none from code:
+    assert(log.calls == 1);
+    assert(log.uris == 4);
+    assert(strstr(html, "'/x/one.html'") != NULL);
+    assert(strstr(html, "'/x/two.png'") != NULL);
+    assert(strstr(html, "'keep.html'") != NULL);
+    assert(strstr(html, "'same.html'") != NULL);
+    assert(strstr(html, "/x/three.html") == NULL);
+    assert(strstr(html, "/x/four.html") == NULL);
+
+    // It must come out just like with a callback per link:
+    s3dw_markdown_tohtmloptions oneoptions = {0};
+    oneoptions.uritransform_callback = _test_markdown_urione_cb;
+    size_t onelen = 0;
+    char *one = spew3dweb_markdown_ByteBufToHTML(
+        doc, strlen(doc), &oneoptions, &onelen
+    );
+    assert(one != NULL);
+    assert(onelen == htmllen && strcmp(one, html) == 0);
+    free(one);
+    size_t parallellen = 0;
+    char *parallel = _internal_spew3dweb_markdown_ByteBufToHTMLParallelEx(
+        doc, strlen(doc), &options, 3, 8, &parallellen
+    );
+    assert(parallel != NULL);
+    assert(parallellen == htmllen && strcmp(parallel, html) == 0);
+    free(parallel);
+    free(html);
+
+    log.fail = 1;
+    html = spew3dweb_markdown_ByteBufToHTML(
+        doc, strlen(doc), &options, &htmllen
+    );
+    assert(html == NULL);
+}
+END_TEST
+
+START_TEST(test_markdown_links)
+{
+    const char doc[] = ("See [one](a.html) and\n![pic](p.png){width=5}.\n"
+        "\n    [code](no1.html)\n\n```\n[fenced](no2.html)\n```\n\n"
+        "Some `[span](no3.html)` and \\[not](no4.html)\n\n"
+        "- [![img](in.png)](out.html)\n\n[multi\nline](m.html)\n");
+    s3dw_markdown_links links;
+    int result = spew3dweb_markdown_ByteBufGetLinks(
+        doc, strlen(doc), &links
+    );
+    assert(result != 0);
+    assert(links.count == 5);
+    const char *urls[] = {"a.html", "p.png", "out.html",
+        "in.png", "m.html"};
+    const size_t lines[] = {1, 2, 12, 12, 14};
+    const int isimage[] = {0, 1, 0, 1, 0};
+    size_t k = 0;
+    while (k < links.count) {
+        s3dw_markdown_linkentry *entry = &links.entries[k];
+        assert(entry->isimage == isimage[k]);
+        assert(entry->line == lines[k]);
+        assert(entry->urllen == strlen(urls[k]));
+        assert(memcmp(doc + entry->urlstart, urls[k],
+            entry->urllen) == 0);
+        assert(doc[entry->offset] == (isimage[k] ? '!' : '['));
+        assert(entry->textstart > entry->offset &&
+            entry->urlstart + entry->urllen < entry->offset + entry->len);
+        k += 1;
+    }
+    assert(links.entries[1].len == strlen("![pic](p.png){width=5}"));
+    assert(links.entries[4].textlen == strlen("multi\nline"));
+
+    // The rendered result must have the very same links:
+    char *html = spew3dweb_markdown_ToHTML(doc);
+    assert(html != NULL);
+    k = 0;
+    while (k < links.count) {
+        char attr[64];
+        snprintf(attr, sizeof(attr), (isimage[k] ? "src='%s'" :
+            "href='%s'"), urls[k]);
+        assert(strstr(html, attr) != NULL);
+        k += 1;
+    }
+    assert(strstr(html, "href='no") == NULL);
+    free(html);
+    spew3dweb_markdown_FreeLinks(&links);
+    assert(links.entries == NULL && links.count == 0);
+
+    // A double tick span running into the end must not be read past:
+    const char tail[] = "[a](b.html) ``x`";
+    char *tailbuf = malloc(strlen(tail));
+    assert(tailbuf != NULL);
+    memcpy(tailbuf, tail, strlen(tail));
+    result = spew3dweb_markdown_ByteBufGetLinks(
+        tailbuf, strlen(tail), &links
+    );
+    assert(result != 0);
+    assert(links.count == 1);
+    spew3dweb_markdown_FreeLinks(&links);
+    free(tailbuf);
+}
+END_TEST
+
+typedef struct linkoffsets {
+    size_t offsets[16];
+    size_t count;
+} linkoffsets;
+
+static int _test_markdown_linkoffsets_cb(
+        const s3dw_markdown_event *event, void *userdata
+        ) {
+    linkoffsets *found = userdata;
+    if (event->type == S3DW_MD_EVENT_ENTER &&
+            (event->element == S3DW_MD_ELEMENT_LINK ||
+            event->element == S3DW_MD_ELEMENT_IMAGE)) {
+        assert(found->count < sizeof(found->offsets) /
+            sizeof(found->offsets[0]));
+        found->offsets[found->count] = event->offset;
+        found->count += 1;
+    }
+    return 1;
+}
+
+START_TEST(test_markdown_links_rendered)
+{
+    // Every link the renderer shows must be in the inventory, also
+    // where code spans and blocks are tricky to tell apart:
+    const char *docs[] = {
+        "text `` two [x](y) `` ticks\n",
+        "a ``b`` c ``` ticks ``` [d](e)\n",
+        "odd `one` [f](g) `` two\n",
+        "`a\nb` [h](i) `c [j](k)\n",
+        "|a|b|\n|-|-|\n|x `y|[l](u) `z|\n",
+        "[a ![b](c.png) `[d](e)`](f) [g [h](i)](j)\n",
+        "x `y\n```\n[m](n)\n```\n[o](p) `q`\n",
+        "- a\n\n        [code](c)\n    [list](l)\n- [t](u)\n",
+        "    [code](c)\n[text](t)\n\n    [more](m)\n",
+    };
+    s3dw_markdown_tohtmloptions options = {0};
+    int k = 0;
+    while (k < (int)(sizeof(docs) / sizeof(docs[0]))) {
+        linkoffsets found = {0};
+        int result = spew3dweb_markdown_ByteBufToEvents(
+            docs[k], strlen(docs[k]), &options,
+            _test_markdown_linkoffsets_cb, &found
+        );
+        assert(result != 0);
+        assert(found.count > 0);
+        s3dw_markdown_links links;
+        result = spew3dweb_markdown_ByteBufGetLinks(
+            docs[k], strlen(docs[k]), &links
+        );
+        assert(result != 0);
+        size_t i = 0;
+        while (i < found.count) {
+            size_t j = 0;
+            while (j < links.count &&
+                    links.entries[j].offset != found.offsets[i])
+                j += 1;
+            assert(j < links.count);
+            i += 1;
+        }
+        spew3dweb_markdown_FreeLinks(&links);
+        k += 1;
+    }
+}
+END_TEST
+
+START_TEST(test_markdown_cleanstream)
+{
+    const char doc[] = ("# Title\n\nSome [multi\nline](x.html) link."
+        "\n\n```\nfenced\n\n\n  with gaps\n```\n\n<!-- a comment\n\n"
+        "over blank lines -->\n- a list\n\n  continued\n\n    code\r\n"
+        "\r\nmore text\n\n<!-- never closed\n\nat all");
+    size_t expectedlen = 0;
+    char *expected = spew3dweb_markdown_CleanByteBuf(
+        doc, strlen(doc), 0, 1, NULL, NULL, &expectedlen, NULL
+    );
+    assert(expected != NULL);
+    assert(strstr(expected, "at all") == NULL);
+    size_t steps[] = {1, 3, 7, 64, strlen(doc)};
+    int k = 0;
+    while (k < (int)(sizeof(steps) / sizeof(steps[0]))) {
+        s3dw_markdown_cleanstream *stream = (
+            spew3dweb_markdown_NewCleanStream(0, 1, NULL, NULL)
+        );
+        assert(stream != NULL);
+        char result[512];
+        size_t resultlen = 0;
+        size_t fedlen = 0;
+        size_t outlen = 0;
+        int earlyoutput = 0;
+        while (fedlen < strlen(doc)) {
+            size_t step = steps[k];
+            if (step > strlen(doc) - fedlen)
+                step = strlen(doc) - fedlen;
+            const char *out = spew3dweb_markdown_CleanStreamFeed(
+                stream, doc + fedlen, step, &outlen
+            );
+            assert(out != NULL);
+            assert(resultlen + outlen < sizeof(result));
+            memcpy(result + resultlen, out, outlen);
+            resultlen += outlen;
+            if (outlen > 0)
+                earlyoutput = 1;
+            fedlen += step;
+        }
+        const char *out = spew3dweb_markdown_CleanStreamFinish(
+            stream, &outlen
+        );
+        assert(out != NULL);
+        assert(resultlen + outlen < sizeof(result));
+        memcpy(result + resultlen, out, outlen);
+        resultlen += outlen;
+        assert(resultlen == expectedlen);
+        assert(memcmp(result, expected, expectedlen) == 0);
+        assert(earlyoutput || steps[k] == strlen(doc));
+        assert(spew3dweb_markdown_CleanStreamFeed(
+            stream, "x", 1, &outlen) == NULL);
+        spew3dweb_markdown_FreeCleanStream(stream);
+        k += 1;
+    }
+    free(expected);
+
+    // Lines inside a ``` block or comment that isn't closed yet must
+    // come out as they arrive, rather than all of it being held:
+    const char *opener[] = {"```\n", "<!--\n"};
+    k = 0;
+    while (k < 2) {
+        s3dw_markdown_cleanstream *stream = (
+            spew3dweb_markdown_NewCleanStream(0, 0, NULL, NULL)
+        );
+        assert(stream != NULL);
+        size_t outlen = 0;
+        size_t total = 0;
+        const char *out = spew3dweb_markdown_CleanStreamFeed(
+            stream, opener[k], strlen(opener[k]), &outlen
+        );
+        assert(out != NULL);
+        total += outlen;
+        int i = 0;
+        while (i < 100) {
+            out = spew3dweb_markdown_CleanStreamFeed(
+                stream, "line\n\n", strlen("line\n\n"), &outlen
+            );
+            assert(out != NULL);
+            total += outlen;
+            i += 1;
+        }
+        assert(total >= strlen(opener[k]) + 99 * strlen("line\n\n"));
+        assert(stream->pendingfill < 64);
+        spew3dweb_markdown_FreeCleanStream(stream);
+        k += 1;
+    }
+}
+END_TEST
+
+START_TEST(test_markdown_isclean)
+{
+    // The check must agree with comparing the cleaner's output, both
+    // for raw input and for input that went through the cleaner once:
+    const char *docs[] = {
+        "", "a", "# Title\n\nSome text.\n", "Trailing space \n",
+        "Title\n===\n\n- a\n- b\n", "x\r\ny", "*  list\n",
+        "[multi\nline](x.html) <!-- c -->\n\n    code <b>\n",
+        "![img](p.png){width=5%} a &amp; b & c", "a\\\\ \\* `x`",
+        "---\n\n<!-- unclosed", NULL
+    };
+    int k = 0;
+    while (docs[k] != NULL) {
+        int stripcomments = 0;
+        while (stripcomments <= 1) {
+            size_t cleanlen = 0;
+            char *clean = spew3dweb_markdown_CleanByteBuf(
+                docs[k], strlen(docs[k]), 1, stripcomments,
+                NULL, NULL, &cleanlen, NULL
+            );
+            assert(clean != NULL);
+            int expected = (cleanlen == strlen(docs[k]) &&
+                memcmp(clean, docs[k], cleanlen) == 0);
+            assert(spew3dweb_markdown_IsByteBufClean(
+                docs[k], strlen(docs[k]), 1, stripcomments,
+                NULL, NULL) == expected);
+            size_t cleanagainlen = 0;
+            char *cleanagain = spew3dweb_markdown_CleanByteBuf(
+                clean, cleanlen, 1, stripcomments,
+                NULL, NULL, &cleanagainlen, NULL
+            );
+            assert(cleanagain != NULL);
+            expected = (cleanagainlen == cleanlen &&
+                memcmp(cleanagain, clean, cleanlen) == 0);
+            assert(spew3dweb_markdown_IsByteBufClean(
+                clean, cleanlen, 1, stripcomments,
+                NULL, NULL) == expected);
+            free(cleanagain);
+            free(clean);
+            stripcomments += 1;
+        }
+        k += 1;
+    }
+    assert(spew3dweb_markdown_IsClean("# Title\n\nSome text.\n"));
+    assert(!spew3dweb_markdown_IsClean("Trailing space \n"));
+    assert(!spew3dweb_markdown_IsByteBufClean("a\0b", 3, 1, 0, NULL, NULL));
+}
+END_TEST
+
+static char *_test_markdown_cleaner_cb(
+        const char *uri, void *userdata
+        ) {
+    if (strcmp(uri, "fail.html") == 0)
+        return NULL;
+    return _test_markdown_urione_cb(uri, userdata);
+}
+
+START_TEST(test_markdown_cleaner)
+{
+    // Link URIs longer than the stack buffer go into the scratch space,
+    // which must work the same when it's reused with longer ones:
+    char longlink[1200];
+    char longerlink[2400];
+    strcpy(longlink, "Text [long](a");
+    int k = 0;
+    while (k < 200) {
+        strcat(longlink, " b/c");
+        k += 1;
+    }
+    strcat(longlink, ".html) more\n");
+    strcpy(longerlink, "* [longer](");
+    k = 0;
+    while (k < 600) {
+        strcat(longerlink, "d'e");
+        k += 1;
+    }
+    strcat(longerlink, ".html)\n");
+    const char *docs[] = {
+        "# Title\n\nSome [link](x.html).\n", longlink, "",
+        longerlink, "  *  a [![i](i.png)](l.html)\r\n", longlink, NULL
+    };
+    s3dw_markdown_cleaner *cleaner = spew3dweb_markdown_NewCleaner(
+        1, 0, _test_markdown_cleaner_cb, NULL
+    );
+    assert(cleaner != NULL);
+    int round = 0;
+    while (round < 2) {
+        k = 0;
+        while (docs[k] != NULL) {
+            size_t expectedlen = 0;
+            char *expected = spew3dweb_markdown_CleanByteBuf(
+                docs[k], strlen(docs[k]), 1, 0,
+                _test_markdown_cleaner_cb, NULL, &expectedlen, NULL
+            );
+            assert(expected != NULL);
+            size_t resultlen = 0;
+            const char *result = spew3dweb_markdown_CleanerCleanByteBuf(
+                cleaner, docs[k], strlen(docs[k]), &resultlen
+            );
+            assert(result != NULL);
+            assert(resultlen == expectedlen);
+            assert(strcmp(result, expected) == 0);
+            free(expected);
+            k += 1;
+        }
+        round += 1;
+    }
+
+    // A failing callback fails only the one document:
+    const char faildoc[] = "A [link](fail.html).\n";
+    assert(spew3dweb_markdown_CleanByteBuf(
+        faildoc, strlen(faildoc), 1, 0,
+        _test_markdown_cleaner_cb, NULL, NULL, NULL) == NULL);
+    assert(spew3dweb_markdown_CleanerCleanByteBuf(
+        cleaner, faildoc, strlen(faildoc), NULL) == NULL);
+    size_t resultlen = 0;
+    const char *result = spew3dweb_markdown_CleanerCleanByteBuf(
+        cleaner, "[a](b.html)", strlen("[a](b.html)"), &resultlen
+    );
+    assert(result != NULL);
+    assert(strcmp(result, "[a](/x/b.html)") == 0);
+    spew3dweb_markdown_FreeCleaner(cleaner);
 }
 END_TEST
 
 TESTS_MAIN(test_markdown_chunks, test_markdown_clean,
-    test_markdown_tohtml, test_is_url_and_is_image)
+    test_markdown_tohtml, test_is_url_and_is_image,
+    test_markdown_linescan, test_markdown_document,
+    test_markdown_document_context, test_markdown_tohtml_parallel,
+    test_markdown_tohtml_batch,
+    test_markdown_rendercache, test_markdown_fragmentcache,
+    test_markdown_anchors, test_markdown_toc,
+    test_markdown_events, test_markdown_totext,
+    test_markdown_escape, test_markdown_outbuf,
+    test_markdown_scanbound,
+    test_markdown_uribatch, test_markdown_links,
+    test_markdown_links_rendered,
+    test_markdown_cleanstream, test_markdown_isclean,
+    test_markdown_cleaner)
 
@@ -75,6 +75,96 @@ S3DEXP char *spew3dweb_markdown_CleanEx(
 
 S3DEXP char *spew3dweb_markdown_Clean(const char *uncleanstr);
 
+/// Returns 1 if spew3dweb_markdown_CleanByteBuf() with the same options
+/// would return the input unchanged, so the caller can just keep it.
+/// Nothing is allocated for the output, and the check stops at the
+/// first difference. Returns 0 if it would change, or on out of memory.
+S3DEXP int spew3dweb_markdown_IsByteBufClean(
+    const char *input, size_t inputlen,
+    int opt_allowunsafehtml,
+    int opt_stripcomments,
+    char *(*opt_uritransformcallback)(
+        const char *uri, void *userdata
+    ),
+    void *opt_uritransform_userdata
+);
+
+S3DEXP int spew3dweb_markdown_IsClean(const char *inputstr);
+
+/// A clean stream cleans markdown that arrives in pieces, e.g. from
+/// a socket or pipe, with the same result as
+/// spew3dweb_markdown_CleanByteBuf() on all of it at once. Output
+/// comes out a block at a time, once a later blank line shows that
+/// nothing can change it anymore. Inside a ``` block or a comment,
+/// which may go on past blank lines, it comes out a line at a time
+/// instead. The input held is about one block or line, except for
+/// an indented ``` block: it is held until it ends, or until a line
+/// shows how far to unindent it. The URI callback may be called more
+/// than once per URI.
+typedef struct s3dw_markdown_cleanstream s3dw_markdown_cleanstream;
+
+S3DEXP s3dw_markdown_cleanstream *spew3dweb_markdown_NewCleanStream(
+    int opt_allowunsafehtml,
+    int opt_stripcomments,
+    char *(*opt_uritransformcallback)(
+        const char *uri, void *userdata
+    ),
+    void *opt_uritransform_userdata
+);
+
+/// Adds more input, and returns the output that is complete now,
+/// which may be empty. The output belongs to the stream and stays
+/// valid until its next use. Returns NULL on failure, after which the
+/// stream can only be freed.
+S3DEXP const char *spew3dweb_markdown_CleanStreamFeed(
+    s3dw_markdown_cleanstream *stream,
+    const char *uncleanbytes, size_t uncleanbyteslen,
+    size_t *out_len
+);
+
+/// Ends the input, and returns the remaining output like
+/// spew3dweb_markdown_CleanStreamFeed() does. The stream can't be
+/// fed anymore afterwards.
+S3DEXP const char *spew3dweb_markdown_CleanStreamFinish(
+    s3dw_markdown_cleanstream *stream, size_t *out_len
+);
+
+S3DEXP void spew3dweb_markdown_FreeCleanStream(
+    s3dw_markdown_cleanstream *stream
+);
+
+/// A cleaner is for cleaning many documents one after another with the
+/// same options, e.g. in a worker thread. It keeps its output buffer
+/// and its scratch space for long URIs between calls, so after the
+/// first few documents cleaning mostly doesn't allocate anymore.
+/// A cleaner must only be used by one thread at a time.
+typedef struct s3dw_markdown_cleaner s3dw_markdown_cleaner;
+
+S3DEXP s3dw_markdown_cleaner *spew3dweb_markdown_NewCleaner(
+    int opt_allowunsafehtml,
+    int opt_stripcomments,
+    char *(*opt_uritransformcallback)(
+        const char *uri, void *userdata
+    ),
+    void *opt_uritransform_userdata
+);
+
+/// Returns the same as spew3dweb_markdown_CleanByteBuf(), except
+/// that the result belongs to the cleaner and stays valid until its
+/// next use. Returns NULL on failure, but the cleaner can still be
+/// used for the next document.
+S3DEXP const char *spew3dweb_markdown_CleanerCleanByteBuf(
+    s3dw_markdown_cleaner *cleaner,
+    const char *uncleanbytes, size_t uncleanbyteslen,
+    size_t *out_len
+);
+
+S3DEXP void spew3dweb_markdown_FreeCleaner(
+    s3dw_markdown_cleaner *cleaner
+);
+
+/// Turn heading text into the name used for its anchor, e.g.
+/// "Some Heading" into "some-heading". The result must be freed.
 S3DEXP char *spew3dweb_markdown_MarkdownBytesToAnchor(
     const char *bytebuf, size_t bytebuflen
 );
@@ -88,6 +178,22 @@ typedef struct s3dw_markdown_tohtmloptions {
     void *uritransform_callback_userdata;
     int externallinks_no_target_blank;
     int externallinks_no_rel_noopener;
+    // Give headings with the same anchor name a "-1", "-2", ...
+    // suffix, such that each anchor is unique in the document:
+    int unique_heading_anchors;
+    // Optional, used instead of uritransform_callback if set. It's
+    // called once with every distinct link and image URI in the
+    // document, and sets out_uris[i] to what uris[i] should become or
+    // leaves it NULL to keep it. The results are copied right after,
+    // so they only need to stay valid until the callback is called
+    // again or the conversion returns. It gets the same userdata as
+    // uritransform_callback. Return 0 on failure, which makes the
+    // conversion fail too. Finding the URIs first costs an extra pass
+    // over the input, so this pays off if each call is expensive.
+    int (*uritransform_batch_callback)(
+        const char **uris, size_t count, const char **out_uris,
+        void *userdata
+    );
 } s3dw_markdown_tohtmloptions;
 
 S3DEXP char *spew3dweb_markdown_ByteBufToHTML(
@@ -96,6 +202,416 @@ S3DEXP char *spew3dweb_markdown_ByteBufToHTML(
     size_t *out_len
 );
 
+/// One heading as found by spew3dweb_markdown_ByteBufToHTMLWithTOC().
+/// All positions are byte offsets into the resulting HTML.
+typedef struct s3dw_markdown_tocentry {
+    int level;  // 1 for <h1>, 2 for <h2>, and so on.
+    size_t offset;  // Where the "<hN>" starts.
+    size_t anchorstart, anchorlen;  // The anchor name, 0 len if none.
+    size_t textstart, textlen;  // The heading's inner HTML.
+} s3dw_markdown_tocentry;
+
+typedef struct s3dw_markdown_toc {
+    s3dw_markdown_tocentry *entries;
+    size_t count, alloc;
+} s3dw_markdown_toc;
+
+/// Like spew3dweb_markdown_ByteBufToHTML(), but also lists all headings
+/// in out_toc in the order they appear, e.g. for a table of contents.
+/// Free the list with spew3dweb_markdown_FreeTOC(). On failure, returns
+/// NULL and out_toc is left empty.
+S3DEXP char *spew3dweb_markdown_ByteBufToHTMLWithTOC(
+    const char *markdownbytes, size_t markdownbyteslen,
+    s3dw_markdown_tohtmloptions *options,
+    s3dw_markdown_toc *out_toc, size_t *out_len
+);
+
+S3DEXP void spew3dweb_markdown_FreeTOC(s3dw_markdown_toc *toc);
+
+/// One link or image as found by spew3dweb_markdown_ByteBufGetLinks().
+/// All positions are byte offsets into the markdown input.
+typedef struct s3dw_markdown_linkentry {
+    int isimage;
+    size_t line;  // 1 for the first line, counting from the "[" or "!".
+    size_t offset, len;  // The whole link or image.
+    size_t textstart, textlen;  // Link text or image alt text.
+    size_t urlstart, urllen;  // As written, not transformed.
+} s3dw_markdown_linkentry;
+
+typedef struct s3dw_markdown_links {
+    s3dw_markdown_linkentry *entries;
+    size_t count, alloc;
+} s3dw_markdown_links;
+
+/// Lists all links and images in out_links in the order they appear,
+/// e.g. for a link checker, without rendering anything. Code blocks,
+/// code spans and table cells are told apart the way the renderer
+/// does, so every link the HTML shows is listed, sometimes with a few
+/// extra ones. Only odd raw input can still differ, like a link broken
+/// over two lines inside a table row, which the cleaner joins up.
+/// Free the list with spew3dweb_markdown_FreeLinks(). Returns 0 if
+/// out of memory, in which case out_links is left empty.
+S3DEXP int spew3dweb_markdown_ByteBufGetLinks(
+    const char *markdownbytes, size_t markdownbyteslen,
+    s3dw_markdown_links *out_links
+);
+
+S3DEXP void spew3dweb_markdown_FreeLinks(s3dw_markdown_links *links);
+
+/// Like spew3dweb_markdown_ByteBufToHTML(), but large inputs are split
+/// at blank lines after a plain paragraph and rendered on up to the
+/// given number of threads, so text that is all lists stays serial.
+/// Pass 0 to use one thread per CPU core. The result is always exactly
+/// the same as the serial one. If SPEW3DWEB_OPTION_DISABLE_THREADS was
+/// defined, this just renders serially. Any uritransform_callback or
+/// uritransform_batch_callback in the options must be safe to call
+/// from several threads at once.
+S3DEXP char *spew3dweb_markdown_ByteBufToHTMLParallel(
+    const char *markdownbytes, size_t markdownbyteslen,
+    s3dw_markdown_tohtmloptions *options, int threads,
+    size_t *out_len
+);
+
+/// Convert many inputs in one go, spread over up to the given number
+/// of threads, or one per CPU core if 0. If markdownbyteslens is NULL,
+/// the inputs are taken as null-terminated strings. On success, returns
+/// 1 and sets out_results[i] to the HTML for input i, which you need to
+/// free(), as well as out_lens[i] unless out_lens is NULL. On failure,
+/// returns 0 and all out_results are NULL. The same thread safety
+/// rules as for spew3dweb_markdown_ByteBufToHTMLParallel() apply.
+S3DEXP int spew3dweb_markdown_ByteBufsToHTML(
+    const char **markdownbytes, const size_t *markdownbyteslens,
+    size_t count, s3dw_markdown_tohtmloptions *options,
+    int threads, char **out_results, size_t *out_lens
+);
+
+S3DHID char *_internal_spew3dweb_markdown_ByteBufToHTMLParallelEx(
+    const char *markdownbytes, size_t markdownbyteslen,
+    s3dw_markdown_tohtmloptions *options, int threads,
+    size_t minpiecelen, size_t *out_len
+);
+
+/// Like spew3dweb_markdown_ByteBufToHTML(), but rather than returning
+/// the HTML, it is passed to write_func piece by piece as soon as each
+/// part of the document is done. The write_func must return 1 on
+/// success, or 0 to abort. Returns 1 on success, 0 on failure.
+S3DEXP int spew3dweb_markdown_ByteBufToHTMLCustomIO(
+    const char *markdownbytes, size_t markdownbyteslen,
+    s3dw_markdown_tohtmloptions *options,
+    int (*write_func)(
+        const char *buff, size_t amount, void *userdata
+    ),
+    void *userdata
+);
+
+S3DEXP int spew3dweb_markdown_ByteBufToHTMLDiskFile(
+    const char *markdownbytes, size_t markdownbyteslen,
+    s3dw_markdown_tohtmloptions *options,
+    FILE *f
+);
+
+/// Info about all lines of a markdown block, kept in compact arrays
+/// that share one allocation. Offsets are relative to base. A line
+/// ends one byte before the next one starts, at its line break, so
+/// there's always one more start than lines.
+typedef struct _markdown_lineinfo {
+    const char *base;
+    uint32_t *start;
+    uint16_t *indent, *flags;
+    int32_t *wideindent;  // Used instead of indent if one is too large.
+    size_t alloc;
+} _markdown_lineinfo;
+
+// What a line looks like, figured out once when the line table is made:
+#define _S3D_MD_LINEFLAG_BULLET 0x1  // "- item" or "* item"
+#define _S3D_MD_LINEFLAG_NUMBERED 0x2  // "1. item"
+#define _S3D_MD_LINEFLAG_QUOTE 0x4  // "> quote"
+#define _S3D_MD_LINEFLAG_FENCE 0x8  // "```"
+#define _S3D_MD_LINEFLAG_HEADING 0x10  // "# Heading"
+#define _S3D_MD_LINEFLAG_UNDERLINE 0x20  // "===" or "---"
+#define _S3D_MD_LINEFLAG_TABLEROW 0x40  // "| a | b |"
+#define _S3D_MD_LINEFLAG_TABLESEP 0x80  // "|---|---|"
+#define _S3D_MD_LINEFLAG_ENDSPARAGRAPH 0x100  // Can't continue a paragraph.
+// Set in the flags of a line that ends without a line break:
+#define _S3D_MD_LINEFLAG_NOBREAK 0x8000
+
+#define _S3D_MD_LINESTART(li, l) ((li)->base + (li)->start[l])
+#define _S3D_MD_LINEENDOFFSET(li, l) \
+    ((li)->start[(l) + 1] - \
+    (((li)->flags[l] & _S3D_MD_LINEFLAG_NOBREAK) != 0 ? 0 : 1))
+#define _S3D_MD_LINEEND(li, l) ((li)->base + _S3D_MD_LINEENDOFFSET(li, l))
+#define _S3D_MD_LINEINDENT(li, l) \
+    ((int)((li)->wideindent ? (li)->wideindent[l] : (li)->indent[l]))
+#define _S3D_MD_LINECONTENTLEN(li, l) \
+    ((int)(_S3D_MD_LINEENDOFFSET(li, l) - (li)->start[l]) - \
+    _S3D_MD_LINEINDENT(li, l))
+
+struct _markdown_fragmentcache;
+
+typedef struct _markdown_anchorslot {
+    uint64_t hash;  // (0 means the slot is unused.)
+    uint32_t suffixes;  // Numbered variants handed out so far.
+} _markdown_anchorslot;
+
+/// A renderer keeps its work buffers around between conversions,
+/// such that repeated use needs no new allocations once they're
+/// large enough. Don't use one from multiple threads at once.
+typedef struct s3dw_markdown_renderer {
+    char *cleanbuf;
+    size_t cleanbufalloc;
+    _markdown_lineinfo lineinfo;
+    char *resultbuf;
+    size_t resultbufalloc;
+    _markdown_anchorslot *anchorslots;
+    size_t anchorslotalloc, anchorcount;
+    char *uriscratch;  // For link URIs too long for the stack.
+    size_t uriscratchalloc;
+    struct _markdown_fragmentcache *fragmentcache;
+    // How many top-level blocks the last conversion took from the
+    // fragment cache, and how many it rendered:
+    size_t fragmentsreused, fragmentsrendered;
+} s3dw_markdown_renderer;
+
+S3DEXP s3dw_markdown_renderer *spew3dweb_markdown_NewRenderer(void);
+
+S3DEXP void spew3dweb_markdown_FreeRenderer(
+    s3dw_markdown_renderer *renderer
+);
+
+/// Make the renderer remember the HTML of each top-level block, keyed
+/// by the block's bytes and the list and indent context it starts in.
+/// Converting a new revision of the same document then only renders
+/// the blocks that changed. Blocks that the latest conversion didn't
+/// use are forgotten. Returns 0 on allocation failure.
+S3DEXP int spew3dweb_markdown_RendererEnableFragmentCache(
+    s3dw_markdown_renderer *renderer, int enable
+);
+
+/// Like spew3dweb_markdown_ByteBufToHTML(), but the result belongs to
+/// the renderer and stays valid only until its next use or until it's
+/// freed. Returns NULL on failure.
+S3DEXP const char *spew3dweb_markdown_RendererByteBufToHTML(
+    s3dw_markdown_renderer *renderer,
+    const char *markdownbytes, size_t markdownbyteslen,
+    s3dw_markdown_tohtmloptions *options,
+    size_t *out_len
+);
+
+/// Render the top-level block that starts at *inputpos, split the same
+/// way as for the fragment cache, and move *inputpos past it. It starts
+/// in the given stream state, or a fresh one if NULL. Unless it was the
+/// last block, the state it ends in is written to out_endstate, which
+/// must fit _S3D_MD_STREAMSTATE_INTS ints. With keepanchors set, the
+/// anchors of the renderer's previous blocks still count for
+/// unique_heading_anchors. The result belongs to the renderer like with
+/// spew3dweb_markdown_RendererByteBufToHTML(). Returns NULL on failure.
+S3DHID const char *_internal_s3dw_markdown_RendererRenderBlock(
+    s3dw_markdown_renderer *renderer,
+    const char *uncleaninput, size_t uncleaninputlen,
+    size_t *inputpos, const int32_t *opt_startstate,
+    int32_t *out_endstate, int keepanchors,
+    s3dw_markdown_tohtmloptions *options, size_t *out_len
+);
+
+typedef struct _markdown_docblock {
+    size_t start, len;
+    int32_t *startstate;
+    char *html;
+    size_t htmllen;
+} _markdown_docblock;
+
+/// A document holds markdown text along with its rendered HTML, for
+/// editors that want a live preview. It's split into the same top-level
+/// blocks as for the renderer's fragment cache, and each block keeps the
+/// list and indent context it starts in. An edit re-renders from the
+/// block before it until a block starts in the same context as before,
+/// so the HTML is always the same as from
+/// spew3dweb_markdown_ByteBufToHTML() on the whole text. With
+/// unique_heading_anchors, a heading's anchor depends on all headings
+/// before it, so an edit re-renders all the blocks then.
+typedef struct s3dw_markdown_document {
+    char *text;
+    size_t textlen, textalloc;
+    s3dw_markdown_tohtmloptions options;
+    _markdown_docblock *blocks;
+    size_t blockcount, blockalloc;
+    s3dw_markdown_renderer *renderer;
+    char *html;
+    size_t htmllen, htmlalloc;
+    int htmlvalid;
+} s3dw_markdown_document;
+
+/// Creates a document from the given markdown, and renders it.
+/// The options are copied. Returns NULL on failure.
+S3DEXP s3dw_markdown_document *spew3dweb_markdown_NewDocument(
+    const char *markdownbytes, size_t markdownbyteslen,
+    s3dw_markdown_tohtmloptions *options
+);
+
+S3DEXP void spew3dweb_markdown_FreeDocument(
+    s3dw_markdown_document *doc
+);
+
+/// Replaces removelen bytes at offset with the inserted bytes, and
+/// updates the HTML. The HTML fragments starting at index
+/// out_firstfragment were changed: out_removedfragments of the old
+/// ones were replaced by out_addedfragments new ones.
+/// Returns 1 on success, 0 on failure which leaves the document as
+/// it was before.
+S3DEXP int spew3dweb_markdown_DocumentEdit(
+    s3dw_markdown_document *doc,
+    size_t offset, size_t removelen,
+    const char *insertbytes, size_t insertlen,
+    size_t *out_firstfragment, size_t *out_removedfragments,
+    size_t *out_addedfragments
+);
+
+S3DEXP size_t spew3dweb_markdown_DocumentGetFragmentCount(
+    s3dw_markdown_document *doc
+);
+
+/// Returns the HTML of one block. It stays valid until the next edit.
+S3DEXP const char *spew3dweb_markdown_DocumentGetFragment(
+    s3dw_markdown_document *doc, size_t index, size_t *out_len
+);
+
+/// Returns the HTML of the entire document, which stays valid until
+/// the next edit. Returns NULL on failure.
+S3DEXP const char *spew3dweb_markdown_DocumentGetHTML(
+    s3dw_markdown_document *doc, size_t *out_len
+);
+
+S3DEXP const char *spew3dweb_markdown_DocumentGetMarkdown(
+    s3dw_markdown_document *doc, size_t *out_len
+);
+
+/// A render cache remembers the HTML for recently converted inputs,
+/// keyed by the input bytes and options, and drops the least recently
+/// used entries once the byte budget is reached. It can be used from
+/// multiple threads at once, unless SPEW3DWEB_OPTION_DISABLE_THREADS
+/// was defined. Since the uritransform_callback and its userdata are
+/// part of the key as pointers only, the callback's results must only
+/// depend on the URI it's given.
+typedef struct s3dw_markdown_rendercache s3dw_markdown_rendercache;
+
+typedef struct s3dw_markdown_rendercachestats {
+    uint64_t hits, misses, evictions;
+    size_t entries, bytesused, bytesbudget;
+} s3dw_markdown_rendercachestats;
+
+S3DEXP s3dw_markdown_rendercache *spew3dweb_markdown_NewRenderCache(
+    size_t budgetbytes
+);
+
+S3DEXP void spew3dweb_markdown_FreeRenderCache(
+    s3dw_markdown_rendercache *cache
+);
+
+/// Like spew3dweb_markdown_ByteBufToHTML(), but uses the cached result
+/// if there is one. The returned copy must be freed by the caller.
+S3DEXP char *spew3dweb_markdown_RenderCacheByteBufToHTML(
+    s3dw_markdown_rendercache *cache,
+    const char *markdownbytes, size_t markdownbyteslen,
+    s3dw_markdown_tohtmloptions *options,
+    size_t *out_len
+);
+
+S3DEXP void spew3dweb_markdown_RenderCacheGetStats(
+    s3dw_markdown_rendercache *cache,
+    s3dw_markdown_rendercachestats *out_stats
+);
+
+/// How often output buffers had to be grown after their first
+/// allocation, and how many bytes that copied in total. Only counted
+/// if SPEW3DWEB_OPTION_MARKDOWN_BUFFER_STATS was defined, otherwise
+/// both are always 0.
+S3DEXP void spew3dweb_markdown_GetBufferStats(
+    uint64_t *out_reallocs, uint64_t *out_bytesmoved
+);
+
+S3DEXP void spew3dweb_markdown_ResetBufferStats(void);
+
+/// How many characters the scans for where inline formatting ends
+/// went over in total. Only counted if
+/// SPEW3DWEB_OPTION_MARKDOWN_SCAN_STATS was defined, otherwise
+/// always 0.
+S3DEXP uint64_t spew3dweb_markdown_GetScanStats(void);
+
+S3DEXP void spew3dweb_markdown_ResetScanStats(void);
+
+#define S3DW_MD_EVENT_ENTER 1
+#define S3DW_MD_EVENT_LEAVE 2
+#define S3DW_MD_EVENT_TEXT 3
+
+#define S3DW_MD_ELEMENT_PARAGRAPH 1
+#define S3DW_MD_ELEMENT_HEADING 2
+#define S3DW_MD_ELEMENT_LIST 3
+#define S3DW_MD_ELEMENT_ORDEREDLIST 4
+#define S3DW_MD_ELEMENT_LISTITEM 5
+#define S3DW_MD_ELEMENT_BLOCKQUOTE 6
+#define S3DW_MD_ELEMENT_CODEBLOCK 7
+#define S3DW_MD_ELEMENT_TABLE 8
+#define S3DW_MD_ELEMENT_TABLEROW 9
+#define S3DW_MD_ELEMENT_TABLEHEADERCELL 10
+#define S3DW_MD_ELEMENT_TABLECELL 11
+#define S3DW_MD_ELEMENT_LINK 12
+#define S3DW_MD_ELEMENT_IMAGE 13
+#define S3DW_MD_ELEMENT_EMPHASIS 14
+#define S3DW_MD_ELEMENT_STRONG 15
+#define S3DW_MD_ELEMENT_STRIKETHROUGH 16
+#define S3DW_MD_ELEMENT_CODE 17
+
+/// One step of a document as reported by
+/// spew3dweb_markdown_ByteBufToEvents(). All pointers are only valid
+/// during the callback, and text is never HTML-escaped.
+typedef struct s3dw_markdown_event {
+    int type;  // S3DW_MD_EVENT_ENTER, S3DW_MD_EVENT_LEAVE or ..._TEXT.
+    int element;  // S3DW_MD_ELEMENT_*, or 0 for text.
+    // Where in the given markdown this comes from. For text it's the
+    // stretch the text was made from, for entering and leaving it's
+    // the markup that did it, which may be empty. Wherever the input
+    // had to be cleaned up first, this is a close guess:
+    size_t offset, length;
+    // For headings the level, for ordered lists the first number:
+    int level;
+    // The text for text events. When entering a link or image it's
+    // the URL, for a heading its anchor name if any, and for a code
+    // block its language if any:
+    const char *text;
+    size_t textlen;
+    // For images, the alt text and the width and height as given,
+    // e.g. "50%" or "120px", or of zero length if not set:
+    const char *alt, *width, *height;
+    size_t altlen, widthlen, heightlen;
+} s3dw_markdown_event;
+
+/// Convert the markdown like spew3dweb_markdown_ByteBufToHTML() does,
+/// but report it as a series of events instead of building any HTML
+/// string for it. Elements are always entered and left in a properly
+/// nested order, an image is entered and left right away, and longer
+/// text may arrive as multiple text events in a row. Inline HTML in
+/// the input is reported as text. If the callback returns 0 this
+/// stops. Returns 1 on success, 0 on error or if it was stopped.
+S3DEXP int spew3dweb_markdown_ByteBufToEvents(
+    const char *markdownbytes, size_t markdownbyteslen,
+    s3dw_markdown_tohtmloptions *options,
+    int (*event_callback)(
+        const s3dw_markdown_event *event, void *userdata
+    ),
+    void *userdata
+);
+
+/// Get just the visible text of the given markdown, for example for
+/// a search index. There are no tags, no link targets, and entities
+/// are decoded. Blocks end in a line break, table cells are separated
+/// by a space, and image alt texts are kept. Code blocks are left out
+/// unless includecode is set. Returns NULL on error.
+S3DEXP char *spew3dweb_markdown_ByteBufToText(
+    const char *markdownbytes, size_t markdownbyteslen,
+    s3dw_markdown_tohtmloptions *options, int includecode,
+    size_t *out_len
+);
+
 S3DEXP char *spew3dweb_markdown_ToHTMLEx(
     const char *markdownstr,
     s3dw_markdown_tohtmloptions *options,
@@ -115,6 +631,10 @@ S3DEXP int spew3dweb_markdown_GetBacktickByteBufLangPrefixLen(
     size_t offset
 );
 
+/// Check if the string is a markdown link like [title](url). Brackets
+/// in the url part may nest at most 8 levels deep, see
+/// _S3D_MD_MAX_URL_BRACKET_NESTING, and anything deeper isn't taken as
+/// a link. Cleaning and rendering treat links the same way.
 S3DEXP int spew3dweb_markdown_IsStrUrl(const char *test_str);
 
 S3DEXP int spew3dweb_markdown_IsStrImage(const char *test_str);
@@ -187,6 +707,40 @@ S3DHID int _internal_spew3dweb_markdown_GetLinkOrImgLen(
     int *out_img_height, char *out_img_height_format
 );
 
+S3DHID int _internal_spew3dweb_skipmarkdownhtmlcomment(
+    const char *input, size_t inputlen, size_t startpos
+);
+
+/// Returns the full length of the inline code span starting with the
+/// backtick at startpos, ticks included, or 0 if the cleaner won't
+/// accept one there and escapes the backtick instead.
+S3DHID size_t _internal_spew3dweb_markdown_GetInlineCodeLen(
+    const char *input, size_t inputlen, size_t startpos,
+    int origindent, int *out_ticks
+);
+
+/// Returns 1 if at least ticks backticks follow at pos, which is what
+/// closes a ``` code block opened with that many.
+S3DHID int _internal_spew3dweb_markdown_IsFenceClose(
+    const char *input, size_t inputlen, size_t pos, int ticks
+);
+
+S3DHID void _internal_spew3dweb_markdown_IsListOrCodeIndentEx(
+    size_t pos, const char *buf, size_t buflen,
+    int lastnonemptylineorigindent,
+    int lastnonemptylineeffectiveindent,
+    int lastnonemptylinewascode,
+    int lastlinewasemptyorblockinterruptor,
+    int *in_list_with_orig_indent_array,
+    int *in_list_with_orig_bullet_indent_array,
+    int in_list_logical_nesting_depth,
+    int *out_is_in_list_depth, int *out_is_code,
+    int *out_effective_indent, int *out_write_this_many_spaces,
+    int *out_content_start, int *out_orig_indent,
+    int *out_orig_bullet_indent, int *out_is_list_entry,
+    char *out_list_bullet_type, int *out_number_list_entry_num
+);
+
 S3DHID ssize_t _internal_spew3dweb_markdown_AddInlineAreaClean(
     const char *input, size_t inputlen, size_t startpos,
     char **resultchunkptr, size_t *resultfillptr,
@@ -201,10 +755,19 @@ S3DHID ssize_t _internal_spew3dweb_markdown_AddInlineAreaClean(
     char *(*opt_uritransformcallback)(
         const char *uri, void *userdata
     ),
-    void *opt_uritransform_userdata
+    void *opt_uritransform_userdata,
+    int opt_uritransformborrowed,
+    int opt_plaintextonly,
+    int *opt_pausedincomment,
+    const char *checkagainst, size_t checkagainstlen,
+    char **uriscratch, size_t *uriscratchalloc
 );
 
-typedef struct _markdown_lineinfo _markdown_lineinfo;
+/// Returns the _S3D_MD_LINEFLAG_* flags for a line's content, which
+/// is everything past its indent. Only looks at the content itself.
+S3DHID int _internal_s3dw_markdown_ClassifyLineContent(
+    const char *p, int len
+);
 
 S3DHID int _internal_s3dw_markdown_LineStartsTable(
     _markdown_lineinfo *lineinfo, size_t linei,
@@ -222,15 +785,34 @@ S3DHID void _internal_s3dw_markdown_GetTableCell(
     int *out_startoffset, int *out_byteslen
 );
 
+/// Make sure the buffer can hold new_size bytes. The buffer grows
+/// geometrically, so many small appends only copy it a few times.
+/// Returns 0 on allocation failure, and the old buffer is freed then.
 S3DHID int _internal_s3dw_markdown_ensurebufsize(
     char **bufptr, size_t *bufalloc, size_t new_size
 );
 
+/// Guess how large the output for inputlen bytes of input will get,
+/// to allocate it once up front. The percentages below were measured
+/// on typical documents, anything off just means one more regrow.
+S3DHID size_t _internal_s3dw_markdown_predictbufsize(
+    size_t inputlen, unsigned int expansionpercent
+);
+#define _S3D_MD_CLEAN_EXPANSION_PERCENT 110
+#define _S3D_MD_HTML_EXPANSION_PERCENT 140
+#define _S3D_MD_TEXT_EXPANSION_PERCENT 100
+
 S3DHID int _internal_s3dw_markdown_bufappend(
     char **bufptr, size_t *bufalloc, size_t *buffill,
     const char *appendbuf, size_t appendbuflen, size_t amount
 );
 
+/// Like _internal_s3dw_markdown_bufappendstr(), but only for string
+/// literals, the length of which is then known at compile time.
+#define _S3D_MD_BUFAPPENDLIT(bufptr, bufalloc, buffill, lit, amount) \
+    (_internal_s3dw_markdown_bufappend(\
+    bufptr, bufalloc, buffill, "" lit, sizeof(lit) - 1, amount))
+
 S3DHID int _internal_s3dw_markdown_bufappendstr(
     char **bufptr, size_t *bufalloc, size_t *buffill,
     const char *appendstr, size_t amount
@@ -241,11 +823,261 @@ S3DHID int _internal_s3dw_markdown_bufappendchar(
     char appendc, size_t amount
 );
 
+/// Append the given text HTML-escaped, copying the runs in between
+/// the characters that need it in one go. If quotesonly is set, only
+/// quotes are escaped, for text that already had everything else done
+/// but is about to go into an attribute.
+S3DHID int _internal_s3dw_markdown_bufappendescaped(
+    char **bufptr, size_t *bufalloc, size_t *buffill,
+    const char *appendbuf, size_t appendbuflen, int quotesonly
+);
+
 // (Warning, dangerous to increase since used on stack:)
 #define _S3D_MD_MAX_FORMAT_NESTING 6
 
 // (Warning, dangerous to increase since used on stack:)
 #define _S3D_MD_MAX_LIST_NESTING 12
 
+// How many ints a saved stream state has, see the renderer's
+// _md2html_SaveStreamState():
+#define _S3D_MD_STREAMSTATE_INTS (22 + _S3D_MD_MAX_LIST_NESTING * 3)
+
+// How deeply brackets may nest inside a link URL, deeper ones make it
+// not a link. Link titles aren't affected. Every link that isn't closed
+// raises the nesting for all the URL scans started before it, so this
+// also caps how often one character can get scanned again:
+#define _S3D_MD_MAX_URL_BRACKET_NESTING 8
+
+// How much cleaned up markdown to gather before converting it to HTML:
+#define _S3D_MD_CLEAN_BLOCK_SIZE (16 * 1024)
+
+typedef struct _markdown_cleanstate {
+    int opt_forcenolinebreaklinks;
+    int opt_forceescapeunambiguousentities;
+    int opt_allowunsafehtml;
+    int opt_stripcomments;
+    char *(*opt_uritransformcallback)(
+        const char *uri, void *userdata
+    );
+    void *opt_uritransform_userdata;
+    // If set, the callback's results are only borrowed and must stay
+    // valid until the next call, rather than being freed:
+    int uritransformborrowed;
+    // If set, the result is only for spew3dweb_markdown_ByteBufToText(),
+    // so plain link and image URLs are left out:
+    int plaintextonly;
+
+    char *resultchunk;
+    size_t resultfill, resultalloc;
+    // If set, output is only compared against this and never written,
+    // see spew3dweb_markdown_IsByteBufClean():
+    const char *checkagainst;
+    size_t checkagainstlen;
+    // If set, long URIs are gathered here instead of in a new heap
+    // buffer each time, and it's left allocated for later use:
+    char **uriscratch;
+    size_t *uriscratchalloc;
+    // If keepposmap is set, posmap says for each output byte where in
+    // the input it came from, plus one more entry for where the input
+    // stopped. This is a best guess wherever the input was changed:
+    int keepposmap;
+    size_t *posmap;
+    size_t posmapfill, posmapalloc;
+    // If set, more input follows later. A ``` block or comment that isn't
+    // closed yet is then cleaned up to its last line break, and the next
+    // call must continue right there:
+    int inputcontinues;
+    // If the last call stopped inside a ``` block, its backtick count:
+    int pausedinfence;
+    int pausedincomment;
+    // If the last call ran into the end inside an indented ``` block
+    // instead, its backtick count. It can't be cleaned line by line
+    // before a later line says how far it gets unindented:
+    int heldfenceticks;
+
+    int currentlineisblockinterruptor;
+    int in_list_with_orig_indent[_S3D_MD_MAX_LIST_NESTING];
+    int in_list_with_orig_bullet_indent[_S3D_MD_MAX_LIST_NESTING];
+    int in_list_logical_nesting_depth;
+    int currentlinehadlistbullet;
+    int currentlineeffectiveindent;
+    int currentlineorigindent;
+    int currentlinehadnonwhitespace;
+    int currentlinehadnonwhitespaceotherthanbullet;
+    int currentlineiscode;
+    int lastnonemptylineeffectiveindent;
+    int lastnonemptylineorigindent;
+    int lastnonemptylinewascode;
+    int lastlinewasemptyorblockinterruptor;
+    int lastlinehadlistbullet;
+} _markdown_cleanstate;
+
+struct s3dw_markdown_cleanstream {
+    _markdown_cleanstate state;
+    char *pending;  // Input that isn't cleaned for good yet.
+    size_t pendingfill, pendingalloc;
+    size_t pendingpos;  // Where cleaning continues in pending.
+    size_t blanklinecheckpos;  // Where to look for new blank lines.
+    size_t blanklineend;  // Past the last blank line found.
+    size_t lineend;  // Past the last line break found.
+    int linewise;  // Set while going on a line at a time.
+    int heldfenceticks;  // See _markdown_cleanstate, or 0.
+    size_t heldcheckpos;  // Where to look for its end next.
+    char *outheld;  // Output at the end that wasn't handed out yet.
+    size_t outheldfill, outheldalloc;
+    int finished;
+};
+
+struct s3dw_markdown_cleaner {
+    int opt_allowunsafehtml;
+    int opt_stripcomments;
+    char *(*opt_uritransformcallback)(
+        const char *uri, void *userdata
+    );
+    void *opt_uritransform_userdata;
+
+    char *result;
+    size_t resultalloc;
+    char *uriscratch;
+    size_t uriscratchalloc;
+};
+
+S3DHID void _internal_spew3dweb_markdown_InitCleanState(
+    _markdown_cleanstate *state,
+    int opt_forcenolinebreaklinks,
+    int opt_forceescapeunambiguousentities,
+    int opt_allowunsafehtml,
+    int opt_stripcomments,
+    char *(*opt_uritransformcallback)(
+        const char *uri, void *userdata
+    ),
+    void *opt_uritransform_userdata
+);
+
+/// Continue cleaning at *inputpos, appending to state->resultchunk.
+/// If opt_pauseatfill is non-zero, this returns early at the start of
+/// a line once the output reached that size and the last output line
+/// was empty. opt_pauseatinputpos does the same once the input was
+/// consumed up to that position. *inputpos is then set to where to
+/// continue later, which may lie past opt_pauseatinputpos if there
+/// was no empty line there.
+/// Returns 0 on allocation failure, and the buffer is gone then.
+S3DHID int _internal_spew3dweb_markdown_CleanByteBufPart(
+    _markdown_cleanstate *state,
+    const char *input, size_t inputlen,
+    size_t *inputpos, size_t opt_pauseatfill,
+    size_t opt_pauseatinputpos
+);
+
+typedef struct _markdown_uribatchentry {
+    uint64_t hash;
+    size_t urioffset, resultoffset;  // Into the arena.
+} _markdown_uribatchentry;
+
+/// The URIs of one document and what the uritransform_batch_callback
+/// made of them, kept for the duration of one conversion.
+typedef struct _markdown_uribatch {
+    const s3dw_markdown_tohtmloptions *options;
+    char *arena;  // All URIs and results, each with a null terminator.
+    size_t arenafill, arenaalloc;
+    _markdown_uribatchentry *entries;
+    size_t entrycount, entryalloc;
+    size_t *slots;  // Index into entries plus 1, or 0 if unused.
+    size_t slotalloc;
+} _markdown_uribatch;
+
+S3DHID void _internal_s3dw_markdown_InitUriBatch(
+    _markdown_uribatch *batch,
+    const s3dw_markdown_tohtmloptions *options
+);
+
+/// Find all link and image URIs in the input, then call the
+/// uritransform_batch_callback on them once. Returns 0 on failure.
+S3DHID int _internal_s3dw_markdown_FillUriBatch(
+    _markdown_uribatch *batch,
+    const char *uncleaninput, size_t uncleaninputlen
+);
+
+/// A uritransform callback that takes the results from a filled
+/// batch given as userdata. Only reads the batch unless a URI wasn't
+/// in it, so it's fine to use from several threads at once. The
+/// result is borrowed, see the cleaner's uritransformborrowed.
+S3DHID char *_internal_s3dw_markdown_UriBatchLookup(
+    const char *uri, void *userdata
+);
+
+S3DHID void _internal_s3dw_markdown_FreeUriBatch(
+    _markdown_uribatch *batch
+);
+
+#define _S3D_MD_LINESCAN_AUTO 0
+#define _S3D_MD_LINESCAN_SCALAR 1
+#define _S3D_MD_LINESCAN_SSE2 2
+#define _S3D_MD_LINESCAN_AVX2 3
+
+S3DHID int _internal_s3dw_markdown_LineScanImplSupported(int impl);
+
+/// Find the '\n' and '\r' positions starting at startpos, writing up
+/// to maxpositions of them. Returns how many were written, which is
+/// less than maxpositions only if the end of the buffer was reached.
+/// This uses SSE2 or AVX2 if the CPU has it, unless
+/// SPEW3DWEB_OPTION_DISABLE_SIMD was defined.
+S3DHID size_t _internal_s3dw_markdown_FindLineBreaks(
+    const char *buf, size_t buflen, size_t startpos,
+    size_t *out_positions, size_t maxpositions
+);
+
+S3DHID size_t _internal_s3dw_markdown_FindLineBreaksWith(
+    int impl, const char *buf, size_t buflen, size_t startpos,
+    size_t *out_positions, size_t maxpositions
+);
+
+/// Find the first '&', '<', '>', '\'' or '"' at or after startpos.
+/// Returns buflen if there is none. Like the line break search, this
+/// uses SSE2 or AVX2 if available, and checks 8 bytes at a time in
+/// plain C otherwise.
+S3DHID size_t _internal_s3dw_markdown_FindEscapeChar(
+    const char *buf, size_t buflen, size_t startpos
+);
+
+S3DHID size_t _internal_s3dw_markdown_FindEscapeCharWith(
+    int impl, const char *buf, size_t buflen, size_t startpos
+);
+
+/// Find the first byte at or after startpos that the inline cleaner
+/// handles in any special way, which is one of '\n' '\r' '\0' '`'
+/// '<' '>' '&' '\\' '!' '['. Returns buflen if there is none.
+S3DHID size_t _internal_s3dw_markdown_FindInlineSpecialChar(
+    const char *buf, size_t buflen, size_t startpos
+);
+
+S3DHID size_t _internal_s3dw_markdown_FindInlineSpecialCharWith(
+    int impl, const char *buf, size_t buflen, size_t startpos
+);
+
+/// Undo the HTML escaping the cleaner and renderer do, for the given
+/// text. Returns the decoded length, which is never longer, so out
+/// may be the same as s. Unknown entities are left as they are.
+S3DHID size_t _internal_s3dw_markdown_DecodeEntities(
+    char *out, const char *s, size_t slen
+);
+
+/// A fast hash for cache keys. It's not meant to resist attacks, so
+/// cache hits must still compare the actual bytes.
+S3DHID uint64_t _internal_s3dw_markdown_Hash64(
+    const char *bytes, size_t len, uint64_t seed
+);
+
+/// Seed for _internal_s3dw_markdown_Hash64() from all the options that
+/// affect the HTML, so that equal options give an equal seed.
+S3DHID uint64_t _internal_s3dw_markdown_OptionsSeed(
+    const s3dw_markdown_tohtmloptions *options
+);
+
+S3DHID int _internal_s3dw_markdown_OptionsEqual(
+    const s3dw_markdown_tohtmloptions *a,
+    const s3dw_markdown_tohtmloptions *b
+);
+
 #endif  // SPEW3DWEB_MARKDOWN_H_
 